@@ -0,0 +1,74 @@
+#include "Bench.h"
+#include "CompiledRuleTree.h"
+
+/**
+ * Compares one packet at a time lookups (RuleTree and CompiledRuleTree) against the batched search with
+ * each of its kernels, on the same packets, and checks that they all agree.
+ */
+int benchBatch(int argc, char* argv[])
+{
+    size_t ruleCount = argOr(argc, argv, 0, 1000000);
+    size_t packetCount = argOr(argc, argv, 1, 10000000);
+    size_t batchSize = argOr(argc, argv, 2, 256);
+    std::mt19937_64 rng(3);
+
+    std::vector<FirewallRule> rules = randomRules(ruleCount, rng);
+    RuleTree tree;
+    for(const FirewallRule& rule : rules)
+        tree.insertRule(rule);
+    CompiledRuleTree compiled = tree.compile();
+
+    std::vector<Packet> packets = randomPackets(packetCount, rules, rng);
+    std::vector<Direction> directions(packetCount);
+    std::vector<Protocol> protocals(packetCount);
+    std::vector<uint16_t> ports(packetCount);
+    std::vector<uint32_t> ips(packetCount);
+    for(size_t i = 0; i < packetCount; i++)
+    {
+        directions[i] = packets[i].direction;
+        protocals[i] = packets[i].protocal;
+        ports[i] = packets[i].port;
+        ips[i] = packets[i].ip;
+    }
+
+    std::vector<uint8_t> expected(packetCount);
+    Timer timer;
+    for(size_t i = 0; i < packetCount; i++)
+        expected[i] = tree.contains(directions[i], protocals[i], ports[i], ips[i]);
+    double treeSeconds = timer.seconds();
+    std::printf("RuleTree::contains          %8.2f Mpackets/s\n", packetCount / treeSeconds / 1e6);
+
+    std::vector<uint8_t> verdicts(packetCount);
+    timer.reset();
+    for(size_t i = 0; i < packetCount; i++)
+        verdicts[i] = compiled.contains(directions[i], protocals[i], ports[i], ips[i]);
+    double seconds = timer.seconds();
+    std::printf("CompiledRuleTree::contains  %8.2f Mpackets/s  %5.2fx\n", packetCount / seconds / 1e6, treeSeconds / seconds);
+    bool agree = verdicts == expected;
+
+    const BatchKernel kernels[] = {BatchKernel::Scalar, BatchKernel::Avx2};
+    const char* names[] = {"scalar", "avx2"};
+    for(int k = 0; k < 2; k++)
+    {
+        if(kernels[k] == BatchKernel::Avx2 && !CompiledRuleTree::hasAvx2())
+            continue;
+        std::fill(verdicts.begin(), verdicts.end(), 2);
+        timer.reset();
+        for(size_t begin = 0; begin < packetCount; begin += batchSize)
+        {
+            PacketBatch batch;
+            batch.size = std::min(batchSize, packetCount - begin);
+            batch.direction = &directions[begin];
+            batch.protocal = &protocals[begin];
+            batch.port = &ports[begin];
+            batch.ip = &ips[begin];
+            compiled.containsBatch(batch, &verdicts[begin], kernels[k]);
+        }
+        seconds = timer.seconds();
+        std::printf("containsBatch %-6s        %8.2f Mpackets/s  %5.2fx\n", names[k], packetCount / seconds / 1e6, treeSeconds / seconds);
+        agree = agree && verdicts == expected;
+    }
+
+    std::printf("verdicts %s\n", agree ? "agree" : "DISAGREE");
+    return agree ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,368 @@
+#ifndef BENCH
+#define BENCH
+
+#include <chrono>
+#include <random>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+#include <algorithm>
+
+#include <sys/resource.h>
+
+#include "RuleTree.h"
+
+/**
+ * Small helpers shared by the benchmarks. Each benchmark is a function taking the remaining command
+ * line arguments and is registered in bench/main.cpp.
+ */
+
+typedef int (*BenchFunction)(int argc, char* argv[]);
+
+class Timer
+{
+public:
+    Timer(): begin(std::chrono::steady_clock::now()) {}
+    void reset() { begin = std::chrono::steady_clock::now(); }
+    double seconds() const
+    {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+    }
+private:
+    std::chrono::steady_clock::time_point begin;
+};
+
+/**
+ * Reads an optional numeric argument, falling back to a default
+ */
+inline size_t argOr(int argc, char* argv[], int index, size_t fallback)
+{
+    return index < argc ? std::strtoull(argv[index], nullptr, 10) : fallback;
+}
+
+/**
+ * The number of calls to operator new made by this process so far. bench/main.cpp replaces the global
+ * operator new to count them.
+ */
+size_t allocationCount();
+
+/**
+ * Keeps the optimizer from throwing away work whose result we never look at
+ */
+template <typename T>
+inline void doNotOptimize(const T& value)
+{
+    asm volatile("" : : "r,m"(value) : "memory");
+}
+
+/**
+ * Generates random rules spread uniformly over the whole ip and port space. Ip ranges are short
+ * (up to maxIpSpan addresses) so that most rules stay disjoint, like an exported rule file would.
+ */
+inline std::vector<FirewallRule> randomRules(size_t count, std::mt19937_64& rng, uint32_t maxIpSpan = 256, uint16_t maxPortSpan = 64)
+{
+    std::vector<FirewallRule> rules(count);
+    for(FirewallRule& rule : rules)
+    {
+        rule.direction = static_cast<Direction>(rng() & 1);
+        rule.protocal = static_cast<Protocol>((rng() >> 1) & 1);
+        uint32_t ip = rng();
+        uint32_t ipSpan = rng() % maxIpSpan;
+        rule.ip_range.start = ip;
+        rule.ip_range.end = ip > UINT32_MAX - ipSpan ? UINT32_MAX : ip + ipSpan;
+        uint16_t port = rng();
+        uint16_t portSpan = rng() % maxPortSpan;
+        rule.port_range.start = port;
+        rule.port_range.end = port > UINT16_MAX - portSpan ? UINT16_MAX : port + portSpan;
+    }
+    return rules;
+}
+
+/**
+ * Generates rules that pile on top of eachother: every rule starts somewhere in a small part of the
+ * address space and spans up to maxIpSpan addresses, so the rules overlap in long chains and merge
+ * into a few wide intervals with big port trees. The worst case for insertRule.
+ */
+inline std::vector<FirewallRule> overlappingRules(size_t count, std::mt19937_64& rng, uint32_t maxIpSpan = 4096)
+{
+    std::vector<FirewallRule> rules = randomRules(count, rng, 1, 16);
+    uint64_t space = std::max<uint64_t>(count * 64, 1);
+    for(FirewallRule& rule : rules)
+    {
+        rule.ip_range.start = rng() % space;
+        rule.ip_range.end = rule.ip_range.start + rng() % maxIpSpan;
+    }
+    return rules;
+}
+
+/**
+ * Generates rules shaped like nested CIDR blocks, the way real rule sets tend to be: a /8 with a few
+ * /16s inside it, /24s inside those, and single hosts at the bottom, each level with its own ports.
+ */
+inline std::vector<FirewallRule> nestedRules(size_t count, std::mt19937_64& rng)
+{
+    std::vector<FirewallRule> rules = randomRules(count, rng, 1, 256);
+    uint32_t block = 0;
+    for(size_t i = 0; i < count; i++)
+    {
+        //one new /8 every so often, and everything after it lands inside it
+        int depth = i % 64 == 0 ? 0 : 1 + rng() % 3;
+        if(depth == 0)
+            block = uint32_t(rng()) & 0xFF000000;
+        int prefix = 8 * (depth + 1);
+        uint32_t hostBits = prefix == 32 ? 0 : 0xFFFFFFFFu >> prefix;
+        uint32_t start = block | (uint32_t(rng()) & 0x00FFFFFF & ~hostBits);
+        rules[i].ip_range = Range<uint32_t>(start, start | hostBits);
+    }
+    return rules;
+}
+
+/**
+ * Generates rules whose ip ranges are back to back without overlapping, each with its own ports. None
+ * of them merge, so every rule becomes its own interval, and every lookup near an edge has to tell two
+ * neighbours apart.
+ */
+inline std::vector<FirewallRule> adjacentRules(size_t count, std::mt19937_64& rng, uint32_t span = 16)
+{
+    std::vector<FirewallRule> rules = randomRules(count, rng, 1, 64);
+    uint32_t start = uint32_t(rng()) % 1024;
+    for(FirewallRule& rule : rules)
+    {
+        rule.ip_range = Range<uint32_t>(start, start + span - 1);
+        start += span;
+    }
+    std::shuffle(rules.begin(), rules.end(), rng);
+    return rules;
+}
+
+/**
+ * Generates rules the way a production rule file tends to look: hosts and subnets that don't overlap,
+ * each running one of a handful of service profiles (web, dns, mail...), written out as one rule per
+ * port or port range. Thousands of ip ranges end up with exactly the same set of ports.
+ */
+inline std::vector<FirewallRule> serviceRules(size_t count, std::mt19937_64& rng, size_t profileCount = 16)
+{
+    std::vector<std::vector<Range<uint16_t>>> profiles(profileCount);
+    for(std::vector<Range<uint16_t>>& profile : profiles)
+    {
+        size_t ports = 4 + rng() % 9;
+        for(size_t i = 0; i < ports; i++)
+        {
+            uint16_t port = 1 + rng() % 49151;
+            uint16_t span = rng() % 4 == 0 ? rng() % 16 : 0;
+            profile.push_back(Range<uint16_t>(port, port + span));
+        }
+    }
+
+    std::vector<FirewallRule> rules;
+    rules.reserve(count + 16);
+    uint32_t start = uint32_t(rng()) % 65536;
+    while(rules.size() < count)
+    {
+        //a single host most of the time, otherwise a small subnet
+        uint32_t span = rng() % 4 == 0 ? 1u << (rng() % 8) : 1;
+        Direction direction = static_cast<Direction>(rng() & 1);
+        Protocol protocal = static_cast<Protocol>((rng() >> 1) & 1);
+        for(const Range<uint16_t>& ports : profiles[rng() % profileCount])
+        {
+            FirewallRule rule = {direction, protocal, Range<uint32_t>(start, start + span - 1), ports};
+            rules.push_back(rule);
+        }
+        start += span + rng() % 64;
+    }
+    rules.resize(count);
+    std::shuffle(rules.begin(), rules.end(), rng);
+    return rules;
+}
+
+/**
+ * Generates rules like a rule file exported host by host: whole subnets where every address gets its own
+ * lines, one per port of the service profile the subnet runs. A few hosts in each subnet run something
+ * else. The hosts are back to back, so they don't merge as they go in, but most neighbours allow exactly
+ * the same ports.
+ */
+inline std::vector<FirewallRule> exportedRules(size_t count, std::mt19937_64& rng, size_t profileCount = 16)
+{
+    std::vector<std::vector<Range<uint16_t>>> profiles(profileCount);
+    for(std::vector<Range<uint16_t>>& profile : profiles)
+    {
+        size_t ports = 1 + rng() % 4;
+        for(size_t i = 0; i < ports; i++)
+        {
+            uint16_t port = 1 + rng() % 49151;
+            profile.push_back(Range<uint16_t>(port, port));
+        }
+    }
+
+    std::vector<FirewallRule> rules;
+    rules.reserve(count + 4);
+    uint32_t start = uint32_t(rng()) % 65536;
+    while(rules.size() < count)
+    {
+        uint32_t hosts = 1u << (4 + rng() % 5);
+        Direction direction = static_cast<Direction>(rng() & 1);
+        Protocol protocal = static_cast<Protocol>((rng() >> 1) & 1);
+        size_t subnetProfile = rng() % profileCount;
+        for(uint32_t host = 0; host < hosts && rules.size() < count; host++)
+        {
+            size_t profile = rng() % 8 == 0 ? rng() % profileCount : subnetProfile;
+            for(const Range<uint16_t>& ports : profiles[profile])
+            {
+                FirewallRule rule = {direction, protocal, Range<uint32_t>(start + host, start + host), ports};
+                rules.push_back(rule);
+            }
+        }
+        start += hosts + 256 * (1 + rng() % 4);
+    }
+    rules.resize(count);
+    std::shuffle(rules.begin(), rules.end(), rng);
+    return rules;
+}
+
+/**
+ * Picks a generator by name: "uniform", "overlapping", "nested", "adjacent", "services" or "exported"
+ * @return bool: false if there is no generator by that name
+ */
+inline bool generateRules(const std::string& shape, size_t count, std::mt19937_64& rng, std::vector<FirewallRule>& rules)
+{
+    if(shape == "uniform")
+        rules = randomRules(count, rng);
+    else if(shape == "overlapping")
+        rules = overlappingRules(count, rng);
+    else if(shape == "nested")
+        rules = nestedRules(count, rng);
+    else if(shape == "adjacent")
+        rules = adjacentRules(count, rng);
+    else if(shape == "services")
+        rules = serviceRules(count, rng);
+    else if(shape == "exported")
+        rules = exportedRules(count, rng);
+    else
+        return false;
+    return true;
+}
+
+/**
+ * Writes rules out as a csv file in the same format the Firewall reads
+ */
+inline void writeRulesFile(const std::string& filename, const std::vector<FirewallRule>& rules)
+{
+    FILE* file = std::fopen(filename.c_str(), "w");
+    if(file == nullptr)
+    {
+        std::perror(filename.c_str());
+        std::exit(EXIT_FAILURE);
+    }
+    for(const FirewallRule& rule : rules)
+    {
+        std::fprintf(file, "%s,%s,", toString(rule.direction), toString(rule.protocal));
+        if(rule.port_range.start == rule.port_range.end)
+            std::fprintf(file, "%u,", rule.port_range.start);
+        else
+            std::fprintf(file, "%u-%u,", rule.port_range.start, rule.port_range.end);
+        uint32_t a = rule.ip_range.start, b = rule.ip_range.end;
+        std::fprintf(file, "%u.%u.%u.%u", a >> 24, (a >> 16) & 0xFF, (a >> 8) & 0xFF, a & 0xFF);
+        if(a != b)
+            std::fprintf(file, "-%u.%u.%u.%u", b >> 24, (b >> 16) & 0xFF, (b >> 8) & 0xFF, b & 0xFF);
+        std::fputc('\n', file);
+    }
+    std::fclose(file);
+}
+
+struct Packet
+{
+    Direction direction;
+    Protocol protocal;
+    uint16_t port;
+    uint32_t ip;
+};
+
+/**
+ * Generates random packets. Roughly hitRatio of them are aimed at the edge of one of the given rules,
+ * so the port search gets exercised, and the rest are uniform over the whole space.
+ */
+inline std::vector<Packet> randomPackets(size_t count, const std::vector<FirewallRule>& rules, std::mt19937_64& rng, double hitRatio = 0.5)
+{
+    std::vector<Packet> packets(count);
+    std::uniform_real_distribution<double> coin(0.0, 1.0);
+    for(Packet& packet : packets)
+    {
+        if(!rules.empty() && coin(rng) < hitRatio)
+        {
+            const FirewallRule& rule = rules[rng() % rules.size()];
+            packet.direction = rule.direction;
+            packet.protocal = rule.protocal;
+            packet.port = rule.port_range.end;
+            packet.ip = rule.ip_range.start;
+        }
+        else
+        {
+            packet.direction = static_cast<Direction>(rng() & 1);
+            packet.protocal = static_cast<Protocol>((rng() >> 1) & 1);
+            packet.port = rng();
+            packet.ip = rng();
+        }
+    }
+    return packets;
+}
+
+/**
+ * Generates a skewed packet trace: distinct different packets (from randomPackets) where the k-th most
+ * popular one shows up with probability proportional to 1/k^skew. A skew around 1 is typical of real
+ * traffic, 0 is uniform over the distinct packets.
+ */
+inline std::vector<Packet> zipfPackets(size_t count, size_t distinct, double skew, const std::vector<FirewallRule>& rules, std::mt19937_64& rng)
+{
+    std::vector<Packet> popular = randomPackets(distinct, rules, rng);
+    std::vector<double> cumulative(distinct);
+    double total = 0;
+    for(size_t rank = 0; rank < distinct; rank++)
+        cumulative[rank] = total += 1.0 / std::pow(rank + 1.0, skew);
+
+    std::vector<Packet> packets(count);
+    std::uniform_real_distribution<double> pick(0.0, total);
+    for(Packet& packet : packets)
+    {
+        size_t rank = std::lower_bound(cumulative.begin(), cumulative.end(), pick(rng)) - cumulative.begin();
+        packet = popular[std::min(rank, distinct - 1)];
+    }
+    return packets;
+}
+
+/**
+ * The peak resident set size of this process so far, in KiB
+ */
+inline long peakRssKiB()
+{
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+
+struct Percentiles
+{
+    double p50;
+    double p99;
+    double p999;
+};
+
+/**
+ * Works out the median and tail of a list of samples. The samples are sorted in place.
+ */
+inline Percentiles percentiles(std::vector<double>& samples)
+{
+    Percentiles result = {0, 0, 0};
+    if(samples.empty())
+        return result;
+    std::sort(samples.begin(), samples.end());
+    auto at = [&](double quantile) { return samples[std::min(samples.size() - 1, size_t(quantile * samples.size()))]; };
+    result.p50 = at(0.5);
+    result.p99 = at(0.99);
+    result.p999 = at(0.999);
+    return result;
+}
+
+#endif
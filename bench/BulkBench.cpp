@@ -0,0 +1,52 @@
+#include "Bench.h"
+
+/**
+ * A worst case for insertRule: every rule's ip range overlaps the one before it, and every rule adds a
+ * port range that isn't adjacent to any other. Every insert merges into one ever growing interval and
+ * copies its whole port tree, so inserting them one by one is quadratic.
+ */
+static std::vector<FirewallRule> chainedRules(size_t count)
+{
+    std::vector<FirewallRule> rules(count);
+    for(size_t i = 0; i < count; i++)
+    {
+        rules[i].direction = Direction::Inbound;
+        rules[i].protocal = Protocol::Tcp;
+        rules[i].ip_range = Range<uint32_t>(i * 10, i * 10 + 10);
+        uint16_t port = (2 * i) % 65534;
+        rules[i].port_range = Range<uint16_t>(port, port);
+    }
+    return rules;
+}
+
+static void compare(const char* name, std::vector<FirewallRule> rules)
+{
+    RuleTree incremental;
+    Timer timer;
+    for(const FirewallRule& rule : rules)
+        incremental.insertRule(rule);
+    double incrementalSeconds = timer.seconds();
+
+    RuleTree bulk;
+    timer.reset();
+    bulk.insertRules(rules);
+    double bulkSeconds = timer.seconds();
+
+    std::printf("%-10s %8zu rules  insertRule %8.3fs  insertRules %8.3fs  %7.2fx\n", name, rules.size(), incrementalSeconds, bulkSeconds, incrementalSeconds / bulkSeconds);
+}
+
+/**
+ * Times building a tree rule by rule against the sort and sweep bulk build, on random rules and on the
+ * overlapping worst case.
+ */
+int benchBulk(int argc, char* argv[])
+{
+    size_t ruleCount = argOr(argc, argv, 0, 1000000);
+    size_t chainCount = argOr(argc, argv, 1, 10000);
+    std::mt19937_64 rng(23);
+
+    compare("uniform", randomRules(ruleCount, rng));
+    compare("wide", randomRules(ruleCount / 4, rng, 1 << 16, 4096));
+    compare("chained", chainedRules(chainCount));
+    return EXIT_SUCCESS;
+}
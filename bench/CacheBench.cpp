@@ -0,0 +1,51 @@
+#include "Bench.h"
+#include "Firewall.h"
+
+static double lookupsPerSecond(const Firewall& firewall, const std::vector<Packet>& packets)
+{
+    size_t accepted = 0;
+    Timer timer;
+    for(const Packet& packet : packets)
+        accepted += firewall.accept_packet(packet.direction, packet.protocal, packet.port, packet.ip);
+    double seconds = timer.seconds();
+    doNotOptimize(accepted);
+    return packets.size() / seconds;
+}
+
+/**
+ * Lookup throughput with and without the VerdictCache on Zipf distributed traces of increasing skew,
+ * against both the rule tree and the frozen rules, along with the cache hit rate.
+ */
+int benchCache(int argc, char* argv[])
+{
+    size_t ruleCount = argOr(argc, argv, 0, 1000000);
+    size_t lookupCount = argOr(argc, argv, 1, 5000000);
+    size_t distinct = argOr(argc, argv, 2, 10000);
+    std::mt19937_64 rng(37);
+    std::vector<FirewallRule> rules = randomRules(ruleCount, rng);
+
+    Firewall firewall;
+    for(const FirewallRule& rule : rules)
+        firewall.insertRule(rule);
+
+    const double skews[] = {0.0, 0.8, 1.0, 1.2};
+    for(bool frozen : {false, true})
+    {
+        if(frozen)
+            firewall.freeze();
+        std::printf("%s:\n", frozen ? "frozen" : "rule tree");
+        for(double skew : skews)
+        {
+            std::vector<Packet> packets = zipfPackets(lookupCount, distinct, skew, rules, rng);
+            firewall.setVerdictCache(false);
+            double uncached = lookupsPerSecond(firewall, packets);
+            firewall.setVerdictCache(true);
+            VerdictCache::resetStats();
+            double cached = lookupsPerSecond(firewall, packets);
+            VerdictCacheStats stats = VerdictCache::stats();
+            std::printf("  zipf %.1f  uncached %7.2fM/s  cached %7.2fM/s  %5.2fx  hit rate %5.1f%%\n", skew, uncached / 1e6, cached / 1e6,
+                        cached / uncached, 100.0 * stats.hits / (stats.hits + stats.misses));
+        }
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,61 @@
+#include "Bench.h"
+#include "CompiledRuleTree.h"
+
+static size_t intervalCount(const RuleTree& tree)
+{
+    RuleTreeStats stats = tree.stats();
+    size_t count = 0;
+    for(size_t intervals : stats.ipIntervals)
+        count += intervals;
+    return count;
+}
+
+/**
+ * Lookups per second through contains, in millions
+ */
+template <typename Tree>
+static double lookupRate(const Tree& tree, const std::vector<Packet>& packets)
+{
+    size_t accepted = 0;
+    Timer timer;
+    for(const Packet& packet : packets)
+        accepted += tree.contains(packet.direction, packet.protocal, packet.port, packet.ip);
+    double seconds = timer.seconds();
+    doNotOptimize(accepted);
+    return packets.size() / seconds / 1e6;
+}
+
+/**
+ * RuleTree::compact on every rule shape: how many intervals it gets rid of, how long that takes, and
+ * lookup throughput on the tree and on the compiled rules before and after
+ */
+int benchCompact(int argc, char* argv[])
+{
+    size_t ruleCount = argOr(argc, argv, 0, 1000000);
+    size_t lookupCount = argOr(argc, argv, 1, 5000000);
+    const char* shapes[] = {"uniform", "overlapping", "nested", "adjacent", "services", "exported"};
+    for(const char* shape : shapes)
+    {
+        std::mt19937_64 rng(71);
+        std::vector<FirewallRule> rules;
+        generateRules(shape, ruleCount, rng, rules);
+        std::vector<Packet> packets = randomPackets(lookupCount, rules, rng);
+        RuleTree tree;
+        tree.insertRules(rules);
+
+        size_t before = intervalCount(tree);
+        double treeBefore = lookupRate(tree, packets);
+        double compiledBefore = lookupRate(tree.compile(), packets);
+        Timer timer;
+        size_t removed = tree.compact();
+        double seconds = timer.seconds();
+        double treeAfter = lookupRate(tree, packets);
+        double compiledAfter = lookupRate(tree.compile(), packets);
+
+        std::printf("%-12s %8zu -> %8zu intervals (-%4.1f%%) in %6.3fs   tree %6.2f -> %6.2fM/s  %5.2fx   compiled %6.2f -> %6.2fM/s  %5.2fx\n",
+                    shape, before, before - removed, 100.0 * removed / std::max<size_t>(before, 1), seconds,
+                    treeBefore, treeAfter, treeAfter / treeBefore, compiledBefore, compiledAfter, compiledAfter / compiledBefore);
+        std::fflush(stdout);
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,105 @@
+#include <thread>
+#include <mutex>
+#include <atomic>
+
+#include "Bench.h"
+#include "Firewall.h"
+#include "ConcurrentFirewall.h"
+
+/**
+ * Runs readers threads of lookups against check while one writer thread keeps inserting rules with
+ * insert until they are done.
+ * @return double: total lookups per second across all the readers
+ */
+template <typename Check, typename Insert>
+static double readWhileWriting(unsigned readers, const std::vector<Packet>& packets, std::mt19937_64& rng, Check check, Insert insert, size_t& updates)
+{
+    std::atomic<bool> done(false);
+    std::atomic<size_t> accepted(0);
+    std::vector<FirewallRule> stream = randomRules(4096, rng);
+    updates = 0;
+
+    std::thread writer([&]() {
+        for(size_t i = 0; !done.load(std::memory_order_relaxed); i++)
+        {
+            insert(stream[i % stream.size()]);
+            updates++;
+            std::this_thread::sleep_for(std::chrono::microseconds(200));
+        }
+    });
+
+    Timer timer;
+    std::vector<std::thread> threads;
+    for(unsigned reader = 0; reader < readers; reader++)
+    {
+        threads.emplace_back([&, reader]() {
+            size_t count = 0;
+            for(size_t i = reader; i < packets.size() * readers; i += readers)
+            {
+                const Packet& packet = packets[i % packets.size()];
+                count += check(packet);
+            }
+            accepted += count;
+        });
+    }
+    for(std::thread& thread : threads)
+        thread.join();
+    double seconds = timer.seconds();
+    done = true;
+    writer.join();
+    doNotOptimize(accepted.load());
+    return packets.size() * readers / seconds;
+}
+
+/**
+ * Lookup throughput with 1, 2, 4... reader threads while rules are being inserted: a Firewall behind a
+ * mutex, which is what it took before, against the ConcurrentFirewall's lock free readers. Each reader
+ * does the same number of lookups, so with perfect scaling the total goes up with the thread count.
+ */
+int benchConcurrent(int argc, char* argv[])
+{
+    size_t ruleCount = argOr(argc, argv, 0, 100000);
+    size_t lookupCount = argOr(argc, argv, 1, 2000000);
+    unsigned maxThreads = argOr(argc, argv, 2, std::max(1u, std::thread::hardware_concurrency()));
+    std::mt19937_64 rng(31);
+    std::vector<FirewallRule> rules = randomRules(ruleCount, rng);
+    std::vector<Packet> packets = randomPackets(lookupCount, rules, rng);
+
+    std::vector<unsigned> counts;
+    for(unsigned threads = 1; threads < maxThreads; threads *= 2)
+        counts.push_back(threads);
+    counts.push_back(maxThreads);
+
+    for(unsigned threads : counts)
+    {
+        Firewall locked;
+        std::mutex lock;
+        for(const FirewallRule& rule : rules)
+            locked.insertRule(rule);
+        locked.freeze();
+        size_t lockedUpdates;
+        double lockedRate = readWhileWriting(threads, packets, rng,
+            [&](const Packet& packet) {
+                std::lock_guard<std::mutex> guard(lock);
+                return locked.accept_packet(packet.direction, packet.protocal, packet.port, packet.ip);
+            },
+            [&](const FirewallRule& rule) {
+                std::lock_guard<std::mutex> guard(lock);
+                locked.insertRule(rule);
+                locked.freeze();
+            }, lockedUpdates);
+
+        ConcurrentFirewall concurrent;
+        std::vector<FirewallRule> copy = rules;
+        concurrent.insertRules(copy);
+        size_t rcuUpdates;
+        double rcuRate = readWhileWriting(threads, packets, rng,
+            [&](const Packet& packet) { return concurrent.accept_packet(packet.direction, packet.protocal, packet.port, packet.ip); },
+            [&](const FirewallRule& rule) { concurrent.insertRule(rule); }, rcuUpdates);
+
+        std::printf("%3u readers  mutex %7.2fM/s (%4zu updates)  rcu %7.2fM/s (%4zu updates)  %5.2fx\n",
+                    threads, lockedRate / 1e6, lockedUpdates, rcuRate / 1e6, rcuUpdates, rcuRate / lockedRate);
+    }
+    std::printf("(%u hardware threads)\n", std::thread::hardware_concurrency());
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,79 @@
+#include "Bench.h"
+#include "Firewall.h"
+#include "ClassifyExecutor.h"
+
+/**
+ * Aggregate classification throughput of a ClassifyExecutor with 1, 2, 4... workers against a single
+ * thread calling accept_packet in a loop, on one frozen firewall. The packets are cut into batches of
+ * the given size, with one batch in eight eight times bigger, so the workers that get those have to be
+ * helped out by stealing. Each configuration classifies the whole trace a few times and keeps the best.
+ */
+int benchExecutor(int argc, char* argv[])
+{
+    size_t ruleCount = argOr(argc, argv, 0, 1000000);
+    size_t packetCount = argOr(argc, argv, 1, 10000000);
+    size_t batchSize = std::max<size_t>(1, argOr(argc, argv, 2, 256));
+    unsigned maxThreads = argOr(argc, argv, 3, std::max(1u, std::thread::hardware_concurrency()));
+    std::mt19937_64 rng(41);
+    std::vector<FirewallRule> rules = randomRules(ruleCount, rng);
+    std::vector<Packet> packets = randomPackets(packetCount, rules, rng);
+
+    Firewall firewall;
+    for(const FirewallRule& rule : rules)
+        firewall.insertRule(rule);
+    firewall.freeze();
+
+    std::vector<Direction> directions(packetCount);
+    std::vector<Protocol> protocals(packetCount);
+    std::vector<uint16_t> ports(packetCount);
+    std::vector<uint32_t> ips(packetCount);
+    for(size_t i = 0; i < packetCount; i++)
+    {
+        directions[i] = packets[i].direction;
+        protocals[i] = packets[i].protocal;
+        ports[i] = packets[i].port;
+        ips[i] = packets[i].ip;
+    }
+    std::vector<uint8_t> verdicts(packetCount);
+    std::vector<ClassifyTask> tasks;
+    for(size_t offset = 0; offset < packetCount;)
+    {
+        size_t size = std::min(packetCount - offset, tasks.size() % 8 == 7 ? 8 * batchSize : batchSize);
+        PacketBatch batch = {size, &directions[offset], &protocals[offset], &ports[offset], &ips[offset]};
+        tasks.push_back({batch, &verdicts[offset]});
+        offset += size;
+    }
+
+    size_t accepted = 0;
+    Timer timer;
+    for(const Packet& packet : packets)
+        accepted += firewall.accept_packet(packet.direction, packet.protocal, packet.port, packet.ip);
+    double baseline = packetCount / timer.seconds();
+    doNotOptimize(accepted);
+    std::printf("%zu rules, %zu packets in %zu batches\n", ruleCount, packetCount, tasks.size());
+    std::printf("  accept_packet loop       %8.2fM packets/s\n", baseline / 1e6);
+
+    std::vector<unsigned> counts;
+    for(unsigned threads = 1; threads < maxThreads; threads *= 2)
+        counts.push_back(threads);
+    counts.push_back(maxThreads);
+    double single = 0;
+    for(unsigned threads : counts)
+    {
+        ClassifyExecutor executor(firewall, threads);
+        double best = 0;
+        for(int round = 0; round < 3; round++)
+        {
+            timer = Timer();
+            executor.run(tasks);
+            best = std::max(best, packetCount / timer.seconds());
+        }
+        if(threads == 1)
+            single = best;
+        std::printf("  executor %3u workers     %8.2fM packets/s  %5.2fx accept_packet  %5.2fx 1 worker  (%llu steals)\n", threads,
+                    best / 1e6, best / baseline, best / single, (unsigned long long)executor.steals());
+        std::fflush(stdout);
+    }
+    std::printf("(%u hardware threads)\n", std::thread::hardware_concurrency());
+    return EXIT_SUCCESS;
+}
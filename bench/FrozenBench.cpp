@@ -0,0 +1,52 @@
+#include "Bench.h"
+#include "CompiledRuleTree.h"
+
+/**
+ * Builds a large random rule tree, freezes it, and compares lookup throughput of the std::set walk
+ * against the compiled Eytzinger search on the same random packets. Also checks that both agree.
+ */
+int benchFrozen(int argc, char* argv[])
+{
+    size_t ruleCount = argOr(argc, argv, 0, 1000000);
+    size_t lookupCount = argOr(argc, argv, 1, 10000000);
+    std::mt19937_64 rng(42);
+
+    std::vector<FirewallRule> rules = randomRules(ruleCount, rng);
+    RuleTree tree;
+    Timer timer;
+    for(FirewallRule& rule : rules)
+        tree.insertRule(rule);
+    std::printf("inserted %zu rules in %.3fs\n", ruleCount, timer.seconds());
+
+    timer.reset();
+    CompiledRuleTree compiled = tree.compile();
+    std::printf("compiled %zu ip intervals in %.3fs\n", compiled.size(), timer.seconds());
+
+    //half the packets are aimed at a rule so the port search gets exercised too
+    std::vector<FirewallRule> packets = randomRules(lookupCount, rng, 1, 1);
+    for(size_t i = 0; i < packets.size(); i += 2)
+    {
+        const FirewallRule& rule = rules[rng() % rules.size()];
+        packets[i].direction = rule.direction;
+        packets[i].protocal = rule.protocal;
+        packets[i].ip_range.start = packets[i].ip_range.end = rule.ip_range.start;
+        packets[i].port_range.start = packets[i].port_range.end = rule.port_range.end;
+    }
+
+    timer.reset();
+    size_t treeAccepted = 0;
+    for(FirewallRule& packet : packets)
+        treeAccepted += tree.contains(packet);
+    double treeSeconds = timer.seconds();
+
+    timer.reset();
+    size_t compiledAccepted = 0;
+    for(FirewallRule& packet : packets)
+        compiledAccepted += compiled.contains(packet);
+    double compiledSeconds = timer.seconds();
+
+    std::printf("RuleTree::contains:         %8.2f Mlookups/s (%zu accepted)\n", lookupCount / treeSeconds / 1e6, treeAccepted);
+    std::printf("CompiledRuleTree::contains: %8.2f Mlookups/s (%zu accepted)\n", lookupCount / compiledSeconds / 1e6, compiledAccepted);
+    std::printf("speedup: %.2fx\n", treeSeconds / compiledSeconds);
+    return treeAccepted == compiledAccepted ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,124 @@
+#include "Bench.h"
+#include "Firewall.h"
+#include "Parser.h"
+
+#include <arpa/inet.h>
+
+/**
+ * Moves an IPv4 address into IPv6, keeping the order: the top 16 bits pick a /64 under 2001:db8::/32 and
+ * the bottom 16 are the host in it. A rule set keeps the same shape, so the two trees can be compared
+ * like for like, and the compares have to look at both halves of the address.
+ */
+static Ipv6Address toIpv6(uint32_t ip)
+{
+    return makeIpv6(0x20010DB800000000ull | (ip >> 16), ip & 0xFFFF);
+}
+
+static void writeRulesFile6(const std::string& filename, const std::vector<FirewallRule>& rules)
+{
+    FILE* file = std::fopen(filename.c_str(), "w");
+    if(file == nullptr)
+    {
+        std::perror(filename.c_str());
+        std::exit(EXIT_FAILURE);
+    }
+    for(const FirewallRule& rule : rules)
+    {
+        std::fprintf(file, "%s,%s,%u-%u,%s", toString(rule.direction), toString(rule.protocal), rule.port_range.start,
+                     rule.port_range.end, toString(toIpv6(rule.ip_range.start)).c_str());
+        if(rule.ip_range.start != rule.ip_range.end)
+            std::fprintf(file, "-%s", toString(toIpv6(rule.ip_range.end)).c_str());
+        std::fputc('\n', file);
+    }
+    std::fclose(file);
+}
+
+/**
+ * Lookups per second, in millions
+ */
+template <typename Lookup>
+static double lookupRate(const std::vector<Packet>& packets, Lookup lookup)
+{
+    size_t accepted = 0;
+    Timer timer;
+    for(const Packet& packet : packets)
+        accepted += lookup(packet);
+    double seconds = timer.seconds();
+    doNotOptimize(accepted);
+    return packets.size() / seconds / 1e6;
+}
+
+/**
+ * The same rule sets loaded as IPv4 and as IPv6: load time from a csv file, memory, and RuleTree::contains
+ * against RuleTree6::contains on the same packets. Then the IPv6 address parser against inet_pton.
+ */
+int benchIpv6(int argc, char* argv[])
+{
+    size_t ruleCount = argOr(argc, argv, 0, 1000000);
+    size_t lookupCount = argOr(argc, argv, 1, 5000000);
+    std::string filename = "/tmp/firewall_bench_ipv6.csv";
+    std::vector<std::string> addresses;
+    const char* shapes[] = {"uniform", "services"};
+    for(const char* shape : shapes)
+    {
+        std::mt19937_64 rng(71);
+        std::vector<FirewallRule> rules;
+        generateRules(shape, ruleCount, rng, rules);
+        std::vector<Packet> packets = randomPackets(lookupCount, rules, rng);
+        for(size_t i = 0; addresses.size() < 1000000 && i < rules.size(); i++)
+            addresses.push_back(toString(toIpv6(rules[i].ip_range.start)));
+
+        writeRulesFile(filename, rules);
+        Timer timer;
+        Firewall firewall(filename);
+        double loadSeconds = timer.seconds();
+        writeRulesFile6(filename, rules);
+        timer = Timer();
+        Firewall firewall6(filename);
+        double loadSeconds6 = timer.seconds();
+
+        const RuleTree& tree = firewall.rules();
+        const RuleTree6& tree6 = firewall6.rules6();
+        double rate = lookupRate(packets, [&tree](const Packet& packet) {
+            return tree.contains(packet.direction, packet.protocal, packet.port, packet.ip);
+        });
+        double rate6 = lookupRate(packets, [&tree6](const Packet& packet) {
+            return tree6.contains(packet.direction, packet.protocal, packet.port, toIpv6(packet.ip));
+        });
+
+        std::printf("%s, %zu rules\n", shape, ruleCount);
+        std::printf("  %-6s load %7.3fs (%5.2fM rules/s)  memory %7.1f MiB  contains %6.2fM lookups/s\n", "ipv4", loadSeconds,
+                    ruleCount / loadSeconds / 1e6, tree.stats().memoryBytes / 1048576.0, rate);
+        std::printf("  %-6s load %7.3fs (%5.2fM rules/s)  memory %7.1f MiB  contains %6.2fM lookups/s  %5.2fx\n", "ipv6", loadSeconds6,
+                    ruleCount / loadSeconds6 / 1e6, tree6.stats().memoryBytes / 1048576.0, rate6, rate6 / rate);
+        std::fflush(stdout);
+    }
+    std::remove(filename.c_str());
+
+    //parsing the addresses on their own, in the short form they were written in
+    size_t parsed = 0;
+    Timer timer;
+    for(const std::string& address : addresses)
+    {
+        in6_addr out;
+        parsed += inet_pton(AF_INET6, address.c_str(), &out);
+        doNotOptimize(out);
+    }
+    double ptonSeconds = timer.seconds();
+    timer = Timer();
+    for(const std::string& address : addresses)
+    {
+        Ipv6Address ip;
+        parsed += parseIPv6(address.data(), address.size(), ip);
+        doNotOptimize(ip);
+    }
+    double parseSeconds = timer.seconds();
+    if(parsed != 2 * addresses.size())
+    {
+        std::fprintf(stderr, "failed to parse an address\n");
+        return EXIT_FAILURE;
+    }
+    std::printf("parsing %zu addresses  inet_pton %6.1f ns  parseIPv6 %6.1f ns  %5.2fx\n", addresses.size(),
+                ptonSeconds / addresses.size() * 1e9, parseSeconds / addresses.size() * 1e9, ptonSeconds / parseSeconds);
+    return EXIT_SUCCESS;
+}
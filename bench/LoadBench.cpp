@@ -0,0 +1,90 @@
+#include <fstream>
+#include <sstream>
+
+#include "Bench.h"
+#include "Firewall.h"
+
+/**
+ * The reader Firewall used before CSVReader was memory mapped: getline into a string, wrap it in an
+ * istringstream and copy every field out into a vector.
+ */
+static bool legacyGetNext(std::ifstream& file, std::vector<std::string>& line)
+{
+    line.clear();
+    std::string readline;
+    if(!getline(file, readline))
+        return false;
+    std::istringstream stream(readline);
+    std::string field;
+    while(getline(stream, field, ','))
+        line.push_back(field);
+    return true;
+}
+
+/**
+ * Writes out a large rule file and reads it back with both readers, first just tokenizing and then
+ * building a whole Firewall.
+ */
+int benchLoad(int argc, char* argv[])
+{
+    size_t ruleCount = argOr(argc, argv, 0, 2000000);
+    std::string filename = "/tmp/firewall_bench_load.csv";
+    std::mt19937_64 rng(5);
+    writeRulesFile(filename, randomRules(ruleCount, rng));
+
+    //read it once so both readers start from a warm page cache
+    {
+        CSVReader warm(filename);
+        CSVRow row;
+        while(warm.next(row)) {}
+    }
+
+    size_t before = allocationCount();
+    Timer timer;
+    size_t fields = 0;
+    {
+        std::ifstream file(filename);
+        std::vector<std::string> line;
+        while(legacyGetNext(file, line))
+            fields += line.size();
+    }
+    double legacySeconds = timer.seconds();
+    size_t legacyAllocations = allocationCount() - before;
+
+    before = allocationCount();
+    timer.reset();
+    size_t mappedFields = 0;
+    {
+        CSVReader reader(filename);
+        CSVRow row;
+        while(reader.next(row))
+            mappedFields += row.count;
+    }
+    double mappedSeconds = timer.seconds();
+    size_t mappedAllocations = allocationCount() - before;
+
+    std::printf("tokenize getline/istringstream: %7.3fs  %.2f allocations/rule\n", legacySeconds, double(legacyAllocations) / ruleCount);
+    std::printf("tokenize CSVReader::next:       %7.3fs  %.2f allocations/rule  %5.2fx\n", mappedSeconds, double(mappedAllocations) / ruleCount, legacySeconds / mappedSeconds);
+
+    timer.reset();
+    {
+        Firewall firewall;
+        std::ifstream file(filename);
+        std::vector<std::string> line;
+        while(legacyGetNext(file, line))
+            firewall.insertRule(line);
+    }
+    legacySeconds = timer.seconds();
+
+    timer.reset();
+    {
+        Firewall firewall(filename);
+    }
+    mappedSeconds = timer.seconds();
+
+    std::printf("Firewall load, old reader:      %7.3fs\n", legacySeconds);
+    std::printf("Firewall load, CSVReader:       %7.3fs  %5.2fx\n", mappedSeconds, legacySeconds / mappedSeconds);
+
+    std::remove(filename.c_str());
+    return fields == mappedFields ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,67 @@
+#include <arpa/inet.h>
+
+#include "Bench.h"
+#include "Firewall.h"
+
+static std::string ipToString(uint32_t ip)
+{
+    char buffer[INET_ADDRSTRLEN];
+    uint32_t network = htonl(ip);
+    inet_ntop(AF_INET, &network, buffer, sizeof(buffer));
+    return buffer;
+}
+
+/**
+ * Runs the same packets through the string and the typed accept_packet, on the rule tree and on the
+ * frozen rules, and counts the heap allocations each loop makes.
+ */
+int benchPacket(int argc, char* argv[])
+{
+    size_t ruleCount = argOr(argc, argv, 0, 1000000);
+    size_t lookupCount = argOr(argc, argv, 1, 5000000);
+    std::mt19937_64 rng(7);
+
+    Firewall firewall;
+    for(const FirewallRule& rule : randomRules(ruleCount, rng))
+        firewall.insertRule(rule);
+
+    std::vector<Packet> packets(lookupCount);
+    std::vector<std::string> ips(lookupCount);
+    for(size_t i = 0; i < lookupCount; i++)
+    {
+        packets[i].direction = static_cast<Direction>(rng() & 1);
+        packets[i].protocal = static_cast<Protocol>((rng() >> 1) & 1);
+        packets[i].port = rng();
+        packets[i].ip = rng();
+        ips[i] = ipToString(packets[i].ip);
+    }
+
+    for(int frozen = 0; frozen < 2; frozen++)
+    {
+        if(frozen)
+            firewall.freeze();
+
+        size_t before = allocationCount();
+        Timer timer;
+        size_t accepted = 0;
+        for(size_t i = 0; i < lookupCount; i++)
+            accepted += firewall.accept_packet(toString(packets[i].direction), toString(packets[i].protocal), packets[i].port, ips[i]);
+        double seconds = timer.seconds();
+        size_t stringAllocations = allocationCount() - before;
+
+        before = allocationCount();
+        timer.reset();
+        size_t typedAccepted = 0;
+        for(const Packet& packet : packets)
+            typedAccepted += firewall.accept_packet(packet.direction, packet.protocal, packet.port, packet.ip);
+        double typedSeconds = timer.seconds();
+        size_t typedAllocations = allocationCount() - before;
+
+        const char* engine = frozen ? "frozen" : "tree";
+        std::printf("%-6s string accept_packet: %8.2f Mlookups/s, %.2f allocations/packet\n", engine, lookupCount / seconds / 1e6, double(stringAllocations) / lookupCount);
+        std::printf("%-6s typed accept_packet:  %8.2f Mlookups/s, %.2f allocations/packet\n", engine, lookupCount / typedSeconds / 1e6, double(typedAllocations) / lookupCount);
+        if(accepted != typedAccepted)
+            return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
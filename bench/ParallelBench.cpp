@@ -0,0 +1,39 @@
+#include <thread>
+
+#include "Bench.h"
+#include "Firewall.h"
+
+/**
+ * Loads the same rule file with 1, 2, 4... threads up to the number of cores and reports the speedup
+ * of each over the single threaded load.
+ */
+int benchParallel(int argc, char* argv[])
+{
+    size_t ruleCount = argOr(argc, argv, 0, 2000000);
+    unsigned maxThreads = argOr(argc, argv, 1, std::max(1u, std::thread::hardware_concurrency()));
+    std::string filename = "/tmp/firewall_bench_parallel.csv";
+    std::mt19937_64 rng(17);
+    writeRulesFile(filename, randomRules(ruleCount, rng));
+
+    std::vector<unsigned> counts;
+    for(unsigned threads = 1; threads < maxThreads; threads *= 2)
+        counts.push_back(threads);
+    counts.push_back(maxThreads);
+
+    double baseline = 0;
+    for(unsigned threads : counts)
+    {
+        LoadOptions options;
+        options.threads = threads;
+        Timer timer;
+        Firewall firewall(filename, options);
+        double seconds = timer.seconds();
+        if(threads == 1)
+            baseline = seconds;
+        std::printf("%3u threads: %7.3fs  %5.2fx\n", threads, seconds, baseline / seconds);
+    }
+    std::printf("(%u hardware threads)\n", std::thread::hardware_concurrency());
+
+    std::remove(filename.c_str());
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,144 @@
+#include <arpa/inet.h>
+
+#include "Bench.h"
+#include "Parser.h"
+
+/**
+ * The field parsing Firewall used to do, kept here to compare against: inet_pton into a sockaddr_in,
+ * and splitting ranges into a vector of substr copies before calling atoi.
+ */
+namespace legacy
+{
+    static uint32_t parseIPV4string(const std::string& ipAddress)
+    {
+        struct sockaddr_in sa;
+        inet_pton(AF_INET, ipAddress.c_str(), &(sa.sin_addr));
+        return ntohl(sa.sin_addr.s_addr);
+    }
+
+    static std::vector<std::string> splitRange(const std::string& str, char c)
+    {
+        std::vector<std::string> vec;
+        std::string::size_type split = str.find(c);
+        if(split == std::string::npos)
+        {
+            vec.push_back(str);
+        }
+        else
+        {
+            vec.push_back(str.substr(0, split));
+            vec.push_back(str.substr(split + 1));
+        }
+        return vec;
+    }
+
+    static void getIpRange(const std::string& field, uint32_t& start, uint32_t& end)
+    {
+        std::vector<std::string> split = splitRange(field, '-');
+        start = parseIPV4string(split[0]);
+        end = split.size() == 1 ? start : parseIPV4string(split[1]);
+    }
+
+    static void getPortRange(const std::string& field, uint16_t& start, uint16_t& end)
+    {
+        std::vector<std::string> split = splitRange(field, '-');
+        start = atoi(split[0].c_str());
+        end = split.size() == 1 ? start : atoi(split[1].c_str());
+    }
+}
+
+static std::string ipText(uint32_t ip)
+{
+    char buffer[INET_ADDRSTRLEN];
+    uint32_t network = htonl(ip);
+    inet_ntop(AF_INET, &network, buffer, sizeof(buffer));
+    return buffer;
+}
+
+static void report(const char* name, size_t count, double seconds, double baseline, size_t allocations)
+{
+    std::printf("%-24s %8.2f Mfields/s  %5.2fx  %.2f allocations/field\n", name, count / seconds / 1e6, baseline / seconds, double(allocations) / count);
+}
+
+/**
+ * Parses the same randomly generated single addresses, address ranges and port ranges with the old
+ * functions and with the span parsers, and checks that the results match.
+ */
+int benchParse(int argc, char* argv[])
+{
+    size_t count = argOr(argc, argv, 0, 2000000);
+    std::mt19937_64 rng(11);
+
+    std::vector<std::string> ips(count), ipRanges(count), portRanges(count);
+    for(size_t i = 0; i < count; i++)
+    {
+        uint32_t ip = rng();
+        ips[i] = ipText(ip);
+        ipRanges[i] = ipText(ip) + "-" + ipText(ip | 0xFF);
+        uint16_t port = rng() % 60000;
+        portRanges[i] = (i & 1) ? std::to_string(port) : std::to_string(port) + "-" + std::to_string(port + (rng() % 5000));
+    }
+
+    uint64_t legacySum = 0, sum = 0;
+    size_t before = allocationCount();
+    Timer timer;
+    for(const std::string& ip : ips)
+        legacySum += legacy::parseIPV4string(ip);
+    double baseline = timer.seconds();
+    report("inet_pton", count, baseline, baseline, allocationCount() - before);
+
+    before = allocationCount();
+    timer.reset();
+    for(const std::string& ip : ips)
+    {
+        uint32_t value = 0;
+        parseIPv4(ip.data(), ip.size(), value);
+        sum += value;
+    }
+    report("parseIPv4", count, timer.seconds(), baseline, allocationCount() - before);
+
+    before = allocationCount();
+    timer.reset();
+    for(const std::string& field : ipRanges)
+    {
+        uint32_t start, end;
+        legacy::getIpRange(field, start, end);
+        legacySum += start ^ end;
+    }
+    baseline = timer.seconds();
+    report("splitRange+inet_pton", count, baseline, baseline, allocationCount() - before);
+
+    before = allocationCount();
+    timer.reset();
+    for(const std::string& field : ipRanges)
+    {
+        Range<uint32_t> range(0, 0);
+        parseIpRange(field.data(), field.size(), range);
+        sum += range.start ^ range.end;
+    }
+    report("parseIpRange", count, timer.seconds(), baseline, allocationCount() - before);
+
+    before = allocationCount();
+    timer.reset();
+    for(const std::string& field : portRanges)
+    {
+        uint16_t start, end;
+        legacy::getPortRange(field, start, end);
+        legacySum += start ^ end;
+    }
+    baseline = timer.seconds();
+    report("splitRange+atoi", count, baseline, baseline, allocationCount() - before);
+
+    before = allocationCount();
+    timer.reset();
+    for(const std::string& field : portRanges)
+    {
+        Range<uint16_t> range(0, 0);
+        parsePortRange(field.data(), field.size(), range);
+        sum += range.start ^ range.end;
+    }
+    report("parsePortRange", count, timer.seconds(), baseline, allocationCount() - before);
+
+    std::printf("results %s\n", sum == legacySum ? "agree" : "DISAGREE");
+    return sum == legacySum ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,50 @@
+#include "Bench.h"
+#include "Firewall.h"
+
+/**
+ * Loads the file with the given options, timing the whole constructor
+ */
+static double loadSeconds(const std::string& filename, const LoadOptions& options)
+{
+    Timer timer;
+    Firewall firewall(filename, options);
+    double seconds = timer.seconds();
+    doNotOptimize(firewall);
+    return seconds;
+}
+
+/**
+ * Ingestion time of a rules file inserted one rule at a time, with the read/parse and insert stages run
+ * one after the other on a single thread against overlapped on two threads with LoadOptions::pipelined.
+ * The sort and sweep bulk build is shown for reference. Each file is loaded once first so every run reads
+ * it from the page cache.
+ */
+int benchPipeline(int argc, char* argv[])
+{
+    size_t ruleCount = argOr(argc, argv, 0, 1000000);
+    std::string filename = "/tmp/firewall_bench_pipeline.csv";
+    const char* shapes[] = {"uniform", "overlapping", "nested", "adjacent", "services"};
+    for(const char* shape : shapes)
+    {
+        std::mt19937_64 rng(67);
+        std::vector<FirewallRule> rules;
+        generateRules(shape, ruleCount, rng, rules);
+        writeRulesFile(filename, rules);
+
+        LoadOptions sequential;
+        sequential.bulk = false;
+        LoadOptions pipelined = sequential;
+        pipelined.pipelined = true;
+        LoadOptions bulk;
+        loadSeconds(filename, bulk);
+
+        double sequentialSeconds = loadSeconds(filename, sequential);
+        double pipelinedSeconds = loadSeconds(filename, pipelined);
+        double bulkSeconds = loadSeconds(filename, bulk);
+        std::printf("%-12s %8zu rules  sequential %7.3fs  pipelined %7.3fs  %5.2fx   (bulk %7.3fs)\n", shape, ruleCount,
+                    sequentialSeconds, pipelinedSeconds, sequentialSeconds / pipelinedSeconds, bulkSeconds);
+        std::fflush(stdout);
+    }
+    std::remove(filename.c_str());
+    return EXIT_SUCCESS;
+}
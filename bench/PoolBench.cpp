@@ -0,0 +1,76 @@
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "Bench.h"
+
+/**
+ * Builds one tree with every rule inserted one at a time, then looks up the trace and tears the tree
+ * down. Runs in its own process so the peak RSS belongs to this tree alone.
+ */
+static void runAllocation(const char* shape, NodeAllocation allocation, size_t ruleCount, size_t lookupCount)
+{
+    std::mt19937_64 rng(53);
+    std::vector<FirewallRule> rules;
+    generateRules(shape, ruleCount, rng, rules);
+    std::vector<Packet> packets = randomPackets(lookupCount, rules, rng);
+    long baselineRss = peakRssKiB();
+    size_t allocationsBefore = allocationCount();
+
+    Timer timer;
+    RuleTree* tree = new RuleTree(allocation);
+    for(const FirewallRule& rule : rules)
+        tree->insertRule(rule);
+    tree->internPortSets();
+    double buildSeconds = timer.seconds();
+    size_t allocations = allocationCount() - allocationsBefore;
+    long rss = peakRssKiB() - baselineRss;
+    size_t treeBytes = tree->stats().memoryBytes;
+
+    size_t accepted = 0;
+    timer.reset();
+    for(const Packet& packet : packets)
+        accepted += tree->contains(packet.direction, packet.protocal, packet.port, packet.ip);
+    double lookupSeconds = timer.seconds();
+    doNotOptimize(accepted);
+
+    timer.reset();
+    delete tree;
+    double destroySeconds = timer.seconds();
+    std::printf("  %-5s build %6.3fs  %9zu allocations  +%7.1f MiB rss  tree %7.1f MiB  lookups %6.2fM/s  destroy %6.3fs\n",
+                allocation == NodeAllocation::Pool ? "pool" : "heap", buildSeconds, allocations, rss / 1024.0, treeBytes / 1048576.0,
+                lookupCount / lookupSeconds / 1e6, destroySeconds);
+    std::fflush(stdout);
+}
+
+/**
+ * RuleTree nodes from a NodePool against plain operator new (what std::allocator does), for every rule
+ * shape: allocations and peak RSS while building with insertRule, lookup throughput, and teardown time.
+ */
+int benchPool(int argc, char* argv[])
+{
+    size_t ruleCount = argOr(argc, argv, 0, 1000000);
+    size_t lookupCount = argOr(argc, argv, 1, 2000000);
+    const char* shapes[] = {"uniform", "overlapping", "nested", "adjacent", "services"};
+    NodeAllocation allocations[] = {NodeAllocation::Heap, NodeAllocation::Pool};
+    for(const char* shape : shapes)
+    {
+        std::printf("%s: %zu rules\n", shape, ruleCount);
+        for(NodeAllocation allocation : allocations)
+        {
+            std::fflush(stdout);
+            pid_t child = fork();
+            if(child < 0)
+                return EXIT_FAILURE;
+            if(child == 0)
+            {
+                runAllocation(shape, allocation, ruleCount, lookupCount);
+                _exit(EXIT_SUCCESS);
+            }
+            int status;
+            waitpid(child, &status, 0);
+            if(!WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS)
+                return EXIT_FAILURE;
+        }
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,73 @@
+#include <set>
+
+#include "Bench.h"
+#include "PortSet.h"
+
+/**
+ * Builds a number of port sets out of random port ranges with the given container, and then looks up
+ * random ports in them. Reports allocations and heap bytes per set, and lookups per second.
+ */
+template <typename Set, typename Insert, typename Contains>
+static void measure(const char* label, size_t sets, size_t fragments, size_t lookups, Insert insert, Contains contains)
+{
+    std::mt19937_64 rng(47);
+    std::uniform_int_distribution<uint32_t> port(0, 65535);
+    size_t allocationsBefore = allocationCount();
+    Timer timer;
+    std::vector<Set> built(sets);
+    for(Set& set : built)
+    {
+        for(size_t i = 0; i < fragments; i++)
+        {
+            uint32_t start = port(rng);
+            insert(set, Interval<uint16_t>(start, std::min<uint32_t>(start + rng() % 4, 65535)));
+        }
+    }
+    double buildSeconds = timer.seconds();
+    size_t allocations = allocationCount() - allocationsBefore;
+
+    size_t found = 0;
+    timer.reset();
+    for(size_t i = 0; i < lookups; i++)
+        found += contains(built[rng() % sets], port(rng));
+    double lookupSeconds = timer.seconds();
+    doNotOptimize(found);
+    std::printf("  %-9s build %7.3fs  %8.2f allocs/set  lookups %7.2fM/s\n", label, buildSeconds,
+                double(allocations) / sets, lookups / lookupSeconds / 1e6);
+}
+
+/**
+ * The old std::set of port intervals against PortSet, at fragment counts that land in each of the
+ * PortSet forms: inline, sorted list, and bitmap.
+ */
+int benchPortSet(int argc, char* argv[])
+{
+    size_t lookups = argOr(argc, argv, 0, 5000000);
+    size_t fragmentCounts[] = {1, 3, 64, 4096};
+    for(size_t fragments : fragmentCounts)
+    {
+        size_t sets = std::max<size_t>(16, 100000 / fragments);
+        std::printf("%zu sets of %zu random port ranges\n", sets, fragments);
+        measure<std::set<Interval<uint16_t>>>("std::set", sets, fragments, lookups,
+            [](std::set<Interval<uint16_t>>& set, const Interval<uint16_t>& range) {
+                //the same union RuleTree used to do: swallow every overlapping interval and put back their hull
+                Interval<uint16_t> joined = range;
+                auto it = set.find(range);
+                while(it != set.end())
+                {
+                    joined.start = std::min(joined.start, it->start);
+                    joined.end = std::max(joined.end, it->end);
+                    set.erase(it);
+                    it = set.find(range);
+                }
+                set.insert(joined);
+            },
+            [](const std::set<Interval<uint16_t>>& set, uint16_t port) {
+                return set.find(Interval<uint16_t>(port, port)) != set.end();
+            });
+        measure<PortSet>("PortSet", sets, fragments, lookups,
+            [](PortSet& set, const Interval<uint16_t>& range) { set.insert(range); },
+            [](const PortSet& set, uint16_t port) { return set.contains(port); });
+    }
+    return EXIT_SUCCESS;
+}
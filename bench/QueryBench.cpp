@@ -0,0 +1,74 @@
+#include "Bench.h"
+#include "CompiledRuleTree.h"
+
+/**
+ * Average time of one call of query over every block, in microseconds, and the average size of what it
+ * returned. Each block comes as the ip range of a rule, along with its root and a port to ask about
+ */
+template <typename Query>
+static void measure(const char* label, const std::vector<FirewallRule>& queries, Query query)
+{
+    size_t results = 0;
+    Timer timer;
+    for(const FirewallRule& block : queries)
+        results += query(block);
+    double seconds = timer.seconds();
+    std::printf("  %-14s %10.2fus per query  %10.1f results\n", label, seconds / queries.size() * 1e6, double(results) / queries.size());
+}
+
+/**
+ * The range queries on RuleTree, for CIDR blocks from a single address up to a /8 placed on the rules.
+ * What the same answer cost before them is shown by the brute force way: asking the compiled rules about
+ * every port of every address in a /24, which for a /8 would take 65536 times as long again.
+ */
+int benchQuery(int argc, char* argv[])
+{
+    size_t ruleCount = argOr(argc, argv, 0, 1000000);
+    size_t queryCount = argOr(argc, argv, 1, 1000);
+    const char* shapes[] = {"uniform", "overlapping", "nested", "adjacent", "services", "exported"};
+    const int prefixes[] = {32, 24, 16, 8};
+    for(const char* shape : shapes)
+    {
+        std::mt19937_64 rng(83);
+        std::vector<FirewallRule> rules;
+        generateRules(shape, ruleCount, rng, rules);
+        RuleTree tree;
+        tree.insertRules(rules);
+        std::printf("%s: %zu rules, %.3g (ip, port) pairs allowed\n", shape, ruleCount, double(tree.coveredVolume()));
+
+        for(int prefix : prefixes)
+        {
+            //blocks around the addresses rules were written for, so there is something in them
+            uint32_t host = prefix == 32 ? 0 : (uint32_t(1) << (32 - prefix)) - 1;
+            std::vector<FirewallRule> queries(queryCount);
+            for(FirewallRule& query : queries)
+            {
+                query = rules[rng() % rules.size()];
+                query.ip_range = Range<uint32_t>(query.ip_range.start & ~host, (query.ip_range.start & ~host) | host);
+            }
+            std::printf(" /%d\n", prefix);
+            measure("allowedPorts", queries, [&tree](const FirewallRule& query) {
+                return tree.allowedPorts(query.direction, query.protocal, query.ip_range).size();
+            });
+            measure("coveredIps", queries, [&tree](const FirewallRule& query) {
+                return tree.coveredIps(query.direction, query.protocal, query.port_range.start, query.ip_range).size();
+            });
+            measure("coveredVolume", queries, [&tree](const FirewallRule& query) {
+                return size_t(tree.coveredVolume(query.direction, query.protocal, query.ip_range) > 0);
+            });
+        }
+
+        CompiledRuleTree compiled = tree.compile();
+        const FirewallRule& rule = rules[rng() % rules.size()];
+        uint32_t base = rule.ip_range.start & ~uint32_t(255);
+        size_t accepted = 0;
+        Timer timer;
+        for(uint32_t ip = base; ip <= base + 255; ip++)
+            for(uint32_t port = 0; port < 65536; port++)
+                accepted += compiled.contains(rule.direction, rule.protocal, port, ip);
+        doNotOptimize(accepted);
+        std::printf("  %-14s %10.0fus for one /24 by contains, every port of every address\n", "brute force", timer.seconds() * 1e6);
+        std::fflush(stdout);
+    }
+    return EXIT_SUCCESS;
+}
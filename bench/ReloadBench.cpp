@@ -0,0 +1,85 @@
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "Bench.h"
+#include "Firewall.h"
+
+/**
+ * Loads the old file, then brings the firewall up to date with the new one, either by reloading it or by
+ * building a second firewall and swapping it in, which is what we had to do before reload. Runs in its own
+ * process so the rss is only this firewall's.
+ */
+static void runUpdate(const std::string& before, const std::string& after, bool reload)
+{
+    LoadOptions options;
+    options.reloadable = reload;
+    Firewall* firewall = new Firewall(before, options);
+    firewall->freeze();
+    long baselineRss = peakRssKiB();
+
+    Timer timer;
+    size_t changed = 0;
+    if(reload)
+        changed = firewall->reload(after);
+    else
+    {
+        Firewall* rebuilt = new Firewall(after);
+        rebuilt->freeze();
+        delete firewall;
+        firewall = rebuilt;
+    }
+    double seconds = timer.seconds();
+    std::printf("  %-8s %8.3fs  +%7.1f MiB rss", reload ? "reload" : "rebuild", seconds, (peakRssKiB() - baselineRss) / 1024.0);
+    if(reload)
+        std::printf("  %zu rules changed", changed);
+    std::printf("\n");
+    std::fflush(stdout);
+    delete firewall;
+}
+
+/**
+ * Firewall::reload on a file where a small fraction of the rules changed (half removed, half added), against
+ * constructing a new firewall from the new file. Both end frozen.
+ */
+int benchReload(int argc, char* argv[])
+{
+    size_t ruleCount = argOr(argc, argv, 0, 1000000);
+    double changedFraction = argc > 1 ? std::atof(argv[1]) : 0.001;
+    std::string before = "/tmp/firewall_bench_reload_before.csv";
+    std::string after = "/tmp/firewall_bench_reload_after.csv";
+    const char* shapes[] = {"uniform", "nested", "services"};
+    for(const char* shape : shapes)
+    {
+        std::mt19937_64 rng(73);
+        std::vector<FirewallRule> rules;
+        generateRules(shape, ruleCount, rng, rules);
+        writeRulesFile(before, rules);
+
+        std::vector<FirewallRule> added;
+        generateRules(shape, size_t(ruleCount * changedFraction / 2), rng, added);
+        for(size_t i = 0; i < added.size(); i++)
+            rules[rng() % rules.size()] = added[i];
+        writeRulesFile(after, rules);
+
+        std::printf("%s: %zu rules, %.2f%% changed\n", shape, ruleCount, 100 * changedFraction);
+        for(bool reload : {false, true})
+        {
+            std::fflush(stdout);
+            pid_t child = fork();
+            if(child < 0)
+                return EXIT_FAILURE;
+            if(child == 0)
+            {
+                runUpdate(before, after, reload);
+                _exit(EXIT_SUCCESS);
+            }
+            int status;
+            waitpid(child, &status, 0);
+            if(!WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS)
+                return EXIT_FAILURE;
+        }
+    }
+    std::remove(before.c_str());
+    std::remove(after.c_str());
+    return EXIT_SUCCESS;
+}
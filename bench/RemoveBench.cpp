@@ -0,0 +1,71 @@
+#include "Bench.h"
+
+/**
+ * Times each call on its own and prints the median and tail, in microseconds
+ */
+template <typename Update>
+static void measure(const char* label, const std::vector<FirewallRule>& rules, Update update)
+{
+    std::vector<double> latencies;
+    latencies.reserve(rules.size());
+    Timer total;
+    for(const FirewallRule& rule : rules)
+    {
+        auto begin = std::chrono::steady_clock::now();
+        update(rule);
+        latencies.push_back(std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - begin).count());
+    }
+    double seconds = total.seconds();
+    Percentiles latency = percentiles(latencies);
+    std::printf("  %-12s %8zu updates  %7.2fM/s  p50 %6.2fus  p99 %6.2fus  p999 %7.2fus\n", label, rules.size(),
+                rules.size() / seconds / 1e6, latency.p50, latency.p99, latency.p999);
+}
+
+/**
+ * Latency of single removeRule and insertRule calls on a big tree, next to what a revocation cost before:
+ * building the whole tree again from the remaining rules. Half of the removals revoke a rule exactly as it
+ * was added, the other half cut a random range out of the middle of one, which splits the intervals.
+ */
+int benchRemove(int argc, char* argv[])
+{
+    size_t ruleCount = argOr(argc, argv, 0, 1000000);
+    size_t updateCount = argOr(argc, argv, 1, 100000);
+    const char* shapes[] = {"uniform", "overlapping", "nested", "adjacent", "services"};
+    for(const char* shape : shapes)
+    {
+        std::mt19937_64 rng(59);
+        std::vector<FirewallRule> rules;
+        generateRules(shape, ruleCount, rng, rules);
+        RuleTree tree;
+        tree.insertRules(rules);
+        RuleTreeStats stats = tree.stats();
+        size_t intervals = 0;
+        for(size_t count : stats.ipIntervals)
+            intervals += count;
+        std::printf("%s: %zu rules, %zu ip intervals\n", shape, ruleCount, intervals);
+
+        std::vector<FirewallRule> removals(updateCount);
+        for(size_t i = 0; i < updateCount; i++)
+        {
+            removals[i] = rules[rng() % rules.size()];
+            if(i % 2 == 0)
+                continue;
+            Range<uint32_t>& ip = removals[i].ip_range;
+            Range<uint16_t>& port = removals[i].port_range;
+            ip.start += (ip.end - ip.start) / 4;
+            ip.end -= (ip.end - ip.start) / 3;
+            port.end = port.start + (port.end - port.start) / 2;
+        }
+
+        measure("removeRule", removals, [&tree](const FirewallRule& rule) { tree.removeRule(rule); });
+        measure("insertRule", removals, [&tree](const FirewallRule& rule) { tree.insertRule(rule); });
+
+        Timer timer;
+        RuleTree rebuilt;
+        rebuilt.insertRules(rules);
+        std::printf("  %-12s %8.3fs per revocation\n", "rebuild", timer.seconds());
+        doNotOptimize(rebuilt);
+        std::fflush(stdout);
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,49 @@
+#include "Bench.h"
+#include "Firewall.h"
+
+/**
+ * Startup time of a firewall loaded from the csv file (parse, build and freeze) against one mapped in from
+ * a snapshot of the same rules, then the time for the first lookups on each, since the snapshot only reads
+ * its pages in from disk as the searches touch them.
+ */
+int benchSnapshot(int argc, char* argv[])
+{
+    size_t ruleCount = argOr(argc, argv, 0, 1000000);
+    size_t lookupCount = argOr(argc, argv, 1, 1000000);
+    std::string filename = "/tmp/firewall_bench_snapshot.csv";
+    std::string snapshot = "/tmp/firewall_bench_snapshot.rules";
+    std::mt19937_64 rng(29);
+    std::vector<FirewallRule> rules = randomRules(ruleCount, rng);
+    writeRulesFile(filename, rules);
+    std::vector<Packet> packets = randomPackets(lookupCount, rules, rng);
+
+    Timer timer;
+    Firewall parsed(filename);
+    parsed.freeze();
+    double csvSeconds = timer.seconds();
+    parsed.save(snapshot);
+
+    timer.reset();
+    Firewall loaded = Firewall::load(snapshot);
+    double snapshotSeconds = timer.seconds();
+
+    size_t accepted = 0;
+    timer.reset();
+    for(const Packet& packet : packets)
+        accepted += parsed.accept_packet(packet.direction, packet.protocal, packet.port, packet.ip);
+    double csvLookups = timer.seconds();
+    timer.reset();
+    for(const Packet& packet : packets)
+        accepted -= loaded.accept_packet(packet.direction, packet.protocal, packet.port, packet.ip);
+    double snapshotLookups = timer.seconds();
+    doNotOptimize(accepted);
+    if(accepted != 0)
+        std::printf("verdicts differ between the csv and snapshot firewalls!\n");
+
+    std::printf("csv load + freeze: %8.3fs   lookups %7.2fM/s\n", csvSeconds, lookupCount / csvLookups / 1e6);
+    std::printf("snapshot load:     %8.3fs   lookups %7.2fM/s   %.0fx faster startup\n", snapshotSeconds, lookupCount / snapshotLookups / 1e6, csvSeconds / snapshotSeconds);
+
+    std::remove(filename.c_str());
+    std::remove(snapshot.c_str());
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,67 @@
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "Bench.h"
+#include "PacketStream.h"
+
+/**
+ * Runs a packets file through classifyStream into /dev/null and prints the packet rate
+ */
+static void stream(const char* label, const Firewall& firewall, const std::string& filename, PacketFormat format, size_t packetCount)
+{
+    int input = open(filename.c_str(), O_RDONLY);
+    int output = open("/dev/null", O_WRONLY);
+    StreamStats stats = classifyStream(firewall, input, output, format);
+    close(input);
+    close(output);
+    if(stats.packets != packetCount || stats.malformed != 0)
+        std::printf("  %s: expected %zu packets, got %llu with %llu malformed!\n", label, packetCount,
+                    (unsigned long long)stats.packets, (unsigned long long)stats.malformed);
+    std::printf("  %-7s %8.3fs  %7.2fM packets/s  %5.1f%% accepted\n", label, stats.seconds, stats.packets / stats.seconds / 1e6,
+                100.0 * stats.accepted / std::max<uint64_t>(stats.packets, 1));
+}
+
+/**
+ * Single core throughput of the streaming classifier behind ./bin/program --classify, from a csv packets
+ * file and from the same packets as binary records, against a frozen firewall. The files are read once
+ * before timing so they come from the page cache, like a pipe would.
+ */
+int benchStream(int argc, char* argv[])
+{
+    size_t ruleCount = argOr(argc, argv, 0, 1000000);
+    size_t packetCount = argOr(argc, argv, 1, 10000000);
+    std::string rulesFile = "/tmp/firewall_bench_stream.csv";
+    std::string csvFile = "/tmp/firewall_bench_stream_packets.csv";
+    std::string binaryFile = "/tmp/firewall_bench_stream_packets.bin";
+    std::mt19937_64 rng(61);
+    std::vector<FirewallRule> rules = randomRules(ruleCount, rng);
+    writeRulesFile(rulesFile, rules);
+    std::vector<Packet> packets = randomPackets(packetCount, rules, rng);
+
+    FILE* csv = std::fopen(csvFile.c_str(), "w");
+    FILE* binary = std::fopen(binaryFile.c_str(), "w");
+    for(const Packet& packet : packets)
+    {
+        uint32_t ip = packet.ip;
+        std::fprintf(csv, "%s,%s,%u,%u.%u.%u.%u\n", toString(packet.direction), toString(packet.protocal), packet.port,
+                     ip >> 24, (ip >> 16) & 0xFF, (ip >> 8) & 0xFF, ip & 0xFF);
+        PacketRecord record = {ip, packet.port, uint8_t(packet.direction), uint8_t(packet.protocal)};
+        std::fwrite(&record, sizeof(record), 1, binary);
+    }
+    std::fclose(csv);
+    std::fclose(binary);
+
+    Firewall firewall(rulesFile);
+    firewall.freeze();
+    std::printf("%zu rules, %zu packets\n", ruleCount, packetCount);
+    Firewall warm;
+    stream("warmup", warm, csvFile, PacketFormat::Csv, packetCount);
+    stream("warmup", warm, binaryFile, PacketFormat::Binary, packetCount);
+    stream("csv", firewall, csvFile, PacketFormat::Csv, packetCount);
+    stream("binary", firewall, binaryFile, PacketFormat::Binary, packetCount);
+
+    std::remove(rulesFile.c_str());
+    std::remove(csvFile.c_str());
+    std::remove(binaryFile.c_str());
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,106 @@
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "Bench.h"
+#include "Firewall.h"
+
+static const char* shapes[] = {"uniform", "overlapping", "nested", "adjacent", "services"};
+
+/**
+ * Times every lookup of the trace on its own, after a run over the whole trace to measure throughput
+ */
+static void measureLookups(const char* label, const Firewall& firewall, const std::vector<Packet>& packets)
+{
+    size_t accepted = 0;
+    Timer timer;
+    for(const Packet& packet : packets)
+        accepted += firewall.accept_packet(packet.direction, packet.protocal, packet.port, packet.ip);
+    double seconds = timer.seconds();
+
+    std::vector<double> latencies;
+    latencies.reserve(packets.size());
+    for(const Packet& packet : packets)
+    {
+        auto begin = std::chrono::steady_clock::now();
+        accepted += firewall.accept_packet(packet.direction, packet.protocal, packet.port, packet.ip);
+        latencies.push_back(std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - begin).count());
+    }
+    doNotOptimize(accepted);
+    Percentiles latency = percentiles(latencies);
+    std::printf("    %-18s %8.2fM/s   p50 %6.0fns  p99 %6.0fns  p999 %6.0fns\n", label, packets.size() / seconds / 1e6, latency.p50, latency.p99, latency.p999);
+}
+
+/**
+ * One rule shape: load it from a file, then look up a uniform and a Zipf trace against the rule tree
+ * and the frozen rules. Runs in its own process so the peak RSS belongs to this shape alone.
+ */
+static void runShape(const char* shape, size_t ruleCount, size_t lookupCount)
+{
+    std::mt19937_64 rng(41);
+    std::vector<FirewallRule> rules;
+    generateRules(shape, ruleCount, rng, rules);
+    std::string filename = std::string("/tmp/firewall_bench_suite_") + shape + ".csv";
+    writeRulesFile(filename, rules);
+    std::vector<Packet> uniform = randomPackets(lookupCount, rules, rng);
+    std::vector<Packet> zipf = zipfPackets(lookupCount, 10000, 1.0, rules, rng);
+    long baselineRss = peakRssKiB();
+
+    Timer timer;
+    Firewall firewall(filename);
+    double loadSeconds = timer.seconds();
+    std::remove(filename.c_str());
+    long loadedRss = peakRssKiB();
+    std::printf("%s: %zu rules, load %.3fs, peak rss %.1f MiB (+%.1f MiB over the generated rules and traces), tree %.1f MiB\n",
+                shape, ruleCount, loadSeconds, loadedRss / 1024.0, (loadedRss - baselineRss) / 1024.0, firewall.stats().rules.memoryBytes / 1048576.0);
+
+    measureLookups("tree uniform", firewall, uniform);
+    measureLookups("tree zipf 1.0", firewall, zipf);
+    firewall.freeze();
+    measureLookups("frozen uniform", firewall, uniform);
+    measureLookups("frozen zipf 1.0", firewall, zipf);
+    std::fflush(stdout);
+}
+
+/**
+ * The regression suite: for every rule shape, Firewall construction time and peak RSS, and
+ * accept_packet throughput with p50/p99/p999 latency. Latencies are single lookups timed with
+ * steady_clock, so they include a few tens of nanoseconds of timer overhead.
+ */
+int benchSuite(int argc, char* argv[])
+{
+    size_t ruleCount = argOr(argc, argv, 0, 1000000);
+    size_t lookupCount = argOr(argc, argv, 1, 2000000);
+    for(const char* shape : shapes)
+    {
+        std::fflush(stdout);
+        pid_t child = fork();
+        if(child < 0)
+            return EXIT_FAILURE;
+        if(child == 0)
+        {
+            runShape(shape, ruleCount, lookupCount);
+            _exit(EXIT_SUCCESS);
+        }
+        int status;
+        waitpid(child, &status, 0);
+        if(!WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS)
+            return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
+
+/**
+ * Writes a generated rules file, for loading with ./bin/program or anything else
+ */
+int benchGenerate(int argc, char* argv[])
+{
+    std::vector<FirewallRule> rules;
+    std::mt19937_64 rng(argOr(argc, argv, 3, 1));
+    if(argc < 3 || !generateRules(argv[0], argOr(argc, argv, 1, 0), rng, rules))
+    {
+        std::fprintf(stderr, "usage: ./bin/bench generate <uniform|overlapping|nested|adjacent|services|exported> <rules> <file> [seed]\n");
+        return EXIT_FAILURE;
+    }
+    writeRulesFile(argv[2], rules);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,84 @@
+#include "Bench.h"
+#include "CompiledRuleTree.h"
+
+/**
+ * Lookup throughput of contains over the whole trace, then the latency of single lookups
+ */
+template <typename Tree>
+static void measure(const char* label, const Tree& tree, size_t bytes, const std::vector<Packet>& packets)
+{
+    size_t accepted = 0;
+    Timer timer;
+    for(const Packet& packet : packets)
+        accepted += tree.contains(packet.direction, packet.protocal, packet.port, packet.ip);
+    double seconds = timer.seconds();
+
+    std::vector<double> latencies;
+    latencies.reserve(packets.size() / 4);
+    for(size_t i = 0; i < packets.size(); i += 4)
+    {
+        const Packet& packet = packets[i];
+        auto begin = std::chrono::steady_clock::now();
+        accepted += tree.contains(packet.direction, packet.protocal, packet.port, packet.ip);
+        latencies.push_back(std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - begin).count());
+    }
+    doNotOptimize(accepted);
+    Percentiles latency = percentiles(latencies);
+    std::printf("  %-10s %8.1f MiB  %7.2fM/s  p50 %5.0fns  p99 %5.0fns  p999 %5.0fns\n", label, bytes / 1048576.0,
+                packets.size() / seconds / 1e6, latency.p50, latency.p99, latency.p999);
+}
+
+static void batchRate(const char* label, const CompiledRuleTree& compiled, const std::vector<Packet>& packets)
+{
+    std::vector<Direction> directions(packets.size());
+    std::vector<Protocol> protocals(packets.size());
+    std::vector<uint16_t> ports(packets.size());
+    std::vector<uint32_t> ips(packets.size());
+    for(size_t i = 0; i < packets.size(); i++)
+    {
+        directions[i] = packets[i].direction;
+        protocals[i] = packets[i].protocal;
+        ports[i] = packets[i].port;
+        ips[i] = packets[i].ip;
+    }
+    std::vector<uint8_t> verdicts(packets.size());
+    PacketBatch batch = {packets.size(), directions.data(), protocals.data(), ports.data(), ips.data()};
+    Timer timer;
+    compiled.containsBatch(batch, verdicts.data());
+    std::printf("  %-10s batch %7.2fM/s\n", label, packets.size() / timer.seconds() / 1e6);
+}
+
+/**
+ * The std::set walk against the compiled Eytzinger search and the compiled multibit trie, for memory,
+ * single lookup throughput and latency, and batch throughput, on a few rule shapes.
+ */
+int benchTrie(int argc, char* argv[])
+{
+    size_t ruleCount = argOr(argc, argv, 0, 1000000);
+    size_t lookupCount = argOr(argc, argv, 1, 5000000);
+    const char* shapes[] = {"uniform", "nested", "adjacent"};
+    for(const char* shape : shapes)
+    {
+        std::mt19937_64 rng(43);
+        std::vector<FirewallRule> rules;
+        generateRules(shape, ruleCount, rng, rules);
+        std::vector<Packet> packets = randomPackets(lookupCount, rules, rng);
+        RuleTree tree;
+        tree.insertRules(rules);
+
+        Timer timer;
+        CompiledRuleTree eytzinger = tree.compile(IpIndex::Eytzinger);
+        double eytzingerBuild = timer.seconds();
+        timer.reset();
+        CompiledRuleTree trie = tree.compile(IpIndex::Trie);
+        double trieBuild = timer.seconds();
+
+        std::printf("%s: %zu ip intervals, compiled in %.3fs (eytzinger) %.3fs (trie)\n", shape, eytzinger.size(), eytzingerBuild, trieBuild);
+        measure("std::set", tree, tree.stats().memoryBytes, packets);
+        measure("eytzinger", eytzinger, eytzinger.memoryBytes(), packets);
+        measure("trie", trie, trie.memoryBytes(), packets);
+        batchRate("eytzinger", eytzinger, packets);
+        batchRate("trie", trie, packets);
+    }
+    return EXIT_SUCCESS;
+}
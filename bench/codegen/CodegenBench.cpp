@@ -0,0 +1,95 @@
+#include "Bench.h"
+#include "Firewall.h"
+#include "CompiledRuleTree.h"
+#include "GeneratedRules.h"
+
+/**
+ * Built on its own by make codegen-bench, against the header make codegen just wrote, since the rules
+ * have to be known when this is compiled. It loads the same rules file at runtime and first checks the
+ * generated lookup against RuleTree::contains on both sides of every edge of every interval and on a
+ * random trace, then times the two of them and the compiled rules on that trace.
+ */
+
+size_t allocationCount()
+{
+    return 0;
+}
+
+/**
+ * Lookups per second, in millions
+ */
+template <typename Lookup>
+static double lookupRate(const std::vector<Packet>& packets, Lookup lookup)
+{
+    size_t accepted = 0;
+    Timer timer;
+    for(const Packet& packet : packets)
+        accepted += lookup(packet);
+    double seconds = timer.seconds();
+    doNotOptimize(accepted);
+    return packets.size() / seconds / 1e6;
+}
+
+int main(int argc, char* argv[])
+{
+    size_t lookupCount = argOr(argc, argv, 1, 10000000);
+    try
+    {
+        Firewall firewall(generated_rules::source);
+        const RuleTree& tree = firewall.rules();
+        CompiledRuleTree compiled = tree.compile();
+        std::printf("%s: %u ip intervals, %u port intervals\n", generated_rules::source,
+                    generated_rules::ipIntervals, generated_rules::portIntervals);
+
+        //every edge, then the random trace
+        std::vector<Packet> packets;
+        for(int slot = 0; slot < ROOT_COUNT; slot++)
+        {
+            for(const IPInterval& interval : tree.getRoot(slot))
+            {
+                uint32_t ips[] = {interval.ip_range.start - 1, interval.ip_range.start, interval.ip_range.end, interval.ip_range.end + 1};
+                std::vector<uint16_t> ports = {0, 65535};
+                interval.portSet.forEach([&ports](const Interval<uint16_t>& range) {
+                    uint16_t edges[] = {uint16_t(range.start - 1), range.start, range.end, uint16_t(range.end + 1)};
+                    ports.insert(ports.end(), edges, edges + 4);
+                });
+                for(uint32_t ip : ips)
+                    for(uint16_t port : ports)
+                        packets.push_back({static_cast<Direction>(slot & 1), static_cast<Protocol>(slot >> 1), port, ip});
+            }
+        }
+        size_t edgeCount = packets.size();
+        std::mt19937_64 rng(97);
+        std::vector<Packet> trace = randomPackets(lookupCount, compiled.toRules(), rng);
+        packets.insert(packets.end(), trace.begin(), trace.end());
+        for(const Packet& packet : packets)
+        {
+            if(generated_rules::contains(packet.direction, packet.protocal, packet.port, packet.ip) !=
+               tree.contains(packet.direction, packet.protocal, packet.port, packet.ip))
+            {
+                std::printf("mismatch on %s %s %u %u\n", toString(packet.direction), toString(packet.protocal), packet.port, packet.ip);
+                return EXIT_FAILURE;
+            }
+        }
+        std::printf("generated lookup agrees with RuleTree::contains on %zu edge and %zu random packets\n", edgeCount, trace.size());
+
+        double treeRate = lookupRate(trace, [&tree](const Packet& packet) {
+            return tree.contains(packet.direction, packet.protocal, packet.port, packet.ip);
+        });
+        double compiledRate = lookupRate(trace, [&compiled](const Packet& packet) {
+            return compiled.contains(packet.direction, packet.protocal, packet.port, packet.ip);
+        });
+        double generatedRate = lookupRate(trace, [](const Packet& packet) {
+            return generated_rules::contains(packet.direction, packet.protocal, packet.port, packet.ip);
+        });
+        std::printf("  %-22s %8.2fM lookups/s\n", "RuleTree::contains", treeRate);
+        std::printf("  %-22s %8.2fM lookups/s  %5.2fx\n", "CompiledRuleTree", compiledRate, compiledRate / treeRate);
+        std::printf("  %-22s %8.2fM lookups/s  %5.2fx\n", "generated", generatedRate, generatedRate / treeRate);
+    }
+    catch(const char* error)
+    {
+        std::fprintf(stderr, "%s\n", error);
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
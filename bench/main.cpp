@@ -0,0 +1,106 @@
+#include <cstring>
+#include <cstdio>
+#include <new>
+#include <atomic>
+
+#include "Bench.h"
+
+int benchFrozen(int argc, char* argv[]);
+int benchPacket(int argc, char* argv[]);
+int benchBatch(int argc, char* argv[]);
+int benchParse(int argc, char* argv[]);
+int benchLoad(int argc, char* argv[]);
+int benchParallel(int argc, char* argv[]);
+int benchBulk(int argc, char* argv[]);
+int benchSnapshot(int argc, char* argv[]);
+int benchConcurrent(int argc, char* argv[]);
+int benchCache(int argc, char* argv[]);
+int benchSuite(int argc, char* argv[]);
+int benchGenerate(int argc, char* argv[]);
+int benchTrie(int argc, char* argv[]);
+int benchPortSet(int argc, char* argv[]);
+int benchPool(int argc, char* argv[]);
+int benchRemove(int argc, char* argv[]);
+int benchStream(int argc, char* argv[]);
+int benchPipeline(int argc, char* argv[]);
+int benchCompact(int argc, char* argv[]);
+int benchReload(int argc, char* argv[]);
+int benchQuery(int argc, char* argv[]);
+int benchIpv6(int argc, char* argv[]);
+int benchExecutor(int argc, char* argv[]);
+
+static std::atomic<size_t> allocations(0);
+
+size_t allocationCount()
+{
+    return allocations.load(std::memory_order_relaxed);
+}
+
+void* operator new(size_t size)
+{
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    if(void* memory = std::malloc(size ? size : 1))
+        return memory;
+    throw std::bad_alloc();
+}
+
+void operator delete(void* memory) noexcept
+{
+    std::free(memory);
+}
+
+struct BenchEntry
+{
+    const char* name;
+    BenchFunction run;
+    const char* usage;
+};
+
+static const BenchEntry benches[] = {
+    {"suite", benchSuite, "suite [rules=1000000] [lookups=2000000]  load time, peak rss and accept_packet throughput/latency for every rule shape"},
+    {"generate", benchGenerate, "generate <uniform|overlapping|nested|adjacent|services|exported> <rules> <file> [seed=1]  write a generated rules file"},
+    {"frozen", benchFrozen, "frozen [rules=1000000] [lookups=10000000]  RuleTree::contains vs CompiledRuleTree::contains"},
+    {"packet", benchPacket, "packet [rules=1000000] [lookups=5000000]   string vs typed Firewall::accept_packet, with heap allocation counts"},
+    {"batch", benchBatch, "batch [rules=1000000] [packets=10000000] [batch=256]  per packet lookups vs accept_packets kernels"},
+    {"parse", benchParse, "parse [fields=2000000]  inet_pton/splitRange/atoi vs the span parsers"},
+    {"load", benchLoad, "load [rules=2000000]  getline/istringstream reader vs the memory mapped CSVReader"},
+    {"parallel", benchParallel, "parallel [rules=2000000] [maxThreads=cores]  load time scaling with LoadOptions::threads"},
+    {"bulk", benchBulk, "bulk [rules=1000000] [chained=10000]  insertRule one by one vs the insertRules sort and sweep"},
+    {"snapshot", benchSnapshot, "snapshot [rules=1000000] [lookups=1000000]  csv load and freeze vs mapping a saved snapshot"},
+    {"concurrent", benchConcurrent, "concurrent [rules=100000] [lookups=2000000] [maxThreads=cores]  mutex guarded Firewall vs ConcurrentFirewall readers during inserts"},
+    {"cache", benchCache, "cache [rules=1000000] [lookups=5000000] [distinct=10000]  accept_packet with and without the VerdictCache on Zipf traces"},
+    {"trie", benchTrie, "trie [rules=1000000] [lookups=5000000]  std::set vs Eytzinger vs multibit trie ip index: memory, throughput, latency"},
+    {"portset", benchPortSet, "portset [lookups=5000000]  std::set of port intervals vs the adaptive PortSet: allocations, build time, lookups"},
+    {"pool", benchPool, "pool [rules=1000000] [lookups=2000000]  RuleTree nodes from a NodePool vs operator new: allocations, rss, lookups, teardown"},
+    {"remove", benchRemove, "remove [rules=1000000] [updates=100000]  latency of removeRule and insertRule on a big tree vs rebuilding it"},
+    {"stream", benchStream, "stream [rules=1000000] [packets=10000000]  ./bin/program --classify throughput from csv and binary packets"},
+    {"pipeline", benchPipeline, "pipeline [rules=1000000]  loading rule by rule sequentially vs with LoadOptions::pipelined reading on a second thread"},
+    {"compact", benchCompact, "compact [rules=1000000] [lookups=5000000]  intervals removed by RuleTree::compact and the lookup speedup, tree and compiled"},
+    {"reload", benchReload, "reload [rules=1000000] [changed=0.001]  Firewall::reload of a slightly changed file vs building a new firewall from it"},
+    {"query", benchQuery, "query [rules=1000000] [queries=1000]  RuleTree range queries on cidr blocks from /32 to /8 vs brute force contains over a /24"},
+    {"ipv6", benchIpv6, "ipv6 [rules=1000000] [lookups=5000000]  the same rule sets as IPv4 and IPv6: load time, memory, lookups, and parseIPv6 vs inet_pton"},
+    {"executor", benchExecutor, "executor [rules=1000000] [packets=10000000] [batch=256] [maxThreads=cores]  ClassifyExecutor throughput with 1 to N work stealing workers vs an accept_packet loop"},
+};
+
+static void usage()
+{
+    std::fprintf(stderr, "usage: ./bin/bench <name> [args...]\n");
+    for(const BenchEntry& entry : benches)
+        std::fprintf(stderr, "    %s\n", entry.usage);
+}
+
+int main(int argc, char* argv[])
+{
+    if(argc < 2)
+    {
+        usage();
+        return EXIT_FAILURE;
+    }
+    for(const BenchEntry& entry : benches)
+    {
+        if(std::strcmp(entry.name, argv[1]) == 0)
+            return entry.run(argc - 2, argv + 2);
+    }
+    usage();
+    return EXIT_FAILURE;
+}
@@ -0,0 +1,43 @@
+#ifndef ADDRESS
+#define ADDRESS
+
+#include <cstdint>
+#include <string>
+
+/**
+ * An IPv6 address as one 128 bit integer in host byte order, so the first group of the text form is the
+ * top 16 bits. Comparing two of them, or adding one, is a couple of instructions on 64 bit cpus, which is
+ * what the rule tree does with addresses, and it orders the same way the addresses do.
+ */
+typedef unsigned __int128 Ipv6Address;
+
+/**
+ * What the rule tree needs to know about an address type, for the two it is built for: uint32_t for IPv4
+ * and Ipv6Address for IPv6
+ */
+template <typename Address>
+struct AddressTraits;
+
+template <>
+struct AddressTraits<uint32_t>
+{
+    static constexpr int bits = 32;
+    static constexpr uint32_t max() { return UINT32_MAX; }
+};
+
+template <>
+struct AddressTraits<Ipv6Address>
+{
+    static constexpr int bits = 128;
+    static constexpr Ipv6Address max() { return ~Ipv6Address(0); }
+};
+
+//builds an address out of its top and bottom 64 bits
+inline Ipv6Address makeIpv6(uint64_t high, uint64_t low)
+{
+    return (Ipv6Address(high) << 64) | low;
+}
+
+std::string toString(Ipv6Address address);
+
+#endif
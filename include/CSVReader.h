@@ -2,22 +2,50 @@
 #define CSV_READER
 
 #include <string>
-#include <iostream>
-#include <fstream>
 #include <vector>
-#include <sstream>
+#include <cstddef>
+#include <memory>
+
+#include "MappedFile.h"
 
 using std::string;
 using std::vector;
 
+//the most fields we split a line into. Anything after the last one stays in the last field
+#define CSV_MAX_FIELDS 8
+
+//a single field of a csv line. It points straight into the mapped file, nothing is copied
+struct CSVField
+{
+    const char* data;
+    size_t size;
+
+    string str() const { return string(data, size); }
+};
+
+struct CSVRow
+{
+    CSVField fields[CSV_MAX_FIELDS];
+    size_t count;
+};
+
 class CSVReader {
 public:
-    CSVReader(){}
+    CSVReader(): cursor(nullptr), end(nullptr), released(0) {}
     CSVReader(const std::string& filename);
+    bool next(CSVRow& row);
     void getNext(std::vector<string>& line);
+    std::vector<CSVReader> split(size_t parts) const;
+    static void splitLine(const char* line, const char* lineEnd, CSVRow& row);
 
 private:
-    std::ifstream file;
+    CSVReader(const std::shared_ptr<const MappedFile>& file, size_t from, size_t to);
+
+    //shared so that the readers made by split keep the mapping alive
+    std::shared_ptr<const MappedFile> file;
+    const char* cursor;
+    const char* end;
+    size_t released;
 };
 
-#endif
\ No newline at end of file
+#endif
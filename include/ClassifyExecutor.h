@@ -0,0 +1,77 @@
+#ifndef CLASSIFY_EXECUTOR
+#define CLASSIFY_EXECUTOR
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <memory>
+
+#include "Firewall.h"
+#include "WorkStealingDeque.h"
+
+//tasks each worker's deque has room for to begin with, run grows them when it is handed more
+#define EXECUTOR_DEQUE_CAPACITY 1024
+
+//a packet batch and where its verdicts go, see Firewall::accept_packets
+struct ClassifyTask
+{
+    PacketBatch batch;
+    uint8_t* verdicts;
+};
+
+/**
+ * Classifies packet batches against one Firewall on a fixed set of worker threads, one per core and
+ * pinned to it, for traffic coming in from many queues at once.
+ *
+ * run splits the tasks it is given into one contiguous share per worker, pushed onto that worker's
+ * WorkStealingDeque. A worker works through its own share and, once that runs out, steals from the far
+ * end of the others', so a worker handed the big batches doesn't hold up the rest. The workers only ever
+ * read the firewall, so nothing on the lookup path is shared but the deques. Freeze the firewall first:
+ * the compiled rules are flat arrays every core can read at once, and accept_packets searches them as
+ * batches. The firewall must not change while run is going.
+ */
+class ClassifyExecutor
+{
+public:
+    ClassifyExecutor(const Firewall& firewall, unsigned threads = 0, bool pin = true);
+    ~ClassifyExecutor();
+    ClassifyExecutor(const ClassifyExecutor&) = delete;
+    ClassifyExecutor& operator=(const ClassifyExecutor&) = delete;
+
+    void run(const std::vector<ClassifyTask>& tasks);
+    unsigned threads() const { return workers.size(); }
+
+    //tasks taken from another worker's deque, since this executor was made
+    uint64_t steals() const { return stolen.load(std::memory_order_relaxed); }
+
+private:
+    struct Worker
+    {
+        WorkStealingDeque<size_t> deque{EXECUTOR_DEQUE_CAPACITY};
+        std::thread thread;
+    };
+
+    void work(unsigned worker, bool pin);
+    bool takeTask(unsigned worker, size_t& task);
+
+    const Firewall& firewall;
+    std::vector<std::unique_ptr<Worker>> workers;
+    const std::vector<ClassifyTask>* tasks = nullptr;
+    std::atomic<size_t> remaining{0};
+    std::atomic<uint64_t> stolen{0};
+
+    //held for the whole of a run, so runs from several threads take turns
+    std::mutex runLock;
+
+    //the workers sleep on wake between runs, and run sleeps on finished until they all went back to sleep
+    std::mutex lock;
+    std::condition_variable wake;
+    std::condition_variable finished;
+    uint64_t generation = 0;
+    unsigned busy = 0;
+    bool stopping = false;
+};
+
+#endif
@@ -0,0 +1,138 @@
+#ifndef COMPILED_RULE_TREE
+#define COMPILED_RULE_TREE
+
+#include <vector>
+#include <string>
+#include <cstdint>
+
+#include "RuleTree.h"
+#include "MappedFile.h"
+
+/**
+ * A batch of packets to check in one call, as parallel arrays. The arrays are owned by the caller
+ * and must each hold at least size entries.
+ */
+struct PacketBatch
+{
+    size_t size;
+    const Direction* direction;
+    const Protocol* protocal;
+    const uint16_t* port;
+    const uint32_t* ip;
+};
+
+//which search loop containsBatch uses. Auto picks AVX2 when the cpu has it
+enum class BatchKernel { Auto, Scalar, Avx2 };
+
+/**
+ * A frozen copy of a RuleTree, laid out as flat arrays instead of red-black tree nodes.
+ *
+ * Each of the four roots becomes a structure of arrays: the sorted ip interval starts and ends, and
+ * an offset for each interval into one packed array of port intervals. The ip starts are also copied
+ * into an Eytzinger (breadth first) layout, which is what the search actually walks. The top levels of
+ * the search all live in the first few cache lines, and the children of a node are next to eachother, so
+ * we can prefetch a few levels ahead instead of waiting on each pointer like we do in the std::set.
+ *
+ * Instead of the Eytzinger search, a root can be indexed with a multibit trie (IpIndex::Trie), the way
+ * routers look up routes. The top 16 bits of the address index a table of 65536 entries, and a block
+ * with a lot of interval edges in it gets a table of 256 entries for the next 8 bits, and again for the
+ * last 8. Each entry is either the answer for the whole block (an interval or nothing), a table for the
+ * next level down, or the first of at most TRIE_SCAN_LIMIT intervals to check one after the other. That
+ * is one to three dependent loads to find the interval instead of one per level of the tree, at the
+ * cost of at least 256 KiB per root.
+ *
+ * Everything lives in one flat buffer, so the compiled tree can be saved as is and mapped back in later
+ * with no parsing or rebuilding at all, see save and load.
+ *
+ * The compiled tree is read only. If the RuleTree changes it has to be compiled again.
+ */
+class CompiledRuleTree
+{
+public:
+    CompiledRuleTree();
+    CompiledRuleTree(const RuleTree& tree, IpIndex index = IpIndex::Eytzinger);
+    CompiledRuleTree(CompiledRuleTree&& other) = default;
+    CompiledRuleTree& operator=(CompiledRuleTree&& other) = default;
+    CompiledRuleTree(const CompiledRuleTree&) = delete;
+    CompiledRuleTree& operator=(const CompiledRuleTree&) = delete;
+
+    bool contains(const FirewallRule& rule) const;
+    bool contains(Direction direction, Protocol protocal, uint16_t port, uint32_t ip) const;
+    void containsBatch(const PacketBatch& batch, uint8_t* verdicts, BatchKernel kernel = BatchKernel::Auto) const;
+    size_t size() const;
+    size_t memoryBytes() const;
+    std::vector<FirewallRule> toRules() const;
+
+    void save(const std::string& filename) const;
+    static CompiledRuleTree load(const std::string& filename);
+
+    static bool hasAvx2();
+
+private:
+    //where each array of a root lives, as byte offsets into the storage. This is also what the snapshot
+    //header stores, so it is all fixed width
+    struct RootLayout
+    {
+        uint32_t count;         //number of ip intervals
+        uint32_t portCount;     //number of port intervals across all of them
+        uint32_t height;        //height of the padded Eytzinger tree, 0 when the root is empty or uses a trie
+        uint32_t trieChunks;    //number of 256 entry tables in the trie, 0 when the root doesn't have one
+        uint64_t ipStart;
+        uint64_t ipEnd;
+        uint64_t portOffset;
+        uint64_t eytzinger;
+        uint64_t eytzingerRank;
+        uint64_t portStart;
+        uint64_t portEnd;
+        uint64_t trie;
+    };
+
+    //the arrays of one root, pointing into the storage
+    struct FlatRoot
+    {
+        //sorted structure of arrays, one entry per ip interval
+        const uint32_t* ipStart;
+        const uint32_t* ipEnd;
+        const uint32_t* portOffset;   //count + 1 entries, ports of interval i live in [portOffset[i], portOffset[i+1])
+
+        //packed port intervals for every ip interval
+        const uint16_t* portStart;
+        const uint16_t* portEnd;
+
+        //Eytzinger layout of ipStart, 1 indexed and padded out to a full tree of 2^height - 1 nodes.
+        //eytzingerRank maps a node back to its index in the sorted arrays
+        const uint32_t* eytzinger;
+        const uint32_t* eytzingerRank;
+        uint32_t height;
+        uint32_t count;
+
+        //the multibit trie, or null when the root is searched with the Eytzinger layout
+        const uint32_t* trie;
+    };
+
+    struct SnapshotHeader;
+
+    static size_t planRoot(RootLayout& layout, size_t offset, const IPIntervalSet& tree, size_t trieEntries);
+    static void buildRoot(char* base, const RootLayout& layout, const IPIntervalSet& tree, const std::vector<uint32_t>& trie);
+    static void buildTrie(std::vector<uint32_t>& trie, const IPIntervalSet& tree);
+    static uint32_t trieEntry(std::vector<uint32_t>& trie, const std::vector<uint32_t>& ipStart, const std::vector<uint32_t>& ipEnd, uint32_t low, int bits);
+    static bool validTrie(const RootLayout& layout, const char* base);
+    static uint32_t buildEytzinger(uint32_t* eytzinger, uint32_t* eytzingerRank, const uint32_t* ipStart, uint32_t count, uint64_t nodes, uint32_t sorted, uint64_t node);
+    static bool validLayout(const RootLayout& layout, uint64_t payloadSize);
+    static uint64_t checksum(const char* data, size_t size);
+    void attach(const char* base);
+
+    static bool containsPort(const FlatRoot& flat, uint32_t rank, uint16_t port);
+    static uint32_t trieRank(const FlatRoot& flat, uint32_t ip);
+    static void searchGroup(const FlatRoot& flat, const uint32_t* ips, const uint16_t* ports, uint8_t* found, uint32_t count, bool avx2);
+
+    RootLayout layout[ROOT_COUNT];
+    FlatRoot roots[ROOT_COUNT];
+
+    //the arrays of every root live in one buffer, laid out exactly as they are in a snapshot. It is either
+    //owned here, or it is a snapshot file mapped straight into memory
+    std::vector<uint64_t> storage;
+    MappedFile mapping;
+};
+
+#endif
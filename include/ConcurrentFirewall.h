@@ -0,0 +1,77 @@
+#ifndef CONCURRENT_FIREWALL
+#define CONCURRENT_FIREWALL
+
+#include <string>
+#include <vector>
+#include <mutex>
+#include <atomic>
+
+#include "Firewall.h"
+#include "Rcu.h"
+
+/**
+ * A Firewall which can be searched from any number of threads while rules are being inserted.
+ *
+ * Lookups go against an immutable compiled snapshot of the rules, reached through an RcuPointer, so a
+ * reader never takes a lock or writes to shared memory and readers scale with the number of cores.
+ * Writers take a mutex, insert into the rule tree that only they touch, compile a new snapshot and
+ * publish it. The old snapshot is deleted once every reader that could still see it is done.
+ *
+ * With setVerdictCache on, each reader thread also keeps its own VerdictCache of recent answers. A
+ * new snapshot comes with a new epoch, so publishing invalidates every thread's cache at once.
+ *
+ * Every insert compiles the whole rule set again, so when rules come in bunches use insertRules,
+ * which publishes once for the lot.
+ *
+ * Only IPv4 rules can be compiled, so unlike Firewall this has no IPv6 rules, and throws on them.
+ */
+class ConcurrentFirewall
+{
+public:
+    ConcurrentFirewall();
+    ConcurrentFirewall(std::string filename, const LoadOptions& options = LoadOptions());
+
+    bool accept_packet(const std::string& direction, const std::string& protocal, uint16_t port, const std::string& ip_address) const;
+    bool accept_packet(Direction direction, Protocol protocal, uint16_t port, uint32_t ip) const;
+    void accept_packets(const PacketBatch& batch, uint8_t* verdicts) const;
+
+    void insertRule(vector<string>& line);
+    void insertRule(const FirewallRule& rule);
+    void insertRules(std::vector<FirewallRule>& rules);
+    void removeRule(vector<string>& line);
+    void removeRule(const FirewallRule& rule);
+    size_t reload(const std::string& filename);
+    size_t compact();
+
+    uint64_t version() const;
+    void setVerdictCache(bool enabled) { cacheVerdicts.store(enabled, std::memory_order_relaxed); }
+
+private:
+    //what readers see, never changed once published
+    struct Snapshot
+    {
+        Snapshot(const RuleTree& tree, IpIndex index, uint64_t version): compiled(tree, index), version(version), cacheEpoch(VerdictCache::newEpoch()) {}
+
+        CompiledRuleTree compiled;
+        uint64_t version;       //how many times the rules have been published
+        uint64_t cacheEpoch;    //for the VerdictCache, unique across every firewall
+    };
+
+    void publish();
+
+    RcuPointer<Snapshot> snapshot;
+    std::atomic<bool> cacheVerdicts{false};
+
+    //only touched by writers, while holding writeLock
+    std::mutex writeLock;
+    RuleTree ruleTree;
+    uint64_t published = 0;
+
+    //how every snapshot indexes the ip addresses, LoadOptions::ipIndex
+    IpIndex ipIndex = IpIndex::Eytzinger;
+
+    //see Firewall::reload
+    LoadedRules loaded;
+};
+
+#endif
@@ -8,32 +8,159 @@
 
 #include <string>
 #include <vector>
-#include <arpa/inet.h>
 
 #include "CSVReader.h"
 #include "RuleTree.h"
+#include "CompiledRuleTree.h"
+#include "VerdictCache.h"
 
 using std::string;
 using std::vector;
 
+//how the Firewall loads its rules file
+struct LoadOptions
+{
+    LoadOptions(): threads(1), bulk(true), pipelined(false), compact(false), reloadable(false), ipIndex(IpIndex::Eytzinger) {}
+
+    //number of threads to parse and build with, 0 means one per core
+    unsigned threads;
+
+    //collect the rules and build the tree with RuleTree::insertRules instead of inserting them one by one
+    bool bulk;
+
+    //with one thread, read and parse the file on a second thread while this one inserts the rules, see
+    //initializeRuleTreePipelined. Takes the place of bulk
+    bool pipelined;
+
+    //join back to back ip intervals with the same ports once loaded, see RuleTree::compact
+    bool compact;
+
+    //keep the parsed rules around, 16 bytes each, so the first reload is already incremental, see Firewall::reload
+    bool reloadable;
+
+    //how freeze indexes the ip addresses, see CompiledRuleTree
+    IpIndex ipIndex;
+};
+
+/**
+ * Everything a Firewall knows about itself, see Firewall::stats
+ */
+struct FirewallStats
+{
+    RuleTreeStats rules;
+    RuleTreeStats rules6;                   //the IPv6 ones, see RuleTree6
+    bool frozen;
+    size_t compiledBytes;                   //size of the compiled rules, 0 when not frozen
+    uint64_t accepted;                      //accept_packet calls which let the packet through
+    uint64_t denied;                        //and which dropped it
+    uint64_t latencySamples;
+    uint64_t latency[LATENCY_BUCKETS];      //sampled accept_packet latencies, bucket b is [2^b, 2^(b+1)) ns
+};
+
+std::ostream& operator<<(std::ostream& os, const FirewallStats& stats);
+
+/**
+ * What reload remembers about the rules file it last loaded, so the next reload can tell what changed.
+ * 24 bytes an IPv4 line. The IPv6 lines are only remembered by a hash of all of them together, and built
+ * again from scratch whenever any of them changes.
+ */
+struct LoadedRules
+{
+    vector<FirewallRule> rules;     //the IPv4 ones, in file order
+    vector<uint64_t> lineHashes;    //of the text of each line, so lines that didn't change don't have to be parsed
+    uint64_t ipv6Hash = 0;          //of every IPv6 line, in order
+    size_t ipv6Rules = 0;
+    bool kept = false;              //whether the trees were built from exactly these rules
+
+    void clear()
+    {
+        rules = vector<FirewallRule>();
+        lineHashes = vector<uint64_t>();
+        ipv6Hash = 0;
+        ipv6Rules = 0;
+        kept = false;
+    }
+};
+
+/**
+ * Not thread safe once rules are being inserted, see ConcurrentFirewall for that.
+ *
+ * IPv6 rules, the ones with a ':' in their ip field, go in a RuleTree6 of their own next to the IPv4 tree,
+ * so they cost the IPv4 lookups nothing. Only the IPv4 rules are compiled by freeze or saved in a snapshot,
+ * the IPv6 ones are always searched in their tree.
+ */
 class Firewall {
+    friend class ConcurrentFirewall;
 public:
     Firewall(){};
     Firewall(std::string filename);
-    bool accept_packet(std::string& direction, std::string& protocal, uint16_t port, std::string& ip_address);
-    bool accept_packet(std::string direction, std::string protocal, uint16_t port, std::string ip_address);
+    Firewall(std::string filename, const LoadOptions& options);
+    bool accept_packet(const std::string& direction, const std::string& protocal, uint16_t port, const std::string& ip_address);
+    bool accept_packet(Direction direction, Protocol protocal, uint16_t port, uint32_t ip) const;
+    bool accept_packet6(Direction direction, Protocol protocal, uint16_t port, Ipv6Address ip) const;
+    void accept_packets(const PacketBatch& batch, uint8_t* verdicts) const;
     void insertRule(vector<string>& line);
+    void insertRule(const FirewallRule& rule);
+    void insertRule(const FirewallRule6& rule);
+    void removeRule(vector<string>& line);
+    void removeRule(const FirewallRule& rule);
+    void removeRule(const FirewallRule6& rule);
+    size_t reload(const std::string& filename);
+    size_t compact();
+    void freeze();
+    bool isFrozen() const { return frozen; }
+    void setVerdictCache(bool enabled) { cacheVerdicts = enabled; }
+    void setLatencySampling(uint32_t every);
+    FirewallStats stats() const;
+
+    //the rules themselves, for the range queries on RuleTree. Empty for a firewall loaded from a snapshot
+    const RuleTree& rules() const { return ruleTree; }
+    const RuleTree6& rules6() const { return ruleTree6; }
+    void save(const std::string& filename) const;
+    static Firewall load(const std::string& filename);
 private:
-    void initializeRuleTree();
-    uint32_t parseIPV4string(string& ipAddress);
-    FirewallRule initRule(const vector<string>& line);
-    FirewallRule initRule(std::string& direction, std::string& protocal, uint16_t port, std::string& ip_address);
-    vector<string> splitRange(const string& str, char c) const;
-    void getIpRange(const string& field, uint32_t& start, uint32_t& end);
-    void getPortRange(const string& field, uint16_t& start, uint16_t& end);
-
-    CSVReader reader;
+    bool lookup(Direction direction, Protocol protocal, uint16_t port, uint32_t ip) const;
+    bool search(Direction direction, Protocol protocal, uint16_t port, uint32_t ip) const;
+    void thaw();
+    static size_t reloadTree(RuleTree& tree, RuleTree6* tree6, LoadedRules& loaded, const std::string& filename);
+    static void diffLines(const LoadedRules& loaded, const vector<uint64_t>& hashes, const vector<CSVField>& lines,
+                          vector<FirewallRule>& rules, vector<FirewallRule>& changed);
+    static FirewallRule parseLine(const CSVField& line);
+    void initializeRuleTree(CSVReader& reader, RuleTree& tree, RuleTree6& tree6, bool bulk);
+    void initializeRuleTreeParallel(CSVReader& reader, unsigned threads, bool bulk);
+    void initializeRuleTreePipelined(CSVReader& reader, RuleTree& tree, RuleTree6& tree6);
+    static uint32_t parseIPV4string(const string& ipAddress);
+    static Ipv6Address parseIPV6string(const string& ipAddress);
+    static FirewallRule initRule(const vector<string>& line);
+    static FirewallRule initRule(const CSVRow& row);
+    static FirewallRule6 initRule6(const CSVRow& row);
+    template <typename Rule>
+    static Rule parseRule(const CSVRow& row);
+    static void getIpRange(const CSVField& field, Range<uint32_t>& range);
+    static void getIpRange(const CSVField& field, Range<Ipv6Address>& range);
+    static void getPortRange(const CSVField& field, Range<uint16_t>& range);
+
     RuleTree ruleTree;
+    RuleTree6 ruleTree6;
+    CompiledRuleTree compiled;
+    bool frozen = false;
+
+    //loaded from a snapshot, so the rules only exist in compiled and ruleTree is empty
+    bool fromSnapshot = false;
+    IpIndex ipIndex = IpIndex::Eytzinger;
+
+    //only kept once the firewall is reloadable, and dropped again by insertRule and removeRule
+    LoadedRules loaded;
+
+    //see VerdictCache. The epoch changes whenever the rules do
+    bool cacheVerdicts = false;
+    uint64_t cacheEpoch = VerdictCache::newEpoch();
+
+    //only counted with FIREWALL_STATS, see Stats.h
+    mutable StatCounter accepted;
+    mutable StatCounter denied;
+    mutable StatCounter latency[LATENCY_BUCKETS];
+    uint32_t latencySampling = 0;   //time one in this many lookups, a power of two. 0 for none
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,64 @@
+#ifndef GENERATED_LOOKUP
+#define GENERATED_LOOKUP
+
+#include <cstdint>
+#include <cstddef>
+
+#include "RuleTree.h"
+
+/**
+ * The search used by the headers writeLookupHeader generates, see RuleCodegen.h. The size of each table
+ * is a template argument, so the binary search below unrolls into exactly log2(Size) compare and
+ * conditional move steps with the midpoints as constants, and no loop, no branch on the data and no
+ * bounds to keep track of at runtime.
+ */
+template <uint32_t Size>
+struct BranchlessSearch
+{
+    /**
+     * @param base uint32_t*: Size sorted values
+     * @param key uint32_t: the value to look for
+     * @return uint32_t*: the last value <= key, or base itself when every value is greater than key
+     */
+    static inline const uint32_t* lastNotAfter(const uint32_t* base, uint32_t key)
+    {
+        return BranchlessSearch<Size - Size / 2>::lastNotAfter(base[Size / 2] <= key ? base + Size / 2 : base, key);
+    }
+};
+
+template <>
+struct BranchlessSearch<1>
+{
+    static inline const uint32_t* lastNotAfter(const uint32_t* base, uint32_t)
+    {
+        return base;
+    }
+};
+
+/**
+ * Looks a packet up in one generated root: the sorted, disjoint ip intervals as starts and ends, and for
+ * interval i the port intervals portOffsets[i] up to portOffsets[i + 1] in portStarts/portEnds. The port
+ * intervals of one ip interval differ in number, so they get the same search as a loop.
+ * @return bool: whether the packet is allowed
+ */
+template <uint32_t Count>
+inline bool generatedRootContains(const uint32_t* starts, const uint32_t* ends, const uint32_t* portOffsets,
+                                  const uint16_t* portStarts, const uint16_t* portEnds, uint16_t port, uint32_t ip)
+{
+    const uint32_t* found = BranchlessSearch<Count>::lastNotAfter(starts, ip);
+    uint32_t index = found - starts;
+    if(*found > ip || ends[index] < ip)
+        return false;
+
+    const uint16_t* first = portStarts + portOffsets[index];
+    uint32_t count = portOffsets[index + 1] - portOffsets[index];
+    while(count > 1)
+    {
+        uint32_t half = count / 2;
+        first = first[half] <= port ? first + half : first;
+        count -= half;
+    }
+    return *first <= port && port <= portEnds[first - portStarts];
+}
+
+#endif
@@ -0,0 +1,39 @@
+#ifndef INTERVAL
+#define INTERVAL
+
+// Represents a range
+template <typename T>
+struct Range 
+{
+    Range(){}
+    Range(T start, T end): start(start), end(end){}
+    T start;
+    T end;
+};
+
+//Represents an interval which is the core component of the interval tree
+template <typename T>
+struct Interval
+{
+    Interval(T start, T end): start(start), end(end){}
+    Interval(const Range<T>& range): start(range.start), end(range.end){}
+    T start;
+    T end;
+
+    bool operator<(const Interval<T>& t) const
+    { 
+        return this->end < t.start;
+    } 
+    bool operator>(const Interval<T>& t) const
+    { 
+        return this->start > t.end;
+    }
+    //checking for overlapping 
+    bool operator==(const Interval<T>& t) const
+    {
+        return (this->start <= t.start && this->end >= t.end) || 
+                (t.start <= this->start && t.end >= this->end);
+    } 
+};
+
+#endif
@@ -0,0 +1,36 @@
+#ifndef MAPPED_FILE
+#define MAPPED_FILE
+
+#include <string>
+#include <cstddef>
+
+/**
+ * A read only memory mapping of a whole file. The pages are only read in from disk as they are touched,
+ * so mapping a huge file costs nothing up front. The mapping is released when this goes out of scope, so
+ * anything pointing into it has to go before it does. Can be moved but not copied.
+ */
+class MappedFile
+{
+public:
+    MappedFile(): begin(nullptr), length(0) {}
+    MappedFile(const std::string& filename);
+    MappedFile(MappedFile&& other);
+    MappedFile& operator=(MappedFile&& other);
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    ~MappedFile();
+
+    const char* data() const { return begin; }
+    size_t size() const { return length; }
+
+    void adviseSequential() const;
+    void release(size_t from, size_t to) const;
+
+private:
+    void unmap();
+
+    const char* begin;
+    size_t length;
+};
+
+#endif
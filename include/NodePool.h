@@ -0,0 +1,131 @@
+#ifndef NODE_POOL
+#define NODE_POOL
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include <memory>
+#include <new>
+#include <type_traits>
+
+//size of each block of memory the pool carves nodes out of
+#define NODEPOOL_CHUNK_BYTES (64 * 1024)
+
+//every slot is a multiple of this, which is also what malloc guarantees for alignment
+#define NODEPOOL_ALIGN 16
+
+//anything bigger than this goes straight to operator new
+#define NODEPOOL_MAX_SLOT 256
+
+/**
+ * A slab allocator for the nodes of the rule tree. Memory is handed out from big chunks by bumping a
+ * pointer, so nodes allocated one after the other end up next to eachother instead of scattered over the
+ * heap, and a million inserts cost a few dozen calls to operator new instead of a million. Freed nodes
+ * go on a free list for their size and are reused by the next allocation of that size. The chunks are
+ * only given back when the pool is destroyed, all at once.
+ *
+ * A pool made with heap set just forwards to operator new and delete, which is the same as using
+ * std::allocator. That is there to compare against.
+ *
+ * Not thread safe. Each RuleTree has its own, and a RuleTree isn't thread safe either.
+ */
+class NodePool
+{
+public:
+    explicit NodePool(bool heap = false);
+    ~NodePool();
+    NodePool(const NodePool&) = delete;
+    NodePool& operator=(const NodePool&) = delete;
+
+    void* allocate(size_t bytes)
+    {
+        if(heap || bytes > NODEPOOL_MAX_SLOT)
+            return ::operator new(bytes);
+        size_t slot = slotIndex(bytes);
+        if(FreeSlot* reused = freeLists[slot])
+        {
+            freeLists[slot] = reused->next;
+            return reused;
+        }
+        size_t size = (slot + 1) * NODEPOOL_ALIGN;
+        if(size_t(limit - cursor) < size)
+            refill();
+        void* memory = cursor;
+        cursor += size;
+        return memory;
+    }
+
+    void deallocate(void* memory, size_t bytes)
+    {
+        if(heap || bytes > NODEPOOL_MAX_SLOT)
+        {
+            ::operator delete(memory);
+            return;
+        }
+        FreeSlot* freed = static_cast<FreeSlot*>(memory);
+        size_t slot = slotIndex(bytes);
+        freed->next = freeLists[slot];
+        freeLists[slot] = freed;
+    }
+
+    bool isHeap() const { return heap; }
+
+    //bytes held in chunks, used or not. Always 0 for a heap pool
+    size_t reservedBytes() const { return chunks.size() * NODEPOOL_CHUNK_BYTES; }
+
+private:
+    struct FreeSlot
+    {
+        FreeSlot* next;
+    };
+
+    static size_t slotIndex(size_t bytes) { return (bytes + NODEPOOL_ALIGN - 1) / NODEPOOL_ALIGN - 1; }
+    void refill();
+
+    bool heap;
+    char* cursor;
+    char* limit;
+    FreeSlot* freeLists[NODEPOOL_MAX_SLOT / NODEPOOL_ALIGN];
+    std::vector<void*> chunks;
+};
+
+/**
+ * A C++11 allocator handing out memory from a NodePool, for plugging into the std::sets of the rule tree.
+ * Copies share the pool, and it stays alive for as long as any container is still using it, so sets can
+ * be moved and swapped between trees without their nodes going away underneath them. Copying a whole
+ * container starts a new pool though, so two trees never end up allocating from the same one.
+ */
+template <typename T>
+class PoolAllocator
+{
+    template <typename U> friend class PoolAllocator;
+public:
+    typedef T value_type;
+    typedef std::true_type propagate_on_container_move_assignment;
+    typedef std::true_type propagate_on_container_swap;
+
+    PoolAllocator(): pool(std::make_shared<NodePool>()) {}
+    explicit PoolAllocator(const std::shared_ptr<NodePool>& pool): pool(pool) {}
+    template <typename U>
+    PoolAllocator(const PoolAllocator<U>& other): pool(other.pool) {}
+
+    T* allocate(size_t count) { return static_cast<T*>(pool->allocate(count * sizeof(T))); }
+    void deallocate(T* memory, size_t count) { pool->deallocate(memory, count * sizeof(T)); }
+
+    PoolAllocator select_on_container_copy_construction() const
+    {
+        return PoolAllocator(std::make_shared<NodePool>(pool->isHeap()));
+    }
+
+    const NodePool& getPool() const { return *pool; }
+
+    template <typename U>
+    bool operator==(const PoolAllocator<U>& other) const { return pool == other.pool; }
+    template <typename U>
+    bool operator!=(const PoolAllocator<U>& other) const { return pool != other.pool; }
+
+private:
+    std::shared_ptr<NodePool> pool;
+};
+
+#endif
@@ -0,0 +1,40 @@
+#ifndef PACKET_STREAM
+#define PACKET_STREAM
+
+#include <cstdint>
+#include <cstddef>
+
+#include "Firewall.h"
+
+//how much input is read, and how much output is buffered, per system call
+#define STREAM_BUFFER_BYTES (1 << 20)
+
+//packets handed to accept_packets at a time
+#define STREAM_BATCH 4096
+
+//what the packets coming in look like, see classifyStream
+enum class PacketFormat { Csv, Binary };
+
+/**
+ * A packet in the binary format. 8 bytes with no padding, in host byte order. Direction and protocol
+ * are the values of the enums, so 0 is inbound/tcp and 1 is outbound/udp.
+ */
+struct PacketRecord
+{
+    uint32_t ip;
+    uint16_t port;
+    uint8_t direction;
+    uint8_t protocal;
+};
+
+struct StreamStats
+{
+    uint64_t packets;       //verdicts written, malformed ones included
+    uint64_t accepted;
+    uint64_t malformed;     //lines or records which couldn't be parsed, and were dropped
+    double seconds;         //from the first read to the last write
+};
+
+StreamStats classifyStream(const Firewall& firewall, int input, int output, PacketFormat format, size_t bufferBytes = STREAM_BUFFER_BYTES);
+
+#endif
@@ -0,0 +1,53 @@
+#ifndef PARSER
+#define PARSER
+
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+
+#include "RuleTree.h"
+
+/**
+ * Non allocating parsers for the ip and port fields of rules and packets. They all work on a pointer and a
+ * length, so they can be pointed straight at a field in the middle of a line without copying it out first.
+ * Instead of producing garbage on bad input like inet_pton/atoi did, they return false and leave the output
+ * alone. Whitespace is not skipped, a field has to be exactly the address, port or range.
+ */
+
+//"inbound" or "outbound"
+bool parseDirection(const char* text, size_t length, Direction& direction);
+
+//"tcp" or "udp"
+bool parseProtocol(const char* text, size_t length, Protocol& protocal);
+
+//dotted quad, "192.168.0.1". No leading zeros in an octet, same as inet_pton
+bool parseIPv4(const char* text, size_t length, uint32_t& ip);
+
+//decimal port number between 0 and 65535
+bool parsePort(const char* text, size_t length, uint16_t& port);
+
+//a single address or "start-end". The start may not be greater than the end
+bool parseIpRange(const char* text, size_t length, Range<uint32_t>& range);
+
+//a CIDR block, "10.0.0.0/8", as the range of addresses it covers. The prefix length is 0 to 32, and the
+//address may not have any bits set past it
+bool parseCidr(const char* text, size_t length, Range<uint32_t>& range);
+
+//RFC 4291 text form, "2001:db8::1". Up to four hex digits a group in either case, "::" once for a run of
+//zero groups, and optionally a dotted quad for the last 32 bits, "::ffff:192.168.0.1"
+bool parseIPv6(const char* text, size_t length, Ipv6Address& ip);
+
+//the IPv6 versions of parseIpRange and parseCidr, with prefix lengths up to 128
+bool parseIpRange(const char* text, size_t length, Range<Ipv6Address>& range);
+bool parseCidr(const char* text, size_t length, Range<Ipv6Address>& range);
+
+//whether an ip field is IPv6 rather than IPv4, which is just whether it has a ':' in it
+inline bool isIPv6Field(const char* text, size_t length)
+{
+    return std::memchr(text, ':', length) != nullptr;
+}
+
+//a single port or "start-end". The start may not be greater than the end
+bool parsePortRange(const char* text, size_t length, Range<uint16_t>& range);
+
+#endif
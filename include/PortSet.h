@@ -0,0 +1,135 @@
+#ifndef PORT_SET
+#define PORT_SET
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include <atomic>
+
+#include "Interval.h"
+
+//port intervals kept inside the PortSet itself before it needs the heap
+#define PORTSET_INLINE 3
+
+//past this many intervals a sorted list costs more to search and insert into than a bitmap of every
+//port, which is 8 KiB no matter what is in it. A bitmap goes back to a list below half of this
+#define PORTSET_BITMAP_INTERVALS 1024
+
+//one bit for every port
+#define PORTSET_BITMAP_WORDS (65536 / 64)
+
+/**
+ * The set of ports allowed for one ip interval, kept as disjoint intervals with overlapping and adjacent
+ * ones joined. Rules mostly allow one port or one range, so it picks its representation by how many
+ * intervals it holds:
+ *  - up to PORTSET_INLINE intervals live inside the object, with no heap allocation at all
+ *  - up to PORTSET_BITMAP_INTERVALS intervals live in a sorted array on the heap
+ *  - past that, a bitmap of all 65536 ports, where looking up a port is a single bit test
+ * Inserting and removing move it between the forms as the number of intervals goes up or down.
+ *
+ * The heap forms are reference counted and copy on write: copying a PortSet just shares the array or
+ * bitmap, and it is only duplicated when one of the copies changes. That is what lets a PortSetTable
+ * keep one copy of every distinct set. The count is atomic, so copies can live in different threads.
+ */
+class PortSet
+{
+public:
+    PortSet(): kind(Kind::Inline), count(0) {}
+    PortSet(const PortSet& other);
+    PortSet(PortSet&& other);
+    PortSet& operator=(const PortSet& other);
+    PortSet& operator=(PortSet&& other);
+    ~PortSet() { release(); }
+
+    void insert(const Interval<uint16_t>& range);
+    void insert(const PortSet& other);
+    void remove(const Interval<uint16_t>& range);
+    bool intersects(const Interval<uint16_t>& range) const;
+    uint32_t countPorts(const Interval<uint16_t>& range) const;
+    void assign(const std::vector<Interval<uint16_t>>& sorted);
+    bool contains(uint16_t port) const;
+
+    //the number of disjoint intervals
+    size_t size() const { return count; }
+    bool empty() const { return count == 0; }
+    size_t heapBytes() const;
+    bool isInline() const { return kind == Kind::Inline; }
+    bool isBitmap() const { return kind == Kind::Bitmap; }
+
+    //sharing of the heap forms. heapBlock is null for an inline set, and useCount is 1
+    const void* heapBlock() const { return kind == Kind::Inline ? nullptr : header(); }
+    uint32_t useCount() const { return kind == Kind::Inline ? 1 : header()->refs.load(std::memory_order_acquire); }
+
+    //whether two sets cover the same ports, whatever their inline, list or bitmap form, and a hash that
+    //agrees with it, so PortSetTable can intern a list and a bitmap of the same ports together
+    bool operator==(const PortSet& other) const;
+    uint64_t hash() const;
+
+    /**
+     * Calls visit with every interval in order, as an Interval<uint16_t>
+     */
+    template <typename Visitor>
+    void forEach(Visitor visit) const
+    {
+        if(kind != Kind::Bitmap)
+        {
+            const Span* items = spans();
+            for(uint32_t i = 0; i < count; i++)
+                visit(Interval<uint16_t>(items[i].start, items[i].end));
+            return;
+        }
+        uint32_t port = 0;
+        while(port < 65536)
+        {
+            uint32_t start = nextBit(port, true);
+            if(start >= 65536)
+                break;
+            uint32_t end = nextBit(start, false);
+            visit(Interval<uint16_t>(start, end - 1));
+            port = end;
+        }
+    }
+
+private:
+    enum class Kind : uint8_t { Inline, List, Bitmap };
+
+    struct Span
+    {
+        uint16_t start;
+        uint16_t end;
+    };
+
+    //sits in front of the list or bitmap on the heap
+    struct Header
+    {
+        std::atomic<uint32_t> refs;
+        uint32_t capacity;          //Spans in a list, words in a bitmap
+        std::atomic<uint64_t> hash; //worked out the first time it is asked for, 0 until then
+    };
+
+    Span* spans() { return kind == Kind::Inline ? small : list; }
+    const Span* spans() const { return kind == Kind::Inline ? small : list; }
+    Header* header() const { return reinterpret_cast<Header*>(kind == Kind::List ? static_cast<void*>(list) : static_cast<void*>(bitmap)) - 1; }
+    static void* allocateBlock(uint32_t capacity, size_t itemBytes);
+    static uint32_t listCapacity(uint32_t count);
+    uint64_t computeHash() const;
+    void makeUnique();
+    uint32_t nextBit(uint32_t from, bool set) const;
+    void setBits(uint32_t start, uint32_t end, bool value);
+    void splice(uint32_t first, uint32_t last, const Span* with, uint32_t withCount);
+    uint32_t runStarts(uint32_t firstWord, uint32_t lastWord) const;
+    void toBitmap();
+    void toSpans();
+    void release();
+
+    union
+    {
+        Span small[PORTSET_INLINE];
+        Span* list;                 //at least count entries, see Header
+        uint64_t* bitmap;           //PORTSET_BITMAP_WORDS words
+    };
+    Kind kind;
+    uint16_t count;                 //intervals, which for a bitmap is its runs of set bits
+};
+
+#endif
@@ -0,0 +1,51 @@
+#ifndef PORT_SET_TABLE
+#define PORT_SET_TABLE
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+#include "PortSet.h"
+
+//smallest number of slots the table has once anything is in it. Always a power of two
+#define PORTSET_TABLE_MIN_SLOTS 16
+
+/**
+ * Hash consing for port sets. Rule files tend to give thousands of ip ranges the exact same list of
+ * ports, and without this every one of them would have its own copy. Interning a set looks for one
+ * with the same intervals already in the table and, if there is one, makes the set share its heap
+ * array instead. Sets that fit inline are left alone, a pointer to them wouldn't be any smaller.
+ *
+ * The table holds a reference to every set in it. A set which is about to change should be taken out
+ * with forget first, otherwise the reference makes it copy itself (see PortSet) and leaves the table
+ * holding the old contents that nobody uses. Those get dropped whenever the table grows, so it stays
+ * within a constant factor of the number of distinct sets in use either way.
+ *
+ * Open addressing with linear probing, so interning doesn't allocate unless the table has to grow. An
+ * empty slot is one holding an inline set, since those are never interned. Not thread safe, one per RuleTree.
+ */
+class PortSetTable
+{
+public:
+    PortSetTable(): used(0) {}
+
+    void intern(PortSet& set);
+    void forget(const PortSet& set);
+    void absorb(PortSetTable& other);
+    size_t size() const { return used; }
+
+private:
+    struct Slot
+    {
+        uint64_t hash;
+        PortSet set;
+    };
+
+    void erase(size_t index);
+    void rehash();
+
+    std::vector<Slot> slots;
+    size_t used;
+};
+
+#endif
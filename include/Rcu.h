@@ -0,0 +1,61 @@
+#ifndef RCU
+#define RCU
+
+#include <atomic>
+#include <cstdint>
+
+/**
+ * A small epoch based read-copy-update scheme, for data that is read all the time from many threads and
+ * replaced now and then. Readers never take a lock or write to anything shared: entering a read section
+ * just records the current epoch in a slot only that thread writes to. A writer publishes a new version
+ * with an atomic pointer swap, and then rcuSynchronize waits until every reader which might still see
+ * the old version has left its read section, after which the old version can be deleted.
+ *
+ * Every thread that reads gets a slot the first time it does so, and gives it back when it exits.
+ */
+
+/**
+ * Marks a read section for as long as it is in scope. Any pointer loaded from an RcuPointer while the
+ * guard is alive stays valid until the guard is destroyed. Guards can be nested.
+ */
+class RcuReadGuard
+{
+public:
+    RcuReadGuard();
+    ~RcuReadGuard();
+    RcuReadGuard(const RcuReadGuard&) = delete;
+    RcuReadGuard& operator=(const RcuReadGuard&) = delete;
+};
+
+//waits until every read section which started before the call has finished. Must not be called from inside one
+void rcuSynchronize();
+
+/**
+ * An atomically swapped pointer to an immutable object, with the reclamation done for you. Readers call
+ * get inside a read section. Writers call publish, which swaps in the new object and deletes the old one
+ * once no reader can be looking at it. Publishing from several threads at once has to be serialized by
+ * the caller.
+ */
+template <typename T>
+class RcuPointer
+{
+public:
+    RcuPointer(T* initial = nullptr): current(initial) {}
+    ~RcuPointer() { delete current.load(std::memory_order_relaxed); }
+    RcuPointer(const RcuPointer&) = delete;
+    RcuPointer& operator=(const RcuPointer&) = delete;
+
+    const T* get() const { return current.load(std::memory_order_acquire); }
+
+    void publish(T* next)
+    {
+        T* old = current.exchange(next, std::memory_order_acq_rel);
+        rcuSynchronize();
+        delete old;
+    }
+
+private:
+    std::atomic<T*> current;
+};
+
+#endif
@@ -0,0 +1,15 @@
+#ifndef RULE_CODEGEN
+#define RULE_CODEGEN
+
+#include <ostream>
+#include <string>
+
+#include "RuleTree.h"
+
+//values written per line of a generated table
+#define CODEGEN_VALUES_PER_LINE 12
+
+void writeLookupHeader(const RuleTree& tree, std::ostream& out, const std::string& name, const std::string& source);
+bool isIdentifier(const std::string& name);
+
+#endif
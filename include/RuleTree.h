@@ -2,108 +2,238 @@
 #define RULE_TREE
 
 #include <set>
-#include <unordered_map>
+#include <vector>
 #include <cstdint>
 #include <string>
 #include <iostream>
+#include <iterator>
+#include <algorithm>
 
-// Represents a range
-template <typename T>
-struct Range 
-{
-    Range(){}
-    Range(T start, T end): start(start), end(end){}
-    T start;
-    T end;
-};
-
-//Represents an interval which is the core component of the interval tree
-template <typename T>
-struct Interval
-{
-    Interval(T start, T end): start(start), end(end){}
-    Interval(Range<T>& range): start(range.start), end(range.end){}
-    T start;
-    T end;
-
-    bool operator<(const Interval<T>& t) const
-    { 
-        return this->end < t.start;
-    } 
-    bool operator>(const Interval<T>& t) const
-    { 
-        return this->start > t.end;
-    }
-    //checking for overlapping 
-    bool operator==(const Interval<T>& t) const
-    {
-        return (this->start <= t.start && this->end >= t.end) || 
-                (t.start <= this->start && t.end >= this->end);
-    } 
-};
+#include "Interval.h"
+#include "Address.h"
+#include "PortSet.h"
+#include "PortSetTable.h"
+#include "NodePool.h"
+#include "Stats.h"
 
-//an IP interval is special since it contains an instance of a interval tree to hold the respective ports for this ip_range. 
-struct IPInterval
+//an IP interval is special since it contains the set of ports allowed for this ip_range. 
+template <typename Address>
+struct BasicIPInterval
 {
-    IPInterval(Range<uint32_t>& iprange) : ip_range(iprange){};
-    IPInterval(Range<uint32_t>& iprange, Range<uint16_t>& portrange): ip_range(iprange)
+    BasicIPInterval(const Range<Address>& iprange) : ip_range(iprange){};
+    BasicIPInterval(const Range<Address>& iprange, const Range<uint16_t>& portrange): ip_range(iprange)
     {
-        portTree.insert(Interval<uint16_t>(portrange));
+        portSet.insert(Interval<uint16_t>(portrange));
     }
 
-    Interval<uint32_t> ip_range;
+    Interval<Address> ip_range;
 
     //Forgot that set values are const once emplaced. To get around having to reconstruct the 
-    //port tree every time I want to add a port range, I'm using this dirty mutable hack
-    mutable std::set<Interval<uint16_t>> portTree; 
+    //port set every time I want to add a port range, I'm using this dirty mutable hack
+    mutable PortSet portSet; 
 
-    bool operator<(const IPInterval& t) const
+    bool operator<(const BasicIPInterval& t) const
     { 
         return this->ip_range < t.ip_range;
     }
-    bool operator>(const IPInterval& t) const
+    bool operator>(const BasicIPInterval& t) const
     { 
         return this->ip_range > t.ip_range;
     }
-    bool operator==(const IPInterval& t) const
+    bool operator==(const BasicIPInterval& t) const
     {
         return this->ip_range == t.ip_range;
     } 
 };
 
+typedef BasicIPInterval<uint32_t> IPInterval;
+typedef BasicIPInterval<Ipv6Address> IPv6Interval;
+
+//the ip intervals of one root, with the nodes coming out of the tree's NodePool
+template <typename Address>
+using BasicIPIntervalSet = std::set<BasicIPInterval<Address>, std::less<BasicIPInterval<Address>>, PoolAllocator<BasicIPInterval<Address>>>;
+typedef BasicIPIntervalSet<uint32_t> IPIntervalSet;
+
+//where a RuleTree gets the memory for its nodes, see NodePool. Heap is plain operator new, like std::allocator
+enum class NodeAllocation : uint8_t { Pool = 0, Heap = 1 };
+
+//the direction and protocal of a packet. Between them they pick which of the roots of the tree to search
+enum class Direction : uint8_t { Inbound = 0, Outbound = 1 };
+enum class Protocol : uint8_t { Tcp = 0, Udp = 1 };
+
+#define ROOT_COUNT 4
+
+//fewest port sets changed in place before insertRule interns them again, see RuleTree::internPortSets
+#define PORTSET_INTERN_BATCH 1024
+
+//how a compiled tree searches the ip addresses, see CompiledRuleTree
+enum class IpIndex : uint8_t { Eytzinger = 0, Trie = 1 };
+
+/**
+ * Maps a direction and protocal onto one of the fixed roots
+ * @return int: the index of the root, between 0 and ROOT_COUNT - 1
+ */
+inline int rootSlot(Direction direction, Protocol protocal)
+{
+    return static_cast<int>(direction) | (static_cast<int>(protocal) << 1);
+}
+
+Direction parseDirection(const std::string& direction);
+Protocol parseProtocol(const std::string& protocal);
+const char* toString(Direction direction);
+const char* toString(Protocol protocal);
+
 //represents a rule to be inserted or searched for in the tree
-struct FirewallRule 
+template <typename Address>
+struct BasicFirewallRule 
 {
-    std::string direction;
-    std::string protocal;
-    Range<uint32_t> ip_range;
+    Direction direction;
+    Protocol protocal;
+    Range<Address> ip_range;
     Range<uint16_t> port_range;
-
-    friend std::ostream& operator<<(std::ostream& os, const FirewallRule& rule);
 };
 
+typedef BasicFirewallRule<uint32_t> FirewallRule;
+typedef BasicFirewallRule<Ipv6Address> FirewallRule6;
+
 inline std::ostream& operator<<(std::ostream& os, const FirewallRule& rule)
 {
-    os << rule.direction << ' ' << rule.protocal << ' ';
+    os << toString(rule.direction) << ' ' << toString(rule.protocal) << ' ';
     os << rule.ip_range.start << '-' << rule.ip_range.end << ' ' << rule.port_range.start << '-' << rule.port_range.end;
 
     return os;
 }
 
+inline std::ostream& operator<<(std::ostream& os, const FirewallRule6& rule)
+{
+    os << toString(rule.direction) << ' ' << toString(rule.protocal) << ' ';
+    os << toString(rule.ip_range.start) << '-' << toString(rule.ip_range.end) << ' ' << rule.port_range.start << '-' << rule.port_range.end;
+
+    return os;
+}
+
+/**
+ * The order insertRules sorts rules into: by root, then by ip range, then by port range. Every field is
+ * compared, so two lists of rules sorted this way can be diffed by walking them side by side.
+ */
+template <typename Address>
+inline bool ruleOrder(const BasicFirewallRule<Address>& a, const BasicFirewallRule<Address>& b)
+{
+    int slotA = rootSlot(a.direction, a.protocal);
+    int slotB = rootSlot(b.direction, b.protocal);
+    if(slotA != slotB)
+        return slotA < slotB;
+    if(a.ip_range.start != b.ip_range.start)
+        return a.ip_range.start < b.ip_range.start;
+    if(a.ip_range.end != b.ip_range.end)
+        return a.ip_range.end < b.ip_range.end;
+    if(a.port_range.start != b.port_range.start)
+        return a.port_range.start < b.port_range.start;
+    return a.port_range.end < b.port_range.end;
+}
+
 /**
- * Represented as an Interval tree of ip ranges, each of which in turn has an interval tree of 
+ * What a RuleTree looks like in memory, and how much work building it took. See RuleTree::stats
+ */
+struct RuleTreeStats
+{
+    size_t ipIntervals[ROOT_COUNT];         //per root, indexed by rootSlot
+    size_t portIntervals;                   //across every ip interval
+    std::vector<size_t> portDistribution;   //bucket b counts the ip intervals with [2^b, 2^(b+1)) port intervals
+    size_t sharedPortSets;                  //distinct port sets on the heap, each stored once however many intervals use it
+    size_t memoryBytes;                     //estimated
+    uint64_t merges;                        //inserts which merged intervals together
+    uint64_t portTreeCopies;                //shared port sets those merges had to copy before changing them
+    uint64_t portIntervalsCopied;           //and how many port intervals were in them
+};
+
+std::ostream& operator<<(std::ostream& os, const RuleTreeStats& stats);
+
+class CompiledRuleTree;
+
+/**
+ * Represented as an Interval tree of ip ranges, each of which in turn has a PortSet of 
  * port ranges.
+ *
+ * The address type is a template argument so that each address family gets a tree of its own, built for
+ * its width: RuleTree for IPv4 and RuleTree6 for IPv6. The code is only compiled for those two, see the
+ * end of RuleTree.cpp. Compiling to a CompiledRuleTree and coveredVolume are IPv4 only.
  */
-class RuleTree 
+template <typename Address>
+class BasicRuleTree 
 {
 public:
-    RuleTree();
-    void insertRule(FirewallRule& rule);
-    bool contains(FirewallRule& rule);
+    typedef BasicFirewallRule<Address> Rule;
+    typedef BasicIPInterval<Address> IntervalType;
+    typedef BasicIPIntervalSet<Address> IntervalSet;
+
+    BasicRuleTree(NodeAllocation allocation = NodeAllocation::Pool);
+    void insertRule(const Rule& rule);
+    void insertRules(std::vector<Rule>& rules);
+    void removeRule(const Rule& rule);
+    void updateRules(const std::vector<Rule>& rules, const std::vector<Rule>& changed);
+    void merge(BasicRuleTree& other);
+    void internPortSets();
+    size_t compact();
+    bool contains(const Rule& rule) const;
+    bool contains(Direction direction, Protocol protocal, uint16_t port, Address ip) const;
+
+    //range queries, each an ordered walk over just the ip intervals overlapping the ips asked about
+    std::vector<Range<uint16_t>> allowedPorts(Direction direction, Protocol protocal, const Range<Address>& ips) const;
+    std::vector<Range<Address>> coveredIps(Direction direction, Protocol protocal, uint16_t port,
+                                           const Range<Address>& ips = Range<Address>(0, AddressTraits<Address>::max())) const;
+    uint64_t coveredVolume(Direction direction, Protocol protocal, const Range<Address>& ips = Range<Address>(0, AddressTraits<Address>::max()),
+                           const Range<uint16_t>& ports = Range<uint16_t>(0, UINT16_MAX)) const;
+    uint64_t coveredVolume() const;
+
+    CompiledRuleTree compile(IpIndex index = IpIndex::Eytzinger) const;
+    const IntervalSet& getRoot(int slot) const { return root[slot]; }
+    bool empty() const
+    {
+        for(const IntervalSet& set : root)
+            if(!set.empty())
+                return false;
+        return true;
+    }
+    RuleTreeStats stats() const;
 
 private:
-    std::string makekey(FirewallRule& rule);
-    std::unordered_map<std::string, std::set<IPInterval>> root;
+    void insertInterval(IntervalSet& tree, const Range<Address>& ipRange, const PortSet& ports);
+    void buildIntervals(IntervalSet& tree, typename IntervalSet::iterator hint, const Rule* first, const Rule* last);
+    static void buildPortSet(PortSet& portSet, std::vector<Interval<uint16_t>>& ports);
+    static void joinPorts(std::vector<Interval<uint16_t>>& ports);
+    void removePorts(PortSet& set, const Interval<uint16_t>& range);
+    void portSetChanged(const PortSet& set);
+
+    //one interval tree per direction/protocal pair, indexed by rootSlot. There are only four of these and they
+    //never change, so a fixed array saves us building and hashing a string key on every lookup.
+    //All four allocate from the same NodePool
+    IntervalSet root[ROOT_COUNT];
+    NodeAllocation allocation;
+
+    //every distinct port set on the heap, so intervals with the same ports share one copy
+    PortSetTable portSets;
+    size_t portSetsChanged;     //changed in place and not interned since, see internPortSets
+    size_t internAfter;         //how many changes until it runs again
+
+    //only counted with FIREWALL_STATS, see Stats.h
+    StatCounter merges;
+    StatCounter portTreeCopies;
+    StatCounter portIntervalsCopied;
 };
 
+typedef BasicRuleTree<uint32_t> RuleTree;
+typedef BasicRuleTree<Ipv6Address> RuleTree6;
+
+//only there for IPv4, an IPv6 tree can't be compiled and its volumes don't fit in 64 bits
+template <>
+CompiledRuleTree BasicRuleTree<uint32_t>::compile(IpIndex index) const;
+template <>
+uint64_t BasicRuleTree<uint32_t>::coveredVolume(Direction direction, Protocol protocal, const Range<uint32_t>& ips, const Range<uint16_t>& ports) const;
+template <>
+uint64_t BasicRuleTree<uint32_t>::coveredVolume() const;
+
+extern template class BasicRuleTree<uint32_t>;
+extern template class BasicRuleTree<Ipv6Address>;
+
 #endif
\ No newline at end of file
@@ -0,0 +1,69 @@
+#ifndef SPSC_RING
+#define SPSC_RING
+
+#include <atomic>
+#include <cstddef>
+#include <thread>
+#include <vector>
+
+//keeps the two indices on different cache lines, so the producer and consumer don't fight over one
+#define SPSC_CACHE_LINE 64
+
+/**
+ * A bounded lock free queue between exactly one producer thread and one consumer thread. The slots are
+ * allocated once up front and filled in place: the producer claims the next free slot, writes into it and
+ * publishes it, and the consumer reads the oldest published slot and then pops it, handing it back. Nothing
+ * is copied or allocated per item, which is why the slots are meant to be big (a whole batch of rules).
+ *
+ * Each side only ever writes its own index, with a release store that the other side picks up with an
+ * acquire load, so there are no locks and no compare and swap. A side that finds the ring full (or empty)
+ * spins, yielding the cpu each time around.
+ */
+template <typename T>
+class SpscRing
+{
+public:
+    /**
+     * @param capacity size_t: number of slots, at least 2
+     */
+    explicit SpscRing(size_t capacity): slots(capacity < 2 ? 2 : capacity), head(0), tail(0) {}
+    SpscRing(const SpscRing&) = delete;
+    SpscRing& operator=(const SpscRing&) = delete;
+
+    //producer: the next slot to fill, waiting for the consumer to free one if the ring is full
+    T& claim()
+    {
+        size_t position = head.load(std::memory_order_relaxed);
+        while(position - tail.load(std::memory_order_acquire) == slots.size())
+            std::this_thread::yield();
+        return slots[position % slots.size()];
+    }
+
+    //producer: hands the claimed slot over to the consumer
+    void publish()
+    {
+        head.store(head.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+    //consumer: the oldest published slot, waiting for the producer if there isn't one yet
+    T& front()
+    {
+        size_t position = tail.load(std::memory_order_relaxed);
+        while(head.load(std::memory_order_acquire) == position)
+            std::this_thread::yield();
+        return slots[position % slots.size()];
+    }
+
+    //consumer: gives the front slot back to the producer
+    void pop()
+    {
+        tail.store(tail.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+private:
+    std::vector<T> slots;
+    alignas(SPSC_CACHE_LINE) std::atomic<size_t> head;  //slots published so far, only written by the producer
+    alignas(SPSC_CACHE_LINE) std::atomic<size_t> tail;  //slots popped so far, only written by the consumer
+};
+
+#endif
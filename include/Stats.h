@@ -0,0 +1,52 @@
+#ifndef STATS
+#define STATS
+
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+
+/**
+ * Counters for the stats API of RuleTree and Firewall. Counting is only compiled in when FIREWALL_STATS
+ * is defined (make STATS=1), otherwise every STAT_ADD disappears and the counters just stay at zero.
+ * The shape of the rules (interval counts, memory) doesn't need counting, so it is always available.
+ */
+#ifdef FIREWALL_STATS
+#define STAT_ADD(counter, amount) (counter).add(amount)
+#else
+#define STAT_ADD(counter, amount) ((void)0)
+#endif
+
+//latency histogram buckets, bucket b holds samples of [2^b, 2^(b+1)) nanoseconds
+#define LATENCY_BUCKETS 32
+
+/**
+ * A relaxed atomic counter. Nothing is ordered by it, so bumping it is as cheap as an atomic add gets.
+ * Copying takes a snapshot of the count, which keeps the classes holding these copyable and movable.
+ */
+class StatCounter
+{
+public:
+    StatCounter(): value(0) {}
+    StatCounter(const StatCounter& other): value(other.load()) {}
+    StatCounter& operator=(const StatCounter& other)
+    {
+        value.store(other.load(), std::memory_order_relaxed);
+        return *this;
+    }
+
+    void add(uint64_t amount) { value.fetch_add(amount, std::memory_order_relaxed); }
+    uint64_t load() const { return value.load(std::memory_order_relaxed); }
+
+private:
+    std::atomic<uint64_t> value;
+};
+
+/**
+ * @return int: the bucket a value lands in, its log base 2 rounded down (0 for 0)
+ */
+inline int log2Bucket(uint64_t value)
+{
+    return value == 0 ? 0 : 63 - __builtin_clzll(value);
+}
+
+#endif
@@ -0,0 +1,97 @@
+#ifndef VERDICT_CACHE
+#define VERDICT_CACHE
+
+#include <atomic>
+#include <cstdint>
+
+#include "RuleTree.h"
+
+//entries in each thread's cache, must be a power of two. 16 bytes each, so 64 KiB per thread
+#ifndef VERDICT_CACHE_ENTRIES
+#define VERDICT_CACHE_ENTRIES 4096
+#endif
+
+//this thread's cache counters
+struct VerdictCacheStats
+{
+    uint64_t hits;
+    uint64_t misses;
+};
+
+/**
+ * A per thread cache of recent verdicts, for traffic where a small number of (direction, protocal,
+ * port, ip) tuples make up most of the packets. The tuple packs into 56 bits, which is the key.
+ *
+ * The cache is two way set associative, and each thread has its own, so there is no locking or
+ * sharing between threads. Every entry also remembers the epoch of the rules it was computed from.
+ * Whoever owns the rules takes a fresh epoch with newEpoch whenever they change, and entries from any
+ * other epoch are just treated as misses. Epochs are unique across the whole process, so any number of
+ * firewalls can share the cache without seeing eachother's verdicts.
+ */
+class VerdictCache
+{
+public:
+    static uint64_t newEpoch()
+    {
+        static std::atomic<uint64_t> next(1);
+        return next.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    /**
+     * Returns the cached verdict for the packet if there is one, otherwise calls search and caches its answer
+     * @param epoch uint64_t: the epoch of the rules search looks at
+     * @param search Search: called as search() on a miss, returning the verdict
+     */
+    template <typename Search>
+    static bool lookup(uint64_t epoch, Direction direction, Protocol protocal, uint16_t port, uint32_t ip, Search search)
+    {
+        uint64_t key = uint64_t(ip) | (uint64_t(port) << 32) | (uint64_t(rootSlot(direction, protocal)) << 48);
+        Entry* set = table() + (((key * 0x9E3779B97F4A7C15ull) >> (64 - SET_BITS)) << 1);
+
+        for(int way = 0; way < 2; way++)
+        {
+            if(set[way].epoch == epoch && (set[way].key & KEY_MASK) == key)
+            {
+                counters().hits++;
+                return set[way].key >> VERDICT_BIT;
+            }
+        }
+
+        counters().misses++;
+        bool verdict = search();
+        set[1] = set[0];
+        set[0].key = key | (uint64_t(verdict) << VERDICT_BIT);
+        set[0].epoch = epoch;
+        return verdict;
+    }
+
+    static VerdictCacheStats stats() { return counters(); }
+    static void resetStats() { counters() = VerdictCacheStats(); }
+
+private:
+    struct Entry
+    {
+        uint64_t key;       //the packed tuple, with the verdict in the top bit
+        uint64_t epoch;     //0 for an empty entry
+    };
+
+    static const int VERDICT_BIT = 63;
+    static const uint64_t KEY_MASK = (uint64_t(1) << 56) - 1;
+    static const int SET_BITS = __builtin_ctz(VERDICT_CACHE_ENTRIES / 2);
+
+    //function local so the header is all there is. Zero initialized, so there is no constructor to
+    //check for on every access
+    static Entry* table()
+    {
+        static thread_local Entry entries[VERDICT_CACHE_ENTRIES];
+        return entries;
+    }
+
+    static VerdictCacheStats& counters()
+    {
+        static thread_local VerdictCacheStats values;
+        return values;
+    }
+};
+
+#endif
@@ -0,0 +1,120 @@
+#ifndef WORK_STEALING_DEQUE
+#define WORK_STEALING_DEQUE
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+//keeps top and bottom on different cache lines, so the owner and the thieves don't fight over one
+#define DEQUE_CACHE_LINE 64
+
+/**
+ * A bounded lock free work stealing deque (Chase and Lev, with the memory orders of Le et al. 2013). One
+ * thread owns it and pushes and pops at the bottom, like a stack. Any number of other threads steal from
+ * the top, so they take the oldest items, the ones the owner would get to last.
+ *
+ * The owner only needs a compare and swap when it pops the very last item, which is the one a thief could
+ * be going for too. Thieves always compare and swap on top, and a steal that loses that race just fails,
+ * the caller tries again or somewhere else. The capacity is fixed, so push fails once it is full instead
+ * of growing the buffer under the thieves' feet.
+ *
+ * The items are copied in and out through relaxed atomics, so keep them small, like an index.
+ */
+template <typename T>
+class WorkStealingDeque
+{
+public:
+    /**
+     * @param capacity size_t: most items held at once, rounded up to a power of two
+     */
+    explicit WorkStealingDeque(size_t capacity = 2) { reset(capacity); }
+    WorkStealingDeque(const WorkStealingDeque&) = delete;
+    WorkStealingDeque& operator=(const WorkStealingDeque&) = delete;
+
+    //empties it with room for capacity items. Only while no other thread is using it
+    void reset(size_t capacity)
+    {
+        size_t rounded = 2;
+        while(rounded < capacity)
+            rounded <<= 1;
+        if(rounded != mask + 1 || slots == nullptr)
+        {
+            slots.reset(new std::atomic<T>[rounded]);
+            mask = rounded - 1;
+        }
+        top.store(0, std::memory_order_relaxed);
+        bottom.store(0, std::memory_order_relaxed);
+    }
+
+    size_t capacity() const { return mask + 1; }
+
+    //owner: adds an item at the bottom. Returns false if it is full
+    bool push(const T& item)
+    {
+        int64_t b = bottom.load(std::memory_order_relaxed);
+        int64_t t = top.load(std::memory_order_acquire);
+        if(b - t > int64_t(mask))
+            return false;
+        slots[b & mask].store(item, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        bottom.store(b + 1, std::memory_order_relaxed);
+        return true;
+    }
+
+    //owner: takes the newest item. Returns false if it is empty
+    bool pop(T& item)
+    {
+        int64_t b = bottom.load(std::memory_order_relaxed) - 1;
+        bottom.store(b, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t t = top.load(std::memory_order_relaxed);
+        if(t > b)
+        {
+            bottom.store(b + 1, std::memory_order_relaxed);
+            return false;
+        }
+        item = slots[b & mask].load(std::memory_order_relaxed);
+        if(t != b)
+            return true;
+
+        //the last one, which a thief may be taking at the same time
+        bool won = top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+        bottom.store(b + 1, std::memory_order_relaxed);
+        return won;
+    }
+
+    //thief: takes the oldest item. Returns false if it is empty or another thread got there first
+    bool steal(T& item)
+    {
+        int64_t t = top.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t b = bottom.load(std::memory_order_acquire);
+        if(t >= b)
+            return false;
+        item = slots[t & mask].load(std::memory_order_relaxed);
+        return top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+    }
+
+    //a guess at how many items are in it, exact only when nothing is pushing, popping or stealing
+    size_t size() const
+    {
+        int64_t b = bottom.load(std::memory_order_relaxed);
+        int64_t t = top.load(std::memory_order_relaxed);
+        return b > t ? size_t(b - t) : 0;
+    }
+
+private:
+    //padded rather than alignas, since these get allocated with plain new, which doesn't honour extended
+    //alignment before C++17. A whole line of padding on each side keeps top and bottom off each other's
+    //line (and off the slots pointer the owner and thieves both read) wherever the deque starts
+    std::unique_ptr<std::atomic<T>[]> slots;
+    size_t mask = 0;
+    char paddingBefore[DEQUE_CACHE_LINE];
+    std::atomic<int64_t> top{0};        //next item to steal, only ever goes up
+    char paddingBetween[DEQUE_CACHE_LINE - sizeof(std::atomic<int64_t>)];
+    std::atomic<int64_t> bottom{0};     //one past the newest item, only written by the owner
+    char paddingAfter[DEQUE_CACHE_LINE - sizeof(std::atomic<int64_t>)];
+};
+
+#endif
@@ -0,0 +1,51 @@
+#include "Address.h"
+
+#include <cstdio>
+
+/**
+ * Writes an IPv6 address out in the RFC 5952 form: lower case hex without leading zeros, and the longest
+ * run of two or more zero groups (the first one if there is a tie) written as "::"
+ * @param address Ipv6Address: the address
+ * @return string: the text, like "2001:db8::1"
+ */
+std::string toString(Ipv6Address address)
+{
+    uint16_t groups[8];
+    for(int group = 7; group >= 0; group--)
+    {
+        groups[group] = uint16_t(address);
+        address >>= 16;
+    }
+
+    int bestStart = -1;
+    int bestLength = 1;
+    for(int group = 0; group < 8;)
+    {
+        int length = 0;
+        while(group + length < 8 && groups[group + length] == 0)
+            length++;
+        if(length > bestLength)
+        {
+            bestStart = group;
+            bestLength = length;
+        }
+        group += length == 0 ? 1 : length;
+    }
+
+    std::string text;
+    char hex[8];
+    for(int group = 0; group < 8; group++)
+    {
+        if(group == bestStart)
+        {
+            text += "::";
+            group += bestLength - 1;
+            continue;
+        }
+        if(!text.empty() && text.back() != ':')
+            text += ':';
+        std::snprintf(hex, sizeof(hex), "%x", groups[group]);
+        text += hex;
+    }
+    return text;
+}
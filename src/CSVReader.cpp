@@ -1,30 +1,130 @@
 #include "CSVReader.h"
+
+#include <cstring>
+
+//how far the reader gets past the pages it is done with before handing them back
+#define CSV_RELEASE_BYTES (64 << 20)
+
 /**
  * Constructor takes in a string which is a file
  * @param filename string: the filename for the csv file with each row representing a new rule
  */
-CSVReader::CSVReader(const std::string& filename): file(filename)
+CSVReader::CSVReader(const std::string& filename): file(std::make_shared<const MappedFile>(filename)), released(0)
+{
+    cursor = file->data();
+    end = file->data() + file->size();
+    file->adviseSequential();
+}
+
+/**
+ * A reader over just the lines in [from, to) of an already mapped file
+ */
+CSVReader::CSVReader(const std::shared_ptr<const MappedFile>& file, size_t from, size_t to): file(file), released(from)
 {
-    if(file.fail())
-        throw "File does not exist error";
+    cursor = file->data() + from;
+    end = file->data() + to;
 }
 
 /**
- * A poor man's iterator through the file, reading each line into memory only when asked for.
+ * Splits whatever this reader has left into roughly equal parts that can be read independently, for
+ * example by different threads. Every part starts at the beginning of a line, so no line is split
+ * between two readers. The parts share the mapping, so they stay valid after this reader goes away.
+ * @param parts size_t: how many readers to split into. Fewer come back if there aren't enough lines.
+ * @return vector<CSVReader>: the readers, in file order
+ */
+std::vector<CSVReader> CSVReader::split(size_t parts) const
+{
+    std::vector<CSVReader> readers;
+    if(!file || cursor >= end)
+        return readers;
+
+    const char* base = file->data();
+    size_t length = end - cursor;
+    const char* from = cursor;
+    for(size_t part = 1; part <= parts && from < end; part++)
+    {
+        const char* to = cursor + length * part / parts;
+        if(to < from)
+            to = from;
+        if(to < end)
+        {
+            const char* newline = static_cast<const char*>(std::memchr(to, '\n', end - to));
+            to = newline == nullptr ? end : newline + 1;
+        }
+        readers.push_back(CSVReader(file, from - base, to - base));
+        from = to;
+    }
+    return readers;
+}
+
+/**
+ * Iterates through the file, tokenizing each line in place. The file is memory mapped, so the fields are
+ * just pointers into the mapping and the lines are never copied. Pages are only read in as the reader
+ * reaches them, and once it is far enough past them they are released again, so the memory we use stays
+ * flat no matter how large the file is. The fields stay valid for as long as the reader does. Blank lines
+ * are skipped, and \r\n line endings are handled.
+ * @param row CSVRow: filled with the fields of the next line
+ * @return bool: false once there are no lines left
+ */
+bool CSVReader::next(CSVRow& row)
+{
+    while(cursor < end && (*cursor == '\n' || *cursor == '\r'))
+        cursor++;
+    if(cursor >= end)
+        return false;
+
+    size_t offset = cursor - file->data();
+    if(offset - released >= CSV_RELEASE_BYTES)
+    {
+        file->release(released, offset);
+        released = offset;
+    }
+
+    const char* lineEnd = static_cast<const char*>(std::memchr(cursor, '\n', end - cursor));
+    if(lineEnd == nullptr)
+        lineEnd = end;
+    const char* next = lineEnd;
+    if(lineEnd > cursor && lineEnd[-1] == '\r')
+        lineEnd--;
+
+    splitLine(cursor, lineEnd, row);
+    cursor = next < end ? next + 1 : end;
+    return true;
+}
+
+/**
+ * Splits a single line into its fields, the same way next does
+ * @param line char*: the start of the line
+ * @param lineEnd char*: the end of it, not including the line ending
+ * @param row CSVRow: filled with the fields
+ */
+void CSVReader::splitLine(const char* line, const char* lineEnd, CSVRow& row)
+{
+    row.count = 0;
+    const char* field = line;
+    while(row.count < CSV_MAX_FIELDS - 1)
+    {
+        const char* comma = static_cast<const char*>(std::memchr(field, ',', lineEnd - field));
+        if(comma == nullptr)
+            break;
+        row.fields[row.count++] = {field, size_t(comma - field)};
+        field = comma + 1;
+    }
+    row.fields[row.count++] = {field, size_t(lineEnd - field)};
+}
+
+/**
+ * A poor man's iterator through the file, reading each line into memory only when asked for. Kept for
+ * callers that want owned strings, it copies the fields out of next.
  * @param line vector<string>: a vector which the line in the csv will be broken up into and placed in.
  */
 void CSVReader::getNext(std::vector<string>& line)
 {
     line.clear();
-    std::string readline;
-    if(getline(file, readline))
+    CSVRow row;
+    if(next(row))
     {
-        if(file.bad())
-            throw "File Read Error";
-
-        std::istringstream stream(readline);
-        std::string field;
-        while (getline(stream, field, ','))
-            line.push_back(field);
-    } 
-}
\ No newline at end of file
+        for(size_t i = 0; i < row.count; i++)
+            line.push_back(row.fields[i].str());
+    }
+}
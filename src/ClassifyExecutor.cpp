@@ -0,0 +1,156 @@
+#include "ClassifyExecutor.h"
+
+#include <algorithm>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+/**
+ * Pins the calling thread to one of the cores this process may run on, the worker-th one round robin.
+ * Best effort: where that isn't supported, or not allowed, the thread just stays where the os puts it.
+ */
+static void pinToCore(unsigned worker)
+{
+#ifdef __linux__
+    cpu_set_t allowed;
+    if(sched_getaffinity(0, sizeof(allowed), &allowed) != 0 || CPU_COUNT(&allowed) == 0)
+        return;
+    unsigned target = worker % CPU_COUNT(&allowed);
+    for(int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+    {
+        if(!CPU_ISSET(cpu, &allowed) || target-- != 0)
+            continue;
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+        pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+        return;
+    }
+#else
+    (void)worker;
+#endif
+}
+
+/**
+ * Starts the workers, which sleep until the first run
+ * @param firewall Firewall: the rules to classify against, which have to outlive the executor
+ * @param threads unsigned: how many workers, 0 means one per core
+ * @param pin bool: whether to pin each worker to a core of its own
+ */
+ClassifyExecutor::ClassifyExecutor(const Firewall& firewall, unsigned threads, bool pin): firewall(firewall)
+{
+    if(threads == 0)
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    for(unsigned worker = 0; worker < threads; worker++)
+        workers.emplace_back(new Worker());
+    for(unsigned worker = 0; worker < threads; worker++)
+        workers[worker]->thread = std::thread(&ClassifyExecutor::work, this, worker, pin);
+}
+
+/**
+ * Wakes the workers up one last time to tell them to exit, and waits for them
+ */
+ClassifyExecutor::~ClassifyExecutor()
+{
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        stopping = true;
+    }
+    wake.notify_all();
+    for(std::unique_ptr<Worker>& worker : workers)
+        worker->thread.join();
+}
+
+/**
+ * Classifies every task and returns once all of their verdicts are written. The tasks are dealt out in
+ * order, the first share to the first worker and so on, and stolen from there as the workers run dry.
+ * The deques are filled from this thread, which is fine since every worker is asleep between runs. Calls
+ * from several threads at once take turns.
+ * @param tasks vector<ClassifyTask>: the batches to classify, which can be any size
+ */
+void ClassifyExecutor::run(const std::vector<ClassifyTask>& tasks)
+{
+    if(tasks.empty())
+        return;
+    std::lock_guard<std::mutex> turn(runLock);
+    std::unique_lock<std::mutex> guard(lock);
+    size_t count = workers.size();
+    for(size_t worker = 0; worker < count; worker++)
+    {
+        size_t first = tasks.size() * worker / count;
+        size_t last = tasks.size() * (worker + 1) / count;
+        WorkStealingDeque<size_t>& deque = workers[worker]->deque;
+        deque.reset(std::max(deque.capacity(), last - first));
+        for(size_t task = first; task < last; task++)
+            deque.push(task);
+    }
+    this->tasks = &tasks;
+    remaining.store(tasks.size(), std::memory_order_relaxed);
+    busy = count;
+    generation++;
+    wake.notify_all();
+    finished.wait(guard, [this]() { return busy == 0; });
+    this->tasks = nullptr;
+}
+
+/**
+ * The next task for a worker: the newest one of its own, or else the oldest one of the first other
+ * worker that has any, looking at them round robin starting from the next one over
+ * @return bool: false if there was nothing to take just now
+ */
+bool ClassifyExecutor::takeTask(unsigned worker, size_t& task)
+{
+    if(workers[worker]->deque.pop(task))
+        return true;
+    for(size_t i = 1; i < workers.size(); i++)
+    {
+        if(workers[(worker + i) % workers.size()]->deque.steal(task))
+        {
+            stolen.fetch_add(1, std::memory_order_relaxed);
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * What each worker thread runs: sleep until there is a run, take and classify tasks until none are left
+ * anywhere, check back in, and go back to sleep
+ */
+void ClassifyExecutor::work(unsigned worker, bool pin)
+{
+    if(pin)
+        pinToCore(worker);
+    uint64_t seen = 0;
+    while(true)
+    {
+        {
+            std::unique_lock<std::mutex> guard(lock);
+            wake.wait(guard, [this, seen]() { return stopping || generation != seen; });
+            if(stopping)
+                return;
+            seen = generation;
+        }
+
+        //a task can still be in another worker's hands after the deques are empty, so the count is what
+        //says we're done
+        size_t task;
+        while(remaining.load(std::memory_order_acquire) != 0)
+        {
+            if(!takeTask(worker, task))
+            {
+                std::this_thread::yield();
+                continue;
+            }
+            const ClassifyTask& current = (*tasks)[task];
+            firewall.accept_packets(current.batch, current.verdicts);
+            remaining.fetch_sub(1, std::memory_order_acq_rel);
+        }
+
+        std::lock_guard<std::mutex> guard(lock);
+        if(--busy == 0)
+            finished.notify_one();
+    }
+}
@@ -0,0 +1,753 @@
+#include "CompiledRuleTree.h"
+
+#include <limits>
+#include <cstring>
+#include <cstdio>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define HAVE_X86 1
+#include <immintrin.h>
+#endif
+
+//how many packets containsBatch sorts and searches at a time. Everything for a chunk lives on the stack
+#define BATCH_CHUNK 256
+
+//every array starts on its own cache line
+#define SECTION_ALIGNMENT 64
+
+#define SNAPSHOT_MAGIC "FWRULES"
+#define SNAPSHOT_VERSION 2
+#define SNAPSHOT_BYTE_ORDER 0x01020304u
+
+//a trie entry is either a leaf (top bit clear) holding the rank of the interval covering its whole block
+//plus one, or 0 for no interval. Otherwise the next bit says whether the rest is the index of the table
+//for the next 8 bits, or the rank to start scanning the intervals from
+#define TRIE_STRIDE 256
+#define TRIE_ROOT_ENTRIES 65536
+#define TRIE_TYPE 0xC0000000u
+#define TRIE_CHILD 0x80000000u
+#define TRIE_SCAN 0xC0000000u
+#define TRIE_PAYLOAD 0x3FFFFFFFu
+
+//a block with more intervals than this in it gets its own table instead of being scanned
+#define TRIE_SCAN_LIMIT 8
+
+/**
+ * The start of a snapshot file. The payload that follows it is the storage buffer, byte for byte.
+ */
+struct CompiledRuleTree::SnapshotHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t byteOrder;         //written as SNAPSHOT_BYTE_ORDER, so a file from a machine of the other endianness is caught
+    uint64_t payloadOffset;
+    uint64_t payloadSize;
+    uint64_t checksum;          //of the payload
+    RootLayout roots[ROOT_COUNT];
+};
+
+static size_t alignSection(size_t offset)
+{
+    return (offset + SECTION_ALIGNMENT - 1) / SECTION_ALIGNMENT * SECTION_ALIGNMENT;
+}
+
+/**
+ * An empty compiled tree, which allows nothing
+ */
+CompiledRuleTree::CompiledRuleTree()
+{
+    std::memset(layout, 0, sizeof(layout));
+    attach(nullptr);
+}
+
+/**
+ * Flattens every root of the rule tree. The intervals in each std::set are already sorted and
+ * disjoint, so an in order walk gives us the sorted arrays directly. The sizes of everything are known
+ * up front, so the whole thing is laid out first and then filled in with a single allocation. The
+ * tries are the exception, their size is only known once they are built, so they are built first.
+ * @param tree RuleTree: the tree to freeze
+ * @param index IpIndex: whether to search the ip addresses with the Eytzinger layout or a trie
+ */
+CompiledRuleTree::CompiledRuleTree(const RuleTree& tree, IpIndex index)
+{
+    std::vector<uint32_t> tries[ROOT_COUNT];
+    size_t bytes = 0;
+    for(int slot = 0; slot < ROOT_COUNT; slot++)
+    {
+        if(index == IpIndex::Trie)
+            buildTrie(tries[slot], tree.getRoot(slot));
+        bytes = planRoot(layout[slot], bytes, tree.getRoot(slot), tries[slot].size());
+    }
+
+    storage.assign(bytes / sizeof(uint64_t), 0);
+    char* base = reinterpret_cast<char*>(storage.data());
+    for(int slot = 0; slot < ROOT_COUNT; slot++)
+        buildRoot(base, layout[slot], tree.getRoot(slot), tries[slot]);
+    attach(base);
+}
+
+/**
+ * Works out where the arrays of one root go in the storage.
+ * @param layout RootLayout: filled with the counts and offsets of the root
+ * @param offset size_t: where the first array of this root can start
+ * @param tree set<IPInterval>: the root to lay out
+ * @param trieEntries size_t: the size of the root's trie, 0 if it is searched with the Eytzinger layout instead
+ * @return size_t: the offset just past the last array of this root
+ */
+size_t CompiledRuleTree::planRoot(RootLayout& layout, size_t offset, const IPIntervalSet& tree, size_t trieEntries)
+{
+    layout.count = tree.size();
+    layout.portCount = 0;
+    for(const IPInterval& interval : tree)
+        layout.portCount += interval.portSet.size();
+    layout.trieChunks = trieEntries / TRIE_STRIDE;
+
+    //pad out to a full tree so every search takes exactly height steps. A root with a trie doesn't need one
+    layout.height = 0;
+    while(layout.trieChunks == 0 && ((uint64_t(1) << layout.height) - 1) < layout.count)
+        layout.height++;
+    uint64_t nodes = layout.height == 0 ? 0 : (uint64_t(1) << layout.height);
+
+    layout.ipStart = alignSection(offset);
+    layout.ipEnd = alignSection(layout.ipStart + layout.count * sizeof(uint32_t));
+    layout.portOffset = alignSection(layout.ipEnd + layout.count * sizeof(uint32_t));
+    layout.eytzinger = alignSection(layout.portOffset + (layout.count + 1) * sizeof(uint32_t));
+    layout.eytzingerRank = alignSection(layout.eytzinger + nodes * sizeof(uint32_t));
+    layout.portStart = alignSection(layout.eytzingerRank + nodes * sizeof(uint32_t));
+    layout.portEnd = alignSection(layout.portStart + layout.portCount * sizeof(uint16_t));
+    layout.trie = alignSection(layout.portEnd + layout.portCount * sizeof(uint16_t));
+    return alignSection(layout.trie + trieEntries * sizeof(uint32_t));
+}
+
+/**
+ * Copies a single root interval tree into its structure of arrays.
+ * @param base char*: the start of the storage
+ * @param layout RootLayout: where the arrays of this root go
+ * @param tree set<IPInterval>: the root to copy
+ * @param trie vector<uint32_t>: the root's trie, if it has one
+ */
+void CompiledRuleTree::buildRoot(char* base, const RootLayout& layout, const IPIntervalSet& tree, const std::vector<uint32_t>& trie)
+{
+    uint32_t* ipStart = reinterpret_cast<uint32_t*>(base + layout.ipStart);
+    uint32_t* ipEnd = reinterpret_cast<uint32_t*>(base + layout.ipEnd);
+    uint32_t* portOffset = reinterpret_cast<uint32_t*>(base + layout.portOffset);
+    uint16_t* portStart = reinterpret_cast<uint16_t*>(base + layout.portStart);
+    uint16_t* portEnd = reinterpret_cast<uint16_t*>(base + layout.portEnd);
+
+    uint32_t rank = 0;
+    uint32_t ports = 0;
+    for(const IPInterval& interval : tree)
+    {
+        ipStart[rank] = interval.ip_range.start;
+        ipEnd[rank] = interval.ip_range.end;
+        portOffset[rank++] = ports;
+        interval.portSet.forEach([&](const Interval<uint16_t>& portRange) {
+            portStart[ports] = portRange.start;
+            portEnd[ports++] = portRange.end;
+        });
+    }
+    portOffset[rank] = ports;
+    std::copy(trie.begin(), trie.end(), reinterpret_cast<uint32_t*>(base + layout.trie));
+
+    if(layout.height == 0)
+        return;
+    buildEytzinger(reinterpret_cast<uint32_t*>(base + layout.eytzinger), reinterpret_cast<uint32_t*>(base + layout.eytzingerRank),
+                   ipStart, layout.count, uint64_t(1) << layout.height, 0, 1);
+}
+
+/**
+ * Fills in the Eytzinger layout with an in order walk of the implicit tree, where the children of
+ * node k are 2k and 2k+1. The padding nodes all come after the real intervals in sorted order, and get
+ * the largest possible start. They point back to the last real interval, which is the right answer if
+ * the search ever lands on one (only possible when the ip is 255.255.255.255).
+ * @param eytzinger uint32_t*: the Eytzinger array to fill
+ * @param eytzingerRank uint32_t*: filled with the sorted index of each node
+ * @param ipStart uint32_t*: the sorted interval starts
+ * @param count uint32_t: the number of intervals
+ * @param nodes uint64_t: the size of the Eytzinger arrays
+ * @param sorted uint32_t: the next index in the sorted arrays to place
+ * @param node uint64_t: the current node in the implicit tree
+ * @return uint32_t: the next sorted index to place after this subtree
+ */
+uint32_t CompiledRuleTree::buildEytzinger(uint32_t* eytzinger, uint32_t* eytzingerRank, const uint32_t* ipStart, uint32_t count, uint64_t nodes, uint32_t sorted, uint64_t node)
+{
+    if(node >= nodes)
+        return sorted;
+
+    sorted = buildEytzinger(eytzinger, eytzingerRank, ipStart, count, nodes, sorted, 2 * node);
+    eytzinger[node] = sorted < count ? ipStart[sorted] : std::numeric_limits<uint32_t>::max();
+    eytzingerRank[node] = std::min(sorted, count - 1);
+    return buildEytzinger(eytzinger, eytzingerRank, ipStart, count, nodes, sorted + 1, 2 * node + 1);
+}
+
+/**
+ * Builds the multibit trie for a root, see the class comment. Empty roots don't get one.
+ * @param trie vector<uint32_t>: filled with the trie, the 65536 entry top level table first
+ * @param tree set<IPInterval>: the root to index
+ */
+void CompiledRuleTree::buildTrie(std::vector<uint32_t>& trie, const IPIntervalSet& tree)
+{
+    trie.clear();
+    if(tree.empty())
+        return;
+
+    std::vector<uint32_t> ipStart, ipEnd;
+    ipStart.reserve(tree.size());
+    ipEnd.reserve(tree.size());
+    for(const IPInterval& interval : tree)
+    {
+        ipStart.push_back(interval.ip_range.start);
+        ipEnd.push_back(interval.ip_range.end);
+    }
+
+    trie.resize(TRIE_ROOT_ENTRIES);
+    for(uint32_t block = 0; block < TRIE_ROOT_ENTRIES; block++)
+    {
+        uint32_t entry = trieEntry(trie, ipStart, ipEnd, block << 16, 16);
+        trie[block] = entry;
+    }
+}
+
+/**
+ * Works out the trie entry for the block of 2^bits addresses starting at low, adding tables for the
+ * levels below it if it needs them.
+ * @param trie vector<uint32_t>: the trie so far. Tables for lower levels are added to the end
+ * @param ipStart vector<uint32_t>: the sorted interval starts
+ * @param ipEnd vector<uint32_t>: the sorted interval ends
+ * @param low uint32_t: the first address of the block
+ * @param bits int: the log2 of the size of the block, 16, 8 or 0
+ * @return uint32_t: the entry
+ */
+uint32_t CompiledRuleTree::trieEntry(std::vector<uint32_t>& trie, const std::vector<uint32_t>& ipStart, const std::vector<uint32_t>& ipEnd, uint32_t low, int bits)
+{
+    uint32_t high = low + uint32_t((uint64_t(1) << bits) - 1);
+    uint32_t first = std::lower_bound(ipEnd.begin(), ipEnd.end(), low) - ipEnd.begin();
+    uint32_t last = first;
+    while(last < ipStart.size() && ipStart[last] <= high && last - first <= TRIE_SCAN_LIMIT)
+        last++;
+
+    if(last == first)
+        return 0;
+    if(last - first == 1 && ipStart[first] <= low && high <= ipEnd[first])
+        return first + 1;
+    if(last - first <= TRIE_SCAN_LIMIT)
+        return TRIE_SCAN | first;
+
+    //too many edges in here to scan, so split it up. A single address only ever has one interval, so
+    //this never happens at the bottom level
+    uint32_t chunk = trie.size() / TRIE_STRIDE;
+    trie.resize(trie.size() + TRIE_STRIDE);
+    for(uint32_t i = 0; i < TRIE_STRIDE; i++)
+    {
+        uint32_t entry = trieEntry(trie, ipStart, ipEnd, low + (i << (bits - 8)), bits - 8);
+        trie[size_t(chunk) * TRIE_STRIDE + i] = entry;
+    }
+    return TRIE_CHILD | chunk;
+}
+
+/**
+ * Finds the interval an ip is in with the trie.
+ * @return uint32_t: the rank of the interval, or UINT32_MAX if the ip isn't in one
+ */
+inline uint32_t CompiledRuleTree::trieRank(const FlatRoot& flat, uint32_t ip)
+{
+    uint32_t entry = flat.trie[ip >> 16];
+    if((entry & TRIE_TYPE) == TRIE_CHILD)
+    {
+        entry = flat.trie[size_t(entry & TRIE_PAYLOAD) * TRIE_STRIDE + ((ip >> 8) & 0xFF)];
+        if((entry & TRIE_TYPE) == TRIE_CHILD)
+            entry = flat.trie[size_t(entry & TRIE_PAYLOAD) * TRIE_STRIDE + (ip & 0xFF)];
+    }
+
+    if((entry & TRIE_CHILD) == 0)
+        return entry - 1;
+    if((entry & TRIE_TYPE) != TRIE_SCAN)
+        return std::numeric_limits<uint32_t>::max();
+
+    //the first interval which doesn't end before the ip, if the ip is in any it is in that one
+    uint32_t rank = entry & TRIE_PAYLOAD;
+    while(rank < flat.count && flat.ipEnd[rank] < ip)
+        rank++;
+    return rank < flat.count && flat.ipStart[rank] <= ip ? rank : std::numeric_limits<uint32_t>::max();
+}
+
+/**
+ * Points the views of every root into the storage
+ * @param base char*: the start of the storage, either our own buffer or the mapped payload of a snapshot
+ */
+void CompiledRuleTree::attach(const char* base)
+{
+    for(int slot = 0; slot < ROOT_COUNT; slot++)
+    {
+        const RootLayout& from = layout[slot];
+        FlatRoot& flat = roots[slot];
+        flat.ipStart = reinterpret_cast<const uint32_t*>(base + from.ipStart);
+        flat.ipEnd = reinterpret_cast<const uint32_t*>(base + from.ipEnd);
+        flat.portOffset = reinterpret_cast<const uint32_t*>(base + from.portOffset);
+        flat.portStart = reinterpret_cast<const uint16_t*>(base + from.portStart);
+        flat.portEnd = reinterpret_cast<const uint16_t*>(base + from.portEnd);
+        flat.eytzinger = reinterpret_cast<const uint32_t*>(base + from.eytzinger);
+        flat.eytzingerRank = reinterpret_cast<const uint32_t*>(base + from.eytzingerRank);
+        flat.height = from.height;
+        flat.count = from.count;
+        flat.trie = from.trieChunks == 0 ? nullptr : reinterpret_cast<const uint32_t*>(base + from.trie);
+    }
+}
+
+/**
+ * Writes the compiled tree out as a snapshot: a header with the layout of every root and a checksum,
+ * followed by the storage buffer exactly as it is in memory.
+ * @param filename string: where to write the snapshot
+ */
+void CompiledRuleTree::save(const std::string& filename) const
+{
+    SnapshotHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+    header.version = SNAPSHOT_VERSION;
+    header.byteOrder = SNAPSHOT_BYTE_ORDER;
+    header.payloadOffset = alignSection(sizeof(SnapshotHeader));
+    header.payloadSize = storage.size() * sizeof(uint64_t);
+    const char* payload = reinterpret_cast<const char*>(storage.data());
+    if(mapping.data() != nullptr)
+    {
+        //saving a tree that was itself loaded from a snapshot
+        payload = mapping.data() + alignSection(sizeof(SnapshotHeader));
+        header.payloadSize = mapping.size() - alignSection(sizeof(SnapshotHeader));
+    }
+    header.checksum = checksum(payload, header.payloadSize);
+    std::memcpy(header.roots, layout, sizeof(layout));
+
+    FILE* file = std::fopen(filename.c_str(), "wb");
+    if(file == nullptr)
+        throw "File Write Error";
+    char padding[SECTION_ALIGNMENT] = {0};
+    bool ok = std::fwrite(&header, sizeof(header), 1, file) == 1;
+    ok = ok && std::fwrite(padding, header.payloadOffset - sizeof(header), 1, file) == 1;
+    ok = ok && (header.payloadSize == 0 || std::fwrite(payload, header.payloadSize, 1, file) == 1);
+    ok = std::fclose(file) == 0 && ok;
+    if(!ok)
+        throw "File Write Error";
+}
+
+/**
+ * Maps a snapshot written by save back into memory. After checking the header (the magic, version, byte
+ * order, that every array lies inside the file), the checksum and every trie entry, the views are pointed
+ * straight into the mapped pages. The checksum reads the whole payload, so every page is read in from disk
+ * once before this returns. After that nothing is copied or rebuilt, lookups run on the mapped pages.
+ * @param filename string: the snapshot to load
+ * @return CompiledRuleTree: the compiled tree, backed by the mapped file
+ */
+CompiledRuleTree CompiledRuleTree::load(const std::string& filename)
+{
+    CompiledRuleTree compiled;
+    compiled.mapping = MappedFile(filename);
+    const MappedFile& file = compiled.mapping;
+
+    SnapshotHeader header;
+    if(file.size() < sizeof(header))
+        throw "Malformed snapshot error";
+    std::memcpy(&header, file.data(), sizeof(header));
+    if(std::memcmp(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic)) != 0)
+        throw "Malformed snapshot error";
+    if(header.version != SNAPSHOT_VERSION || header.byteOrder != SNAPSHOT_BYTE_ORDER)
+        throw "Unsupported snapshot version error";
+    if(header.payloadOffset != alignSection(sizeof(header)) || header.payloadOffset + header.payloadSize != file.size())
+        throw "Malformed snapshot error";
+    for(const RootLayout& root : header.roots)
+    {
+        if(!validLayout(root, header.payloadSize))
+            throw "Malformed snapshot error";
+    }
+
+    const char* payload = file.data() + header.payloadOffset;
+    if(checksum(payload, header.payloadSize) != header.checksum)
+        throw "Snapshot checksum error";
+    for(const RootLayout& root : header.roots)
+    {
+        if(!validTrie(root, payload))
+            throw "Malformed snapshot error";
+    }
+
+    std::memcpy(compiled.layout, header.roots, sizeof(compiled.layout));
+    compiled.attach(payload);
+    return compiled;
+}
+
+/**
+ * Checks that the layout of a root read from a snapshot is self consistent and that all of its arrays
+ * fit inside the payload.
+ */
+bool CompiledRuleTree::validLayout(const RootLayout& layout, uint64_t payloadSize)
+{
+    if(layout.height > 31)
+        return false;
+    if(layout.trieChunks != 0)
+    {
+        if(layout.height != 0 || layout.count == 0 || layout.trieChunks < TRIE_ROOT_ENTRIES / TRIE_STRIDE || layout.trieChunks > TRIE_PAYLOAD)
+            return false;
+    }
+    else if(layout.count == 0 ? layout.height != 0 : ((uint64_t(1) << layout.height) - 1 < layout.count || (uint64_t(1) << (layout.height - 1)) - 1 >= layout.count))
+        return false;
+    uint64_t nodes = layout.height == 0 ? 0 : (uint64_t(1) << layout.height);
+
+    struct { uint64_t offset; uint64_t bytes; } sections[] = {
+        {layout.ipStart, layout.count * sizeof(uint32_t)},
+        {layout.ipEnd, layout.count * sizeof(uint32_t)},
+        {layout.portOffset, (layout.count + uint64_t(1)) * sizeof(uint32_t)},
+        {layout.eytzinger, nodes * sizeof(uint32_t)},
+        {layout.eytzingerRank, nodes * sizeof(uint32_t)},
+        {layout.portStart, layout.portCount * sizeof(uint16_t)},
+        {layout.portEnd, layout.portCount * sizeof(uint16_t)},
+        {layout.trie, uint64_t(layout.trieChunks) * TRIE_STRIDE * sizeof(uint32_t)},
+    };
+    for(const auto& section : sections)
+    {
+        if(section.offset % SECTION_ALIGNMENT != 0 || section.offset > payloadSize || section.bytes > payloadSize - section.offset)
+            return false;
+    }
+    return true;
+}
+
+/**
+ * Checks that every entry of a root's trie points somewhere inside the root, so a lookup can't wander
+ * off the end of an array.
+ */
+bool CompiledRuleTree::validTrie(const RootLayout& layout, const char* base)
+{
+    const uint32_t* trie = reinterpret_cast<const uint32_t*>(base + layout.trie);
+    for(size_t i = 0; i < size_t(layout.trieChunks) * TRIE_STRIDE; i++)
+    {
+        uint32_t entry = trie[i];
+        uint32_t payload = entry & TRIE_PAYLOAD;
+        if((entry & TRIE_CHILD) == 0 ? entry > layout.count : (entry & TRIE_TYPE) == TRIE_CHILD ? payload >= layout.trieChunks : payload >= layout.count)
+            return false;
+    }
+    return true;
+}
+
+/**
+ * A fast 64 bit checksum of the payload, eight bytes at a time. This is there to catch truncated or
+ * corrupted files, not tampering. The payload is always a multiple of eight bytes long.
+ */
+uint64_t CompiledRuleTree::checksum(const char* data, size_t size)
+{
+    uint64_t hash = 0x9E3779B97F4A7C15ull ^ size;
+    for(size_t offset = 0; offset + sizeof(uint64_t) <= size; offset += sizeof(uint64_t))
+    {
+        uint64_t word;
+        std::memcpy(&word, data + offset, sizeof(word));
+        hash = (hash ^ word) * 0xFF51AFD7ED558CCDull;
+        hash ^= hash >> 32;
+    }
+    return hash;
+}
+
+/**
+ * Turns the compiled tree back into rules, one for every port interval of every ip interval. Inserting
+ * them into an empty RuleTree gives back a tree that allows exactly the same packets.
+ * @return vector<FirewallRule>: the rules
+ */
+std::vector<FirewallRule> CompiledRuleTree::toRules() const
+{
+    std::vector<FirewallRule> rules;
+    for(int slot = 0; slot < ROOT_COUNT; slot++)
+    {
+        const FlatRoot& flat = roots[slot];
+        FirewallRule rule;
+        rule.direction = static_cast<Direction>(slot & 1);
+        rule.protocal = static_cast<Protocol>(slot >> 1);
+        for(uint32_t rank = 0; rank < flat.count; rank++)
+        {
+            rule.ip_range = Range<uint32_t>(flat.ipStart[rank], flat.ipEnd[rank]);
+            for(uint32_t port = flat.portOffset[rank]; port < flat.portOffset[rank + 1]; port++)
+            {
+                rule.port_range = Range<uint16_t>(flat.portStart[port], flat.portEnd[port]);
+                rules.push_back(rule);
+            }
+        }
+    }
+    return rules;
+}
+
+bool CompiledRuleTree::contains(const FirewallRule& rule) const
+{
+    return contains(rule.direction, rule.protocal, rule.port_range.start, rule.ip_range.start);
+}
+
+/**
+ * Checks whether a single ip address/port is allowed. The Eytzinger search always takes height steps and
+ * has no branches in the loop. Going right means the node's start is <= ip, so the last node where we
+ * went right is the interval with the largest start <= ip. That node can be recovered from the final
+ * index by stripping off the trailing left turns and the last right turn.
+ * @param direction Direction: the direction of the packet
+ * @param protocal Protocol: the protocal of the packet
+ * @param port uint16_t: the port of the packet
+ * @param ip uint32_t: the ip address of the packet
+ * @return bool: whether the packet is allowed
+ */
+bool CompiledRuleTree::contains(Direction direction, Protocol protocal, uint16_t port, uint32_t ip) const
+{
+    const FlatRoot& flat = roots[rootSlot(direction, protocal)];
+    if(flat.trie != nullptr)
+    {
+        uint32_t rank = trieRank(flat, ip);
+        return rank != std::numeric_limits<uint32_t>::max() && containsPort(flat, rank, port);
+    }
+    if(flat.height == 0)
+        return false;
+
+    const uint32_t* tree = flat.eytzinger;
+    size_t node = 1;
+    for(uint32_t level = 0; level < flat.height; level++)
+    {
+        //the 16 nodes 4 levels down share a cache line, fetch it while we work through the next 3
+        __builtin_prefetch(tree + 16 * node);
+        node = 2 * node + (tree[node] <= ip);
+    }
+    node >>= __builtin_ffsll(node);
+    if(node == 0)
+        return false;
+
+    uint32_t rank = flat.eytzingerRank[node];
+    return ip <= flat.ipEnd[rank] && containsPort(flat, rank, port);
+}
+
+/**
+ * Searches the port intervals of a single ip interval. These are usually tiny so this is a plain
+ * branchless binary search for the last interval starting at or before the port.
+ */
+bool CompiledRuleTree::containsPort(const FlatRoot& flat, uint32_t rank, uint16_t port)
+{
+    const uint16_t* base = flat.portStart + flat.portOffset[rank];
+    uint32_t length = flat.portOffset[rank + 1] - flat.portOffset[rank];
+    while(length > 1)
+    {
+        uint32_t half = length / 2;
+        base += (base[half] <= port) ? half : 0;
+        length -= half;
+    }
+    size_t index = base - flat.portStart;
+    return flat.portStart[index] <= port && port <= flat.portEnd[index];
+}
+
+/**
+ * Checks a whole batch of packets at once. Each chunk of the batch is bucketed by root with a counting
+ * sort, and then every packet headed for the same root walks the tree together, level by level. None of
+ * those walks depend on eachother, so the cpu can have a miss outstanding for every packet in the group
+ * instead of one at a time like repeated calls to contains.
+ * @param batch PacketBatch: the packets to check
+ * @param verdicts uint8_t*: filled with 1 for every accepted packet and 0 otherwise, batch.size entries
+ * @param kernel BatchKernel: which search loop to use, mostly here so the benchmarks can compare them
+ */
+void CompiledRuleTree::containsBatch(const PacketBatch& batch, uint8_t* verdicts, BatchKernel kernel) const
+{
+    bool avx2 = kernel != BatchKernel::Scalar && hasAvx2();
+
+    uint8_t slots[BATCH_CHUNK];
+    uint32_t order[BATCH_CHUNK];
+    uint32_t ips[BATCH_CHUNK];
+    uint16_t ports[BATCH_CHUNK];
+    uint8_t found[BATCH_CHUNK];
+    for(size_t begin = 0; begin < batch.size; begin += BATCH_CHUNK)
+    {
+        uint32_t count = std::min<size_t>(BATCH_CHUNK, batch.size - begin);
+
+        uint32_t offsets[ROOT_COUNT + 1] = {0};
+        for(uint32_t i = 0; i < count; i++)
+        {
+            slots[i] = rootSlot(batch.direction[begin + i], batch.protocal[begin + i]);
+            offsets[slots[i] + 1]++;
+        }
+        for(int slot = 0; slot < ROOT_COUNT; slot++)
+            offsets[slot + 1] += offsets[slot];
+
+        uint32_t cursor[ROOT_COUNT];
+        std::copy(offsets, offsets + ROOT_COUNT, cursor);
+        for(uint32_t i = 0; i < count; i++)
+        {
+            uint32_t position = cursor[slots[i]]++;
+            order[position] = i;
+            ips[position] = batch.ip[begin + i];
+            ports[position] = batch.port[begin + i];
+        }
+
+        for(int slot = 0; slot < ROOT_COUNT; slot++)
+        {
+            uint32_t first = offsets[slot];
+            searchGroup(roots[slot], ips + first, ports + first, found + first, offsets[slot + 1] - first, avx2);
+        }
+
+        for(uint32_t position = 0; position < count; position++)
+            verdicts[begin + order[position]] = found[position];
+    }
+}
+
+/**
+ * Walks the Eytzinger tree for a group of ips at once, one level at a time. Every step is the same as in
+ * contains, just interleaved across the group.
+ * @param tree uint32_t*: the Eytzinger array of a root
+ * @param height uint32_t: the height of the padded tree
+ * @param ips uint32_t*: the ips to search for
+ * @param nodes uint32_t*: filled with the leaf each search ends on
+ * @param count uint32_t: the number of ips
+ */
+static void descendScalar(const uint32_t* tree, uint32_t height, const uint32_t* ips, uint32_t* nodes, uint32_t count)
+{
+    for(uint32_t i = 0; i < count; i++)
+        nodes[i] = 1;
+    for(uint32_t level = 0; level < height; level++)
+    {
+        for(uint32_t i = 0; i < count; i++)
+        {
+            uint32_t node = nodes[i];
+            __builtin_prefetch(tree + 16 * size_t(node));
+            nodes[i] = 2 * node + (tree[node] <= ips[i]);
+        }
+    }
+}
+
+#ifdef HAVE_X86
+/**
+ * The same walk as descendScalar, 8 ips to a register with the tree loads done as gathers. Four registers
+ * go down the tree together so there are 32 loads in flight. AVX2 only has signed compares, so both sides
+ * get their sign bit flipped first. Node indexes have to fit in a signed 32 bit gather index, so the caller
+ * only uses this for trees of height 30 or less.
+ */
+__attribute__((target("avx2")))
+static void descendAvx2(const uint32_t* tree, uint32_t height, const uint32_t* ips, uint32_t* nodes, uint32_t count)
+{
+    const __m256i bias = _mm256_set1_epi32(0x80000000);
+    const __m256i one = _mm256_set1_epi32(1);
+    const int* base = reinterpret_cast<const int*>(tree);
+
+    uint32_t i = 0;
+    for(; i + 32 <= count; i += 32)
+    {
+        __m256i key[4];
+        __m256i node[4];
+        for(int lane = 0; lane < 4; lane++)
+        {
+            key[lane] = _mm256_xor_si256(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(ips + i + 8 * lane)), bias);
+            node[lane] = one;
+        }
+        for(uint32_t level = 0; level < height; level++)
+        {
+            for(int lane = 0; lane < 4; lane++)
+            {
+                __m256i start = _mm256_xor_si256(_mm256_i32gather_epi32(base, node[lane], 4), bias);
+                __m256i right = _mm256_andnot_si256(_mm256_cmpgt_epi32(start, key[lane]), one);
+                node[lane] = _mm256_add_epi32(_mm256_add_epi32(node[lane], node[lane]), right);
+            }
+        }
+        for(int lane = 0; lane < 4; lane++)
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(nodes + i + 8 * lane), node[lane]);
+    }
+    for(; i + 8 <= count; i += 8)
+    {
+        __m256i key = _mm256_xor_si256(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(ips + i)), bias);
+        __m256i node = one;
+        for(uint32_t level = 0; level < height; level++)
+        {
+            __m256i start = _mm256_xor_si256(_mm256_i32gather_epi32(base, node, 4), bias);
+            node = _mm256_add_epi32(_mm256_add_epi32(node, node), _mm256_andnot_si256(_mm256_cmpgt_epi32(start, key), one));
+        }
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(nodes + i), node);
+    }
+    if(i < count)
+        descendScalar(tree, height, ips + i, nodes + i, count - i);
+}
+#endif
+
+/**
+ * Runs the searches for every packet of a chunk that goes to the same root. After the walk each leaf is
+ * turned into its interval like in contains, and the loads that follow (the rank, then the interval end
+ * and its port offsets) are each started for the whole group before any of them are used.
+ */
+void CompiledRuleTree::searchGroup(const FlatRoot& flat, const uint32_t* ips, const uint16_t* ports, uint8_t* found, uint32_t count, bool avx2)
+{
+    if(count == 0)
+        return;
+    const uint32_t none = std::numeric_limits<uint32_t>::max();
+    if(flat.trie != nullptr)
+    {
+        //the trie is at most three loads deep, so just get every top level entry going first
+        for(uint32_t i = 0; i < count; i++)
+            __builtin_prefetch(&flat.trie[ips[i] >> 16]);
+        uint32_t ranks[BATCH_CHUNK];
+        for(uint32_t i = 0; i < count; i++)
+        {
+            ranks[i] = trieRank(flat, ips[i]);
+            if(ranks[i] != none)
+                __builtin_prefetch(&flat.portOffset[ranks[i]]);
+        }
+        for(uint32_t i = 0; i < count; i++)
+            found[i] = ranks[i] != none && containsPort(flat, ranks[i], ports[i]);
+        return;
+    }
+    if(flat.height == 0)
+    {
+        std::memset(found, 0, count);
+        return;
+    }
+
+    uint32_t nodes[BATCH_CHUNK];
+#ifdef HAVE_X86
+    if(avx2 && flat.height <= 30)
+        descendAvx2(flat.eytzinger, flat.height, ips, nodes, count);
+    else
+#endif
+        descendScalar(flat.eytzinger, flat.height, ips, nodes, count);
+
+    for(uint32_t i = 0; i < count; i++)
+    {
+        nodes[i] >>= __builtin_ffs(nodes[i]);
+        __builtin_prefetch(&flat.eytzingerRank[nodes[i]]);
+    }
+    for(uint32_t i = 0; i < count; i++)
+    {
+        nodes[i] = nodes[i] == 0 ? none : flat.eytzingerRank[nodes[i]];
+        if(nodes[i] != none)
+        {
+            __builtin_prefetch(&flat.ipEnd[nodes[i]]);
+            __builtin_prefetch(&flat.portOffset[nodes[i]]);
+        }
+    }
+    for(uint32_t i = 0; i < count; i++)
+    {
+        uint32_t rank = nodes[i];
+        found[i] = rank != none && ips[i] <= flat.ipEnd[rank] && containsPort(flat, rank, ports[i]);
+    }
+}
+
+/**
+ * @return bool: whether this cpu can run the AVX2 batch search
+ */
+bool CompiledRuleTree::hasAvx2()
+{
+#ifdef HAVE_X86
+    static const bool supported = __builtin_cpu_supports("avx2");
+    return supported;
+#else
+    return false;
+#endif
+}
+
+/**
+ * @return size_t: the total number of ip intervals across all roots
+ */
+size_t CompiledRuleTree::size() const
+{
+    size_t total = 0;
+    for(const FlatRoot& flat : roots)
+        total += flat.count;
+    return total;
+}
+
+/**
+ * @return size_t: the bytes holding the compiled rules, either the storage buffer or the mapped snapshot
+ */
+size_t CompiledRuleTree::memoryBytes() const
+{
+    return mapping.data() != nullptr ? mapping.size() : storage.size() * sizeof(uint64_t);
+}
@@ -0,0 +1,169 @@
+#include "ConcurrentFirewall.h"
+#include "Parser.h"
+
+/**
+ * An empty firewall, which drops everything until rules are inserted
+ */
+ConcurrentFirewall::ConcurrentFirewall()
+{
+    publish();
+}
+
+/**
+ * Loads the rules file just like Firewall does, and publishes the first snapshot, compiled with the ip
+ * index the options ask for like Firewall::freeze does. Snapshots are compiled,
+ * and only IPv4 rules can be, so a file with IPv6 rules in it throws
+ */
+ConcurrentFirewall::ConcurrentFirewall(std::string filename, const LoadOptions& options)
+{
+    Firewall loader(filename, options);
+    if(!loader.ruleTree6.empty())
+        throw "IPv6 rules unsupported error";
+    ipIndex = options.ipIndex;
+    ruleTree = std::move(loader.ruleTree);
+    loaded = std::move(loader.loaded);
+    publish();
+}
+
+/**
+ * Same as Firewall::accept_packet, safe to call from any thread at any time.
+ */
+bool ConcurrentFirewall::accept_packet(const std::string& direction, const std::string& protocal, uint16_t port, const std::string& ip_address) const
+{
+    return accept_packet(parseDirection(direction), parseProtocol(protocal), port, Firewall::parseIPV4string(ip_address));
+}
+
+/**
+ * Checks a packet against whichever snapshot is current when the call starts. A rule inserted while the
+ * call is running may or may not be seen, but the answer always comes from one whole version of the rules.
+ * @param direction Direction: the direction the packet is flowing
+ * @param protocal Protocol: the protocal of the packet
+ * @param port uint16_t: the port number of the packet
+ * @param ip uint32_t: the ip address of the packet in host byte order
+ * @return bool: whether the packet is allowed through the firewall
+ */
+bool ConcurrentFirewall::accept_packet(Direction direction, Protocol protocal, uint16_t port, uint32_t ip) const
+{
+    RcuReadGuard guard;
+    const Snapshot* current = snapshot.get();
+    if(cacheVerdicts.load(std::memory_order_relaxed))
+        return VerdictCache::lookup(current->cacheEpoch, direction, protocal, port, ip, [&]() { return current->compiled.contains(direction, protocal, port, ip); });
+    return current->compiled.contains(direction, protocal, port, ip);
+}
+
+/**
+ * Checks a whole batch against a single snapshot, so every packet in it sees the same rules.
+ * @param batch PacketBatch: the packets to check, as parallel arrays
+ * @param verdicts uint8_t*: filled with 1 for every accepted packet and 0 for every dropped one
+ */
+void ConcurrentFirewall::accept_packets(const PacketBatch& batch, uint8_t* verdicts) const
+{
+    RcuReadGuard guard;
+    snapshot.get()->compiled.containsBatch(batch, verdicts);
+}
+
+/**
+ * Adds a single rule, with each field in a separate index as in the csv file, and publishes it
+ */
+void ConcurrentFirewall::insertRule(vector<string>& line)
+{
+    if(line.size() > IP && isIPv6Field(line[IP].data(), line[IP].size()))
+        throw "IPv6 rules unsupported error";
+    insertRule(Firewall::initRule(line));
+}
+
+/**
+ * Adds a rule and publishes it. Lookups that start after this returns will see it.
+ * @param rule FirewallRule: the rule to add
+ */
+void ConcurrentFirewall::insertRule(const FirewallRule& rule)
+{
+    std::lock_guard<std::mutex> lock(writeLock);
+    ruleTree.insertRule(rule);
+    loaded.clear();
+    publish();
+}
+
+/**
+ * Revokes a single rule, with each field in a separate index as in the csv file, and publishes the change.
+ * See Firewall::removeRule
+ */
+void ConcurrentFirewall::removeRule(vector<string>& line)
+{
+    if(line.size() > IP && isIPv6Field(line[IP].data(), line[IP].size()))
+        throw "IPv6 rules unsupported error";
+    removeRule(Firewall::initRule(line));
+}
+
+/**
+ * Revokes a rule and publishes the change. Lookups that start after this returns won't see it.
+ * @param rule FirewallRule: the rule to remove
+ */
+void ConcurrentFirewall::removeRule(const FirewallRule& rule)
+{
+    std::lock_guard<std::mutex> lock(writeLock);
+    ruleTree.removeRule(rule);
+    loaded.clear();
+    publish();
+}
+
+/**
+ * Swaps in the rules of a changed rules file, applying only what changed, see Firewall::reload. Readers
+ * carry on with the old rules until the new ones are published, in one go. A file with IPv6 rules throws
+ * before anything changes.
+ * @param filename string: the rules file to load
+ * @return size_t: how many rules were added or removed, or every rule in the file when it was built from scratch
+ */
+size_t ConcurrentFirewall::reload(const std::string& filename)
+{
+    std::lock_guard<std::mutex> lock(writeLock);
+    size_t changed = Firewall::reloadTree(ruleTree, nullptr, loaded, filename);
+    if(changed != 0)
+        publish();
+    return changed;
+}
+
+/**
+ * Joins back to back ip intervals which allow the same ports, see RuleTree::compact, and publishes
+ * the smaller rule set if that changed anything
+ * @return size_t: how many intervals went away
+ */
+size_t ConcurrentFirewall::compact()
+{
+    std::lock_guard<std::mutex> lock(writeLock);
+    size_t removed = ruleTree.compact();
+    if(removed != 0)
+        publish();
+    return removed;
+}
+
+/**
+ * Adds a bunch of rules and publishes them all at once, so readers go straight from seeing none of them
+ * to seeing all of them.
+ * @param rules vector<FirewallRule>: the rules to add. They are sorted in place.
+ */
+void ConcurrentFirewall::insertRules(std::vector<FirewallRule>& rules)
+{
+    std::lock_guard<std::mutex> lock(writeLock);
+    ruleTree.insertRules(rules);
+    loaded.clear();
+    publish();
+}
+
+/**
+ * @return uint64_t: the version of the rules lookups are currently seeing, starting at 1
+ */
+uint64_t ConcurrentFirewall::version() const
+{
+    RcuReadGuard guard;
+    return snapshot.get()->version;
+}
+
+/**
+ * Compiles the rule tree and swaps it in for the readers. Called with writeLock held (or from a
+ * constructor). Waits for readers of the old snapshot before returning.
+ */
+void ConcurrentFirewall::publish()
+{
+    snapshot.publish(new Snapshot(ruleTree, ipIndex, ++published));
+}
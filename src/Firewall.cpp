@@ -1,49 +1,267 @@
 #include "Firewall.h"
+#include "Parser.h"
+#include "SpscRing.h"
+
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <exception>
+#include <cstring>
+#include <algorithm>
+#include <iterator>
+
+//rules per batch handed from the reader to the inserter when pipelined, 16 KiB of them
+#define LOAD_BATCH_RULES 1024
+
+//batches in flight between them. The reader can get this far ahead before it has to wait
+#define LOAD_PIPELINE_BATCHES 16
+
+//how far reload looks ahead for where the old and new rules line up again after a change
+#define RELOAD_RESYNC_LINES 64
+
+//reload builds the tree from scratch once more than one in this many rules changed
+#define RELOAD_REBUILD_FRACTION 4
 
 /**
  * The constructor takes in a file name and produces the Rule Interval Tree upon initialization
  */
-Firewall::Firewall(std::string filename) : reader(filename)
+Firewall::Firewall(std::string filename): Firewall(filename, LoadOptions()) {}
+
+/**
+ * Same as above, but lets the caller choose how the file is loaded. See LoadOptions.
+ */
+Firewall::Firewall(std::string filename, const LoadOptions& options)
+{
+    ipIndex = options.ipIndex;
+    if(options.reloadable)
+        reload(filename);
+    else
+    {
+        CSVReader reader(filename);
+        unsigned threads = options.threads == 0 ? std::thread::hardware_concurrency() : options.threads;
+        if(threads > 1)
+            initializeRuleTreeParallel(reader, threads, options.bulk);
+        else if(options.pipelined)
+            initializeRuleTreePipelined(reader, ruleTree, ruleTree6);
+        else
+            initializeRuleTree(reader, ruleTree, ruleTree6, options.bulk);
+    }
+    if(options.compact)
+    {
+        ruleTree.compact();
+        ruleTree6.compact();
+    }
+}
+
+/**
+ * Whether a line of the rules file is an IPv6 rule. Lines with the wrong number of fields are left for
+ * initRule to throw on
+ */
+static bool isIPv6Row(const CSVRow& row)
+{
+    return row.count == 4 && isIPv6Field(row.fields[IP].data, row.fields[IP].size);
+}
+
+/**
+ * Points a row at the fields of a line given as strings
+ */
+static CSVRow toRow(const vector<string>& line)
 {
-    initializeRuleTree();
+    CSVRow row;
+    row.count = std::min<size_t>(line.size(), CSV_MAX_FIELDS);
+    for(size_t i = 0; i < row.count; i++)
+        row.fields[i] = {line[i].data(), line[i].size()};
+    return row;
 }
 
 /**
  * Takes in a packet definition and finds whether the packet is allowed through the firewall or not.
- * This function has consistant O(logn) time complexity, where n is the number of rules.
+ * This is a thin adapter which parses the strings and hands off to the typed version below.
  * @param direction string: the direction the packet is flowing, either "outbound" or "inbound"
  * @param protocal string: the protocal of the packet, either "tcp" or "udp"
  * @param port int: a a6 bit integer representing the port number, between 1 and 64435
  * @param ip_address string: the ip address of the packet
  * @return bool: whether the packet is allowed through the firewall 
  */
-bool Firewall::accept_packet(std::string& direction, std::string& protocal, uint16_t port, std::string& ip_address)
+bool Firewall::accept_packet(const std::string& direction, const std::string& protocal, uint16_t port, const std::string& ip_address)
+{
+    if(isIPv6Field(ip_address.data(), ip_address.size()))
+        return accept_packet6(parseDirection(direction), parseProtocol(protocal), port, parseIPV6string(ip_address));
+    return accept_packet(parseDirection(direction), parseProtocol(protocal), port, parseIPV4string(ip_address));
+}
+
+/**
+ * Takes in an already parsed packet and finds whether the packet is allowed through the firewall or not.
+ * This function has consistant O(logn) time complexity, where n is the number of rules, and never
+ * allocates, so it is the one to call from a packet processing loop. With setVerdictCache on, repeat
+ * packets are answered from this thread's VerdictCache instead.
+ * @param direction Direction: the direction the packet is flowing
+ * @param protocal Protocol: the protocal of the packet
+ * @param port uint16_t: the port number of the packet
+ * @param ip uint32_t: the ip address of the packet in host byte order
+ * @return bool: whether the packet is allowed through the firewall 
+ */
+bool Firewall::accept_packet(Direction direction, Protocol protocal, uint16_t port, uint32_t ip) const
+{
+#ifdef FIREWALL_STATS
+    static thread_local uint32_t lookupTick = 0;
+    if(latencySampling != 0 && (++lookupTick & (latencySampling - 1)) == 0)
+    {
+        auto begin = std::chrono::steady_clock::now();
+        bool verdict = lookup(direction, protocal, port, ip);
+        auto nanoseconds = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - begin).count();
+        latency[std::min(log2Bucket(nanoseconds), LATENCY_BUCKETS - 1)].add(1);
+        (verdict ? accepted : denied).add(1);
+        return verdict;
+    }
+#endif
+    bool verdict = lookup(direction, protocal, port, ip);
+    STAT_ADD(verdict ? accepted : denied, 1);
+    return verdict;
+}
+
+/**
+ * The IPv6 version of accept_packet. IPv6 rules are never compiled or cached, so this always searches the
+ * IPv6 rule tree, in O(logn) of the IPv6 rules alone.
+ * @param direction Direction: the direction the packet is flowing
+ * @param protocal Protocol: the protocal of the packet
+ * @param port uint16_t: the port number of the packet
+ * @param ip Ipv6Address: the ip address of the packet, see Address.h
+ * @return bool: whether the packet is allowed through the firewall
+ */
+bool Firewall::accept_packet6(Direction direction, Protocol protocal, uint16_t port, Ipv6Address ip) const
+{
+    bool verdict = ruleTree6.contains(direction, protocal, port, ip);
+    STAT_ADD(verdict ? accepted : denied, 1);
+    return verdict;
+}
+
+/**
+ * Answers from the VerdictCache when it is on, otherwise searches
+ */
+bool Firewall::lookup(Direction direction, Protocol protocal, uint16_t port, uint32_t ip) const
+{
+    if(cacheVerdicts)
+        return VerdictCache::lookup(cacheEpoch, direction, protocal, port, ip, [&]() { return search(direction, protocal, port, ip); });
+    return search(direction, protocal, port, ip);
+}
+
+/**
+ * The actual lookup behind accept_packet, against the compiled rules if we are frozen
+ */
+bool Firewall::search(Direction direction, Protocol protocal, uint16_t port, uint32_t ip) const
+{
+    if(frozen)
+        return compiled.contains(direction, protocal, port, ip);
+    return ruleTree.contains(direction, protocal, port, ip);
+}
+
+/**
+ * Checks a whole batch of packets. Once the firewall is frozen this sorts the batch by root and searches
+ * them together, which is several times faster per packet than calling accept_packet in a loop. Before
+ * that it just falls back to checking them one at a time against the rule tree.
+ * @param batch PacketBatch: the packets to check, as parallel arrays
+ * @param verdicts uint8_t*: filled with 1 for every accepted packet and 0 for every dropped one
+ */
+void Firewall::accept_packets(const PacketBatch& batch, uint8_t* verdicts) const
+{
+    if(frozen)
+        compiled.containsBatch(batch, verdicts);
+    else
+    {
+        for(size_t i = 0; i < batch.size; i++)
+            verdicts[i] = ruleTree.contains(batch.direction[i], batch.protocal[i], batch.port[i], batch.ip[i]);
+    }
+
+#ifdef FIREWALL_STATS
+    size_t accepts = 0;
+    for(size_t i = 0; i < batch.size; i++)
+        accepts += verdicts[i];
+    accepted.add(accepts);
+    denied.add(batch.size - accepts);
+#endif
+}
+
+/**
+ * Times one in every so many accept_packet calls (per thread) into the latency histogram of stats.
+ * Only does anything with FIREWALL_STATS.
+ * @param every uint32_t: how often to sample, rounded up to a power of two. 0 turns sampling off
+ */
+void Firewall::setLatencySampling(uint32_t every)
 {
-    FirewallRule rule = initRule(direction, protocal, port, ip_address);
-    return ruleTree.contains(rule);
+    uint32_t rounded = every == 0 ? 0 : 1;
+    while(rounded != 0 && rounded < every && rounded < (1u << 31))
+        rounded <<= 1;
+    latencySampling = rounded;
 }
 
-bool Firewall::accept_packet(std::string direction, std::string protocal, uint16_t port, std::string ip_address)
+/**
+ * Reports the shape of the rules (see RuleTree::stats) along with the lookup counters. The counters are
+ * only counted with FIREWALL_STATS, and are zero otherwise.
+ * @return FirewallStats: the stats
+ */
+FirewallStats Firewall::stats() const
 {
-    FirewallRule rule = initRule(direction, protocal, port, ip_address);
-    return ruleTree.contains(rule);
+    FirewallStats stats;
+    stats.rules = ruleTree.stats();
+    stats.rules6 = ruleTree6.stats();
+    stats.frozen = frozen;
+    stats.compiledBytes = frozen ? compiled.memoryBytes() : 0;
+    stats.accepted = accepted.load();
+    stats.denied = denied.load();
+    stats.latencySamples = 0;
+    for(int bucket = 0; bucket < LATENCY_BUCKETS; bucket++)
+    {
+        stats.latency[bucket] = latency[bucket].load();
+        stats.latencySamples += stats.latency[bucket];
+    }
+    return stats;
 }
+
+std::ostream& operator<<(std::ostream& os, const FirewallStats& stats)
+{
+    os << stats.rules;
+    if(stats.rules6.portIntervals != 0)
+        os << "\nipv6 rules:\n" << stats.rules6;
+    if(stats.frozen)
+        os << "\ncompiled: " << stats.compiledBytes << " bytes";
+    os << "\nlookups: " << stats.accepted + stats.denied << " (" << stats.accepted << " accepted, " << stats.denied << " denied)";
+    if(stats.latencySamples != 0)
+    {
+        os << "\nlatency (" << stats.latencySamples << " samples):";
+        for(int bucket = 0; bucket < LATENCY_BUCKETS; bucket++)
+        {
+            if(stats.latency[bucket] != 0)
+                os << " <" << (uint64_t(2) << bucket) << "ns=" << stats.latency[bucket];
+        }
+    }
+    return os;
+}
+
 /** 
  * parses an ipv4 ip string (128.0.0.1) and produces the 32 bit integer associated with the ip_address.
- * taken from https://stackoverflow.com/questions/5328070/how-to-convert-string-to-ip-address-and-vice-versa
- * @param ipAddress char*: a c-string representing the ipAddress
- * @return uint32_t: the integer the IP address represents
+ * @param ipAddress string: the dotted quad ip address
+ * @return uint32_t: the integer the IP address represents, in host byte order
+ */
+uint32_t Firewall::parseIPV4string(const string& ipAddress)
+{
+    uint32_t ip;
+    if(!parseIPv4(ipAddress.data(), ipAddress.size(), ip))
+        throw "Malformed ip address error";
+    return ip;
+}
+
+/**
+ * parses an ipv6 ip string (2001:db8::1), see parseIPv6
+ * @param ipAddress string: the ip address
+ * @return Ipv6Address: the 128 bit integer the IP address represents
  */
-uint32_t Firewall::parseIPV4string(string& ipAddress)
+Ipv6Address Firewall::parseIPV6string(const string& ipAddress)
 {
-    const char* ipStr = ipAddress.c_str();
-    struct sockaddr_in sa;
-    char str[INET_ADDRSTRLEN];
-    // store this IP address in sa:
-    inet_pton(AF_INET, ipStr, &(sa.sin_addr));
-    
-    //address is unpacked in network byte order, so we need to flip it to host byte order to get an accurate representation
-    return ntohl(sa.sin_addr.s_addr);
+    Ipv6Address ip;
+    if(!parseIPv6(ipAddress.data(), ipAddress.size(), ip))
+        throw "Malformed ip address error";
+    return ip;
 }
 
 /**
@@ -52,116 +270,647 @@ uint32_t Firewall::parseIPV4string(string& ipAddress)
  * memory. I chose this approach since the file could be arbitrarily large, and so the 
  * ruleTree will grow with the size of the file. It may be dangerous to our memory capacity
  * to have both the file and the datastructure held in main memory at the same time. 
+ * The reader maps the file and hands back fields pointing into it, so the rules are parsed
+ * straight out of the page cache without copying any strings.
+ *
+ * That is what happens with bulk off. With it on (the default) the parsed rules, at 16 bytes each,
+ * are kept until the end of the file and then handed to RuleTree::insertRules, which sorts them and
+ * builds the tree in one pass. That costs us the rules in memory for a moment, but not the file, and
+ * avoids rebuilding intervals over and over when the rules overlap.
+ *
+ * IPv6 rules go to a tree of their own, the same way.
+ * @param reader CSVReader: the reader over the rules file
+ * @param tree RuleTree: the tree to load the IPv4 rules into
+ * @param tree6 RuleTree6: and the IPv6 ones
+ * @param bulk bool: whether to collect the rules and build the trees in one go
+ */
+void Firewall::initializeRuleTree(CSVReader& reader, RuleTree& tree, RuleTree6& tree6, bool bulk)
+{
+    CSVRow row;
+    if(!bulk)
+    {
+        while(reader.next(row))
+        {
+            if(isIPv6Row(row))
+                tree6.insertRule(initRule6(row));
+            else
+                tree.insertRule(initRule(row));
+        }
+        tree.internPortSets();
+        tree6.internPortSets();
+        return;
+    }
+
+    vector<FirewallRule> rules;
+    vector<FirewallRule6> rules6;
+    while(reader.next(row))
+    {
+        if(isIPv6Row(row))
+            rules6.push_back(initRule6(row));
+        else
+            rules.push_back(initRule(row));
+    }
+    tree.insertRules(rules);
+    if(!rules6.empty())
+        tree6.insertRules(rules6);
+}
+
+/**
+ * A batch of parsed rules on its way from the reader thread to the inserting one, see
+ * initializeRuleTreePipelined
+ */
+struct RuleBatch
+{
+    FirewallRule rules[LOAD_BATCH_RULES];
+    size_t size = 0;
+    bool last = false;                  //nothing comes after this one
+    std::exception_ptr error;           //set on the last batch when the reader hit a bad line
+};
+
+/**
+ * Builds the rule tree one rule at a time like initializeRuleTree with bulk off, but with reading and
+ * inserting overlapped instead of one after the other. A reader thread goes through the file, parses
+ * the rules straight into batches of LOAD_BATCH_RULES, and hands them over through an SpscRing. This
+ * thread takes them out and inserts them as they come, so while it is busy rebuilding intervals the
+ * reader is already faulting in and parsing the next pages of the file. The load takes as long as the
+ * slower of the two stages instead of both added together.
+ *
+ * A bad line stops the reader, and the error is thrown from here once the rules before it are in. If
+ * inserting throws instead, the reader is stopped and joined before the exception goes on.
+ * IPv6 rules aren't sent through the ring, the reader keeps them and they are built in one go at the end.
+ * @param reader CSVReader: the reader over the rules file
+ * @param tree RuleTree: the tree to load the IPv4 rules into
+ * @param tree6 RuleTree6: and the IPv6 ones
+ */
+void Firewall::initializeRuleTreePipelined(CSVReader& reader, RuleTree& tree, RuleTree6& tree6)
+{
+    SpscRing<RuleBatch> ring(LOAD_PIPELINE_BATCHES);
+    vector<FirewallRule6> rules6;
+    std::atomic<bool> stopping(false);
+    std::thread producer([&reader, &ring, &rules6, &stopping]() {
+        CSVRow row;
+        bool more = true;
+        while(more)
+        {
+            RuleBatch& batch = ring.claim();
+            batch.size = 0;
+            if(stopping.load(std::memory_order_relaxed))
+                more = false;
+            try
+            {
+                while(more && batch.size < LOAD_BATCH_RULES && (more = reader.next(row)))
+                {
+                    if(isIPv6Row(row))
+                        rules6.push_back(initRule6(row));
+                    else
+                        batch.rules[batch.size++] = initRule(row);
+                }
+            }
+            catch(...)
+            {
+                batch.error = std::current_exception();
+                more = false;
+            }
+            batch.last = !more;
+            ring.publish();
+        }
+    });
+
+    std::exception_ptr error;
+    bool last = false;
+    try
+    {
+        while(!last)
+        {
+            RuleBatch& batch = ring.front();
+            for(size_t i = 0; i < batch.size; i++)
+                tree.insertRule(batch.rules[i]);
+            last = batch.last;
+            error = batch.error;
+            ring.pop();
+        }
+    }
+    catch(...)
+    {
+        //inserting failed (out of memory), so tell the reader to stop and keep taking its batches off the ring,
+        //so it isn't left waiting for room, until it sends its last one. Then it can be joined
+        stopping.store(true, std::memory_order_relaxed);
+        while(!last)
+        {
+            last = ring.front().last;
+            ring.pop();
+        }
+        producer.join();
+        throw;
+    }
+    producer.join();
+    tree.internPortSets();
+    if(!rules6.empty())
+        tree6.insertRules(rules6);
+    if(error)
+        std::rethrow_exception(error);
+}
+
+/**
+ * Builds the rule tree with several threads. The file is split at line boundaries into one chunk per
+ * thread, and every thread parses its chunk into a rule tree of its own. Those are then merged together
+ * in pairs, also in parallel, until only one is left. Merging is a union just like insertRule, so the
+ * result is the same as loading the file on one thread.
+ * @param reader CSVReader: the reader over the rules file
+ * @param threads unsigned: how many threads to use
+ * @param bulk bool: whether each thread builds its tree with insertRules, see initializeRuleTree
  */
-void Firewall::initializeRuleTree()
+void Firewall::initializeRuleTreeParallel(CSVReader& reader, unsigned threads, bool bulk)
 {
-    vector<string> line;
-    reader.getNext(line);
-    while(line.size() > 0)
+    vector<CSVReader> chunks = reader.split(threads);
+    vector<RuleTree> partials(chunks.size());
+    vector<RuleTree6> partials6(chunks.size());
+    vector<std::exception_ptr> errors(chunks.size());
+
+    vector<std::thread> workers;
+    for(size_t i = 0; i < chunks.size(); i++)
+    {
+        workers.emplace_back([this, &chunks, &partials, &partials6, &errors, i, bulk]() {
+            try
+            {
+                initializeRuleTree(chunks[i], partials[i], partials6[i], bulk);
+            }
+            catch(...)
+            {
+                errors[i] = std::current_exception();
+            }
+        });
+    }
+    for(std::thread& worker : workers)
+        worker.join();
+    for(std::exception_ptr& error : errors)
+    {
+        if(error)
+            std::rethrow_exception(error);
+    }
+
+    for(size_t step = 1; step < partials.size(); step *= 2)
     {
-        FirewallRule new_rule = initRule(line);
-        ruleTree.insertRule(new_rule);
-        reader.getNext(line);
+        workers.clear();
+        for(size_t i = 0; i + step < partials.size(); i += 2 * step)
+        {
+            workers.emplace_back([&partials, &partials6, i, step]() {
+                partials[i].merge(partials[i + step]);
+                partials6[i].merge(partials6[i + step]);
+            });
+        }
+        for(std::thread& worker : workers)
+            worker.join();
+    }
+    if(!partials.empty())
+    {
+        ruleTree.merge(partials[0]);
+        ruleTree6.merge(partials6[0]);
     }
 }
 
+/**
+ * Adds a single rule to the firewall. If the firewall was frozen, the compiled rules are now stale, so
+ * we drop them and go back to searching the rule tree until the next call to freeze.
+ * @param line vector<string>: the rule, with each field in a separate index as in the csv file
+ */
 void Firewall::insertRule(vector<string>& line)
 {
-    FirewallRule new_rule = initRule(line);
-    ruleTree.insertRule(new_rule);
+    if(line.size() > IP && isIPv6Field(line[IP].data(), line[IP].size()))
+        insertRule(initRule6(toRow(line)));
+    else
+        insertRule(initRule(line));
 }
 
 /**
- * Mini Factory for a FirewallRule struct based on a line from the csv file
- * @param line vector<string>: the line from the csv file, with each field in a separate index
- * @return FirewallRule: the rule to be placed in the tree.
+ * Adds an already parsed rule to the firewall.
+ * @param rule FirewallRule: the rule to add
  */
-FirewallRule Firewall::initRule(const vector<string>& line)
+void Firewall::insertRule(const FirewallRule& rule)
 {
-    FirewallRule rule;
-    rule.direction = line[DIRECTION];
-    rule.protocal = line[PROTOCAL];
-    getIpRange(line[IP], rule.ip_range.start, rule.ip_range.end);
-    getPortRange(line[PORT], rule.port_range.start, rule.port_range.end);
-    return rule;
+    thaw();
+    loaded.clear();
+    ruleTree.insertRule(rule);
 }
 
 /**
- * Mini Factory for a FirewallRule struct based on input from the accept_packet function
- * @param direction string: the direction the packet is flowing, either "outbound" or "inbound"
- * @param protocal string: the protocal of the packet, either "tcp" or "udp"
- * @param port int: a a6 bit integer representing the port number, between 1 and 64435
- * @param ip_address string: the ip address of the packet
- * @return FirewallRule: the rule to be searched for in the tree
+ * Adds an already parsed IPv6 rule. Only the IPv4 rules are compiled, so this doesn't unfreeze anything.
+ * @param rule FirewallRule6: the rule to add
  */
-FirewallRule Firewall::initRule(std::string& direction, std::string& protocal, uint16_t port, std::string& ip_address)
+void Firewall::insertRule(const FirewallRule6& rule)
 {
-    FirewallRule rule;
-    rule.direction = direction;
-    rule.protocal = protocal;
-    rule.port_range.start = rule.port_range.end = port;
-    rule.ip_range.start = rule.ip_range.end = parseIPV4string(ip_address);
-    return rule;
+    loaded.clear();
+    ruleTree6.insertRule(rule);
 }
 
 /**
- * Splits a string of ip addresses or ports into its range and places them into a vector
- * EX: 127.0.0.1-127.0.0.2 -> vector<string> vec {"127.0.0.1", "127.0.0.2"}
- * @param str string: the string to be split
- * @param c char: the character to split on
- * @return vector<string>: a vector with maximum size of 2
+ * Revokes a rule, in the same format as insertRule. The rule's ports stop being allowed anywhere in its
+ * ip range, see RuleTree::removeRule. Like insertRule, this unfreezes a frozen firewall.
+ * @param line vector<string>: the rule, with each field in a separate index as in the csv file
  */
-vector<string> Firewall::splitRange(const string& str, char c) const
+void Firewall::removeRule(vector<string>& line)
 {
-    vector<string> vec;
-    string::size_type split = str.find(c);
-    if(split == std::string::npos)
+    if(line.size() > IP && isIPv6Field(line[IP].data(), line[IP].size()))
+        removeRule(initRule6(toRow(line)));
+    else
+        removeRule(initRule(line));
+}
+
+/**
+ * Revokes an already parsed rule.
+ * @param rule FirewallRule: the rule to remove
+ */
+void Firewall::removeRule(const FirewallRule& rule)
+{
+    thaw();
+    loaded.clear();
+    ruleTree.removeRule(rule);
+}
+
+/**
+ * Revokes an already parsed IPv6 rule.
+ * @param rule FirewallRule6: the rule to remove
+ */
+void Firewall::removeRule(const FirewallRule6& rule)
+{
+    loaded.clear();
+    ruleTree6.removeRule(rule);
+}
+
+/**
+ * Gets ready for the rules to change: the rules we were loaded with go back into the tree if they came
+ * from a snapshot, and the compiled rules and cached verdicts are dropped since they are about to go stale.
+ */
+void Firewall::thaw()
+{
+    if(fromSnapshot)
     {
-        vec.push_back(str);
+        std::vector<FirewallRule> rules = compiled.toRules();
+        ruleTree.insertRules(rules);
+        fromSnapshot = false;
     }
-    else
+    cacheEpoch = VerdictCache::newEpoch();
+    if(frozen)
     {
-        vec.push_back(str.substr(0, split));
-        vec.push_back(str.substr(split+1));
-    }   
-    return vec;
+        compiled = CompiledRuleTree();
+        frozen = false;
+    }
 }
 
 /**
- * Gets the range of IP addresses represented as 32 bit integers
- * @param field string: the field read from the csv file
- * @param start uint32_t&: the struct field to place the number into
- * @param end uint32_t&: the struct field to place the number into
+ * Swaps in the rules of a changed rules file without building the firewall again from scratch. The file
+ * is lined up against the one the firewall was loaded from, and only the rules added or removed are
+ * applied to the tree, see RuleTree::updateRules. Every line still has to be read, but lines are compared
+ * by a hash of their text, so only the ones that changed get parsed, and the tree, and its memory, is
+ * only touched where the rules changed.
+ *
+ * The firewall ends up allowing exactly what loading the new file would. To diff, it has to keep the
+ * rules it loaded (see LoadedRules), which it only does once it is reloadable: loaded with
+ * LoadOptions::reloadable, or reloaded once already. Otherwise, or after insertRule or removeRule changed
+ * the rules by hand, or when most of the file changed, the tree is built again from the whole file. A
+ * frozen firewall is compiled again.
+ *
+ * A bad line throws before anything changes.
+ * @param filename string: the rules file to load
+ * @return size_t: how many rules were added or removed, or every rule in the file when it was built from scratch
  */
-void Firewall::getIpRange(const string& field, uint32_t& start, uint32_t& end)
+size_t Firewall::reload(const std::string& filename)
 {
-    vector<string> split = splitRange(field, '-');
-    if(split.size() == 1)
+    if(fromSnapshot)
     {
-        start = end = parseIPV4string(split[0]);
+        fromSnapshot = false;
+        loaded.clear();
     }
-    else 
+    size_t changed = reloadTree(ruleTree, &ruleTree6, loaded, filename);
+    if(changed != 0)
+    {
+        cacheEpoch = VerdictCache::newEpoch();
+        if(frozen)
+            compiled = ruleTree.compile(ipIndex);
+    }
+    return changed;
+}
+
+/**
+ * A fast 64 bit hash of the text of a line, eight bytes at a time
+ */
+static uint64_t hashLine(const CSVField& line)
+{
+    uint64_t hash = 0x9E3779B97F4A7C15ull ^ line.size;
+    for(size_t offset = 0; offset < line.size; offset += sizeof(uint64_t))
+    {
+        uint64_t word = 0;
+        std::memcpy(&word, line.data + offset, std::min(sizeof(word), line.size - offset));
+        hash = (hash ^ word) * 0xFF51AFD7ED558CCDull;
+        hash ^= hash >> 32;
+    }
+    return hash;
+}
+
+/**
+ * Folds the hash of one more line into a running hash, which depends on the order the lines came in
+ */
+static uint64_t combineHash(uint64_t hash, uint64_t line)
+{
+    hash = (hash ^ line) * 0x9E3779B97F4A7C15ull;
+    return hash ^ (hash >> 29);
+}
+
+/**
+ * Parses a whole line of the rules file
+ */
+FirewallRule Firewall::parseLine(const CSVField& line)
+{
+    CSVRow row;
+    CSVReader::splitLine(line.data, line.data + line.size, row);
+    return initRule(row);
+}
+
+/**
+ * Lines up the lines of the new file against the loaded ones, the way diff does, and fills in the rules
+ * of the new file. Wherever the hashes stop matching, we look up to RELOAD_RESYNC_LINES ahead in both for
+ * where they match again, and whatever was skipped over was removed or added. Matching lines take their
+ * rule from the loaded ones, and only the added ones are parsed. Files that were edited in place line up
+ * again straight away. Lines that moved further than that show up as removed and added again, which is
+ * more work for the tree but still comes out right.
+ * @param loaded LoadedRules: the rules of the old file
+ * @param hashes vector<uint64_t>: the hash of every line of the new file
+ * @param lines vector<CSVField>: every line of the new file
+ * @param rules vector<FirewallRule>: filled with the rules of the new file, in order
+ * @param changed vector<FirewallRule>: filled with every rule removed from the old file or added in the new one
+ */
+void Firewall::diffLines(const LoadedRules& loaded, const vector<uint64_t>& hashes, const vector<CSVField>& lines,
+                         vector<FirewallRule>& rules, vector<FirewallRule>& changed)
+{
+    const vector<uint64_t>& before = loaded.lineHashes;
+    size_t i = 0;
+    size_t j = 0;
+    auto add = [&](size_t count) {
+        for(size_t end = j + count; j < end; j++)
+        {
+            rules[j] = parseLine(lines[j]);
+            changed.push_back(rules[j]);
+        }
+    };
+    auto remove = [&](size_t count) {
+        changed.insert(changed.end(), loaded.rules.begin() + i, loaded.rules.begin() + i + count);
+        i += count;
+    };
+
+    while(i < before.size() && j < hashes.size())
     {
-        start = parseIPV4string(split[0]);
-        end = parseIPV4string(split[1]);
+        if(before[i] == hashes[j])
+        {
+            rules[j++] = loaded.rules[i++];
+            continue;
+        }
+
+        size_t skip = 1;
+        for(; skip <= RELOAD_RESYNC_LINES; skip++)
+        {
+            if(j + skip < hashes.size() && before[i] == hashes[j + skip])
+            {
+                add(skip);
+                break;
+            }
+            if(i + skip < before.size() && before[i + skip] == hashes[j])
+            {
+                remove(skip);
+                break;
+            }
+        }
+        if(skip > RELOAD_RESYNC_LINES)
+        {
+            remove(1);
+            add(1);
+        }
     }
+    remove(before.size() - i);
+    add(hashes.size() - j);
 }
+
 /**
- * Gets the range of ports represented as 32 bit integers
- * @param field string: the field read from the csv file
- * @param start uint32_t&: the struct field to place the number into
- * @param end uint32_t&: the struct field to place the number into
+ * The part of reload shared with ConcurrentFirewall. Reads the new file and diffs it against the loaded
+ * one, then updates the tree with the difference, or builds the tree from scratch if the loaded rules
+ * weren't kept or too much changed for updating to be worth it. Either way the new file is kept as the
+ * loaded one afterwards.
+ *
+ * The IPv6 lines are set aside and only hashed, all together. If that hash changed, every IPv6 rule is
+ * parsed and their tree built again, which counts as removing all the old ones and adding all the new.
+ * @param tree RuleTree: the tree built from loaded
+ * @param tree6 RuleTree6*: the IPv6 tree built from loaded, or null when there can't be any IPv6 rules
+ * @param loaded LoadedRules: what the trees were built from, replaced with the new file
+ * @param filename string: the new rules file
+ * @return size_t: how many rules were added or removed, or all of them when the tree was built from scratch
  */
-void Firewall::getPortRange(const string& field, uint16_t& start, uint16_t& end)
+size_t Firewall::reloadTree(RuleTree& tree, RuleTree6* tree6, LoadedRules& loaded, const std::string& filename)
 {
-    vector<string> split = splitRange(field, '-');
-    if(split.size() == 1)
+    CSVReader reader(filename);
+    CSVRow row;
+    vector<CSVField> lines;
+    vector<uint64_t> hashes;
+    vector<CSVRow> rows6;
+    uint64_t ipv6Hash = 0;
+    lines.reserve(loaded.rules.size() + loaded.rules.size() / 16);
+    hashes.reserve(loaded.rules.size() + loaded.rules.size() / 16);
+    while(reader.next(row))
+    {
+        const CSVField& last = row.fields[row.count - 1];
+        CSVField line = {row.fields[0].data, size_t(last.data + last.size - row.fields[0].data)};
+        if(isIPv6Row(row))
+        {
+            rows6.push_back(row);
+            ipv6Hash = combineHash(ipv6Hash, hashLine(line));
+            continue;
+        }
+        lines.push_back(line);
+        hashes.push_back(hashLine(line));
+    }
+
+    //parsed before either tree changes, so a bad line leaves both alone
+    vector<FirewallRule6> rules6;
+    bool rebuild6 = !loaded.kept || ipv6Hash != loaded.ipv6Hash;
+    if(!rows6.empty() && tree6 == nullptr)
+        throw "IPv6 rules unsupported error";
+    if(rebuild6)
     {
-        start = end = atoi(split[0].c_str());
+        rules6.reserve(rows6.size());
+        for(const CSVRow& ipv6Row : rows6)
+            rules6.push_back(initRule6(ipv6Row));
     }
+
+    vector<FirewallRule> rules(lines.size());
+    vector<FirewallRule> changed;
+    if(loaded.kept)
+        diffLines(loaded, hashes, lines, rules, changed);
     else
     {
-        start = atoi(split[0].c_str());
-        end = atoi(split[1].c_str());
+        for(size_t i = 0; i < lines.size(); i++)
+            rules[i] = parseLine(lines[i]);
+    }
+
+    size_t changes = loaded.kept ? changed.size() : rules.size();
+    if(loaded.kept && changes <= rules.size() / RELOAD_REBUILD_FRACTION)
+        tree.updateRules(rules, changed);
+    else if(!loaded.kept || changes != 0)
+    {
+        vector<FirewallRule> sorted = rules;
+        RuleTree built;
+        built.insertRules(sorted);
+        tree = std::move(built);
     }
-}
\ No newline at end of file
+    if(rebuild6 && tree6 != nullptr)
+    {
+        changes += (loaded.kept ? loaded.ipv6Rules : 0) + rules6.size();
+        RuleTree6 built;
+        built.insertRules(rules6);
+        *tree6 = std::move(built);
+    }
+    loaded.rules.swap(rules);
+    loaded.lineHashes.swap(hashes);
+    loaded.ipv6Hash = ipv6Hash;
+    loaded.ipv6Rules = rows6.size();
+    loaded.kept = true;
+    return changes;
+}
+
+/**
+ * Joins back to back ip intervals which allow the same ports, see RuleTree::compact. What is allowed
+ * stays the same, so a frozen firewall stays frozen and is just compiled again from the smaller tree.
+ * A firewall loaded from a snapshot has no tree to compact until a rule is inserted.
+ * @return size_t: how many intervals went away
+ */
+size_t Firewall::compact()
+{
+    size_t removed = ruleTree.compact();
+    if(frozen && !fromSnapshot && removed != 0)
+        compiled = ruleTree.compile(ipIndex);
+    return removed + ruleTree6.compact();
+}
+
+/**
+ * Compiles the rule tree into its flat read only form, and answers every accept_packet call from that
+ * until another rule is inserted. Worth doing once the rule set is loaded and is not going to change.
+ * The ip addresses are indexed however LoadOptions::ipIndex said to.
+ */
+void Firewall::freeze()
+{
+    compiled = ruleTree.compile(ipIndex);
+    frozen = true;
+}
+
+/**
+ * Saves the compiled rules as a binary snapshot, which load can map back in far faster than the csv file
+ * can be parsed. If the firewall isn't frozen the rules are compiled just for the save. Snapshots only
+ * hold IPv4 rules, so this throws if there are any IPv6 ones rather than quietly dropping them.
+ * @param filename string: where to write the snapshot
+ */
+void Firewall::save(const std::string& filename) const
+{
+    if(!ruleTree6.empty())
+        throw "Snapshot IPv6 unsupported error";
+    if(frozen)
+        compiled.save(filename);
+    else
+        ruleTree.compile().save(filename);
+}
+
+/**
+ * Builds a frozen firewall from a snapshot written by save. The snapshot is mapped into memory and
+ * searched where it is, so this takes about as long as checking the checksum. Inserting a rule afterwards
+ * still works, it just has to rebuild the rule tree from the snapshot first.
+ * @param filename string: the snapshot to load
+ * @return Firewall: the frozen firewall
+ */
+Firewall Firewall::load(const std::string& filename)
+{
+    Firewall firewall;
+    firewall.compiled = CompiledRuleTree::load(filename);
+    firewall.frozen = true;
+    firewall.fromSnapshot = true;
+    return firewall;
+}
+
+/**
+ * Mini Factory for a FirewallRule struct based on a line from the csv file
+ * @param line vector<string>: the line from the csv file, with each field in a separate index
+ * @return FirewallRule: the rule to be placed in the tree.
+ */
+FirewallRule Firewall::initRule(const vector<string>& line)
+{
+    return initRule(toRow(line));
+}
+
+/**
+ * Mini Factory for a FirewallRule struct based on a tokenized line from the csv file
+ * @param row CSVRow: the fields of the line, pointing into the file
+ * @return FirewallRule: the rule to be placed in the tree.
+ */
+FirewallRule Firewall::initRule(const CSVRow& row)
+{
+    return parseRule<FirewallRule>(row);
+}
+
+/**
+ * Same as above for a line with an IPv6 ip field
+ * @param row CSVRow: the fields of the line, pointing into the file
+ * @return FirewallRule6: the rule to be placed in the IPv6 tree.
+ */
+FirewallRule6 Firewall::initRule6(const CSVRow& row)
+{
+    return parseRule<FirewallRule6>(row);
+}
+
+/**
+ * What initRule and initRule6 share, the ip field is parsed by whichever getIpRange fits the rule
+ */
+template <typename Rule>
+Rule Firewall::parseRule(const CSVRow& row)
+{
+    if(row.count != 4)
+        throw "Malformed rule error";
+
+    Rule rule;
+    const CSVField& direction = row.fields[DIRECTION];
+    const CSVField& protocal = row.fields[PROTOCAL];
+    if(!parseDirection(direction.data, direction.size, rule.direction))
+        throw "Unknown direction error";
+    if(!parseProtocol(protocal.data, protocal.size, rule.protocal))
+        throw "Unknown protocal error";
+    getIpRange(row.fields[IP], rule.ip_range);
+    getPortRange(row.fields[PORT], rule.port_range);
+    return rule;
+}
+
+/**
+ * Gets the range of IP addresses represented as 32 bit integers
+ * @param field CSVField: the field read from the csv file, a single address or "start-end"
+ * @param range Range<uint32_t>&: the struct field to place the range into
+ */
+void Firewall::getIpRange(const CSVField& field, Range<uint32_t>& range)
+{
+    if(!parseIpRange(field.data, field.size, range))
+        throw "Malformed ip range error";
+}
+
+/**
+ * Gets the range of IPv6 addresses represented as 128 bit integers
+ * @param field CSVField: the field read from the csv file, a single address or "start-end"
+ * @param range Range<Ipv6Address>&: the struct field to place the range into
+ */
+void Firewall::getIpRange(const CSVField& field, Range<Ipv6Address>& range)
+{
+    if(!parseIpRange(field.data, field.size, range))
+        throw "Malformed ip range error";
+}
+
+/**
+ * Gets the range of ports represented as 16 bit integers
+ * @param field CSVField: the field read from the csv file, a single port or "start-end"
+ * @param range Range<uint16_t>&: the struct field to place the range into
+ */
+void Firewall::getPortRange(const CSVField& field, Range<uint16_t>& range)
+{
+    if(!parsePortRange(field.data, field.size, range))
+        throw "Malformed port range error";
+}
@@ -0,0 +1,97 @@
+#include "MappedFile.h"
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+/**
+ * Maps the whole file into memory. The file descriptor isn't needed once the mapping exists, so it is
+ * closed straight away.
+ * @param filename string: the file to map
+ */
+MappedFile::MappedFile(const std::string& filename): begin(nullptr), length(0)
+{
+    int fd = open(filename.c_str(), O_RDONLY);
+    if(fd < 0)
+        throw "File does not exist error";
+
+    struct stat info;
+    if(fstat(fd, &info) != 0)
+    {
+        close(fd);
+        throw "File Read Error";
+    }
+
+    //mmap refuses zero length mappings, an empty file just stays unmapped
+    if(info.st_size > 0)
+    {
+        void* mapping = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if(mapping == MAP_FAILED)
+        {
+            close(fd);
+            throw "File Read Error";
+        }
+        begin = static_cast<const char*>(mapping);
+        length = info.st_size;
+    }
+    close(fd);
+}
+
+MappedFile::MappedFile(MappedFile&& other): begin(other.begin), length(other.length)
+{
+    other.begin = nullptr;
+    other.length = 0;
+}
+
+MappedFile& MappedFile::operator=(MappedFile&& other)
+{
+    if(this != &other)
+    {
+        unmap();
+        begin = other.begin;
+        length = other.length;
+        other.begin = nullptr;
+        other.length = 0;
+    }
+    return *this;
+}
+
+MappedFile::~MappedFile()
+{
+    unmap();
+}
+
+void MappedFile::unmap()
+{
+    if(begin != nullptr)
+        munmap(const_cast<char*>(begin), length);
+    begin = nullptr;
+    length = 0;
+}
+
+/**
+ * Tells the kernel we are going to walk the file front to back, so it reads ahead aggressively and
+ * doesn't bother keeping pages we are done with.
+ */
+void MappedFile::adviseSequential() const
+{
+    if(begin != nullptr)
+        madvise(const_cast<char*>(begin), length, MADV_SEQUENTIAL);
+}
+
+/**
+ * Drops the pages in [from, to) from our resident memory. Only whole pages inside the range are released.
+ * The mapping is private and read only, so the pages are still valid to read afterwards, they would just
+ * be read in from the file again.
+ * @param from size_t: offset of the start of the range
+ * @param to size_t: offset of the end of the range
+ */
+void MappedFile::release(size_t from, size_t to) const
+{
+    size_t page = sysconf(_SC_PAGESIZE);
+    from = (from + page - 1) / page * page;
+    to = to / page * page;
+    if(begin != nullptr && from < to && to <= length)
+        madvise(const_cast<char*>(begin + from), to - from, MADV_DONTNEED);
+}
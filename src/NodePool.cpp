@@ -0,0 +1,27 @@
+#include "NodePool.h"
+
+NodePool::NodePool(bool heap): heap(heap), cursor(nullptr), limit(nullptr), freeLists()
+{
+}
+
+/**
+ * Gives back every chunk in one go. Whatever was still allocated from them is gone, so the containers
+ * using the pool have to be destroyed first, which the shared_ptr in PoolAllocator takes care of.
+ */
+NodePool::~NodePool()
+{
+    for(void* chunk : chunks)
+        ::operator delete(chunk);
+}
+
+/**
+ * Starts a new chunk. Whatever was left at the end of the old one is too small for the node being
+ * allocated, and is just left unused.
+ */
+void NodePool::refill()
+{
+    char* chunk = static_cast<char*>(::operator new(NODEPOOL_CHUNK_BYTES));
+    chunks.push_back(chunk);
+    cursor = chunk;
+    limit = chunk + NODEPOOL_CHUNK_BYTES;
+}
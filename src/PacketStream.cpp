@@ -0,0 +1,322 @@
+#include "PacketStream.h"
+#include "Parser.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <cerrno>
+#include <memory>
+#include <unistd.h>
+
+static_assert(sizeof(PacketRecord) == 8, "binary packet records are 8 bytes");
+
+/**
+ * Reads the input in big blocks. Whatever hasn't been used yet is moved to the front before reading
+ * more, so a line split between two reads comes out whole.
+ */
+class StreamReader
+{
+public:
+    StreamReader(int fd, size_t capacity): fd(fd), buffer(capacity), begin(0), end(0), finished(false) {}
+
+    const char* data() const { return buffer.data() + begin; }
+    size_t available() const { return end - begin; }
+    bool full() const { return begin == 0 && end == buffer.size(); }
+    bool atEnd() const { return finished; }
+    void consume(size_t bytes) { begin += bytes; }
+
+    //throws away everything read so far, for getting past a line too long to ever fit
+    void discard() { begin = end = 0; }
+
+    /**
+     * Reads more input after whatever is left. Sets atEnd once there is nothing more to read
+     */
+    void refill()
+    {
+        if(begin > 0)
+        {
+            std::memmove(buffer.data(), buffer.data() + begin, end - begin);
+            end -= begin;
+            begin = 0;
+        }
+        ssize_t bytes;
+        do
+            bytes = read(fd, buffer.data() + end, buffer.size() - end);
+        while(bytes < 0 && errno == EINTR);
+        if(bytes < 0)
+            throw "File Read Error";
+        finished = bytes == 0;
+        end += bytes;
+    }
+
+private:
+    int fd;
+    std::vector<char> buffer;
+    size_t begin;
+    size_t end;
+    bool finished;
+};
+
+/**
+ * Collects output and writes it in one go once the buffer fills up, instead of a write per verdict
+ */
+class StreamWriter
+{
+public:
+    StreamWriter(int fd, size_t capacity): fd(fd), buffer(capacity), used(0) {}
+
+    void put(char c)
+    {
+        if(used == buffer.size())
+            flush();
+        buffer[used++] = c;
+    }
+
+    void flush()
+    {
+        size_t written = 0;
+        while(written < used)
+        {
+            ssize_t bytes = write(fd, buffer.data() + written, used - written);
+            if(bytes < 0 && errno == EINTR)
+                continue;
+            if(bytes < 0)
+                throw "File Write Error";
+            written += bytes;
+        }
+        used = 0;
+    }
+
+private:
+    int fd;
+    std::vector<char> buffer;
+    size_t used;
+};
+
+/**
+ * The packets of one batch as the parallel arrays accept_packets wants. Malformed packets still take up
+ * a slot so the verdicts come out in the same order as the input, but are always dropped. So do IPv6
+ * packets, which accept_packets can't search, with their address in ip6 to be looked up one at a time.
+ */
+struct StreamBatch
+{
+    Direction direction[STREAM_BATCH];
+    Protocol protocal[STREAM_BATCH];
+    uint16_t port[STREAM_BATCH];
+    uint32_t ip[STREAM_BATCH];
+    Ipv6Address ip6[STREAM_BATCH];
+    uint8_t ipv6[STREAM_BATCH];
+    uint8_t valid[STREAM_BATCH];
+    uint8_t verdicts[STREAM_BATCH];
+    size_t size;
+
+    void add(Direction packetDirection, Protocol packetProtocal, uint16_t packetPort, uint32_t packetIp, bool isValid)
+    {
+        direction[size] = packetDirection;
+        protocal[size] = packetProtocal;
+        port[size] = packetPort;
+        ip[size] = packetIp;
+        ipv6[size] = false;
+        valid[size] = isValid;
+        size++;
+    }
+
+    void add6(Direction packetDirection, Protocol packetProtocal, uint16_t packetPort, Ipv6Address packetIp, bool isValid)
+    {
+        add(packetDirection, packetProtocal, packetPort, 0, isValid);
+        ip6[size - 1] = packetIp;
+        ipv6[size - 1] = true;
+    }
+};
+
+/**
+ * Classifies a full (or the last) batch and writes out its verdicts, "1\n" or "0\n" per packet for csv
+ * and a single byte for binary. The IPv6 packets get accept_packet6 instead of the batch's answer
+ */
+static void classifyBatch(const Firewall& firewall, StreamBatch& batch, PacketFormat format, StreamWriter& writer, StreamStats& stats)
+{
+    PacketBatch packets = {batch.size, batch.direction, batch.protocal, batch.port, batch.ip};
+    firewall.accept_packets(packets, batch.verdicts);
+    for(size_t i = 0; i < batch.size; i++)
+    {
+        if(batch.ipv6[i] && batch.valid[i])
+            batch.verdicts[i] = firewall.accept_packet6(batch.direction[i], batch.protocal[i], batch.port[i], batch.ip6[i]);
+        bool accept = batch.valid[i] && batch.verdicts[i];
+        stats.accepted += accept;
+        stats.malformed += !batch.valid[i];
+        if(format == PacketFormat::Csv)
+        {
+            writer.put(accept ? '1' : '0');
+            writer.put('\n');
+        }
+        else
+            writer.put(accept);
+    }
+    stats.packets += batch.size;
+    batch.size = 0;
+}
+
+/**
+ * Parses a "direction,protocol,port,ip" line, the same fields accept_packet takes, where the ip can be
+ * IPv4 or IPv6. Anything else is added as a malformed packet.
+ */
+static void parseLine(const char* line, size_t length, StreamBatch& batch)
+{
+    const char* fields[4];
+    size_t lengths[4];
+    const char* end = line + length;
+    size_t count = 0;
+    for(const char* field = line; count < 4; count++)
+    {
+        const char* comma = count < 3 ? static_cast<const char*>(std::memchr(field, ',', end - field)) : end;
+        if(comma == nullptr)
+            break;
+        fields[count] = field;
+        lengths[count] = comma - field;
+        field = comma + 1;
+    }
+
+    Direction direction = Direction::Inbound;
+    Protocol protocal = Protocol::Tcp;
+    uint16_t port = 0;
+    uint32_t ip = 0;
+    bool valid = count == 4 &&
+                 parseDirection(fields[0], lengths[0], direction) &&
+                 parseProtocol(fields[1], lengths[1], protocal) &&
+                 parsePort(fields[2], lengths[2], port);
+    if(valid && isIPv6Field(fields[3], lengths[3]))
+    {
+        Ipv6Address ip6 = 0;
+        valid = parseIPv6(fields[3], lengths[3], ip6);
+        batch.add6(direction, protocal, port, ip6, valid);
+        return;
+    }
+    valid = valid && parseIPv4(fields[3], lengths[3], ip);
+    batch.add(direction, protocal, port, ip, valid);
+}
+
+/**
+ * Pulls every complete csv line out of what has been read so far. Blank lines are skipped without a
+ * verdict, and \r\n line endings are handled. A line that doesn't fit in the buffer at all is skipped up
+ * to its newline and counts as one malformed packet.
+ * @return bool: false once the input is used up
+ */
+static bool nextCsvPackets(StreamReader& reader, StreamBatch& batch, bool& skipping)
+{
+    while(batch.size < STREAM_BATCH)
+    {
+        const char* line = reader.data();
+        const char* newline = static_cast<const char*>(std::memchr(line, '\n', reader.available()));
+        if(newline == nullptr)
+        {
+            if(reader.atEnd())
+            {
+                size_t length = reader.available();
+                if(length > 0 && !skipping)
+                {
+                    if(line[length - 1] == '\r')
+                        length--;
+                    if(length > 0)
+                        parseLine(line, length, batch);
+                }
+                reader.consume(reader.available());
+                return false;
+            }
+            if(reader.full())
+            {
+                if(!skipping)
+                    batch.add(Direction::Inbound, Protocol::Tcp, 0, 0, false);
+                skipping = true;
+                reader.discard();
+            }
+            reader.refill();
+            continue;
+        }
+
+        size_t length = newline - line;
+        reader.consume(length + 1);
+        if(skipping)
+        {
+            skipping = false;
+            continue;
+        }
+        if(length > 0 && line[length - 1] == '\r')
+            length--;
+        if(length > 0)
+            parseLine(line, length, batch);
+    }
+    return true;
+}
+
+/**
+ * Pulls every complete PacketRecord out of what has been read so far. A record with a direction or
+ * protocol that doesn't exist is malformed, and so are any bytes left over at the end that don't make a
+ * whole record.
+ * @return bool: false once the input is used up
+ */
+static bool nextBinaryPackets(StreamReader& reader, StreamBatch& batch)
+{
+    while(batch.size < STREAM_BATCH)
+    {
+        if(reader.available() < sizeof(PacketRecord))
+        {
+            if(reader.atEnd())
+            {
+                if(reader.available() > 0)
+                    batch.add(Direction::Inbound, Protocol::Tcp, 0, 0, false);
+                reader.consume(reader.available());
+                return false;
+            }
+            reader.refill();
+            continue;
+        }
+
+        PacketRecord record;
+        std::memcpy(&record, reader.data(), sizeof(record));
+        reader.consume(sizeof(record));
+        bool valid = record.direction <= 1 && record.protocal <= 1;
+        batch.add(valid ? Direction(record.direction) : Direction::Inbound, valid ? Protocol(record.protocal) : Protocol::Tcp,
+                  record.port, record.ip, valid);
+    }
+    return true;
+}
+
+/**
+ * Classifies every packet read from input and writes a verdict for each to output, in the same order.
+ * Packets are parsed straight out of big read buffers into batches of STREAM_BATCH, which go through
+ * accept_packets in one call (the AVX2 kernel when the firewall is frozen), and the verdicts are written
+ * out a buffer at a time. Nothing is allocated per packet.
+ *
+ * Csv input has one "direction,protocol,port,ip" packet per line, like "inbound,tcp,80,192.168.1.2" or
+ * "inbound,tcp,80,2001:db8::1", and gets a "1" (accept) or "0" (drop) line back. IPv6 packets are looked
+ * up one at a time with accept_packet6, so a stream of them is no faster than calling it in a loop. Binary input is a stream of PacketRecords, and gets one
+ * byte of 1 or 0 back per record. Malformed packets are dropped rather than stopping the stream, so the
+ * output always lines up with the input.
+ * @param firewall Firewall: the rules to classify against, frozen for the best throughput
+ * @param input int: file descriptor to read packets from until end of file
+ * @param output int: file descriptor to write the verdicts to
+ * @param format PacketFormat: csv lines or binary records
+ * @param bufferBytes size_t: size of the read and write buffers
+ * @return StreamStats: how many packets went through, and how long it took
+ */
+StreamStats classifyStream(const Firewall& firewall, int input, int output, PacketFormat format, size_t bufferBytes)
+{
+    auto begin = std::chrono::steady_clock::now();
+    StreamStats stats = {0, 0, 0, 0};
+    StreamReader reader(input, std::max(bufferBytes, sizeof(PacketRecord)));
+    StreamWriter writer(output, std::max<size_t>(bufferBytes, 1));
+    std::unique_ptr<StreamBatch> batch(new StreamBatch());
+    batch->size = 0;
+
+    bool more = true;
+    bool skipping = false;
+    while(more)
+    {
+        more = format == PacketFormat::Csv ? nextCsvPackets(reader, *batch, skipping) : nextBinaryPackets(reader, *batch);
+        if(batch->size > 0)
+            classifyBatch(firewall, *batch, format, writer, stats);
+    }
+    writer.flush();
+    stats.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+    return stats;
+}
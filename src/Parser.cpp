@@ -0,0 +1,351 @@
+#include "Parser.h"
+
+#include <cstring>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+//"0.0.0.0" to "255.255.255.255"
+#define MIN_IPV4_LENGTH 7
+#define MAX_IPV4_LENGTH 15
+
+//"::" to "ffff:ffff:ffff:ffff:ffff:ffff:255.255.255.255"
+#define MIN_IPV6_LENGTH 2
+#define MAX_IPV6_LENGTH 45
+
+//groups of 16 bits in an IPv6 address
+#define IPV6_GROUPS 8
+
+#ifdef __SSE2__
+/**
+ * Loads a field of at most 16 bytes into a register, zero padded. The field is always copied into a
+ * buffer on the stack first, since loading 16 bytes straight from text would read past the end of the
+ * field, and fields at the end of a mapped file or a string have nothing readable after them. The copy
+ * is a couple of moves for fields this short.
+ */
+static inline __m128i loadField(const char* text, size_t length)
+{
+    char buffer[16] = {0};
+    std::memcpy(buffer, text, length);
+    return _mm_loadu_si128(reinterpret_cast<const __m128i*>(buffer));
+}
+
+/**
+ * SSE2 version. The whole address fits in one 16 byte register, so every character is classified at once
+ * and the dots come out as a bitmask. From there the shape check is a popcount, and the dot positions tell
+ * us exactly where each octet is, so each octet is just its last three digits times 1, 10 and 100 with the
+ * ones that aren't part of it zeroed out, rather than a character by character state machine.
+ */
+bool parseIPv4(const char* text, size_t length, uint32_t& ip)
+{
+    if(length < MIN_IPV4_LENGTH || length > MAX_IPV4_LENGTH)
+        return false;
+
+    __m128i chars = loadField(text, length);
+    __m128i digits = _mm_sub_epi8(chars, _mm_set1_epi8('0'));
+    __m128i isDigit = _mm_cmpeq_epi8(_mm_min_epu8(digits, _mm_set1_epi8(9)), digits);
+    __m128i isDot = _mm_cmpeq_epi8(chars, _mm_set1_epi8('.'));
+
+    unsigned valid = (1u << length) - 1;
+    unsigned dots = _mm_movemask_epi8(isDot) & valid;
+    unsigned digitMask = _mm_movemask_epi8(isDigit) & valid;
+    if((dots | digitMask) != valid || __builtin_popcount(dots) != 3)
+        return false;
+
+    //a few zero bytes in front so the first octet can look back three places
+    uint8_t values[20] = {0};
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(values + 4), _mm_and_si128(digits, isDigit));
+    const uint8_t* digit = values + 4;
+
+    unsigned ends[4];
+    ends[0] = __builtin_ctz(dots);
+    dots &= dots - 1;
+    ends[1] = __builtin_ctz(dots);
+    dots &= dots - 1;
+    ends[2] = __builtin_ctz(dots);
+    ends[3] = length;
+
+    uint32_t value = 0;
+    unsigned begin = 0;
+    bool ok = true;
+    for(int octet = 0; octet < 4; octet++)
+    {
+        unsigned end = ends[octet];
+        unsigned size = end - begin;
+        unsigned part = digit[end - 1] + (size > 1) * 10 * digit[int(end) - 2] + (size > 2) * 100 * digit[int(end) - 3];
+        ok &= size - 1 < 3 && part <= 255 && !(size > 1 && digit[begin] == 0);
+        value = (value << 8) | (part & 0xFF);
+        begin = end + 1;
+    }
+    if(!ok)
+        return false;
+    ip = value;
+    return true;
+}
+#else
+/**
+ * Turns the 1 to 3 digits of an octet into its value. The digits have already been checked.
+ * @return int: the octet, or -1 if it is out of range or has a leading zero
+ */
+static inline int octetValue(const char* digits, size_t length)
+{
+    if(length == 0 || length > 3 || (length > 1 && digits[0] == '0'))
+        return -1;
+    int value = 0;
+    for(size_t i = 0; i < length; i++)
+        value = value * 10 + (digits[i] - '0');
+    return value <= 255 ? value : -1;
+}
+
+/**
+ * Plain version for when SSE2 is not available, walking the octets one character at a time.
+ */
+bool parseIPv4(const char* text, size_t length, uint32_t& ip)
+{
+    if(length < MIN_IPV4_LENGTH || length > MAX_IPV4_LENGTH)
+        return false;
+
+    size_t begin = 0;
+    uint32_t value = 0;
+    for(int octet = 0; octet < 4; octet++)
+    {
+        size_t end = begin;
+        while(end < length && text[end] >= '0' && text[end] <= '9')
+            end++;
+        if(octet < 3 ? (end >= length || text[end] != '.') : end != length)
+            return false;
+        int part = octetValue(text + begin, end - begin);
+        if(part < 0)
+            return false;
+        value = (value << 8) | part;
+        begin = end + 1;
+    }
+    ip = value;
+    return true;
+}
+#endif
+
+/**
+ * @return int: the value of a hex digit, or -1 if it isn't one
+ */
+static inline int hexDigit(char c)
+{
+    unsigned digit = static_cast<unsigned char>(c) - '0';
+    if(digit <= 9)
+        return digit;
+    unsigned letter = (static_cast<unsigned char>(c) | 0x20) - 'a';
+    return letter <= 5 ? int(letter) + 10 : -1;
+}
+
+/**
+ * One pass over the text, collecting the groups as it goes and remembering how many came before the "::".
+ * The zeros it stands for are only filled in at the end, once we know how many groups there were.
+ */
+bool parseIPv6(const char* text, size_t length, Ipv6Address& ip)
+{
+    if(length < MIN_IPV6_LENGTH || length > MAX_IPV6_LENGTH)
+        return false;
+
+    uint16_t groups[IPV6_GROUPS];
+    int count = 0;
+    int gap = -1;           //groups before the "::", if there is one
+    size_t i = 0;
+    if(text[0] == ':')
+    {
+        if(text[1] != ':')
+            return false;
+        gap = 0;
+        i = 2;
+    }
+    while(i < length)
+    {
+        if(count == IPV6_GROUPS)
+            return false;
+        size_t begin = i;
+        uint32_t value = 0;
+        int digit;
+        while(i < length && i - begin < 5 && (digit = hexDigit(text[i])) >= 0)
+        {
+            value = (value << 4) | digit;
+            i++;
+        }
+        if(i < length && text[i] == '.')
+        {
+            //a dotted quad, which has to be the end and fill the last two groups
+            uint32_t v4;
+            if(count > IPV6_GROUPS - 2 || !parseIPv4(text + begin, length - begin, v4))
+                return false;
+            groups[count++] = v4 >> 16;
+            groups[count++] = v4 & 0xFFFF;
+            break;
+        }
+        if(i == begin || i - begin > 4)
+            return false;
+        groups[count++] = value;
+        if(i == length)
+            break;
+        if(text[i] != ':' || ++i == length)
+            return false;
+        if(text[i] == ':')
+        {
+            if(gap >= 0)
+                return false;
+            gap = count;
+            i++;
+        }
+    }
+    if(gap < 0 ? count != IPV6_GROUPS : count > IPV6_GROUPS - 1)
+        return false;
+
+    int zeros = IPV6_GROUPS - count;
+    Ipv6Address value = 0;
+    for(int group = 0; group <= count; group++)
+    {
+        if(group == gap && zeros < IPV6_GROUPS)
+            value <<= 16 * zeros;
+        if(group < count)
+            value = (value << 16) | groups[group];
+    }
+    ip = value;
+    return true;
+}
+
+bool parseDirection(const char* text, size_t length, Direction& direction)
+{
+    if(length == 7 && std::memcmp(text, "inbound", 7) == 0)
+        direction = Direction::Inbound;
+    else if(length == 8 && std::memcmp(text, "outbound", 8) == 0)
+        direction = Direction::Outbound;
+    else
+        return false;
+    return true;
+}
+
+bool parseProtocol(const char* text, size_t length, Protocol& protocal)
+{
+    if(length == 3 && std::memcmp(text, "tcp", 3) == 0)
+        protocal = Protocol::Tcp;
+    else if(length == 3 && std::memcmp(text, "udp", 3) == 0)
+        protocal = Protocol::Udp;
+    else
+        return false;
+    return true;
+}
+
+bool parsePort(const char* text, size_t length, uint16_t& port)
+{
+    if(length == 0 || length > 5)
+        return false;
+    uint32_t value = 0;
+    for(size_t i = 0; i < length; i++)
+    {
+        unsigned digit = static_cast<unsigned char>(text[i]) - '0';
+        if(digit > 9)
+            return false;
+        value = value * 10 + digit;
+    }
+    if(value > UINT16_MAX)
+        return false;
+    port = value;
+    return true;
+}
+
+bool parseIpRange(const char* text, size_t length, Range<uint32_t>& range)
+{
+    const char* split = static_cast<const char*>(std::memchr(text, '-', length));
+    if(split == nullptr)
+    {
+        if(!parseIPv4(text, length, range.start))
+            return false;
+        range.end = range.start;
+        return true;
+    }
+
+    uint32_t start, end;
+    if(!parseIPv4(text, split - text, start) || !parseIPv4(split + 1, text + length - split - 1, end) || start > end)
+        return false;
+    range.start = start;
+    range.end = end;
+    return true;
+}
+
+bool parseCidr(const char* text, size_t length, Range<uint32_t>& range)
+{
+    const char* slash = static_cast<const char*>(std::memchr(text, '/', length));
+    if(slash == nullptr)
+        return false;
+    uint32_t address;
+    uint16_t prefix;
+    size_t prefixLength = text + length - slash - 1;
+    if(!parseIPv4(text, slash - text, address) || prefixLength > 2 || (prefixLength == 2 && slash[1] == '0'))
+        return false;
+    if(!parsePort(slash + 1, prefixLength, prefix) || prefix > 32)
+        return false;
+
+    uint32_t host = prefix == 0 ? 0xFFFFFFFF : (uint32_t(1) << (32 - prefix)) - 1;
+    if((address & host) != 0)
+        return false;
+    range.start = address;
+    range.end = address | host;
+    return true;
+}
+
+bool parseIpRange(const char* text, size_t length, Range<Ipv6Address>& range)
+{
+    const char* split = static_cast<const char*>(std::memchr(text, '-', length));
+    if(split == nullptr)
+    {
+        if(!parseIPv6(text, length, range.start))
+            return false;
+        range.end = range.start;
+        return true;
+    }
+
+    Ipv6Address start, end;
+    if(!parseIPv6(text, split - text, start) || !parseIPv6(split + 1, text + length - split - 1, end) || start > end)
+        return false;
+    range.start = start;
+    range.end = end;
+    return true;
+}
+
+bool parseCidr(const char* text, size_t length, Range<Ipv6Address>& range)
+{
+    const char* slash = static_cast<const char*>(std::memchr(text, '/', length));
+    if(slash == nullptr)
+        return false;
+    Ipv6Address address;
+    uint16_t prefix;
+    size_t prefixLength = text + length - slash - 1;
+    if(!parseIPv6(text, slash - text, address) || prefixLength > 3 || (prefixLength > 1 && slash[1] == '0'))
+        return false;
+    if(!parsePort(slash + 1, prefixLength, prefix) || prefix > 128)
+        return false;
+
+    Ipv6Address host = prefix == 0 ? ~Ipv6Address(0) : (Ipv6Address(1) << (128 - prefix)) - 1;
+    if((address & host) != 0)
+        return false;
+    range.start = address;
+    range.end = address | host;
+    return true;
+}
+
+bool parsePortRange(const char* text, size_t length, Range<uint16_t>& range)
+{
+    const char* split = static_cast<const char*>(std::memchr(text, '-', length));
+    if(split == nullptr)
+    {
+        if(!parsePort(text, length, range.start))
+            return false;
+        range.end = range.start;
+        return true;
+    }
+
+    uint16_t start, end;
+    if(!parsePort(text, split - text, start) || !parsePort(split + 1, text + length - split - 1, end) || start > end)
+        return false;
+    range.start = start;
+    range.end = end;
+    return true;
+}
@@ -0,0 +1,525 @@
+#include "PortSet.h"
+
+#include <cstring>
+#include <algorithm>
+#include <new>
+
+PortSet::PortSet(const PortSet& other): kind(Kind::Inline), count(0)
+{
+    *this = other;
+}
+
+PortSet::PortSet(PortSet&& other): kind(Kind::Inline), count(0)
+{
+    *this = std::move(other);
+}
+
+/**
+ * Copies are shallow, the heap forms are shared until one side changes
+ */
+PortSet& PortSet::operator=(const PortSet& other)
+{
+    if(this == &other)
+        return *this;
+    release();
+    std::memcpy(small, other.small, sizeof(small));     //copies whichever of the union is in use
+    kind = other.kind;
+    count = other.count;
+    if(kind != Kind::Inline)
+        header()->refs.fetch_add(1, std::memory_order_relaxed);
+    return *this;
+}
+
+PortSet& PortSet::operator=(PortSet&& other)
+{
+    if(this == &other)
+        return *this;
+    release();
+    std::memcpy(small, other.small, sizeof(small));     //copies whichever of the union is in use
+    kind = other.kind;
+    count = other.count;
+    other.kind = Kind::Inline;
+    other.count = 0;
+    return *this;
+}
+
+/**
+ * Lets go of whatever is on the heap, freeing it if this was the last set using it, and leaves the set empty
+ */
+void PortSet::release()
+{
+    if(kind != Kind::Inline)
+    {
+        Header* shared = header();
+        if(shared->refs.fetch_sub(1, std::memory_order_acq_rel) == 1)
+        {
+            shared->~Header();
+            ::operator delete(shared);
+        }
+    }
+    kind = Kind::Inline;
+    count = 0;
+}
+
+/**
+ * Allocates a list or bitmap with a Header in front of it, used by nobody else yet
+ * @return void*: the first item, just past the header
+ */
+void* PortSet::allocateBlock(uint32_t capacity, size_t itemBytes)
+{
+    void* memory = ::operator new(sizeof(Header) + capacity * itemBytes);
+    Header* shared = new(memory) Header;
+    shared->refs.store(1, std::memory_order_relaxed);
+    shared->capacity = capacity;
+    shared->hash.store(0, std::memory_order_relaxed);
+    return shared + 1;
+}
+
+/**
+ * The copy half of copy on write: gives this set its own copy of the heap array if anyone else is using it.
+ * Called before every change to the heap array, so it also forgets the hash.
+ */
+void PortSet::makeUnique()
+{
+    if(kind == Kind::Inline)
+        return;
+    if(header()->refs.load(std::memory_order_acquire) == 1)
+    {
+        header()->hash.store(0, std::memory_order_relaxed);
+        return;
+    }
+    Header* shared = header();
+    size_t itemBytes = kind == Kind::List ? sizeof(Span) : sizeof(uint64_t);
+    void* copy = allocateBlock(shared->capacity, itemBytes);
+    std::memcpy(copy, shared + 1, shared->capacity * itemBytes);
+    Kind form = kind;
+    uint16_t runs = count;
+    release();
+    if(form == Kind::List)
+        list = static_cast<Span*>(copy);
+    else
+        bitmap = static_cast<uint64_t*>(copy);
+    kind = form;
+    count = runs;
+}
+
+/**
+ * The size of the heap array for a list of count intervals. Always a power of two, so growing one at
+ * a time only reallocates log n times.
+ */
+uint32_t PortSet::listCapacity(uint32_t count)
+{
+    uint32_t capacity = 4;
+    while(capacity < count)
+        capacity <<= 1;
+    return capacity;
+}
+
+/**
+ * Unions a range of ports into the set. Any intervals it overlaps or touches are joined into one, and
+ * the set changes form if the number of intervals crosses one of the thresholds.
+ * @param range Interval<uint16_t>: the ports to add
+ */
+void PortSet::insert(const Interval<uint16_t>& range)
+{
+    uint32_t start = range.start;
+    uint32_t end = range.end;
+    if(kind == Kind::Bitmap)
+    {
+        //already all there, so don't copy a shared bitmap just to change nothing
+        if(nextBit(start, false) > end)
+            return;
+        makeUnique();
+        setBits(start, end, true);
+        if(count <= PORTSET_BITMAP_INTERVALS / 2)
+            toSpans();
+        return;
+    }
+
+    //the run of intervals which overlap or touch the new one: first is the first one that doesn't end
+    //more than one port before it, and last is one past the last that doesn't start more than one after
+    Span* items = spans();
+    uint32_t first = std::lower_bound(items, items + count, start, [](const Span& span, uint32_t port) {
+        return uint32_t(span.end) + 1 < port;
+    }) - items;
+    uint32_t last = first;
+    while(last < count && items[last].start <= end + 1)
+        last++;
+    if(last - first == 1 && items[first].start <= start && end <= items[first].end)
+        return;
+    if(first < last)
+    {
+        start = std::min<uint32_t>(start, items[first].start);
+        end = std::max<uint32_t>(end, items[last - 1].end);
+    }
+
+    if(count - (last - first) + 1 > PORTSET_BITMAP_INTERVALS)
+    {
+        toBitmap();
+        setBits(start, end, true);
+        return;
+    }
+    Span joined = {uint16_t(start), uint16_t(end)};
+    splice(first, last, &joined, 1);
+}
+
+/**
+ * Takes a range of ports out of the set. An interval which only partly overlaps it is trimmed, and one
+ * which sticks out on both sides is split in two.
+ * @param range Interval<uint16_t>: the ports to remove
+ */
+void PortSet::remove(const Interval<uint16_t>& range)
+{
+    uint32_t start = range.start;
+    uint32_t end = range.end;
+    if(kind == Kind::Bitmap)
+    {
+        if(nextBit(start, true) > end)
+            return;
+        makeUnique();
+        setBits(start, end, false);
+        if(count <= PORTSET_BITMAP_INTERVALS / 2)
+            toSpans();
+        return;
+    }
+
+    //the run of intervals which overlap the range, and whatever is left of the ones at either end
+    Span* items = spans();
+    uint32_t first = std::lower_bound(items, items + count, start, [](const Span& span, uint32_t port) {
+        return span.end < port;
+    }) - items;
+    uint32_t last = first;
+    while(last < count && items[last].start <= end)
+        last++;
+    if(first == last)
+        return;
+    Span pieces[2];
+    uint32_t kept = 0;
+    if(items[first].start < start)
+        pieces[kept++] = {items[first].start, uint16_t(start - 1)};
+    if(items[last - 1].end > end)
+        pieces[kept++] = {uint16_t(end + 1), items[last - 1].end};
+
+    if(count - (last - first) + kept > PORTSET_BITMAP_INTERVALS)
+    {
+        toBitmap();
+        setBits(start, end, false);
+        return;
+    }
+    splice(first, last, pieces, kept);
+}
+
+/**
+ * @return bool: whether any port of the range is in the set
+ */
+bool PortSet::intersects(const Interval<uint16_t>& range) const
+{
+    if(kind == Kind::Bitmap)
+        return nextBit(range.start, true) <= range.end;
+    const Span* items = spans();
+    const Span* first = std::lower_bound(items, items + count, range.start, [](const Span& span, uint16_t port) {
+        return span.end < port;
+    });
+    return first != items + count && first->start <= range.end;
+}
+
+/**
+ * Counts the ports of the set inside a range, only looking at the intervals that overlap it, or the
+ * bitmap words it covers
+ * @param range Interval<uint16_t>: the ports to count in
+ * @return uint32_t: how many of them are in the set, up to 65536
+ */
+uint32_t PortSet::countPorts(const Interval<uint16_t>& range) const
+{
+    uint32_t total = 0;
+    if(kind == Kind::Bitmap)
+    {
+        uint32_t first = range.start >> 6;
+        uint32_t last = range.end >> 6;
+        for(uint32_t word = first; word <= last; word++)
+        {
+            uint64_t bits = bitmap[word];
+            if(word == first)
+                bits &= ~0ull << (range.start & 63);
+            if(word == last)
+                bits &= ~0ull >> (63 - (range.end & 63));
+            total += __builtin_popcountll(bits);
+        }
+        return total;
+    }
+    const Span* items = spans();
+    const Span* span = std::lower_bound(items, items + count, range.start, [](const Span& item, uint16_t port) {
+        return item.end < port;
+    });
+    for(; span != items + count && span->start <= range.end; span++)
+        total += uint32_t(std::min(span->end, range.end)) - std::max(span->start, range.start) + 1;
+    return total;
+}
+
+/**
+ * Replaces the intervals [first, last) of a list or inline set with the given ones, moving between
+ * inline and the heap or resizing the list if the new count calls for it. The new count must not be
+ * over PORTSET_BITMAP_INTERVALS.
+ */
+void PortSet::splice(uint32_t first, uint32_t last, const Span* with, uint32_t withCount)
+{
+    uint32_t newCount = count - (last - first) + withCount;
+    bool fits = kind == Kind::Inline ? newCount <= PORTSET_INLINE : newCount > PORTSET_INLINE && listCapacity(newCount) == header()->capacity;
+    if(fits)
+    {
+        makeUnique();
+        Span* items = spans();
+        std::memmove(items + first + withCount, items + last, (count - last) * sizeof(Span));
+        std::copy(with, with + withCount, items + first);
+        count = newCount;
+        return;
+    }
+
+    //moving between inline and the heap, or the list has to grow or shrink
+    const Span* items = spans();
+    Span buffer[PORTSET_INLINE];
+    Span* target = newCount <= PORTSET_INLINE ? buffer : static_cast<Span*>(allocateBlock(listCapacity(newCount), sizeof(Span)));
+    std::copy(items, items + first, target);
+    std::copy(with, with + withCount, target + first);
+    std::copy(items + last, items + count, target + first + withCount);
+    release();
+    if(target == buffer)
+        std::copy(buffer, buffer + newCount, small);
+    else
+    {
+        list = target;
+        kind = Kind::List;
+    }
+    count = newCount;
+}
+
+/**
+ * Unions every port of another set into this one. Two bitmaps are just or'd together.
+ * @param other PortSet: the ports to add
+ */
+void PortSet::insert(const PortSet& other)
+{
+    if(this == &other || (kind != Kind::Inline && heapBlock() == other.heapBlock()))
+        return;
+    if(other.kind != Kind::Bitmap)
+    {
+        other.forEach([this](const Interval<uint16_t>& range) { insert(range); });
+        return;
+    }
+    if(kind != Kind::Bitmap)
+        toBitmap();
+    else
+        makeUnique();
+    for(uint32_t word = 0; word < PORTSET_BITMAP_WORDS; word++)
+        bitmap[word] |= other.bitmap[word];
+    count = runStarts(0, PORTSET_BITMAP_WORDS - 1);
+    if(count <= PORTSET_BITMAP_INTERVALS / 2)
+        toSpans();
+}
+
+/**
+ * Replaces the contents with a list of intervals which are already sorted, disjoint and not adjacent,
+ * like the ones RuleTree::insertRules builds.
+ * @param sorted vector<Interval<uint16_t>>: the intervals
+ */
+void PortSet::assign(const std::vector<Interval<uint16_t>>& sorted)
+{
+    release();
+    if(sorted.size() > PORTSET_BITMAP_INTERVALS)
+    {
+        for(const Interval<uint16_t>& range : sorted)
+            insert(range);
+        return;
+    }
+    Span* target = small;
+    if(sorted.size() > PORTSET_INLINE)
+    {
+        list = target = static_cast<Span*>(allocateBlock(listCapacity(sorted.size()), sizeof(Span)));
+        kind = Kind::List;
+    }
+    for(size_t i = 0; i < sorted.size(); i++)
+        target[i] = {sorted[i].start, sorted[i].end};
+    count = sorted.size();
+}
+
+/**
+ * @return bool: whether the port is in the set
+ */
+bool PortSet::contains(uint16_t port) const
+{
+    if(kind == Kind::Bitmap)
+        return (bitmap[port >> 6] >> (port & 63)) & 1;
+
+    //the last interval starting at or before the port is the only one that can hold it
+    const Span* items = spans();
+    const Span* after = std::upper_bound(items, items + count, port, [](uint16_t value, const Span& span) {
+        return value < span.start;
+    });
+    return after != items && port <= after[-1].end;
+}
+
+/**
+ * @return size_t: the bytes this set has on the heap
+ */
+size_t PortSet::heapBytes() const
+{
+    if(kind == Kind::Bitmap)
+        return sizeof(Header) + PORTSET_BITMAP_WORDS * sizeof(uint64_t);
+    if(kind == Kind::List)
+        return sizeof(Header) + header()->capacity * sizeof(Span);
+    return 0;
+}
+
+/**
+ * Compares the ports in the sets, whichever form they are in. Between PORTSET_BITMAP_INTERVALS / 2 and
+ * PORTSET_BITMAP_INTERVALS intervals the same set can be a list or a bitmap depending on how it got
+ * there, and those still have to come out equal for PortSetTable and compact to share and join them.
+ */
+bool PortSet::operator==(const PortSet& other) const
+{
+    if(count != other.count)
+        return false;
+    if(kind != Kind::Inline && heapBlock() == other.heapBlock())
+        return true;
+    if(kind == Kind::Bitmap && other.kind == Kind::Bitmap)
+        return std::memcmp(bitmap, other.bitmap, PORTSET_BITMAP_WORDS * sizeof(uint64_t)) == 0;
+    if(kind != Kind::Bitmap && other.kind != Kind::Bitmap)
+        return std::memcmp(spans(), other.spans(), count * sizeof(Span)) == 0;
+
+    //one of each, so walk the runs of the bitmap against the intervals of the list
+    const PortSet& bits = kind == Kind::Bitmap ? *this : other;
+    const Span* items = (kind == Kind::Bitmap ? other : *this).spans();
+    uint32_t i = 0;
+    bool same = true;
+    bits.forEach([&](const Interval<uint16_t>& range) {
+        same &= i < count && items[i].start == range.start && items[i].end == range.end;
+        i++;
+    });
+    return same && i == count;
+}
+
+/**
+ * @return uint64_t: a hash of every interval, the same whichever form the set is in, so equal sets agree
+ * on it. Worked out once for a set on the heap and kept until it changes.
+ */
+uint64_t PortSet::hash() const
+{
+    if(kind == Kind::Inline)
+        return computeHash();
+    uint64_t cached = header()->hash.load(std::memory_order_relaxed);
+    if(cached == 0)
+    {
+        cached = computeHash();
+        header()->hash.store(cached, std::memory_order_relaxed);
+    }
+    return cached;
+}
+
+uint64_t PortSet::computeHash() const
+{
+    uint64_t hash = 0xcbf29ce484222325ull ^ count;
+    forEach([&hash](const Interval<uint16_t>& range) {
+        hash = (hash ^ ((uint32_t(range.start) << 16) | range.end)) * 0x9E3779B97F4A7C15ull;
+        hash ^= hash >> 29;
+    });
+    return hash == 0 ? 1 : hash;
+}
+
+/**
+ * Converts the intervals into a bitmap. Intervals are never adjacent, so each one is its own run.
+ */
+void PortSet::toBitmap()
+{
+    uint64_t* bits = static_cast<uint64_t*>(allocateBlock(PORTSET_BITMAP_WORDS, sizeof(uint64_t)));
+    std::memset(bits, 0, PORTSET_BITMAP_WORDS * sizeof(uint64_t));
+    const Span* items = spans();
+    uint32_t runs = count;
+    for(uint32_t i = 0; i < count; i++)
+    {
+        for(uint32_t port = items[i].start; port <= items[i].end; port++)
+            bits[port >> 6] |= uint64_t(1) << (port & 63);
+    }
+    release();
+    bitmap = bits;
+    kind = Kind::Bitmap;
+    count = runs;
+}
+
+/**
+ * Converts a bitmap back into a list of intervals, once it has few enough runs
+ */
+void PortSet::toSpans()
+{
+    uint32_t runs = count;
+    Span buffer[PORTSET_INLINE];
+    Span* target = runs <= PORTSET_INLINE ? buffer : static_cast<Span*>(allocateBlock(listCapacity(runs), sizeof(Span)));
+    uint32_t next = 0;
+    forEach([&](const Interval<uint16_t>& range) { target[next++] = {range.start, range.end}; });
+
+    release();
+    if(target == buffer)
+        std::copy(buffer, buffer + runs, small);
+    else
+    {
+        list = target;
+        kind = Kind::List;
+    }
+    count = runs;
+}
+
+/**
+ * Sets (or clears) the bits from start to end in the bitmap, keeping count up to date. Only the words
+ * around the range can gain or lose the start of a run, so only those get recounted.
+ */
+void PortSet::setBits(uint32_t start, uint32_t end, bool value)
+{
+    uint32_t firstWord = start >> 6;
+    uint32_t lastWord = std::min<uint32_t>((end + 1) >> 6, PORTSET_BITMAP_WORDS - 1);
+    uint32_t before = runStarts(firstWord, lastWord);
+
+    for(uint32_t word = start >> 6; word <= (end >> 6); word++)
+    {
+        uint32_t low = word == (start >> 6) ? (start & 63) : 0;
+        uint32_t high = word == (end >> 6) ? (end & 63) : 63;
+        uint64_t mask = (high == 63 ? ~uint64_t(0) : (uint64_t(1) << (high + 1)) - 1) & ~((uint64_t(1) << low) - 1);
+        if(value)
+            bitmap[word] |= mask;
+        else
+            bitmap[word] &= ~mask;
+    }
+    count = count + runStarts(firstWord, lastWord) - before;
+}
+
+/**
+ * Counts the set bits in the given words whose previous bit is clear, which is to say the runs that
+ * start there.
+ */
+uint32_t PortSet::runStarts(uint32_t firstWord, uint32_t lastWord) const
+{
+    uint32_t starts = 0;
+    uint64_t carry = firstWord == 0 ? 0 : bitmap[firstWord - 1] >> 63;
+    for(uint32_t word = firstWord; word <= lastWord; word++)
+    {
+        uint64_t bits = bitmap[word];
+        starts += __builtin_popcountll(bits & ~((bits << 1) | carry));
+        carry = bits >> 63;
+    }
+    return starts;
+}
+
+/**
+ * Finds the first port at or after from whose bit is set (or clear)
+ * @return uint32_t: the port, or 65536 if there isn't one
+ */
+uint32_t PortSet::nextBit(uint32_t from, bool set) const
+{
+    uint32_t word = from >> 6;
+    uint64_t bits = (set ? bitmap[word] : ~bitmap[word]) & (~uint64_t(0) << (from & 63));
+    while(bits == 0)
+    {
+        if(++word == PORTSET_BITMAP_WORDS)
+            return 65536;
+        bits = set ? bitmap[word] : ~bitmap[word];
+    }
+    return (word << 6) + __builtin_ctzll(bits);
+}
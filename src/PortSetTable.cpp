@@ -0,0 +1,130 @@
+#include "PortSetTable.h"
+
+#include <utility>
+
+/**
+ * Makes the set share the heap array of an equal set already in the table, or adds it to the table if
+ * there isn't one yet.
+ * @param set PortSet: the set to intern, which may be changed to point at the shared copy
+ */
+void PortSetTable::intern(PortSet& set)
+{
+    if(set.isInline())
+        return;
+    if((used + 1) * 4 > slots.size() * 3)
+        rehash();
+
+    uint64_t hash = set.hash();
+    size_t mask = slots.size() - 1;
+    size_t index = hash & mask;
+    while(!slots[index].set.isInline())
+    {
+        if(slots[index].set.heapBlock() == set.heapBlock())
+            return;
+        if(slots[index].hash == hash && slots[index].set == set)
+        {
+            if(slots[index].set.heapBlock() != set.heapBlock())
+                set = slots[index].set;
+            return;
+        }
+        index = (index + 1) & mask;
+    }
+    slots[index].hash = hash;
+    slots[index].set = set;
+    used++;
+}
+
+/**
+ * Takes the table's reference to this exact set away, so that it can be changed in place when nothing
+ * else is using it. Intern it again afterwards.
+ * @param set PortSet: the set about to change
+ */
+void PortSetTable::forget(const PortSet& set)
+{
+    if(set.isInline() || used == 0)
+        return;
+    uint64_t hash = set.hash();
+    size_t mask = slots.size() - 1;
+    for(size_t index = hash & mask; !slots[index].set.isInline(); index = (index + 1) & mask)
+    {
+        if(slots[index].set.heapBlock() == set.heapBlock())
+        {
+            erase(index);
+            return;
+        }
+    }
+}
+
+/**
+ * Takes over the sets of another table, for when a merge moves intervals from one tree to another
+ * without going through intern. The other table is left empty.
+ * @param other PortSetTable: the table to take the sets of
+ */
+void PortSetTable::absorb(PortSetTable& other)
+{
+    for(Slot& slot : other.slots)
+    {
+        if(slot.set.useCount() > 1)
+        {
+            PortSet set = slot.set;
+            intern(set);
+        }
+    }
+    other.slots.clear();
+    other.used = 0;
+}
+
+/**
+ * Empties a slot, then shifts back any entries after it which would no longer be found past the hole
+ */
+void PortSetTable::erase(size_t index)
+{
+    size_t mask = slots.size() - 1;
+    slots[index].set = PortSet();
+    used--;
+    size_t next = index;
+    while(true)
+    {
+        next = (next + 1) & mask;
+        if(slots[next].set.isInline())
+            return;
+        //the entry at next can fill the hole unless its home slot lies cyclically in (index, next]
+        size_t home = slots[next].hash & mask;
+        bool between = index <= next ? (index < home && home <= next) : (index < home || home <= next);
+        if(!between)
+        {
+            slots[index] = std::move(slots[next]);
+            index = next;
+        }
+    }
+}
+
+/**
+ * Rebuilds the table with room to grow, dropping every set only the table is still using
+ */
+void PortSetTable::rehash()
+{
+    std::vector<Slot> old;
+    old.swap(slots);
+    size_t live = 0;
+    for(const Slot& slot : old)
+        live += slot.set.useCount() > 1;
+
+    size_t capacity = PORTSET_TABLE_MIN_SLOTS;
+    while(capacity < live * 4)
+        capacity <<= 1;
+    slots.resize(capacity);
+    used = 0;
+    size_t mask = capacity - 1;
+    for(Slot& slot : old)
+    {
+        if(slot.set.useCount() <= 1)
+            continue;
+        size_t index = slot.hash & mask;
+        while(!slots[index].set.isInline())
+            index = (index + 1) & mask;
+        slots[index].hash = slot.hash;
+        slots[index].set = std::move(slot.set);
+        used++;
+    }
+}
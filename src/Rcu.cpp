@@ -0,0 +1,108 @@
+#include "Rcu.h"
+
+#include <thread>
+
+/**
+ * The epoch a reader was in when it entered its outermost read section, or 0 when it isn't in one. Each
+ * slot is padded out to two cache lines so that readers on different cores never share a line.
+ */
+struct RcuSlot
+{
+    std::atomic<uint64_t> epoch;
+    std::atomic<bool> inUse;
+    RcuSlot* next;
+    char padding[128 - sizeof(std::atomic<uint64_t>) - sizeof(std::atomic<bool>) - sizeof(RcuSlot*)];
+};
+
+//bumped by every rcuSynchronize. Starts at 1 so 0 can mean quiescent
+static std::atomic<uint64_t> globalEpoch(1);
+
+//every slot ever handed out. Slots are never freed, a thread that exits just marks its slot as free
+static std::atomic<RcuSlot*> slots(nullptr);
+
+//this thread's slot and how deeply it is nested in read sections. Plain pointers so the fast path
+//doesn't go through a thread_local constructor check
+static thread_local RcuSlot* threadSlot = nullptr;
+static thread_local unsigned threadNesting = 0;
+
+/**
+ * Gives the slot of a thread back when the thread exits
+ */
+struct RcuSlotReleaser
+{
+    ~RcuSlotReleaser()
+    {
+        if(threadSlot != nullptr)
+        {
+            threadSlot->epoch.store(0, std::memory_order_release);
+            threadSlot->inUse.store(false, std::memory_order_release);
+        }
+    }
+};
+
+/**
+ * Finds this thread a slot, reusing one given back by an exited thread if there is one
+ */
+static RcuSlot* acquireSlot()
+{
+    static thread_local RcuSlotReleaser releaser;
+    (void)releaser;
+
+    for(RcuSlot* slot = slots.load(std::memory_order_acquire); slot != nullptr; slot = slot->next)
+    {
+        bool expected = false;
+        if(!slot->inUse.load(std::memory_order_relaxed) && slot->inUse.compare_exchange_strong(expected, true, std::memory_order_acq_rel))
+            return slot;
+    }
+
+    RcuSlot* slot = new RcuSlot();
+    slot->epoch.store(0, std::memory_order_relaxed);
+    slot->inUse.store(true, std::memory_order_relaxed);
+    slot->next = slots.load(std::memory_order_relaxed);
+    while(!slots.compare_exchange_weak(slot->next, slot, std::memory_order_acq_rel))
+        ;
+    return slot;
+}
+
+/**
+ * Enters a read section. The epoch has to be visible to writers before anything protected is loaded,
+ * hence the full fence. Either a writer sees our epoch and waits for us, or we see its new pointer.
+ */
+RcuReadGuard::RcuReadGuard()
+{
+    if(threadNesting++ != 0)
+        return;
+    if(threadSlot == nullptr)
+        threadSlot = acquireSlot();
+    threadSlot->epoch.store(globalEpoch.load(std::memory_order_acquire), std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+}
+
+/**
+ * Leaves a read section. The release keeps every load made inside it from moving past the point where a
+ * writer can see we are done.
+ */
+RcuReadGuard::~RcuReadGuard()
+{
+    if(--threadNesting != 0)
+        return;
+    threadSlot->epoch.store(0, std::memory_order_release);
+}
+
+/**
+ * Starts a new epoch and waits for every reader still in an older one. Anyone who entered after the
+ * new epoch started came after the pointer swap that preceded this call, so they can't be holding the
+ * old pointer.
+ */
+void rcuSynchronize()
+{
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    uint64_t target = globalEpoch.fetch_add(1, std::memory_order_acq_rel) + 1;
+
+    for(RcuSlot* slot = slots.load(std::memory_order_acquire); slot != nullptr; slot = slot->next)
+    {
+        uint64_t epoch;
+        while((epoch = slot->epoch.load(std::memory_order_acquire)) != 0 && epoch < target)
+            std::this_thread::yield();
+    }
+}
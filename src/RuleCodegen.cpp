@@ -0,0 +1,146 @@
+#include "RuleCodegen.h"
+
+#include <vector>
+#include <cctype>
+
+/**
+ * Writes a table as a constexpr array, CODEGEN_VALUES_PER_LINE values to a line
+ */
+template <typename T>
+static void writeTable(std::ostream& out, const char* type, const std::string& name, const std::vector<T>& values)
+{
+    out << "constexpr " << type << ' ' << name << '[' << values.size() << "] = {";
+    for(size_t i = 0; i < values.size(); i++)
+    {
+        if(i % CODEGEN_VALUES_PER_LINE == 0)
+            out << "\n    ";
+        out << uint64_t(values[i]) << (i + 1 < values.size() ? "," : "");
+    }
+    out << "\n};\n";
+}
+
+/**
+ * @return string: the name the tables of a root get, like "inboundTcp"
+ */
+static std::string rootName(int slot)
+{
+    std::string direction = toString(static_cast<Direction>(slot & 1));
+    std::string protocal = toString(static_cast<Protocol>(slot >> 1));
+    protocal[0] = std::toupper(protocal[0]);
+    return direction + protocal;
+}
+
+/**
+ * @return string: text as a C++ string literal, quotes included
+ */
+static std::string quoted(const std::string& text)
+{
+    std::string literal = "\"";
+    for(char c : text)
+    {
+        if(c == '"' || c == '\\')
+            literal += '\\';
+        literal += c;
+    }
+    return literal + '"';
+}
+
+/**
+ * @return bool: whether name can be used as a C++ namespace name
+ */
+bool isIdentifier(const std::string& name)
+{
+    if(name.empty() || std::isdigit(static_cast<unsigned char>(name[0])))
+        return false;
+    for(char c : name)
+        if(!std::isalnum(static_cast<unsigned char>(c)) && c != '_')
+            return false;
+    return true;
+}
+
+/**
+ * Writes out a C++ header with the rules of the tree baked in, for a policy that is fixed when the
+ * program is built. Every root becomes constexpr tables of its sorted ip interval starts and ends and the
+ * port intervals of each, the same structure of arrays a CompiledRuleTree builds at runtime, and a
+ * contains function picks the root and searches it with generatedRootContains (see GeneratedLookup.h),
+ * unrolled for the number of intervals in that root. A root without any rules is just "return false".
+ *
+ * Everything goes in namespace name, so more than one generated header can be used in the same program.
+ * @param tree RuleTree: the rules
+ * @param out ostream: where the header goes
+ * @param name string: the namespace, which also makes up the include guard. Has to be an identifier
+ * @param source string: the rules file, written into the header as a comment and as name::source
+ */
+void writeLookupHeader(const RuleTree& tree, std::ostream& out, const std::string& name, const std::string& source)
+{
+    if(!isIdentifier(name))
+        throw "Invalid Generated Name Error";
+    std::string guard;
+    for(char c : name)
+        guard += std::toupper(static_cast<unsigned char>(c));
+
+    out << "//generated from " << source << " by ./bin/program --generate, don't edit. See GeneratedLookup.h\n";
+    out << "#ifndef " << guard << "\n#define " << guard << "\n\n";
+    out << "#include \"GeneratedLookup.h\"\n\n";
+    out << "namespace " << name << "\n{\n\n";
+    out << "constexpr const char* source = " << quoted(source) << ";\n\n";
+
+    uint32_t counts[ROOT_COUNT];
+    uint64_t totalPorts = 0;
+    for(int slot = 0; slot < ROOT_COUNT; slot++)
+    {
+        std::vector<uint32_t> starts, ends, portOffsets;
+        std::vector<uint16_t> portStarts, portEnds;
+        for(const IPInterval& interval : tree.getRoot(slot))
+        {
+            if(interval.portSet.empty())
+                continue;
+            starts.push_back(interval.ip_range.start);
+            ends.push_back(interval.ip_range.end);
+            portOffsets.push_back(portStarts.size());
+            interval.portSet.forEach([&portStarts, &portEnds](const Interval<uint16_t>& range) {
+                portStarts.push_back(range.start);
+                portEnds.push_back(range.end);
+            });
+        }
+        portOffsets.push_back(portStarts.size());
+        counts[slot] = starts.size();
+        totalPorts += portStarts.size();
+        if(starts.empty())
+            continue;
+
+        std::string root = rootName(slot);
+        out << "//" << toString(static_cast<Direction>(slot & 1)) << ' ' << toString(static_cast<Protocol>(slot >> 1)) << ": ";
+        out << starts.size() << " ip intervals, " << portStarts.size() << " port intervals\n";
+        writeTable(out, "uint32_t", root + "Starts", starts);
+        writeTable(out, "uint32_t", root + "Ends", ends);
+        writeTable(out, "uint32_t", root + "PortOffsets", portOffsets);
+        writeTable(out, "uint16_t", root + "PortStarts", portStarts);
+        writeTable(out, "uint16_t", root + "PortEnds", portEnds);
+        out << '\n';
+    }
+
+    uint64_t totalIps = 0;
+    for(uint32_t count : counts)
+        totalIps += count;
+    out << "constexpr uint32_t ipIntervals = " << totalIps << ";\n";
+    out << "constexpr uint32_t portIntervals = " << totalPorts << ";\n\n";
+
+    //static, like the tables, so every file including this gets its own copy and nothing clashes
+    out << "static inline bool contains(Direction direction, Protocol protocal, uint16_t port, uint32_t ip)\n{\n";
+    out << "    switch(rootSlot(direction, protocal))\n    {\n";
+    for(int slot = 0; slot < ROOT_COUNT; slot++)
+    {
+        out << "    case " << slot << ":\n";
+        if(counts[slot] == 0)
+        {
+            out << "        return false;\n";
+            continue;
+        }
+        std::string root = rootName(slot);
+        out << "        return generatedRootContains<" << counts[slot] << ">(" << root << "Starts, " << root << "Ends, "
+            << root << "PortOffsets, " << root << "PortStarts, " << root << "PortEnds, port, ip);\n";
+    }
+    out << "    }\n    return false;\n}\n\n";
+    out << "}\n\n#endif\n";
+}
@@ -1,22 +1,55 @@
 #include "RuleTree.h"
+#include "CompiledRuleTree.h"
+#include "Parser.h"
+
+#include <unordered_set>
+
+/**
+ * Turns the direction field of a rule or packet into its enum
+ * @param direction string: either "inbound" or "outbound"
+ */
+Direction parseDirection(const std::string& direction)
+{
+    Direction parsed;
+    if(!parseDirection(direction.data(), direction.size(), parsed))
+        throw "Unknown direction error";
+    return parsed;
+}
+
+/**
+ * Turns the protocal field of a rule or packet into its enum
+ * @param protocal string: either "tcp" or "udp"
+ */
+Protocol parseProtocol(const std::string& protocal)
+{
+    Protocol parsed;
+    if(!parseProtocol(protocal.data(), protocal.size(), parsed))
+        throw "Unknown protocal error";
+    return parsed;
+}
+
+const char* toString(Direction direction)
+{
+    return direction == Direction::Inbound ? "inbound" : "outbound";
+}
+
+const char* toString(Protocol protocal)
+{
+    return protocal == Protocol::Tcp ? "tcp" : "udp";
+}
 
 /**
- * Intializes the RuleTree with the first 4 roots. Right now, these are hard coded, since these are 
- * the only known roots in the tree. It's faster and cleaner to place them in here instead of generating
- * them dynaimcally as new rules are added because we don't have any extra if statements in the insertRule
- * function. It's important that function be as streamlined as possible since it takes the most time
- * in the process.
+ * Sets up the four roots to share one NodePool, or to go straight to the heap
+ * @param allocation NodeAllocation: where the nodes of the tree come from
  */
-RuleTree::RuleTree()
+template <typename Address>
+BasicRuleTree<Address>::BasicRuleTree(NodeAllocation allocation): allocation(allocation), portSetsChanged(0), internAfter(PORTSET_INTERN_BATCH)
 {
-    //hardcoding these for now, since these are the only permuations of the top levels of the tree
-    //only disadvantage is not being able to exit early if a rule for any of these permutations hasn't been defined 
-    //yet. However, it's only one extra call to check the interval tree, so not too big a deal.
-    root["outboundtcp"] = {};
-    root["inboundtcp"]  = {};
-    root["outboundudp"] = {};
-    root["inboundudp"]  = {};
+    PoolAllocator<IntervalType> nodes(std::make_shared<NodePool>(allocation == NodeAllocation::Heap));
+    for(IntervalSet& tree : root)
+        tree = IntervalSet(std::less<IntervalType>(), nodes);
 }
+
 /**
  * Given a FirewallRule struct, we attempt to insert the rule into the balanced red-black tree. Each insertion takes 
  * O(logn) time with an additional constant time to rebalance the tree. Ideally, this would be an interval tree as used in 
@@ -25,80 +58,554 @@ RuleTree::RuleTree()
  * 
  * @param rule FirewallRule: the rule to insert into the tree
  */
-void RuleTree::insertRule(FirewallRule& rule)
+template <typename Address>
+void BasicRuleTree<Address>::insertRule(const Rule& rule)
 {
     // std::cout << rule << '\n';
-    
+    PortSet ports;
+    ports.insert(Interval<uint16_t>(rule.port_range));
+    insertInterval(root[rootSlot(rule.direction, rule.protocal)], rule.ip_range, ports);
+}
+
+/**
+ * Unions an ip range and its set of port ranges into one of the roots. This is the heart of insertRule, and
+ * is also how whole intervals from another tree get merged in.
+ * @param tree IntervalSet: the root to insert into
+ * @param ipRange Range<Address>: the range of ip addresses
+ * @param ports PortSet: the ports allowed for those addresses
+ */
+template <typename Address>
+void BasicRuleTree<Address>::insertInterval(IntervalSet& tree, const Range<Address>& ipRange, const PortSet& ports)
+{
     //let's check to see if this interval already exists
-    IPInterval ip(rule.ip_range, rule.port_range);
-    std::string key = makekey(rule);
+    IntervalType ip(ipRange);
 
-    auto rootIt = root.find(makekey(rule));
-    auto node = rootIt->second.find(ip);
-    if(node == rootIt->second.end())
+    //the new range may overlap several of the existing (disjoint) intervals, so grab the whole run of them.
+    //lower_bound gives us the first interval which doesn't end before this one starts
+    auto node = tree.lower_bound(ip);
+    auto last = node;
+    while(last != tree.end() && !(ip < *last))
+        ++last;
+
+    if(node == last)
     {
         // didn't find the rule yet, can insert the rule into the RuleTree
-        root[key].insert(ip);
+        ip.portSet = ports;
+        portSets.intern(ip.portSet);
+        tree.insert(std::move(ip));
+    }
+    else if(std::next(node) == last && node->ip_range.start == ip.ip_range.start && node->ip_range.end == ip.ip_range.end)
+    {
+        //found an exact match, so we are adding a new port rule. Take the set out of the table first, so
+        //it can change in place if this interval is the only one using it. Sets built up one rule at a time
+        //like this (or by merges, below) keep changing, and interning each step would just make the next one
+        //copy it, so they are interned in batches instead, see internPortSets
+        if(node->portSet.useCount() == 2)
+            portSets.forget(node->portSet);
+        node->portSet.insert(ports);
+        portSetChanged(node->portSet);
     }
     else
     {
-        //found an instance of the interval that fit
-        //lets's check if the rule is an exact match
-        if(node->ip_range.start == ip.ip_range.start && node->ip_range.end == ip.ip_range.end)
+        //reconstruct a new ip range spanning every interval we overlap
+        Range<Address> newIpRange(std::min(node->ip_range.start, ip.ip_range.start), std::max(std::prev(last)->ip_range.end, ip.ip_range.end));
+
+        //create the new interval, take over the port set of the first one (it gets erased below) and union in
+        //the ports of everything else we swallowed. The port set is only copied if another interval shares it
+        //and the others add something to it
+        IntervalType newInterval(newIpRange);
+        newInterval.portSet = std::move(node->portSet);
+        if(newInterval.portSet.useCount() == 2)
+            portSets.forget(newInterval.portSet);
+#ifdef FIREWALL_STATS
+        const void* shared = newInterval.portSet.useCount() > 1 ? newInterval.portSet.heapBlock() : nullptr;
+        size_t sharedSize = newInterval.portSet.size();
+#endif
+        for(auto it = std::next(node); it != last; ++it)
         {
-            //found an exact match, so we are adding a new port rule
-            //let's check if the port rule is a new one using the same method as finding the ip ranges 
-            std::set<Interval<uint16_t>>& portTree = node->portTree;
-            Interval<uint16_t> portRange(rule.port_range);
-            auto portIt = portTree.find(portRange);
-            if(portIt == portTree.end())
-            {
-                //didn't find this range, let's insert
-                portTree.insert(portRange);
-            }
-            else
-            {
-                //We hvae found a port range which overlaps, so we should expand given the current rule set and the new one
-                Interval<uint16_t> newPortRange(std::min(portIt->start, rule.port_range.start), std::max(portIt->end, rule.port_range.end));
-                
-                //extend the current port range by erasing the previous node and then inserting the new one
-                portTree.erase(portIt);
-                portTree.insert(newPortRange);
-            }
+            newInterval.portSet.insert(it->portSet);
+            if(it->portSet.useCount() == 2)
+                portSets.forget(it->portSet);
         }
-        else
+        newInterval.portSet.insert(ports);
+#ifdef FIREWALL_STATS
+        merges.add(1);
+        if(shared != nullptr && newInterval.portSet.heapBlock() != shared)
         {
-           //reconstruct a new ip range
-            Range<uint32_t> newIpRange(std::min(node->ip_range.start, ip.ip_range.start), std::max(node->ip_range.end, ip.ip_range.end));
-            std::set<Interval<uint16_t>>& portTree = node->portTree;
-            
-            //lets find if the port range to be inserted overlaps with any that we have
-            Interval<uint16_t> portRange(rule.port_range);
-            auto portIt = portTree.find(portRange);
-            if(portIt == portTree.end())
-            {
-                //we did not find any overlapping ranges, we can insert and then copy this tree over to the new interval
-                portTree.insert(portRange);
-            }
-            else
+            portTreeCopies.add(1);
+            portIntervalsCopied.add(sharedSize);
+        }
+#endif
+        if(!newInterval.portSet.isInline())
+            portSetsChanged++;
+
+        //erase the old intervals and insert the new one
+        tree.erase(node, last);
+        tree.insert(std::move(newInterval));
+        if(portSetsChanged > internAfter)
+            internPortSets();
+    }
+}
+
+/**
+ * Takes a rule's ports away from its ip range, the opposite of insertRule. Every interval the ip range
+ * overlaps loses those ports over the part of it inside the range. An interval entirely inside the range
+ * is trimmed in place, and dropped if it has no ports left. One sticking out of either side is split,
+ * and the parts outside the range keep every port they had. Only the k intervals the range overlaps are
+ * touched, so this is O(logn + k) plus the port set changes.
+ *
+ * Overlapping rules were merged when they went in, so this takes the ports away from everything the
+ * tree allows in that range, not just from the one rule being revoked.
+ * @param rule FirewallRule: the rule to remove
+ */
+template <typename Address>
+void BasicRuleTree<Address>::removeRule(const Rule& rule)
+{
+    IntervalSet& tree = root[rootSlot(rule.direction, rule.protocal)];
+    Interval<uint16_t> ports(rule.port_range);
+    Address start = rule.ip_range.start;
+    Address end = rule.ip_range.end;
+
+    auto node = tree.lower_bound(IntervalType(rule.ip_range));
+    while(node != tree.end() && node->ip_range.start <= end)
+    {
+        if(!node->portSet.intersects(ports))
+        {
+            ++node;
+            continue;
+        }
+        if(start <= node->ip_range.start && node->ip_range.end <= end)
+        {
+            removePorts(node->portSet, ports);
+            node = node->portSet.empty() ? tree.erase(node) : std::next(node);
+            continue;
+        }
+
+        //split the interval at the edges of the range. Everything goes back in front of the interval after
+        //it, so each insert is amortized constant time with the hint
+        Interval<Address> ipRange = node->ip_range;
+        PortSet kept = std::move(node->portSet);
+        node = tree.erase(node);
+        if(ipRange.start < start)
+        {
+            IntervalType left(Range<Address>(ipRange.start, start - 1));
+            left.portSet = kept;
+            tree.emplace_hint(node, std::move(left));
+        }
+        IntervalType middle(Range<Address>(std::max(ipRange.start, start), std::min(ipRange.end, end)));
+        middle.portSet = kept;
+        removePorts(middle.portSet, ports);
+        if(!middle.portSet.empty())
+            tree.emplace_hint(node, std::move(middle));
+        if(ipRange.end > end)
+        {
+            IntervalType right(Range<Address>(end + 1, ipRange.end));
+            right.portSet = std::move(kept);
+            tree.emplace_hint(node, std::move(right));
+        }
+    }
+}
+
+/**
+ * Takes a range of ports out of an interval's port set
+ */
+template <typename Address>
+void BasicRuleTree<Address>::removePorts(PortSet& set, const Interval<uint16_t>& range)
+{
+    if(set.useCount() == 2)
+        portSets.forget(set);
+    set.remove(range);
+    portSetChanged(set);
+}
+
+/**
+ * Counts a port set changed in place, and interns everything again once enough have, see internPortSets
+ */
+template <typename Address>
+void BasicRuleTree<Address>::portSetChanged(const PortSet& set)
+{
+    if(!set.isInline() && ++portSetsChanged > internAfter)
+        internPortSets();
+}
+
+/**
+ * Interns the port set of every interval. insertRule doesn't intern a set it changes in place straight
+ * away, it runs this once enough sets have changed to pay for it: at least as many changes as there are
+ * intervals and port intervals, which is what walking and hashing the whole tree can cost. That keeps
+ * it down to a constant per insert. Call it after a batch of insertRule calls to share whatever has
+ * changed since.
+ */
+template <typename Address>
+void BasicRuleTree<Address>::internPortSets()
+{
+    size_t work = 0;
+    for(const IntervalSet& tree : root)
+    {
+        for(const IntervalType& interval : tree)
+        {
+            portSets.intern(interval.portSet);
+            work += 1 + interval.portSet.size();
+        }
+    }
+    portSetsChanged = 0;
+    internAfter = std::max<size_t>(PORTSET_INTERN_BATCH, work);
+}
+
+/**
+ * Joins every run of back to back ip intervals with identical port sets, like [1,5] and [6,10] both
+ * allowing ports 80 and 443, into one interval. The tree doesn't do that as rules go in, since the
+ * intervals don't overlap, so rule files listing neighbouring addresses one per line end up with an
+ * interval each. Port sets are already as small as they get, overlapping and adjacent port ranges are
+ * joined as they are inserted, and overlapping ip intervals never survive an insert either.
+ *
+ * Nothing that is allowed changes. What does is that a rule inserted afterwards over part of a joined
+ * interval merges into all of it, just like it would have if the rules had overlapped to begin with.
+ * The port sets are interned first, so comparing them is mostly just comparing pointers. O(n) on top.
+ * @return size_t: how many intervals went away
+ */
+template <typename Address>
+size_t BasicRuleTree<Address>::compact()
+{
+    internPortSets();
+    size_t removed = 0;
+    for(IntervalSet& tree : root)
+    {
+        auto first = tree.begin();
+        while(first != tree.end())
+        {
+            auto last = first;
+            auto next = std::next(first);
+            while(next != tree.end() && next->ip_range.start - 1 == last->ip_range.end && next->portSet == first->portSet)
+                last = next++;
+            if(last == first)
             {
-                Interval<uint16_t> newPortRange(std::min(portIt->start, rule.port_range.start), std::max(portIt->end, rule.port_range.end));
-                
-                //extend the current port range by erasing the previous node and then inserting the new one
-                portTree.erase(portIt);
-                portTree.insert(newPortRange);
+                first = next;
+                continue;
             }
 
-            //create the new interval
-            IPInterval newInterval(newIpRange);
-            //Copy over the port tree
-            newInterval.portTree = portTree;
+            IntervalType joined(Range<Address>(first->ip_range.start, last->ip_range.end));
+            joined.portSet = std::move(first->portSet);
+            removed += std::distance(first, next) - 1;
+            tree.erase(first, next);
+            first = std::next(tree.emplace_hint(next, std::move(joined)));
+        }
+    }
+    return removed;
+}
+
+/**
+ * Unions every rule of another tree into this one, with the same semantics as inserting each of the
+ * other tree's rules with insertRule. The other tree is left empty. Whichever root is smaller is the one
+ * that gets walked, so merging a small tree into a big one (or the other way) only costs the small one.
+ * @param other RuleTree: the tree to absorb
+ */
+template <typename Address>
+void BasicRuleTree<Address>::merge(BasicRuleTree& other)
+{
+    for(int slot = 0; slot < ROOT_COUNT; slot++)
+    {
+        IntervalSet& tree = root[slot];
+        IntervalSet& from = other.root[slot];
+        if(from.size() > tree.size())
+            tree.swap(from);
+        for(const IntervalType& interval : from)
+        {
+            Range<Address> ipRange(interval.ip_range.start, interval.ip_range.end);
+            insertInterval(tree, ipRange, interval.portSet);
+        }
+        from.clear();
+    }
+    portSets.absorb(other.portSets);
+    STAT_ADD(merges, other.merges.load());
+    STAT_ADD(portTreeCopies, other.portTreeCopies.load());
+    STAT_ADD(portIntervalsCopied, other.portIntervalsCopied.load());
+}
+
+/**
+ * Bulk version of insertRule for when all of the rules are known up front, like when loading a whole file.
+ * Instead of inserting one at a time, which has to erase and rebuild an interval (copying its whole port
+ * tree) every time a rule overlaps one already in the tree, the rules are sorted by root and then by the
+ * start of their ip range. After that every group of overlapping ip ranges is next to eachother, so one
+ * linear sweep finds each final interval and all of its ports at once. Each port set is sorted and swept
+ * the same way, with adjacent port ranges joined since that doesn't change which ports are allowed. The
+ * intervals come out of the sweep in order, so they are added to the back of each set in amortized
+ * constant time. O(nlogn) for the sort and then O(n) for everything else.
+ *
+ * The result allows exactly the same packets as calling insertRule on every rule. If the tree already
+ * has rules in it, the new ones are built into a tree of their own and merged in.
+ * @param rules vector<FirewallRule>: the rules to insert. They are sorted in place, with ruleOrder.
+ */
+template <typename Address>
+void BasicRuleTree<Address>::insertRules(std::vector<Rule>& rules)
+{
+    for(const IntervalSet& tree : root)
+    {
+        if(!tree.empty())
+        {
+            BasicRuleTree built(allocation);
+            built.insertRules(rules);
+            merge(built);
+            return;
+        }
+    }
+
+    std::sort(rules.begin(), rules.end(), ruleOrder<Address>);
+    size_t next = 0;
+    while(next < rules.size())
+    {
+        int slot = rootSlot(rules[next].direction, rules[next].protocal);
+        size_t first = next;
+        while(next < rules.size() && rootSlot(rules[next].direction, rules[next].protocal) == slot)
+            next++;
+        IntervalSet& tree = root[slot];
+        buildIntervals(tree, tree.end(), rules.data() + first, rules.data() + next);
+    }
+}
+
+/**
+ * The sweep behind insertRules and updateRules. Joins every group of overlapping ip ranges into one
+ * interval holding all of their ports, and puts each in front of hint as it comes out.
+ * @param tree IntervalSet: the root all of the rules belong to
+ * @param hint IntervalSet::iterator: where the intervals go. Nothing between them and it may overlap them
+ * @param first FirewallRule*: the rules, sorted by the start of their ip range
+ * @param last FirewallRule*: one past the last rule
+ */
+template <typename Address>
+void BasicRuleTree<Address>::buildIntervals(IntervalSet& tree, typename IntervalSet::iterator hint, const Rule* first, const Rule* last)
+{
+    std::vector<Interval<uint16_t>> ports;
+    while(first != last)
+    {
+        Range<Address> ipRange = first->ip_range;
+        ports.clear();
+
+        //swallow every following rule which starts inside the interval we have so far
+        while(first != last && first->ip_range.start <= ipRange.end)
+        {
+            ipRange.end = std::max(ipRange.end, first->ip_range.end);
+            ports.push_back(Interval<uint16_t>(first->port_range));
+            first++;
+        }
+
+        IntervalType interval(ipRange);
+        buildPortSet(interval.portSet, ports);
+        portSets.intern(interval.portSet);
+        tree.emplace_hint(hint, std::move(interval));
+    }
+}
+
+/**
+ * Brings the tree in line with a changed list of rules, only touching the parts of it that changed. Every
+ * interval a changed rule overlaps is erased, and the ranges they covered (along with the changed rules'
+ * own) are built again from the rules in the new list that fall inside them. The intervals everywhere else
+ * are left alone. Finding those rules is one pass over the list, otherwise this costs O(c log n) for c
+ * changed rules plus the size of the intervals they hit.
+ *
+ * The tree ends up allowing exactly what building it from the new list with insertRules would. That
+ * needs the tree to have been built from the old list to begin with, without insertRule or removeRule
+ * calls since (compact is fine), since the intervals outside the changed ranges are assumed to be right.
+ * @param rules vector<FirewallRule>: every rule after the change, in any order
+ * @param changed vector<FirewallRule>: the rules added or removed by the change
+ */
+template <typename Address>
+void BasicRuleTree<Address>::updateRules(const std::vector<Rule>& rules, const std::vector<Rule>& changed)
+{
+    //every ip range that has to be built again. Intervals never overlap, so growing a range to cover
+    //the ones it hits can't make it overlap anything still in the tree
+    std::vector<Rule> regions;
+    regions.reserve(changed.size());
+    for(const Rule& rule : changed)
+    {
+        IntervalSet& tree = root[rootSlot(rule.direction, rule.protocal)];
+        Rule region = rule;
+        region.port_range = Range<uint16_t>(0, 0);
+        auto node = tree.lower_bound(IntervalType(rule.ip_range));
+        while(node != tree.end() && node->ip_range.start <= rule.ip_range.end)
+        {
+            region.ip_range.start = std::min(region.ip_range.start, node->ip_range.start);
+            region.ip_range.end = std::max(region.ip_range.end, node->ip_range.end);
+            if(node->portSet.useCount() == 2)
+                portSets.forget(node->portSet);
+            node = tree.erase(node);
+        }
+        regions.push_back(region);
+    }
+    if(regions.empty())
+        return;
+
+    //join the regions which overlap, so a rule can only fall inside one of them
+    std::sort(regions.begin(), regions.end(), ruleOrder<Address>);
+    size_t joined = 0;
+    for(size_t next = 1; next < regions.size(); next++)
+    {
+        Rule& last = regions[joined];
+        const Rule& region = regions[next];
+        if(rootSlot(region.direction, region.protocal) == rootSlot(last.direction, last.protocal) && region.ip_range.start <= last.ip_range.end)
+            last.ip_range.end = std::max(last.ip_range.end, region.ip_range.end);
+        else
+            regions[++joined] = region;
+    }
+    regions.resize(joined + 1);
+
+    //every rule of the new list overlapping a region lies inside it, so only the starts need checking.
+    //Most rules are nowhere near a region, so first a bit per root for each of the 65536 blocks the top
+    //16 bits of an address pick, set for the blocks with a region in them, rules those out without searching
+    const int blockShift = AddressTraits<Address>::bits - 16;
+    std::vector<uint64_t> touched(ROOT_COUNT << 10, 0);
+    for(const Rule& region : regions)
+    {
+        size_t base = size_t(rootSlot(region.direction, region.protocal)) << 16;
+        for(size_t block = size_t(region.ip_range.start >> blockShift); block <= size_t(region.ip_range.end >> blockShift); block++)
+            touched[(base + block) >> 6] |= uint64_t(1) << (block & 63);
+    }
+    std::vector<Rule> inside;
+    for(const Rule& rule : rules)
+    {
+        size_t block = (size_t(rootSlot(rule.direction, rule.protocal)) << 16) + size_t(rule.ip_range.start >> blockShift);
+        if((touched[block >> 6] & (uint64_t(1) << (block & 63))) == 0)
+            continue;
+        Rule key = rule;
+        key.ip_range.end = AddressTraits<Address>::max();
+        key.port_range = Range<uint16_t>(UINT16_MAX, UINT16_MAX);
+        auto region = std::upper_bound(regions.begin(), regions.end(), key, ruleOrder<Address>);
+        if(region == regions.begin())
+            continue;
+        --region;
+        if(rootSlot(region->direction, region->protocal) == rootSlot(rule.direction, rule.protocal) && rule.ip_range.start <= region->ip_range.end)
+            inside.push_back(rule);
+    }
+    std::sort(inside.begin(), inside.end(), ruleOrder<Address>);
+
+    const Rule* first = inside.data();
+    const Rule* stop = inside.data() + inside.size();
+    for(const Rule& region : regions)
+    {
+        int slot = rootSlot(region.direction, region.protocal);
+        const Rule* last = first;
+        while(last != stop && rootSlot(last->direction, last->protocal) == slot && last->ip_range.start <= region.ip_range.end)
+            last++;
+        IntervalSet& tree = root[slot];
+        buildIntervals(tree, tree.lower_bound(IntervalType(region.ip_range)), first, last);
+        first = last;
+    }
+}
+
+/**
+ * Fills a port set from a list of possibly overlapping port ranges, by sorting them and joining
+ * every run of overlapping or adjacent ranges.
+ * @param portSet PortSet: the port set to fill
+ * @param ports vector<Interval<uint16_t>>: the port ranges. They are sorted and joined in place.
+ */
+template <typename Address>
+void BasicRuleTree<Address>::buildPortSet(PortSet& portSet, std::vector<Interval<uint16_t>>& ports)
+{
+    joinPorts(ports);
+    portSet.assign(ports);
+}
+
+/**
+ * Sorts a list of port ranges and joins every run of overlapping or adjacent ones, in place
+ * @param ports vector<Interval<uint16_t>>: the port ranges
+ */
+template <typename Address>
+void BasicRuleTree<Address>::joinPorts(std::vector<Interval<uint16_t>>& ports)
+{
+    std::sort(ports.begin(), ports.end(), [](const Interval<uint16_t>& a, const Interval<uint16_t>& b) {
+        return a.start < b.start;
+    });
+
+    size_t joined = 0;
+    size_t next = 0;
+    while(next < ports.size())
+    {
+        Interval<uint16_t> run = ports[next++];
+        while(next < ports.size() && uint32_t(ports[next].start) <= uint32_t(run.end) + 1)
+            run.end = std::max(run.end, ports[next++].end);
+        ports[joined++] = run;
+    }
+    ports.erase(ports.begin() + joined, ports.end());
+}
+
+/**
+ * Rough heap size of a std::set node holding a value of the given size: the red-black node header (colour
+ * and three pointers), the value, and malloc's bookkeeping, rounded up to malloc's 16 byte chunks.
+ */
+static size_t setNodeBytes(size_t valueSize)
+{
+    return (32 + valueSize + 8 + 15) / 16 * 16;
+}
+
+/**
+ * Describes the shape of the tree: how many intervals each root has, how the port intervals are spread
+ * over them, and roughly how much memory it all takes. The memory is an estimate worked out from the node
+ * counts, not measured, except for pooled nodes where it is the pool's chunks, and port sets shared between
+ * intervals are only counted once. The merge counters are only counted with FIREWALL_STATS, and are zero otherwise.
+ * Walks the whole tree, so it costs O(n).
+ * @return RuleTreeStats: the stats
+ */
+template <typename Address>
+RuleTreeStats BasicRuleTree<Address>::stats() const
+{
+    RuleTreeStats stats;
+    stats.portIntervals = 0;
+    std::unordered_set<const void*> portSetBlocks;
+    stats.memoryBytes = sizeof(BasicRuleTree);
+    for(int slot = 0; slot < ROOT_COUNT; slot++)
+    {
+        //a merge can leave roots on another tree's pool, so only count each pool once
+        const NodePool& pool = root[slot].get_allocator().getPool();
+        bool counted = false;
+        for(int other = 0; other < slot; other++)
+            counted |= &root[other].get_allocator().getPool() == &pool;
+        if(!counted)
+            stats.memoryBytes += pool.reservedBytes();
 
-            //erase the old interval and insert the new one
-            rootIt->second.erase(node);
-            root[key].insert(newInterval);
+        stats.ipIntervals[slot] = root[slot].size();
+        for(const IntervalType& interval : root[slot])
+        {
+            size_t ports = interval.portSet.size();
+            size_t bucket = log2Bucket(ports);
+            if(stats.portDistribution.size() <= bucket)
+                stats.portDistribution.resize(bucket + 1, 0);
+            stats.portDistribution[bucket]++;
+            stats.portIntervals += ports;
+            stats.memoryBytes += pool.isHeap() ? setNodeBytes(sizeof(IntervalType)) : 0;
+            if(!interval.portSet.isInline() && portSetBlocks.insert(interval.portSet.heapBlock()).second)
+                stats.memoryBytes += interval.portSet.heapBytes();
         }
     }
+    stats.sharedPortSets = portSetBlocks.size();
+    stats.merges = merges.load();
+    stats.portTreeCopies = portTreeCopies.load();
+    stats.portIntervalsCopied = portIntervalsCopied.load();
+    return stats;
+}
+
+std::ostream& operator<<(std::ostream& os, const RuleTreeStats& stats)
+{
+    os << "ip intervals:";
+    for(int slot = 0; slot < ROOT_COUNT; slot++)
+        os << ' ' << toString(static_cast<Direction>(slot & 1)) << '/' << toString(static_cast<Protocol>(slot >> 1)) << '=' << stats.ipIntervals[slot];
+    os << "\nport intervals: " << stats.portIntervals << "\nport intervals per ip interval:";
+    for(size_t bucket = 0; bucket < stats.portDistribution.size(); bucket++)
+    {
+        if(stats.portDistribution[bucket] != 0)
+            os << " [" << (size_t(1) << bucket) << ',' << (size_t(2) << bucket) << ")=" << stats.portDistribution[bucket];
+    }
+    os << "\nport sets on the heap: " << stats.sharedPortSets;
+    os << "\nestimated memory: " << stats.memoryBytes << " bytes";
+    os << "\nmerges: " << stats.merges << ", port trees copied: " << stats.portTreeCopies << " (" << stats.portIntervalsCopied << " port intervals)";
+    return os;
+}
+
+/**
+ * Freezes the tree into its flat, read only form. See CompiledRuleTree.
+ * @param index IpIndex: how the compiled tree searches the ip addresses
+ */
+template <>
+CompiledRuleTree BasicRuleTree<uint32_t>::compile(IpIndex index) const
+{
+    return CompiledRuleTree(*this, index);
 }
 
 /**
@@ -107,24 +614,144 @@ void RuleTree::insertRule(FirewallRule& rule)
  * at the first found rule, avoiding std::find_if and its O(n) complexity.
  * @return bool: wether the ip address is contained inside a rule
  */
-bool RuleTree::contains(FirewallRule& rule)
+template <typename Address>
+bool BasicRuleTree<Address>::contains(const Rule& rule) const
 {
-    std::string key = makekey(rule);
-    auto rootIt = root.find(key);
-    //check for port range
-    IPInterval ip(rule.ip_range);
-    auto ipRangeIt = rootIt->second.find(ip);
-    if(ipRangeIt != rootIt->second.end())
+    return contains(rule.direction, rule.protocal, rule.port_range.start, rule.ip_range.start);
+}
+
+/**
+ * The allocation free version of contains, used by the packet path. Picking the root is just an array index,
+ * and an interval with an empty port tree doesn't touch the heap.
+ * @param direction Direction: the direction of the packet
+ * @param protocal Protocol: the protocal of the packet
+ * @param port uint16_t: the port of the packet
+ * @param ip Address: the ip address of the packet, uint32_t for IPv4 or Ipv6Address
+ * @return bool: wether the packet is contained inside a rule
+ */
+template <typename Address>
+bool BasicRuleTree<Address>::contains(Direction direction, Protocol protocal, uint16_t port, Address ip) const
+{
+    const IntervalSet& tree = root[rootSlot(direction, protocal)];
+    auto ipRangeIt = tree.find(IntervalType(Range<Address>(ip, ip)));
+    if(ipRangeIt != tree.end())
     {
         // found a rule with a matching range
-        return ipRangeIt->portTree.find(Interval<u_int16_t>(rule.port_range)) != ipRangeIt->portTree.end();
+        return ipRangeIt->portSet.contains(port);
     }
     else
         return false;
-    
 }
 
 /**
- * creates a key for the root of the tree based on the direction and protocol
+ * The ports allowed for at least one address in an ip range, "which ports are open for 10.0.0.0/8". Walks
+ * the ip intervals overlapping the range in order and unions their port sets, reading each interned port
+ * set once however many intervals share it.
+ * @param direction Direction: the direction to look in
+ * @param protocal Protocol: the protocal to look in
+ * @param ips Range<Address>: the addresses to ask about, a single address works too
+ * @return vector<Range<uint16_t>>: sorted port ranges, with overlapping and adjacent ones joined. Empty if
+ * no address in the range allows anything
  */
-std::string RuleTree::makekey(FirewallRule& rule){ return rule.direction + rule.protocal; }
\ No newline at end of file
+template <typename Address>
+std::vector<Range<uint16_t>> BasicRuleTree<Address>::allowedPorts(Direction direction, Protocol protocal, const Range<Address>& ips) const
+{
+    const IntervalSet& tree = root[rootSlot(direction, protocal)];
+    std::vector<Interval<uint16_t>> ports;
+    std::unordered_set<const void*> seen;
+    size_t joinAt = 64;
+    for(auto node = tree.lower_bound(IntervalType(ips)); node != tree.end() && node->ip_range.start <= ips.end; ++node)
+    {
+        const void* block = node->portSet.heapBlock();
+        if(block != nullptr && !seen.insert(block).second)
+            continue;
+        node->portSet.forEach([&ports](const Interval<uint16_t>& range) { ports.push_back(range); });
+
+        //joining whenever the list doubles keeps it near the size of the answer, and once every port is
+        //allowed there is no point looking any further
+        if(ports.size() >= joinAt)
+        {
+            joinPorts(ports);
+            if(ports.size() == 1 && ports[0].start == 0 && ports[0].end == UINT16_MAX)
+                break;
+            joinAt = std::max<size_t>(64, 2 * ports.size());
+        }
+    }
+    joinPorts(ports);
+
+    std::vector<Range<uint16_t>> allowed;
+    allowed.reserve(ports.size());
+    for(const Interval<uint16_t>& range : ports)
+        allowed.emplace_back(range.start, range.end);
+    return allowed;
+}
+
+/**
+ * The addresses a port is allowed for, "who can reach port 22". The ip intervals are ordered by address
+ * and not by port, so this walks every interval overlapping ips and keeps the ones whose port set holds
+ * the port. Narrowing ips down narrows the walk with it.
+ * @param direction Direction: the direction to look in
+ * @param protocal Protocol: the protocal to look in
+ * @param port uint16_t: the port to ask about
+ * @param ips Range<Address>: only look at these addresses, every address by default
+ * @return vector<Range<Address>>: sorted ip ranges cut down to ips, with adjacent ones joined
+ */
+template <typename Address>
+std::vector<Range<Address>> BasicRuleTree<Address>::coveredIps(Direction direction, Protocol protocal, uint16_t port, const Range<Address>& ips) const
+{
+    const IntervalSet& tree = root[rootSlot(direction, protocal)];
+    std::vector<Range<Address>> covered;
+    for(auto node = tree.lower_bound(IntervalType(ips)); node != tree.end() && node->ip_range.start <= ips.end; ++node)
+    {
+        if(!node->portSet.contains(port))
+            continue;
+        Address start = std::max(node->ip_range.start, ips.start);
+        Address end = std::min(node->ip_range.end, ips.end);
+        //intervals never overlap, so the last one ends before this starts and the + 1 can't wrap
+        if(!covered.empty() && covered.back().end + 1 == start)
+            covered.back().end = end;
+        else
+            covered.emplace_back(start, end);
+    }
+    return covered;
+}
+
+/**
+ * How many (ip, port) pairs inside a box are allowed, each interval adding its addresses in the box
+ * times its ports in the box. With a single port this is how many addresses can reach it, and with a
+ * single address how many ports it has open.
+ * @param direction Direction: the direction to look in
+ * @param protocal Protocol: the protocal to look in
+ * @param ips Range<Address>: the addresses to count over, every address by default
+ * @param ports Range<uint16_t>: the ports to count over, every port by default
+ * @return uint64_t: the number of allowed pairs, at most 2^48
+ */
+template <>
+uint64_t BasicRuleTree<uint32_t>::coveredVolume(Direction direction, Protocol protocal, const Range<uint32_t>& ips, const Range<uint16_t>& ports) const
+{
+    const IntervalSet& tree = root[rootSlot(direction, protocal)];
+    uint64_t volume = 0;
+    for(auto node = tree.lower_bound(IntervalType(ips)); node != tree.end() && node->ip_range.start <= ips.end; ++node)
+    {
+        uint64_t addresses = uint64_t(std::min(node->ip_range.end, ips.end)) - std::max(node->ip_range.start, ips.start) + 1;
+        volume += addresses * node->portSet.countPorts(Interval<uint16_t>(ports));
+    }
+    return volume;
+}
+
+/**
+ * @return uint64_t: the allowed (ip, port) pairs of every direction and protocal together
+ */
+template <>
+uint64_t BasicRuleTree<uint32_t>::coveredVolume() const
+{
+    uint64_t volume = 0;
+    for(int direction = 0; direction < 2; direction++)
+        for(int protocal = 0; protocal < 2; protocal++)
+            volume += coveredVolume(Direction(direction), Protocol(protocal));
+    return volume;
+}
+
+//the only two address types the tree is built for
+template class BasicRuleTree<uint32_t>;
+template class BasicRuleTree<Ipv6Address>;
@@ -4,8 +4,24 @@
 #include <fstream>
 #include <vector>
 #include <assert.h>
+#include <string.h>
+
+#include <thread>
+#include <chrono>
+#include <algorithm>
+#include <fcntl.h>
+#include <atomic>
+#include <sstream>
 
 #include "Firewall.h"
+#include "ConcurrentFirewall.h"
+#include "CompiledRuleTree.h"
+#include "Parser.h"
+#include "PacketStream.h"
+#include "RuleCodegen.h"
+#include "GeneratedLookup.h"
+#include "WorkStealingDeque.h"
+#include "ClassifyExecutor.h"
 
 
 using std::string;
@@ -37,6 +53,8 @@ string getFilename(int argc, char* argv[])
     if(argc != 2)
     {
         std::cerr << "Incorrect argument format correct format is" << '\n' << '\t' << "./program [filename]" << '\n';
+        std::cerr << '\t' << "./program [filename] --classify [packets file, stdin if missing or -] [--binary, ipv4 only]" << '\n';
+        std::cerr << '\t' << "./program [filename] --generate [header file] [namespace, generated_rules if missing]" << '\n';
         std::exit(EXIT_FAILURE);
     }
     string filename(argv[1]);
@@ -118,15 +136,1866 @@ void overlappingRuleTest()
     printf("passed overlapping intervals test\n");
 }
 
+void bridgingRuleTest()
+{
+    //a rule which overlaps two existing intervals has to swallow both of them
+    Firewall fw;
+    vector<string> left = {in, tcp, "10", "0.0.0.0-0.0.0.10"};
+    vector<string> right = {in, tcp, "30", "0.0.0.20-0.0.0.30"};
+    vector<string> bridge = {in, tcp, "20", "0.0.0.5-0.0.0.25"};
+    fw.insertRule(left);
+    fw.insertRule(right);
+    fw.insertRule(bridge);
+
+    assert(fw.accept_packet(in, tcp, 10, "0.0.0.30"));
+    assert(fw.accept_packet(in, tcp, 30, "0.0.0.0"));
+    assert(fw.accept_packet(in, tcp, 20, "0.0.0.15"));
+    assert(!fw.accept_packet(in, tcp, 25, "0.0.0.15"));
+    assert(!fw.accept_packet(in, tcp, 10, "0.0.0.31"));
+
+    printf("passed bridging intervals test\n");
+}
+
+void frozenTest()
+{
+    Firewall fw;
+    vector<vector<string>> rules = {
+        {in, tcp, "80", "0.0.0.1"},
+        {in, tcp, "80", "0.0.0.2"},
+        {in, tcp, "10-20", "0.0.1.0-0.0.1.255"},
+        {in, tcp, "443", "0.0.1.128"},
+        {out, udp, "1000-2000", "52.12.48.92"},
+        {out, tcp, "1-65535", "255.255.255.0-255.255.255.255"},
+    };
+    for(vector<string>& rule : rules)
+        fw.insertRule(rule);
+
+    vector<string> directions = {in, out};
+    vector<string> protocals = {tcp, udp};
+    vector<string> ips = {"0.0.0.0", "0.0.0.1", "0.0.0.2", "0.0.0.3", "0.0.1.0", "0.0.1.128", "0.0.1.255", "0.0.2.0",
+                          "52.12.48.91", "52.12.48.92", "255.255.254.255", "255.255.255.0", "255.255.255.255"};
+    vector<uint16_t> ports = {0, 1, 10, 15, 20, 21, 80, 443, 999, 1000, 2000, 2001, 65535};
+
+    vector<bool> expected;
+    for(const string& direction : directions)
+        for(const string& protocal : protocals)
+            for(const string& ip : ips)
+                for(uint16_t port : ports)
+                    expected.push_back(fw.accept_packet(direction, protocal, port, ip));
+
+    fw.freeze();
+    assert(fw.isFrozen());
+    size_t i = 0;
+    for(const string& direction : directions)
+        for(const string& protocal : protocals)
+            for(const string& ip : ips)
+                for(uint16_t port : ports)
+                    assert(fw.accept_packet(direction, protocal, port, ip) == expected[i++]);
+
+    assert(fw.accept_packet(out, tcp, 65535, "255.255.255.255"));
+    assert(fw.accept_packet(in, tcp, 443, "0.0.1.128"));
+    assert(!fw.accept_packet(in, tcp, 444, "0.0.1.127"));
+
+    //inserting a rule drops the compiled rules until the next freeze
+    vector<string> late = {in, udp, "53", "8.8.8.8"};
+    fw.insertRule(late);
+    assert(!fw.isFrozen());
+    assert(fw.accept_packet(in, udp, 53, "8.8.8.8"));
+    fw.freeze();
+    assert(fw.accept_packet(in, udp, 53, "8.8.8.8"));
+
+    printf("passed frozen rule tree test\n");
+}
+
+void typedPacketTest()
+{
+    Firewall fw;
+    vector<string> rule = {out, udp, "1000-2000", "52.12.48.92"};
+    fw.insertRule(rule);
+
+    //52.12.48.92 in host byte order
+    uint32_t ip = (52u << 24) | (12u << 16) | (48u << 8) | 92u;
+    assert(fw.accept_packet(Direction::Outbound, Protocol::Udp, 1500, ip));
+    assert(!fw.accept_packet(Direction::Inbound, Protocol::Udp, 1500, ip));
+    assert(!fw.accept_packet(Direction::Outbound, Protocol::Tcp, 1500, ip));
+    assert(!fw.accept_packet(Direction::Outbound, Protocol::Udp, 1500, ip + 1));
+    assert(fw.accept_packet(out, udp, 1500, "52.12.48.92"));
+
+    bool threw = false;
+    try { fw.accept_packet("sideways", udp, 1500, "52.12.48.92"); }
+    catch(const char*) { threw = true; }
+    assert(threw);
+
+    printf("passed typed packet test\n");
+}
+
+void batchTest()
+{
+    Firewall fw;
+    vector<vector<string>> rules = {
+        {in, tcp, "80", "0.0.0.1-0.0.0.100"},
+        {in, udp, "53", "0.0.0.50-0.0.0.150"},
+        {out, tcp, "1000-2000", "0.0.0.0-0.0.0.10"},
+        {out, udp, "1-65535", "0.0.0.200-0.0.1.0"},
+    };
+    for(vector<string>& rule : rules)
+        fw.insertRule(rule);
+
+    //enough packets to span a few chunks and leave a ragged tail for the vector loops
+    const size_t count = 1000;
+    vector<Direction> directions(count);
+    vector<Protocol> protocals(count);
+    vector<uint16_t> ports(count);
+    vector<uint32_t> ips(count);
+    for(size_t i = 0; i < count; i++)
+    {
+        directions[i] = static_cast<Direction>(i % 2);
+        protocals[i] = static_cast<Protocol>((i / 2) % 2);
+        const uint16_t portChoices[] = {53, 80, 1500, 9999};
+        ports[i] = portChoices[(i / 4) % 4];
+        ips[i] = (i * 7) % 300;
+    }
+    PacketBatch batch = {count, directions.data(), protocals.data(), ports.data(), ips.data()};
+
+    vector<uint8_t> treeVerdicts(count), frozenVerdicts(count);
+    fw.accept_packets(batch, treeVerdicts.data());
+    fw.freeze();
+    fw.accept_packets(batch, frozenVerdicts.data());
+
+    size_t accepted = 0;
+    for(size_t i = 0; i < count; i++)
+    {
+        assert(treeVerdicts[i] == fw.accept_packet(directions[i], protocals[i], ports[i], ips[i]));
+        assert(frozenVerdicts[i] == treeVerdicts[i]);
+        accepted += frozenVerdicts[i];
+    }
+    assert(accepted > 0 && accepted < count);
+
+    printf("passed batch test\n");
+}
+
+void parserTest()
+{
+    uint32_t ip;
+    assert(parseIPv4("192.168.1.2", 11, ip) && ip == 0xC0A80102);
+    assert(parseIPv4("0.0.0.0", 7, ip) && ip == 0);
+    assert(parseIPv4("255.255.255.255", 15, ip) && ip == 0xFFFFFFFF);
+    const char* badIps[] = {"", "1.2.3", "1.2.3.4.5", "256.0.0.1", "1.2.3.04", "1..2.3", "1.2.3.", ".1.2.3",
+                            "1.2.3.4 ", "a.b.c.d", "1.2.3.-4", "1234.1.1.1", "255.255.255.2555"};
+    for(const char* bad : badIps)
+        assert(!parseIPv4(bad, strlen(bad), ip));
+
+    //fields are spans, so the parser must stop at the length it was given
+    assert(parseIPv4("10.0.0.1-10.0.0.9", 8, ip) && ip == 0x0A000001);
+
+    uint16_t port;
+    assert(parsePort("0", 1, port) && port == 0);
+    assert(parsePort("65535", 5, port) && port == 65535);
+    assert(!parsePort("65536", 5, port));
+    assert(!parsePort("", 0, port));
+    assert(!parsePort("8o", 2, port));
+    assert(!parsePort("-1", 2, port));
+
+    Range<uint32_t> ips;
+    assert(parseIpRange("10.0.0.1-10.0.0.9", 17, ips) && ips.start == 0x0A000001 && ips.end == 0x0A000009);
+    assert(parseIpRange("10.0.0.1", 8, ips) && ips.start == ips.end);
+    assert(!parseIpRange("10.0.0.9-10.0.0.1", 17, ips));
+    assert(!parseIpRange("10.0.0.1-", 9, ips));
+
+    assert(parseCidr("10.0.0.0/8", 10, ips) && ips.start == 0x0A000000 && ips.end == 0x0AFFFFFF);
+    assert(parseCidr("192.168.1.7/32", 14, ips) && ips.start == 0xC0A80107 && ips.end == ips.start);
+    assert(parseCidr("0.0.0.0/0", 9, ips) && ips.start == 0 && ips.end == 0xFFFFFFFF);
+    const char* badCidrs[] = {"10.0.0.0", "10.0.0.0/", "10.0.0.0/33", "10.0.0.1/8", "10.0.0.0/08", "10.0.0.0/8/8", "/8"};
+    for(const char* bad : badCidrs)
+        assert(!parseCidr(bad, strlen(bad), ips));
+
+    Ipv6Address ip6;
+    auto parses6 = [&ip6](const char* text) { return parseIPv6(text, strlen(text), ip6); };
+    assert(parses6("::") && ip6 == 0);
+    assert(parses6("::1") && ip6 == 1);
+    assert(parses6("2001:db8::1") && ip6 == makeIpv6(0x20010DB800000000ull, 1));
+    assert(parses6("2001:DB8:0:0:0:0:0:1") && ip6 == makeIpv6(0x20010DB800000000ull, 1));
+    assert(parses6("1:2:3:4:5:6:7:8") && ip6 == makeIpv6(0x0001000200030004ull, 0x0005000600070008ull));
+    assert(parses6("1::") && ip6 == makeIpv6(0x0001000000000000ull, 0));
+    assert(parses6("::ffff:192.168.1.2") && ip6 == makeIpv6(0, 0x0000FFFFC0A80102ull));
+    assert(parses6("ffff:ffff:ffff:ffff:ffff:ffff:ffff:ffff") && ip6 == AddressTraits<Ipv6Address>::max());
+    const char* badIps6[] = {"", ":", ":1", "1:", ":::", "1::2::3", "1:2:3:4:5:6:7:8:9", "1:2:3:4:5:6:7", "12345::",
+                             "g::", "1:2:3:4:5:6:7:8::", "::1.2.3", "1.2.3.4::", "::ffff:1.2.3.4:1", " ::1"};
+    for(const char* bad : badIps6)
+        assert(!parses6(bad));
+
+    //written back out in the short form
+    const char* canonical[] = {"::", "::1", "1::", "2001:db8::1", "1:0:0:2::3", "1:2:3:4:5:6:7:8", "fe80::1:0:0:1"};
+    for(const char* text : canonical)
+        assert(parses6(text) && toString(ip6) == text);
+
+    Range<Ipv6Address> ips6;
+    assert(parseIpRange("::1-::ff", 8, ips6) && ips6.start == 1 && ips6.end == 0xFF);
+    assert(!parseIpRange("::ff-::1", 8, ips6));
+    assert(parseCidr("2001:db8::/32", 13, ips6) && ips6.start == makeIpv6(0x20010DB800000000ull, 0) &&
+           ips6.end == makeIpv6(0x20010DB8FFFFFFFFull, ~0ull));
+    assert(parseCidr("::/0", 4, ips6) && ips6.start == 0 && ips6.end == AddressTraits<Ipv6Address>::max());
+    assert(!parseCidr("2001:db8::1/64", 14, ips6));
+    assert(!parseCidr("::/129", 6, ips6));
+
+    Range<uint16_t> ports;
+    assert(parsePortRange("10000-20000", 11, ports) && ports.start == 10000 && ports.end == 20000);
+    assert(parsePortRange("80", 2, ports) && ports.start == 80 && ports.end == 80);
+    assert(!parsePortRange("20-10", 5, ports));
+    assert(!parsePortRange("1-2-3", 5, ports));
+
+    //bad rules are rejected instead of going in as garbage
+    Firewall fw;
+    vector<string> bad = {in, tcp, "80", "300.0.0.1"};
+    bool threw = false;
+    try { fw.insertRule(bad); }
+    catch(const char*) { threw = true; }
+    assert(threw);
+
+    printf("passed parser test\n");
+}
+
+void csvReaderTest()
+{
+    //crlf endings, a blank line in the middle and no newline at the very end
+    string filename = "/tmp/firewall_csv_reader_test.csv";
+    std::ofstream out_file(filename);
+    out_file << "inbound,tcp,80,0.0.0.1\r\n\r\noutbound,udp,1000-2000,52.12.48.92\ninbound,udp,53,192.168.1.1-192.168.2.5";
+    out_file.close();
+
+    CSVReader reader(filename);
+    CSVRow row;
+    assert(reader.next(row) && row.count == 4 && row.fields[IP].str() == "0.0.0.1");
+    assert(reader.next(row) && row.count == 4 && row.fields[PORT].str() == "1000-2000");
+    vector<string> line;
+    reader.getNext(line);
+    assert(line.size() == 4 && line[IP] == "192.168.1.1-192.168.2.5");
+    assert(!reader.next(row));
+    reader.getNext(line);
+    assert(line.empty());
+
+    Firewall fw(filename);
+    assert(fw.accept_packet(in, tcp, 80, "0.0.0.1"));
+    assert(fw.accept_packet(out, udp, 1500, "52.12.48.92"));
+    assert(fw.accept_packet(in, udp, 53, "192.168.2.5"));
+    assert(!fw.accept_packet(in, udp, 53, "192.168.2.6"));
+    remove(filename.c_str());
+
+    printf("passed csv reader test\n");
+}
+
+/**
+ * Writes a file of small, heavily overlapping rules, so that loading it exercises the merges
+ */
+void writeOverlappingRules(const string& filename, int count)
+{
+    std::ofstream out_file(filename);
+    uint32_t seed = 12345;
+    for(int i = 0; i < count; i++)
+    {
+        seed = seed * 1103515245 + 12345;
+        uint32_t ip = (seed >> 8) % 2000;
+        uint32_t span = (seed >> 4) % 8;
+        uint32_t port = (seed >> 12) % 100;
+        out_file << ((seed >> 1) & 1 ? in : out) << ',' << ((seed >> 2) & 1 ? tcp : udp) << ',';
+        out_file << port << '-' << port + (seed >> 20) % 5 << ',';
+        out_file << "0.0." << ip / 256 << '.' << ip % 256 << "-0.0." << (ip + span) / 256 << '.' << (ip + span) % 256 << '\n';
+    }
+}
+
+void parallelLoadTest()
+{
+    string filename = "/tmp/firewall_parallel_load_test.csv";
+    writeOverlappingRules(filename, 3000);
+
+    Firewall serial(filename);
+    LoadOptions options;
+    options.threads = 4;
+    Firewall parallel(filename, options);
+    options.threads = 64;
+    Firewall tooManyThreads(filename, options);
+
+    vector<string> directions = {in, out};
+    vector<string> protocals = {tcp, udp};
+    for(const string& direction : directions)
+        for(const string& protocal : protocals)
+            for(uint32_t ip = 0; ip < 2020; ip += 3)
+                for(uint16_t port = 0; port < 110; port += 7)
+                {
+                    string address = "0.0." + std::to_string(ip / 256) + "." + std::to_string(ip % 256);
+                    bool expected = serial.accept_packet(direction, protocal, port, address);
+                    assert(parallel.accept_packet(direction, protocal, port, address) == expected);
+                    assert(tooManyThreads.accept_packet(direction, protocal, port, address) == expected);
+                }
+    remove(filename.c_str());
+
+    printf("passed parallel load test\n");
+}
+
+void pipelinedLoadTest()
+{
+    string filename = "/tmp/firewall_pipelined_load_test.csv";
+    writeOverlappingRules(filename, 5000);
+
+    LoadOptions options;
+    options.bulk = false;
+    Firewall incremental(filename, options);
+    options.pipelined = true;
+    Firewall pipelined(filename, options);
+
+    vector<string> directions = {in, out};
+    vector<string> protocals = {tcp, udp};
+    for(const string& direction : directions)
+        for(const string& protocal : protocals)
+            for(uint32_t ip = 0; ip < 2020; ip += 3)
+                for(uint16_t port = 0; port < 110; port += 7)
+                {
+                    string address = "0.0." + std::to_string(ip / 256) + "." + std::to_string(ip % 256);
+                    bool expected = incremental.accept_packet(direction, protocal, port, address);
+                    assert(pipelined.accept_packet(direction, protocal, port, address) == expected);
+                }
+
+    //a bad line a few batches in has to come back out of the reader thread
+    std::ofstream out_file(filename, std::ios::app);
+    out_file << "inbound,tcp,80,not an ip\n";
+    out_file.close();
+    bool threw = false;
+    try
+    {
+        Firewall broken(filename, options);
+    }
+    catch(const char*) { threw = true; }
+    assert(threw);
+    remove(filename.c_str());
+
+    printf("passed pipelined load test\n");
+}
+
+void bulkLoadTest()
+{
+    string filename = "/tmp/firewall_bulk_load_test.csv";
+    writeOverlappingRules(filename, 3000);
+
+    LoadOptions options;
+    options.bulk = false;
+    Firewall incremental(filename, options);
+    Firewall bulk(filename);
+    options.bulk = true;
+    options.threads = 3;
+    Firewall parallelBulk(filename, options);
+
+    vector<string> directions = {in, out};
+    vector<string> protocals = {tcp, udp};
+    for(const string& direction : directions)
+        for(const string& protocal : protocals)
+            for(uint32_t ip = 0; ip < 2020; ip += 3)
+                for(uint16_t port = 0; port < 110; port += 7)
+                {
+                    string address = "0.0." + std::to_string(ip / 256) + "." + std::to_string(ip % 256);
+                    bool expected = incremental.accept_packet(direction, protocal, port, address);
+                    assert(bulk.accept_packet(direction, protocal, port, address) == expected);
+                    assert(parallelBulk.accept_packet(direction, protocal, port, address) == expected);
+                }
+
+    //bulk inserting into a tree which already has rules merges them in
+    vector<FirewallRule> rules;
+    FirewallRule rule;
+    rule.direction = Direction::Inbound;
+    rule.protocal = Protocol::Tcp;
+    rule.ip_range = Range<uint32_t>(500, 600);
+    rule.port_range = Range<uint16_t>(10, 20);
+    rules.push_back(rule);
+    rule.ip_range = Range<uint32_t>(5000, 5000);
+    rules.push_back(rule);
+    RuleTree tree;
+    tree.insertRule(rule);
+    tree.insertRules(rules);
+    assert(tree.contains(Direction::Inbound, Protocol::Tcp, 15, 550));
+    assert(tree.contains(Direction::Inbound, Protocol::Tcp, 20, 5000));
+    assert(!tree.contains(Direction::Inbound, Protocol::Tcp, 21, 5000));
+    assert(!tree.contains(Direction::Inbound, Protocol::Tcp, 15, 601));
+    remove(filename.c_str());
+
+    printf("passed bulk load test\n");
+}
+
+/**
+ * A firewall saved as a snapshot and loaded back in should answer exactly like the one that was saved, a
+ * damaged snapshot should be rejected, and rules can still be added after loading one.
+ */
+void snapshotTest()
+{
+    string filename = "/tmp/firewall_snapshot_test.csv";
+    string snapshot = "/tmp/firewall_snapshot_test.rules";
+    writeOverlappingRules(filename, 3000);
+
+    Firewall original(filename);
+    original.save(snapshot);
+    Firewall loaded = Firewall::load(snapshot);
+    assert(loaded.isFrozen());
+
+    vector<string> directions = {in, out};
+    vector<string> protocals = {tcp, udp};
+    for(const string& direction : directions)
+        for(const string& protocal : protocals)
+            for(uint32_t ip = 0; ip < 2020; ip += 3)
+                for(uint16_t port = 0; port < 110; port += 7)
+                {
+                    string address = "0.0." + std::to_string(ip / 256) + "." + std::to_string(ip % 256);
+                    assert(loaded.accept_packet(direction, protocal, port, address) == original.accept_packet(direction, protocal, port, address));
+                }
+
+    //saving a loaded snapshot gives back the same snapshot
+    string resaved = "/tmp/firewall_snapshot_test_resaved.rules";
+    loaded.save(resaved);
+    Firewall reloaded = Firewall::load(resaved);
+    assert(reloaded.accept_packet(Direction::Inbound, Protocol::Tcp, 5, 100) == original.accept_packet(Direction::Inbound, Protocol::Tcp, 5, 100));
+
+    //an empty firewall round trips too
+    Firewall empty;
+    empty.save(resaved);
+    assert(!Firewall::load(resaved).accept_packet(in, tcp, 80, "0.0.0.1"));
+
+    //flip a byte in the payload, the checksum should catch it
+    FILE* file = fopen(snapshot.c_str(), "r+b");
+    fseek(file, -5, SEEK_END);
+    int byte = fgetc(file);
+    fseek(file, -5, SEEK_END);
+    fputc(byte ^ 0x10, file);
+    fclose(file);
+    bool rejected = false;
+    try
+    {
+        Firewall::load(snapshot);
+    }
+    catch(const char* error)
+    {
+        rejected = true;
+    }
+    assert(rejected);
+
+    //a csv file isn't a snapshot
+    rejected = false;
+    try
+    {
+        Firewall::load(filename);
+    }
+    catch(const char* error)
+    {
+        rejected = true;
+    }
+    assert(rejected);
+
+    //inserting after a load keeps the snapshot's rules
+    assert(!loaded.accept_packet(in, tcp, 9999, "10.0.0.1"));
+    loaded.insertRule(FirewallRule{Direction::Inbound, Protocol::Tcp, Range<uint32_t>(167772161, 167772161), Range<uint16_t>(9999, 9999)});
+    assert(loaded.accept_packet(in, tcp, 9999, "10.0.0.1"));
+    for(uint32_t ip = 0; ip < 2020; ip += 11)
+        assert(loaded.accept_packet(Direction::Outbound, Protocol::Udp, 42, ip) == original.accept_packet(Direction::Outbound, Protocol::Udp, 42, ip));
+    remove(filename.c_str());
+    remove(snapshot.c_str());
+    remove(resaved.c_str());
+
+    printf("passed snapshot test\n");
+}
+
+/**
+ * Readers hammer a ConcurrentFirewall while a writer inserts one port at a time, in order. Every batch is
+ * answered from a single version of the rules, so the accepted ports in it should always be a prefix of
+ * the inserted ones, and that prefix should never shrink.
+ */
+void concurrentTest()
+{
+    const uint16_t portCount = 300;
+    ConcurrentFirewall fw;
+    assert(fw.version() == 1);
+    assert(!fw.accept_packet(in, tcp, 1, "0.0.3.232"));
+
+    vector<Direction> directions(portCount, Direction::Inbound);
+    vector<Protocol> protocals(portCount, Protocol::Tcp);
+    vector<uint16_t> ports(portCount);
+    vector<uint32_t> ips(portCount, 1000);
+    for(uint16_t port = 0; port < portCount; port++)
+        ports[port] = port + 1;
+    PacketBatch batch = {portCount, directions.data(), protocals.data(), ports.data(), ips.data()};
+
+    std::atomic<bool> done(false);
+    std::atomic<bool> consistent(true);
+    vector<std::thread> readers;
+    for(int reader = 0; reader < 3; reader++)
+    {
+        readers.emplace_back([&]() {
+            vector<uint8_t> verdicts(portCount);
+            size_t seen = 0;
+            while(!done.load())
+            {
+                fw.accept_packets(batch, verdicts.data());
+                size_t prefix = 0;
+                while(prefix < portCount && verdicts[prefix])
+                    prefix++;
+                for(size_t i = prefix; i < portCount; i++)
+                    if(verdicts[i])
+                        consistent = false;
+                //a later lookup can only see the same rules or more
+                if(prefix < seen || (prefix > 0 && !fw.accept_packet(Direction::Inbound, Protocol::Tcp, prefix, 1000)))
+                    consistent = false;
+                seen = prefix;
+            }
+        });
+    }
+
+    for(uint16_t port = 1; port <= portCount; port++)
+        fw.insertRule(FirewallRule{Direction::Inbound, Protocol::Tcp, Range<uint32_t>(1000, 1000), Range<uint16_t>(port, port)});
+    done = true;
+    for(std::thread& reader : readers)
+        reader.join();
+    assert(consistent);
+    assert(fw.version() == 1 + portCount);
+
+    //a batch of rules is published as one version
+    vector<FirewallRule> rules = {
+        {Direction::Outbound, Protocol::Udp, Range<uint32_t>(5, 10), Range<uint16_t>(53, 53)},
+        {Direction::Outbound, Protocol::Udp, Range<uint32_t>(8, 20), Range<uint16_t>(80, 80)},
+    };
+    fw.insertRules(rules);
+    assert(fw.version() == 2 + portCount);
+    assert(fw.accept_packet(out, udp, 53, "0.0.0.9"));
+    assert(fw.accept_packet(out, udp, 80, "0.0.0.5"));
+    assert(!fw.accept_packet(out, udp, 81, "0.0.0.5"));
+    assert(fw.accept_packet(in, tcp, 300, "0.0.3.232"));
+
+    printf("passed concurrent test\n");
+}
+
+/**
+ * The verdict cache should answer repeat packets without changing any verdict, forget everything when
+ * a rule is inserted, and keep the verdicts of different firewalls apart.
+ */
+void verdictCacheTest()
+{
+    Firewall fw;
+    vector<string> rule = {in, tcp, "80", "0.0.0.1-0.0.0.100"};
+    fw.insertRule(rule);
+    fw.setVerdictCache(true);
+
+    VerdictCache::resetStats();
+    assert(fw.accept_packet(Direction::Inbound, Protocol::Tcp, 80, 50));
+    assert(!fw.accept_packet(Direction::Inbound, Protocol::Tcp, 81, 50));
+    assert(VerdictCache::stats().hits == 0 && VerdictCache::stats().misses == 2);
+    for(int i = 0; i < 10; i++)
+    {
+        assert(fw.accept_packet(Direction::Inbound, Protocol::Tcp, 80, 50));
+        assert(!fw.accept_packet(Direction::Inbound, Protocol::Tcp, 81, 50));
+    }
+    assert(VerdictCache::stats().hits == 20 && VerdictCache::stats().misses == 2);
+
+    //the cached "no" has to go once a rule allows the packet
+    vector<string> wider = {in, tcp, "81", "0.0.0.50"};
+    fw.insertRule(wider);
+    assert(fw.accept_packet(Direction::Inbound, Protocol::Tcp, 81, 50));
+    assert(VerdictCache::stats().misses == 3);
+
+    //same packet, different rules
+    Firewall other;
+    other.setVerdictCache(true);
+    assert(!other.accept_packet(Direction::Inbound, Protocol::Tcp, 80, 50));
+    assert(fw.accept_packet(Direction::Inbound, Protocol::Tcp, 80, 50));
+
+    //direction and protocal are part of the key
+    assert(!fw.accept_packet(Direction::Outbound, Protocol::Tcp, 80, 50));
+    assert(!fw.accept_packet(Direction::Inbound, Protocol::Udp, 80, 50));
+
+    //lots of packets through a frozen firewall, more than fit in the cache, agree with no cache
+    fw.freeze();
+    Firewall uncached;
+    uncached.insertRule(rule);
+    uncached.insertRule(wider);
+    for(int round = 0; round < 2; round++)
+        for(uint32_t ip = 0; ip < 120; ip++)
+            for(uint16_t port = 75; port < 140; port++)
+                assert(fw.accept_packet(Direction::Inbound, Protocol::Tcp, port, ip) == uncached.accept_packet(Direction::Inbound, Protocol::Tcp, port, ip));
+
+    ConcurrentFirewall concurrent;
+    concurrent.setVerdictCache(true);
+    assert(!concurrent.accept_packet(Direction::Inbound, Protocol::Tcp, 80, 50));
+    concurrent.insertRule(rule);
+    assert(concurrent.accept_packet(Direction::Inbound, Protocol::Tcp, 80, 50));
+
+    printf("passed verdict cache test\n");
+}
+
+/**
+ * The shape of the rules should always be reported, and the counters only counted in a FIREWALL_STATS build
+ */
+void statsTest()
+{
+    Firewall fw;
+    vector<vector<string>> rules = {
+        {in, tcp, "80", "0.0.0.1-0.0.0.10"},
+        {in, tcp, "81", "0.0.0.5-0.0.0.20"},      //merges with the first
+        {in, tcp, "90-95", "0.0.0.30"},
+        {in, tcp, "100", "0.0.0.30"},
+        {in, tcp, "200", "0.0.0.30"},
+        {out, udp, "53", "0.0.0.1"},
+    };
+    for(vector<string>& rule : rules)
+        fw.insertRule(rule);
+
+    FirewallStats stats = fw.stats();
+    assert(stats.rules.ipIntervals[rootSlot(Direction::Inbound, Protocol::Tcp)] == 2);
+    assert(stats.rules.ipIntervals[rootSlot(Direction::Outbound, Protocol::Udp)] == 1);
+    assert(stats.rules.ipIntervals[rootSlot(Direction::Outbound, Protocol::Tcp)] == 0);
+    assert(stats.rules.portIntervals == 5);
+    //two intervals with a single port range (80 and 81 are adjacent, so they are joined) and one with three
+    assert(stats.rules.portDistribution.size() == 2 && stats.rules.portDistribution[0] == 2 && stats.rules.portDistribution[1] == 1);
+    assert(stats.rules.memoryBytes > 0);
+    assert(!stats.frozen && stats.compiledBytes == 0);
+
+    fw.setLatencySampling(1);
+    assert(fw.accept_packet(Direction::Inbound, Protocol::Tcp, 81, 2));
+    assert(!fw.accept_packet(Direction::Inbound, Protocol::Tcp, 82, 2));
+    fw.freeze();
+    vector<Direction> directions = {Direction::Inbound, Direction::Outbound};
+    vector<Protocol> protocals = {Protocol::Tcp, Protocol::Udp};
+    vector<uint16_t> ports = {92, 53};
+    vector<uint32_t> ips = {30, 2};
+    PacketBatch batch = {2, directions.data(), protocals.data(), ports.data(), ips.data()};
+    uint8_t verdicts[2];
+    fw.accept_packets(batch, verdicts);
+
+    stats = fw.stats();
+    assert(stats.frozen && stats.compiledBytes > 0);
+#ifdef FIREWALL_STATS
+    //the merged port set was inline, so there was nothing shared to copy
+    assert(stats.rules.merges == 1 && stats.rules.portTreeCopies == 0 && stats.rules.portIntervalsCopied == 0);
+    assert(stats.accepted == 2 && stats.denied == 2);
+    assert(stats.latencySamples == 2);
+#else
+    assert(stats.rules.merges == 0 && stats.accepted == 0 && stats.denied == 0 && stats.latencySamples == 0);
+#endif
+    printf("passed stats test\n");
+}
+
+/**
+ * A port set should hold the same ports as a plain array of flags as it grows from a few inline
+ * intervals to a list and then a bitmap, and as merging ranges shrinks it back down again.
+ */
+void portSetTest()
+{
+    PortSet ports;
+    vector<bool> expected(65536, false);
+    auto insert = [&](uint32_t start, uint32_t end) {
+        ports.insert(Interval<uint16_t>(start, end));
+        for(uint32_t port = start; port <= end; port++)
+            expected[port] = true;
+    };
+    auto check = [&]() {
+        for(uint32_t port = 0; port < 65536; port++)
+            assert(ports.contains(port) == expected[port]);
+        size_t runs = 0;
+        for(uint32_t port = 0; port < 65536; port++)
+            runs += expected[port] && (port == 0 || !expected[port - 1]);
+        assert(ports.size() == runs);
+        size_t visited = 0;
+        uint32_t previousEnd = 0;
+        ports.forEach([&](const Interval<uint16_t>& range) {
+            assert(visited == 0 || range.start > previousEnd + 1);
+            assert(expected[range.start] && expected[range.end]);
+            previousEnd = range.end;
+            visited++;
+        });
+        assert(visited == runs);
+        for(uint32_t start = 0; start < 65536; start += 7919)
+        {
+            uint32_t end = std::min<uint32_t>(65535, start + start % 3001);
+            uint32_t inside = 0;
+            for(uint32_t port = start; port <= end; port++)
+                inside += expected[port];
+            assert(ports.countPorts(Interval<uint16_t>(start, end)) == inside);
+        }
+        assert(ports.countPorts(Interval<uint16_t>(0, 65535)) == uint32_t(std::count(expected.begin(), expected.end(), true)));
+    };
+
+    insert(80, 80);
+    insert(81, 81);                 //adjacent, joined into 80-81
+    insert(443, 443);
+    insert(0, 0);
+    assert(ports.isInline() && ports.size() == 3);
+    check();
+    insert(65535, 65535);
+    assert(!ports.isInline() && !ports.isBitmap());
+    check();
+
+    //every fourth port is its own interval, which is more than a list should hold
+    for(uint32_t port = 1000; port < 1000 + 4 * PORTSET_BITMAP_INTERVALS; port += 4)
+        insert(port, port + 1);
+    assert(ports.isBitmap());
+    check();
+
+    PortSet copy = ports;
+    PortSet small;
+    small.insert(Interval<uint16_t>(20000, 20010));
+    copy.insert(small);
+    assert(copy.isBitmap() && copy.contains(20005) && !ports.contains(20005));
+
+    //filling in the gaps joins the runs, which turns it back into a list and then an inline set
+    insert(1000, 1000 + 3 * PORTSET_BITMAP_INTERVALS);
+    assert(!ports.isBitmap());
+    check();
+    insert(1, 65534);
+    assert(ports.isInline() && ports.size() == 1);
+    check();
+
+    //a list unioned with a bitmap becomes a bitmap, and the bitmap goes back once it is joined up
+    PortSet list;
+    for(uint32_t port = 0; port < 40; port += 2)
+        list.insert(Interval<uint16_t>(port, port));
+    list.insert(copy);
+    assert(list.isBitmap() && list.contains(38) && list.contains(20010) && !list.contains(39));
+    list.insert(Interval<uint16_t>(0, 65535));
+    assert(list.isInline() && list.size() == 1);
+
+    //punching holes splits intervals until it becomes a bitmap, and filling them back in undoes it
+    auto erase = [&](uint32_t start, uint32_t end) {
+        ports.remove(Interval<uint16_t>(start, end));
+        for(uint32_t port = start; port <= end; port++)
+            expected[port] = false;
+    };
+    for(uint32_t port = 100; port < 100 + 3 * PORTSET_BITMAP_INTERVALS; port += 3)
+        erase(port, port);
+    assert(ports.isBitmap());
+    check();
+    assert(ports.intersects(Interval<uint16_t>(100, 100)) == expected[100] && ports.intersects(Interval<uint16_t>(100, 101)));
+
+    //the same intervals as a bitmap that shrank and as a list that never grew are still the same set
+    PortSet shrunk, grown;
+    for(uint32_t port = 0; port < 4 * (PORTSET_BITMAP_INTERVALS + 100); port += 4)
+        shrunk.insert(Interval<uint16_t>(port, port + 1));
+    for(uint32_t port = 0; port < 4 * 300; port += 4)
+        shrunk.remove(Interval<uint16_t>(port, port + 1));
+    for(uint32_t port = 4 * 300; port < 4 * (PORTSET_BITMAP_INTERVALS + 100); port += 4)
+        grown.insert(Interval<uint16_t>(port, port + 1));
+    assert(shrunk.isBitmap() && !grown.isBitmap() && !grown.isInline());
+    assert(shrunk == grown && grown == shrunk && shrunk.hash() == grown.hash());
+    PortSetTable table;
+    table.intern(shrunk);
+    table.intern(grown);
+    assert(table.size() == 1 && shrunk.heapBlock() == grown.heapBlock());
+    grown.insert(Interval<uint16_t>(2, 2));
+    assert(!(shrunk == grown) && !(grown == shrunk));
+
+    erase(0, 40000);
+    assert(!ports.isBitmap());
+    check();
+    erase(60000, 60000);
+    erase(40001, 65535);
+    assert(ports.empty() && !ports.intersects(Interval<uint16_t>(0, 65535)));
+    check();
+    printf("passed port set test\n");
+}
+
+/**
+ * The trie index should give the same answers as the rule tree and the Eytzinger search, including in
+ * blocks dense enough to need every level of the trie, and after a round trip through a snapshot.
+ */
+void trieTest()
+{
+    RuleTree tree;
+    uint64_t state = 7;
+    auto next = [&state]() { state = state * 6364136223846793005ull + 1442695040888963407ull; return uint32_t(state >> 33); };
+    auto add = [&tree](Direction direction, uint32_t start, uint32_t end, uint16_t portStart, uint16_t portEnd) {
+        tree.insertRule(FirewallRule{direction, Protocol::Tcp, Range<uint32_t>(start, end), Range<uint16_t>(portStart, portEnd)});
+    };
+
+    //every other address of one /24, so it needs a table for the last 8 bits
+    for(uint32_t ip = 0x0A000100; ip < 0x0A000200; ip += 2)
+        add(Direction::Inbound, ip, ip, ip % 100, ip % 100 + 5);
+    //a few dozen small ranges spread over one /16, so it needs a table for the middle 8 bits
+    for(uint32_t i = 0; i < 40; i++)
+    {
+        uint32_t start = 0x0B000000 + next() % 0x10000;
+        add(Direction::Inbound, start, start + next() % 300, 10, 20);
+    }
+    //wide ranges covering whole blocks, a few sparse ones, and the very ends of the address space
+    add(Direction::Inbound, 0x0C000000, 0x0DFFFFFF, 80, 80);
+    add(Direction::Inbound, 0x0E001234, 0x0E005678, 443, 443);
+    add(Direction::Inbound, 0, 0, 1, 1);
+    add(Direction::Inbound, 0xFFFFFF00, 0xFFFFFFFF, 2, 2);
+    add(Direction::Outbound, 0x0A000150, 0x0A0001F0, 7, 9);
+
+    CompiledRuleTree eytzinger = tree.compile(IpIndex::Eytzinger);
+    CompiledRuleTree trie = tree.compile(IpIndex::Trie);
+    string snapshot = "/tmp/firewall_trie_test.rules";
+    trie.save(snapshot);
+    CompiledRuleTree loaded = CompiledRuleTree::load(snapshot);
+    remove(snapshot.c_str());
+
+    vector<uint32_t> ips = {0, 1, 0xFFFFFFFF, 0xFFFFFEFF, 0x0C000000, 0x0BFFFFFF, 0x0DFFFFFF, 0x0E000000, 0x0E001233, 0x0E001234, 0x0E005678};
+    for(uint32_t ip = 0x0A0000F0; ip < 0x0A000210; ip++)
+        ips.push_back(ip);
+    for(int i = 0; i < 3000; i++)
+        ips.push_back(0x0B000000 + next() % 0x10200);
+    vector<uint16_t> ports = {0, 1, 2, 7, 10, 15, 20, 21, 50, 80, 443};
+
+    vector<Direction> batchDirections;
+    vector<Protocol> batchProtocals;
+    vector<uint16_t> batchPorts;
+    vector<uint32_t> batchIps;
+    vector<uint8_t> expected;
+    for(int d = 0; d < 2; d++)
+        for(uint32_t ip : ips)
+            for(uint16_t port : ports)
+            {
+                Direction direction = static_cast<Direction>(d);
+                bool verdict = tree.contains(direction, Protocol::Tcp, port, ip);
+                assert(eytzinger.contains(direction, Protocol::Tcp, port, ip) == verdict);
+                assert(trie.contains(direction, Protocol::Tcp, port, ip) == verdict);
+                assert(loaded.contains(direction, Protocol::Tcp, port, ip) == verdict);
+                assert(!trie.contains(direction, Protocol::Udp, port, ip));
+                batchDirections.push_back(direction);
+                batchProtocals.push_back(Protocol::Tcp);
+                batchPorts.push_back(port);
+                batchIps.push_back(ip);
+                expected.push_back(verdict);
+            }
+
+    PacketBatch batch = {expected.size(), batchDirections.data(), batchProtocals.data(), batchPorts.data(), batchIps.data()};
+    vector<uint8_t> verdicts(expected.size());
+    trie.containsBatch(batch, verdicts.data());
+    assert(verdicts == expected);
+    assert(trie.memoryBytes() > eytzinger.memoryBytes());
+
+    //a ConcurrentFirewall compiles its snapshots with the index it was asked for
+    string filename = "/tmp/firewall_trie_test.csv";
+    {
+        std::ofstream out_file(filename);
+        out_file << "inbound,tcp,80,12.0.0.0-13.255.255.255\ninbound,tcp,443,14.0.18.52-14.0.86.120\ninbound,tcp,1,0.0.0.0\n";
+    }
+    LoadOptions trieOptions;
+    trieOptions.ipIndex = IpIndex::Trie;
+    ConcurrentFirewall concurrent(filename, trieOptions);
+    Firewall plain(filename);
+    remove(filename.c_str());
+    for(uint32_t ip : ips)
+        for(uint16_t port : ports)
+            assert(concurrent.accept_packet(Direction::Inbound, Protocol::Tcp, port, ip) == plain.accept_packet(Direction::Inbound, Protocol::Tcp, port, ip));
+
+    printf("passed trie test\n");
+}
+
+/**
+ * Trees on a NodePool should answer the same as ones on the heap, and keep working when their sets are
+ * moved, merged into another tree or copied, and the tree they came from goes away.
+ */
+void nodePoolTest()
+{
+    uint64_t state = 11;
+    auto next = [&state]() { state = state * 6364136223846793005ull + 1442695040888963407ull; return uint32_t(state >> 33); };
+    vector<FirewallRule> rules(3000);
+    for(FirewallRule& rule : rules)
+    {
+        rule.direction = static_cast<Direction>(next() & 1);
+        rule.protocal = static_cast<Protocol>(next() & 1);
+        uint32_t ip = next() % 200000;
+        rule.ip_range = Range<uint32_t>(ip, ip + next() % 500);
+        uint16_t port = next() % 1000;
+        rule.port_range = Range<uint16_t>(port, port + next() % 20);
+    }
+
+    RuleTree heap(NodeAllocation::Heap);
+    RuleTree merged;
+    {
+        RuleTree first;
+        RuleTree second;
+        for(size_t i = 0; i < rules.size(); i++)
+        {
+            heap.insertRule(rules[i]);
+            (i % 2 ? first : second).insertRule(rules[i]);
+        }
+        merged.merge(first);
+        merged.merge(second);
+        //first and second are destroyed here, while merged may still hold nodes from their pools
+    }
+    RuleTree copied(merged);
+    RuleTree moved(std::move(merged));
+    assert(heap.stats().memoryBytes > 0 && moved.stats().memoryBytes > 0);
+
+    for(int i = 0; i < 20000; i++)
+    {
+        Direction direction = static_cast<Direction>(next() & 1);
+        Protocol protocal = static_cast<Protocol>(next() & 1);
+        uint16_t port = next() % 1030;
+        uint32_t ip = next() % 201000;
+        bool expected = heap.contains(direction, protocal, port, ip);
+        assert(moved.contains(direction, protocal, port, ip) == expected);
+        assert(copied.contains(direction, protocal, port, ip) == expected);
+    }
+    printf("passed node pool test\n");
+}
+
+/**
+ * Intervals with the same ports should share one port set, changing one of them should copy it first
+ * rather than change the others, and merging intervals shouldn't copy anything it doesn't have to.
+ */
+void sharedPortSetTest()
+{
+    //a copy shares the list until one side changes
+    PortSet services;
+    uint16_t servicePorts[] = {22, 53, 80, 443, 8080};
+    for(uint16_t port : servicePorts)
+        services.insert(Interval<uint16_t>(port, port));
+    PortSet copy = services;
+    assert(copy.heapBlock() == services.heapBlock() && services.useCount() == 2);
+    copy.insert(Interval<uint16_t>(80, 80));
+    assert(copy.heapBlock() == services.heapBlock());
+    copy.insert(Interval<uint16_t>(9000, 9000));
+    assert(copy.heapBlock() != services.heapBlock() && services.useCount() == 1);
+    assert(copy.contains(9000) && !services.contains(9000) && copy.size() == 6 && services.size() == 5);
+
+    //a hundred hosts with the same five services, inserted one rule at a time and in bulk
+    RuleTree tree;
+    vector<FirewallRule> rules;
+    for(uint32_t host = 0; host < 100; host++)
+    {
+        for(uint16_t port : servicePorts)
+        {
+            FirewallRule rule = {Direction::Inbound, Protocol::Tcp, Range<uint32_t>(host * 10, host * 10 + 4), Range<uint16_t>(port, port)};
+            tree.insertRule(rule);
+            rules.push_back(rule);
+        }
+    }
+    //sets built up one rule at a time only get shared in batches
+    tree.internPortSets();
+    RuleTreeStats stats = tree.stats();
+    assert(stats.ipIntervals[rootSlot(Direction::Inbound, Protocol::Tcp)] == 100 && stats.sharedPortSets == 1);
+    RuleTree bulk;
+    bulk.insertRules(rules);
+    assert(bulk.stats().sharedPortSets == 1);
+
+    //one host gets an extra port, which must not leak into the others
+    FirewallRule extra = {Direction::Inbound, Protocol::Tcp, Range<uint32_t>(50, 54), Range<uint16_t>(9000, 9000)};
+    tree.insertRule(extra);
+    assert(tree.contains(Direction::Inbound, Protocol::Tcp, 9000, 52) && !tree.contains(Direction::Inbound, Protocol::Tcp, 9000, 62));
+    assert(tree.stats().sharedPortSets == 2);
+
+    //bridging two hosts with the same ports is a merge that doesn't change the set, so nothing is copied
+    FirewallRule bridge = {Direction::Inbound, Protocol::Tcp, Range<uint32_t>(0, 14), Range<uint16_t>(80, 80)};
+    tree.insertRule(bridge);
+    stats = tree.stats();
+    assert(stats.ipIntervals[rootSlot(Direction::Inbound, Protocol::Tcp)] == 99 && stats.sharedPortSets == 2);
+    assert(stats.portTreeCopies == 0);
+    assert(tree.contains(Direction::Inbound, Protocol::Tcp, 443, 7) && tree.contains(Direction::Inbound, Protocol::Tcp, 8080, 14));
+
+    //and the same through merge
+    bulk.merge(tree);
+    stats = bulk.stats();
+    assert(stats.sharedPortSets == 2 && bulk.contains(Direction::Inbound, Protocol::Tcp, 9000, 50));
+    printf("passed shared port set test\n");
+}
+
+/**
+ * A tree with rules added and removed in random order should allow exactly what a brute force copy of
+ * it does. The reference keeps the same union semantics as insertRule, so overlapping rules merge their
+ * ports, and removing takes ports away from the part of each interval inside the removed range.
+ */
+void removeRuleTest()
+{
+    struct Reference
+    {
+        uint32_t start;
+        uint32_t end;
+        vector<bool> ports;
+    };
+    const uint32_t ipSpace = 300;
+    const uint32_t portSpace = 64;
+    vector<Reference> reference;
+    RuleTree tree;
+    Firewall firewall;
+
+    uint64_t state = 17;
+    auto next = [&state]() { state = state * 6364136223846793005ull + 1442695040888963407ull; return uint32_t(state >> 33); };
+    auto overlaps = [](const Reference& interval, uint32_t start, uint32_t end) { return interval.start <= end && start <= interval.end; };
+
+    for(int step = 0; step < 3000; step++)
+    {
+        uint32_t ip = next() % ipSpace;
+        uint32_t ipEnd = std::min(ipSpace - 1, ip + next() % 40);
+        uint16_t port = next() % portSpace;
+        uint16_t portEnd = std::min<uint32_t>(portSpace - 1, port + next() % 12);
+        FirewallRule rule = {Direction::Inbound, Protocol::Tcp, Range<uint32_t>(ip, ipEnd), Range<uint16_t>(port, portEnd)};
+
+        if(next() % 5 < 3)
+        {
+            Reference merged = {ip, ipEnd, vector<bool>(portSpace, false)};
+            vector<Reference> untouched;
+            for(Reference& interval : reference)
+            {
+                if(!overlaps(interval, ip, ipEnd))
+                {
+                    untouched.push_back(interval);
+                    continue;
+                }
+                merged.start = std::min(merged.start, interval.start);
+                merged.end = std::max(merged.end, interval.end);
+                for(uint32_t p = 0; p < portSpace; p++)
+                    merged.ports[p] = merged.ports[p] || interval.ports[p];
+            }
+            for(uint32_t p = port; p <= portEnd; p++)
+                merged.ports[p] = true;
+            untouched.push_back(merged);
+            reference.swap(untouched);
+            tree.insertRule(rule);
+            firewall.insertRule(rule);
+        }
+        else
+        {
+            vector<Reference> pieces;
+            for(Reference& interval : reference)
+            {
+                bool hit = false;
+                for(uint32_t p = port; p <= portEnd; p++)
+                    hit = hit || interval.ports[p];
+                if(!overlaps(interval, ip, ipEnd) || !hit)
+                {
+                    pieces.push_back(interval);
+                    continue;
+                }
+                if(interval.start < ip)
+                    pieces.push_back({interval.start, ip - 1, interval.ports});
+                Reference middle = {std::max(interval.start, ip), std::min(interval.end, ipEnd), interval.ports};
+                bool any = false;
+                for(uint32_t p = 0; p < portSpace; p++)
+                {
+                    middle.ports[p] = middle.ports[p] && (p < port || p > portEnd);
+                    any = any || middle.ports[p];
+                }
+                if(any)
+                    pieces.push_back(middle);
+                if(interval.end > ipEnd)
+                    pieces.push_back({ipEnd + 1, interval.end, interval.ports});
+            }
+            reference.swap(pieces);
+            tree.removeRule(rule);
+            firewall.removeRule(rule);
+        }
+
+        if(step % 100 == 0)
+            firewall.freeze();
+        if(step % 25 != 0)
+            continue;
+        for(uint32_t address = 0; address < ipSpace + 2; address++)
+        {
+            for(uint32_t p = 0; p < portSpace + 2; p++)
+            {
+                bool expected = false;
+                for(const Reference& interval : reference)
+                    expected = expected || (interval.start <= address && address <= interval.end && p < portSpace && interval.ports[p]);
+                assert(tree.contains(Direction::Inbound, Protocol::Tcp, p, address) == expected);
+                assert(firewall.accept_packet(Direction::Inbound, Protocol::Tcp, p, address) == expected);
+            }
+        }
+        assert(tree.stats().ipIntervals[rootSlot(Direction::Inbound, Protocol::Tcp)] == reference.size());
+    }
+
+    //the string version takes the same fields as insertRule
+    vector<string> line = {in, tcp, "10-20", "0.0.1.0-0.0.1.255"};
+    firewall.insertRule(line);
+    assert(firewall.accept_packet(Direction::Inbound, Protocol::Tcp, 15, 300));
+    firewall.removeRule(line);
+    assert(!firewall.accept_packet(Direction::Inbound, Protocol::Tcp, 15, 300));
+    assert(!firewall.accept_packet(Direction::Outbound, Protocol::Tcp, 15, 300));
+    printf("passed remove rule test\n");
+}
+
+/**
+ * Streams csv and binary packets through classifyStream and checks every verdict against accept_packet,
+ * with buffers small enough that lines and records get split between reads
+ */
+void packetStreamTest()
+{
+    Firewall firewall;
+    vector<string> rule = {in, tcp, "80-90", "10.0.0.0-10.0.0.255"};
+    firewall.insertRule(rule);
+    rule = {out, udp, "53", "8.8.8.8"};
+    firewall.insertRule(rule);
+    rule = {in, tcp, "443", "2001:db8::-2001:db8::ff"};
+    firewall.insertRule(rule);
+    firewall.freeze();
+
+    string csv = "inbound,tcp,80,10.0.0.1\n"
+                 "inbound,tcp,79,10.0.0.1\r\n"
+                 "\n"
+                 "outbound,udp,53,8.8.8.8\n"
+                 "outbound,udp,53,8.8.8.9\n"
+                 "sideways,tcp,80,10.0.0.1\n"
+                 "inbound,tcp,80\n"
+                 "inbound,tcp,80,10.0.0.1,extra\n"
+                 "inbound,tcp,80,10.0.0." + string(100, '1') + "\n"
+                 "inbound,tcp,443,2001:db8::80\n"
+                 "inbound,tcp,443,2001:db8::100\n"
+                 "inbound,tcp,443,2001:db8:::1\n"
+                 "inbound,tcp,90,10.0.0.255";
+    string expected = "1\n0\n1\n0\n0\n0\n0\n0\n1\n0\n0\n1\n";
+    for(size_t bufferBytes : {size_t(32), size_t(64), size_t(STREAM_BUFFER_BYTES)})
+    {
+        FILE* input = tmpfile();
+        FILE* output = tmpfile();
+        fputs(csv.c_str(), input);
+        fflush(input);
+        rewind(input);
+        StreamStats stats = classifyStream(firewall, fileno(input), fileno(output), PacketFormat::Csv, bufferBytes);
+        assert(stats.packets == 12 && stats.accepted == 4 && stats.malformed == 5);
+        rewind(output);
+        char verdicts[64] = {0};
+        assert(fread(verdicts, 1, sizeof(verdicts), output) == expected.size());
+        assert(expected == verdicts);
+        fclose(input);
+        fclose(output);
+    }
+
+    //enough binary records to fill a few batches, plus a bad one and half a record at the end
+    vector<PacketRecord> records;
+    for(uint32_t i = 0; i < 3 * STREAM_BATCH; i++)
+    {
+        PacketRecord record = {(10u << 24) + (i % 300), uint16_t(75 + i % 20), uint8_t(i % 7 == 0), uint8_t(i % 5 == 0)};
+        records.push_back(record);
+    }
+    records.push_back({8u << 24 | 8u << 16 | 8u << 8 | 8u, 53, 1, 2});
+    FILE* input = tmpfile();
+    FILE* output = tmpfile();
+    fwrite(records.data(), sizeof(PacketRecord), records.size(), input);
+    fwrite(records.data(), 3, 1, input);
+    fflush(input);
+    rewind(input);
+    StreamStats stats = classifyStream(firewall, fileno(input), fileno(output), PacketFormat::Binary, 4096 + 3);
+    assert(stats.packets == records.size() + 1 && stats.malformed == 2);
+    rewind(output);
+    vector<uint8_t> verdicts(records.size() + 2);
+    assert(fread(verdicts.data(), 1, verdicts.size(), output) == records.size() + 1);
+    uint64_t accepted = 0;
+    for(size_t i = 0; i + 1 < records.size(); i++)
+    {
+        const PacketRecord& record = records[i];
+        bool accept = firewall.accept_packet(Direction(record.direction), Protocol(record.protocal), record.port, record.ip);
+        assert(verdicts[i] == accept);
+        accepted += accept;
+    }
+    assert(verdicts[records.size() - 1] == 0 && verdicts[records.size()] == 0 && stats.accepted == accepted);
+    fclose(input);
+    fclose(output);
+    printf("passed packet stream test\n");
+}
+
+/**
+ * Compacting has to leave every verdict alone, and leave no two back to back intervals with the same ports
+ */
+void compactTest()
+{
+    RuleTree tree;
+    Firewall firewall;
+    const uint16_t profiles[][2] = {{80, 80}, {443, 443}, {1000, 2000}, {53, 54}};
+    uint32_t seed = 99;
+    for(int i = 0; i < 2000; i++)
+    {
+        seed = seed * 1103515245 + 12345;
+        uint32_t ip = (seed >> 8) % 3000;
+        const uint16_t* ports = profiles[(seed >> 20) % 4];
+        FirewallRule rule = {Direction((seed >> 2) & 1), Protocol::Tcp, Range<uint32_t>(ip, ip + (seed >> 4) % 3), Range<uint16_t>(ports[0], ports[1])};
+        tree.insertRule(rule);
+        firewall.insertRule(rule);
+    }
+    firewall.freeze();
+
+    auto count = [](const RuleTree& tree) {
+        RuleTreeStats stats = tree.stats();
+        return stats.ipIntervals[0] + stats.ipIntervals[1] + stats.ipIntervals[2] + stats.ipIntervals[3];
+    };
+    size_t intervals = count(tree);
+    size_t removed = tree.compact();
+    assert(removed > 0 && count(tree) == intervals - removed);
+    assert(tree.compact() == 0);
+    assert(firewall.compact() == removed && firewall.isFrozen());
+
+    for(int slot = 0; slot < ROOT_COUNT; slot++)
+    {
+        const IPIntervalSet& root = tree.getRoot(slot);
+        for(auto node = root.begin(); node != root.end() && std::next(node) != root.end(); ++node)
+            assert(node->ip_range.end + 1 != std::next(node)->ip_range.start || !(node->portSet == std::next(node)->portSet));
+    }
+
+    Firewall reference;
+    seed = 99;
+    for(int i = 0; i < 2000; i++)
+    {
+        seed = seed * 1103515245 + 12345;
+        uint32_t ip = (seed >> 8) % 3000;
+        const uint16_t* ports = profiles[(seed >> 20) % 4];
+        reference.insertRule({Direction((seed >> 2) & 1), Protocol::Tcp, Range<uint32_t>(ip, ip + (seed >> 4) % 3), Range<uint16_t>(ports[0], ports[1])});
+    }
+    for(int direction = 0; direction < 2; direction++)
+        for(uint32_t ip = 0; ip < 3005; ip++)
+            for(uint16_t port : {uint16_t(53), uint16_t(54), uint16_t(55), uint16_t(80), uint16_t(443), uint16_t(999), uint16_t(1500)})
+            {
+                bool expected = reference.accept_packet(Direction(direction), Protocol::Tcp, port, ip);
+                assert(tree.contains(Direction(direction), Protocol::Tcp, port, ip) == expected);
+                assert(firewall.accept_packet(Direction(direction), Protocol::Tcp, port, ip) == expected);
+            }
+
+    //the neighbouring 0.0.0.1 and 0.0.0.2 lines of test.csv end up as one interval
+    string filename = "/tmp/firewall_compact_test.csv";
+    std::ofstream out_file(filename);
+    out_file << "inbound,tcp,80,0.0.0.1\ninbound,tcp,80,0.0.0.2\ninbound,tcp,80,0.0.1.0\ninbound,tcp,80,192.168.1.2\n";
+    out_file.close();
+    LoadOptions options;
+    Firewall loaded(filename, options);
+    options.compact = true;
+    Firewall compacted(filename, options);
+    remove(filename.c_str());
+    int inboundTcp = rootSlot(Direction::Inbound, Protocol::Tcp);
+    assert(compacted.stats().rules.ipIntervals[inboundTcp] == loaded.stats().rules.ipIntervals[inboundTcp] - 1);
+    assert(compacted.accept_packet(in, tcp, 80, "0.0.0.2") && !compacted.accept_packet(in, tcp, 80, "0.0.0.3"));
+
+    printf("passed compact test\n");
+}
+
+/**
+ * Reloading a changed file has to give the same verdicts as loading it fresh, however the rules changed.
+ * The rules are small and crowded so that removing one splits intervals and adding one joins them.
+ */
+void reloadTest()
+{
+    string filename = "/tmp/firewall_reload_test.csv";
+    uint32_t seed = 4242;
+    auto randomLine = [&seed]() {
+        seed = seed * 1103515245 + 12345;
+        uint32_t ip = (seed >> 8) % 1000;
+        uint32_t span = (seed >> 4) % 6;
+        uint32_t port = (seed >> 16) % 40;
+        return ((seed >> 1) & 1 ? in : out) + ',' + tcp + ',' + std::to_string(port) + '-' + std::to_string(port + (seed >> 24) % 4) + ','
+               + "0.0." + std::to_string(ip / 256) + '.' + std::to_string(ip % 256) + "-0.0." + std::to_string((ip + span) / 256) + '.' + std::to_string((ip + span) % 256);
+    };
+    auto write = [&filename](const vector<string>& lines) {
+        std::ofstream out_file(filename);
+        for(const string& line : lines)
+            out_file << line << '\n';
+    };
+    auto check = [](Firewall& fresh, Firewall& reloaded, ConcurrentFirewall& concurrent) {
+        for(int direction = 0; direction < 2; direction++)
+            for(uint32_t ip = 0; ip < 1010; ip++)
+                for(uint16_t port = 0; port < 46; port += 3)
+                {
+                    bool expected = fresh.accept_packet(Direction(direction), Protocol::Tcp, port, ip);
+                    assert(reloaded.accept_packet(Direction(direction), Protocol::Tcp, port, ip) == expected);
+                    assert(concurrent.accept_packet(Direction(direction), Protocol::Tcp, port, ip) == expected);
+                }
+    };
+
+    vector<string> lines;
+    for(int i = 0; i < 400; i++)
+        lines.push_back(randomLine());
+    write(lines);
+    LoadOptions options;
+    options.reloadable = true;
+    Firewall reloaded(filename, options);
+    ConcurrentFirewall concurrent(filename, options);
+    Firewall plain(filename);
+
+    for(int round = 0; round < 30; round++)
+    {
+        //drop, add and edit a few lines, sometimes a lot of them
+        size_t changes = round % 10 == 9 ? 150 : 1 + round % 6;
+        for(size_t i = 0; i < changes; i++)
+        {
+            seed = seed * 1103515245 + 12345;
+            size_t at = (seed >> 8) % lines.size();
+            if(seed % 3 == 0)
+                lines.erase(lines.begin() + at);
+            else if(seed % 3 == 1)
+                lines.push_back(randomLine());
+            else
+                lines[at] = randomLine();
+        }
+        if(round % 7 == 3)
+            lines.push_back(lines[0]);
+        write(lines);
+
+        Firewall fresh(filename);
+        size_t changed = reloaded.reload(filename);
+        assert(changed <= 2 * changes + 1);
+        assert(concurrent.reload(filename) == changed);
+        if(round == 10)
+            reloaded.freeze();
+        if(round == 20)
+            reloaded.compact();
+        check(fresh, reloaded, concurrent);
+    }
+
+    //the first reload of a firewall that wasn't reloadable builds it from scratch
+    assert(plain.reload(filename) == lines.size());
+    assert(plain.reload(filename) == 0);
+
+    //so does the one after changing the rules by hand
+    reloaded.insertRule({Direction::Inbound, Protocol::Tcp, Range<uint32_t>(0, 2000), Range<uint16_t>(0, 100)});
+    assert(reloaded.reload(filename) == lines.size());
+    Firewall fresh(filename);
+    check(fresh, reloaded, concurrent);
+
+    //a bad line leaves everything as it was
+    lines.push_back("inbound,tcp,80,not an ip");
+    write(lines);
+    bool threw = false;
+    try
+    {
+        reloaded.reload(filename);
+    }
+    catch(const char*) { threw = true; }
+    assert(threw);
+    check(fresh, reloaded, concurrent);
+    remove(filename.c_str());
+
+    printf("passed reload test\n");
+}
+
+/**
+ * The range queries have to agree with asking contains about every (ip, port) pair one at a time. A few
+ * rules allow many ports on their own so some of the port sets are bitmaps.
+ */
+void rangeQueryTest()
+{
+    const uint32_t ipSpace = 300;
+    const uint32_t portSpace = 64;
+    RuleTree tree;
+    uint64_t state = 23;
+    auto next = [&state]() { state = state * 6364136223846793005ull + 1442695040888963407ull; return uint32_t(state >> 33); };
+    for(int i = 0; i < 400; i++)
+    {
+        uint32_t ip = next() % ipSpace;
+        uint16_t port = next() % portSpace;
+        FirewallRule rule = {Direction::Inbound, Protocol::Tcp, Range<uint32_t>(ip, std::min(ipSpace - 1, ip + next() % 8)),
+                             Range<uint16_t>(port, std::min<uint32_t>(portSpace - 1, port + next() % 4))};
+        tree.insertRule(rule);
+    }
+    for(uint32_t port = 1000; port < 1000 + 4 * PORTSET_BITMAP_INTERVALS; port += 4)
+        tree.insertRule({Direction::Inbound, Protocol::Tcp, Range<uint32_t>(150, 160), Range<uint16_t>(port, port)});
+    tree.insertRule({Direction::Outbound, Protocol::Udp, Range<uint32_t>(0, UINT32_MAX), Range<uint16_t>(53, 53)});
+
+    auto isAllowed = [&tree](uint32_t ip, uint16_t port) { return tree.contains(Direction::Inbound, Protocol::Tcp, port, ip); };
+    for(int query = 0; query < 200; query++)
+    {
+        uint32_t start = next() % (ipSpace + 10);
+        Range<uint32_t> ips(start, start + next() % (query % 2 ? 3 : 60));
+        Range<uint16_t> ports(next() % portSpace, 0);
+        ports.end = ports.start + next() % 20;
+
+        //allowed ports, checked on every port with a rule plus either side of the bitmap ones
+        vector<Range<uint16_t>> allowed = tree.allowedPorts(Direction::Inbound, Protocol::Tcp, ips);
+        auto inAllowed = [&allowed](uint16_t port) {
+            for(const Range<uint16_t>& range : allowed)
+                if(range.start <= port && port <= range.end)
+                    return true;
+            return false;
+        };
+        for(size_t i = 1; i < allowed.size(); i++)
+            assert(allowed[i].start > allowed[i - 1].end + 1);
+        for(uint32_t port = 0; port < 1000 + 4 * PORTSET_BITMAP_INTERVALS + 2; port = port < portSpace + 2 ? port + 1 : port + 3)
+        {
+            bool expected = false;
+            for(uint32_t ip = ips.start; ip <= ips.end && !expected; ip++)
+                expected = isAllowed(ip, port);
+            assert(inAllowed(port) == expected);
+        }
+
+        //covered ips for one port, cut down to the window
+        uint16_t port = query % 10 == 0 ? 1000 : ports.start;
+        vector<Range<uint32_t>> covered = tree.coveredIps(Direction::Inbound, Protocol::Tcp, port, ips);
+        for(size_t i = 1; i < covered.size(); i++)
+            assert(covered[i].start > covered[i - 1].end + 1);
+        for(uint32_t ip = ips.start; ip <= ips.end; ip++)
+        {
+            bool inCovered = false;
+            for(const Range<uint32_t>& range : covered)
+                inCovered = inCovered || (range.start <= ip && ip <= range.end);
+            assert(inCovered == isAllowed(ip, port));
+        }
+        if(!covered.empty())
+            assert(covered.front().start >= ips.start && covered.back().end <= ips.end);
+
+        //volume of the box
+        uint64_t volume = 0;
+        for(uint32_t ip = ips.start; ip <= ips.end; ip++)
+            for(uint32_t p = ports.start; p <= ports.end; p++)
+                volume += isAllowed(ip, p);
+        assert(tree.coveredVolume(Direction::Inbound, Protocol::Tcp, ips, ports) == volume);
+    }
+
+    //the whole space, across every root
+    uint64_t inboundTcp = 0;
+    for(uint32_t ip = 0; ip < ipSpace; ip++)
+        for(uint32_t port = 0; port < 1000 + 4 * PORTSET_BITMAP_INTERVALS; port++)
+            inboundTcp += isAllowed(ip, port);
+    assert(tree.coveredVolume(Direction::Inbound, Protocol::Tcp) == inboundTcp);
+    assert(tree.coveredVolume(Direction::Outbound, Protocol::Udp) == (uint64_t(1) << 32));
+    assert(tree.coveredVolume() == inboundTcp + (uint64_t(1) << 32));
+    vector<Range<uint32_t>> everyone = tree.coveredIps(Direction::Outbound, Protocol::Udp, 53);
+    assert(everyone.size() == 1 && everyone[0].start == 0 && everyone[0].end == UINT32_MAX);
+    assert(tree.coveredIps(Direction::Outbound, Protocol::Udp, 54).empty());
+    assert(tree.allowedPorts(Direction::Inbound, Protocol::Udp, Range<uint32_t>(0, UINT32_MAX)).empty());
+
+    //a cidr block straight into a query, through a firewall
+    Firewall firewall;
+    vector<string> line = {in, tcp, "22", "10.1.0.0-10.1.255.255"};
+    firewall.insertRule(line);
+    firewall.freeze();
+    Range<uint32_t> block;
+    assert(parseCidr("10.0.0.0/8", 10, block));
+    vector<Range<uint16_t>> open = firewall.rules().allowedPorts(Direction::Inbound, Protocol::Tcp, block);
+    assert(open.size() == 1 && open[0].start == 22 && open[0].end == 22);
+    assert(firewall.rules().coveredVolume(Direction::Inbound, Protocol::Tcp, block, Range<uint16_t>(22, 22)) == 65536);
+    printf("passed range query test\n");
+}
+
+/**
+ * Checks the unrolled search against std::upper_bound for one table size, on every value in the table and
+ * either side of it
+ */
+template <uint32_t Size>
+void checkBranchlessSearch()
+{
+    uint32_t values[Size];
+    for(uint32_t i = 0; i < Size; i++)
+        values[i] = 10 + 3 * i + (i % 4);
+    for(uint32_t key = 0; key < values[Size - 1] + 3; key++)
+    {
+        const uint32_t* after = std::upper_bound(values, values + Size, key);
+        const uint32_t* expected = after == values ? values : after - 1;
+        assert(BranchlessSearch<Size>::lastNotAfter(values, key) == expected);
+    }
+}
+
+/**
+ * The pieces of the generated lookup: the unrolled search on awkward sizes, a root flattened the way
+ * writeLookupHeader writes it searched against RuleTree::contains, and the header it writes for that tree
+ */
+void generatedLookupTest()
+{
+    checkBranchlessSearch<1>();
+    checkBranchlessSearch<2>();
+    checkBranchlessSearch<3>();
+    checkBranchlessSearch<7>();
+    checkBranchlessSearch<64>();
+    checkBranchlessSearch<1000>();
+
+    //40 ip intervals with gaps between them, each with a few port intervals
+    RuleTree tree;
+    for(uint32_t i = 0; i < 40; i++)
+    {
+        for(uint32_t j = 0; j <= i % 5; j++)
+        {
+            uint16_t port = 7 * j + i % 3;
+            tree.insertRule({Direction::Inbound, Protocol::Tcp, Range<uint32_t>(10 * i + 2, 10 * i + 2 + i % 6), Range<uint16_t>(port, port + j % 3)});
+        }
+    }
+    vector<uint32_t> starts, ends, portOffsets;
+    vector<uint16_t> portStarts, portEnds;
+    for(const IPInterval& interval : tree.getRoot(rootSlot(Direction::Inbound, Protocol::Tcp)))
+    {
+        starts.push_back(interval.ip_range.start);
+        ends.push_back(interval.ip_range.end);
+        portOffsets.push_back(portStarts.size());
+        interval.portSet.forEach([&](const Interval<uint16_t>& range) {
+            portStarts.push_back(range.start);
+            portEnds.push_back(range.end);
+        });
+    }
+    portOffsets.push_back(portStarts.size());
+    assert(starts.size() == 40);
+    for(uint32_t ip = 0; ip < 410; ip++)
+        for(uint32_t port = 0; port < 40; port++)
+            assert(generatedRootContains<40>(starts.data(), ends.data(), portOffsets.data(), portStarts.data(), portEnds.data(), port, ip) ==
+                   tree.contains(Direction::Inbound, Protocol::Tcp, port, ip));
+
+    std::ostringstream header;
+    writeLookupHeader(tree, header, "test_rules", "dir/\"quoted\".csv");
+    string text = header.str();
+    assert(text.find("#ifndef TEST_RULES") != string::npos);
+    assert(text.find("namespace test_rules") != string::npos);
+    assert(text.find("source = \"dir/\\\"quoted\\\".csv\";") != string::npos);
+    assert(text.find("constexpr uint32_t inboundTcpStarts[40] = {\n    2,12,") != string::npos);
+    assert(text.find("generatedRootContains<40>(inboundTcpStarts,") != string::npos);
+    assert(text.find("outboundUdp") == string::npos);
+    bool threw = false;
+    try { writeLookupHeader(tree, header, "not a name", "rules.csv"); }
+    catch(const char*) { threw = true; }
+    assert(threw);
+    printf("passed generated lookup test\n");
+}
+
+/**
+ * RuleTree6 against RuleTree holding the same rules, with the IPv6 ranges straddling the middle of the
+ * address so both halves of the 128 bit compares matter. Overlapping rules merge the same way in both, so
+ * they have to agree on every packet. Then a file mixing IPv4 and IPv6 rules has to load the same every
+ * way it can be loaded, and reload.
+ */
+void ipv6Test()
+{
+    const Ipv6Address middle = makeIpv6(0x20010DB800000000ull, 0);
+    const uint32_t middle4 = 0x80000000;
+    uint64_t state = 61;
+    auto next = [&state]() { state = state * 6364136223846793005ull + 1442695040888963407ull; return uint32_t(state >> 33); };
+
+    vector<FirewallRule> rules;
+    vector<FirewallRule6> rules6;
+    RuleTree tree;
+    RuleTree6 tree6;
+    for(int i = 0; i < 300; i++)
+    {
+        FirewallRule rule;
+        rule.direction = static_cast<Direction>(next() & 1);
+        rule.protocal = static_cast<Protocol>(next() & 1);
+        uint32_t start = next() % 1000;
+        uint32_t end = start + next() % 40;
+        uint16_t port = next() % 60;
+        rule.port_range = Range<uint16_t>(port, port + next() % 5);
+        rule.ip_range = Range<uint32_t>(middle4 - 500 + start, middle4 - 500 + end);
+        rules.push_back(rule);
+        rules6.push_back({rule.direction, rule.protocal, Range<Ipv6Address>(middle - 500 + start, middle - 500 + end), rule.port_range});
+        tree.insertRule(rules.back());
+        tree6.insertRule(rules6.back());
+    }
+    RuleTree6 bulk;
+    bulk.insertRules(rules6);
+    for(int slot = 0; slot < ROOT_COUNT; slot++)
+        for(uint32_t offset = 0; offset < 1060; offset++)
+            for(uint16_t port = 0; port < 66; port += 5)
+            {
+                Direction direction = static_cast<Direction>(slot & 1);
+                Protocol protocal = static_cast<Protocol>(slot >> 1);
+                bool expected = tree.contains(direction, protocal, port, middle4 - 510 + offset);
+                assert(tree6.contains(direction, protocal, port, middle - 510 + offset) == expected);
+                assert(bulk.contains(direction, protocal, port, middle - 510 + offset) == expected);
+            }
+    assert(tree.stats().portIntervals == tree6.stats().portIntervals);
+
+    //the top and bottom of the address space
+    RuleTree6 edges;
+    edges.insertRule({Direction::Inbound, Protocol::Tcp, Range<Ipv6Address>(AddressTraits<Ipv6Address>::max() - 1, AddressTraits<Ipv6Address>::max()), Range<uint16_t>(1, 1)});
+    edges.insertRule({Direction::Inbound, Protocol::Tcp, Range<Ipv6Address>(0, 0), Range<uint16_t>(1, 1)});
+    assert(edges.contains(Direction::Inbound, Protocol::Tcp, 1, AddressTraits<Ipv6Address>::max()));
+    assert(edges.contains(Direction::Inbound, Protocol::Tcp, 1, 0));
+    assert(!edges.contains(Direction::Inbound, Protocol::Tcp, 1, 1));
+    edges.removeRule({Direction::Inbound, Protocol::Tcp, Range<Ipv6Address>(0, AddressTraits<Ipv6Address>::max()), Range<uint16_t>(0, 65535)});
+    assert(edges.empty());
+
+    //a mixed file, every way it can be loaded
+    string filename = "/tmp/firewall_ipv6_test.csv";
+    {
+        std::ofstream out_file(filename);
+        for(int i = 0; i < 200; i++)
+        {
+            out_file << (i & 1 ? in : out) << ',' << tcp << ',' << i % 50 << ',' << "10.0.0." << i % 250 << '\n';
+            out_file << (i & 1 ? in : out) << ',' << udp << ',' << i % 50 << '-' << i % 50 + 2 << ",2001:db8::" << std::hex << i << std::dec
+                     << "-2001:db8::" << std::hex << i + 3 << std::dec << '\n';
+        }
+    }
+    auto check = [](const Firewall& expected, const Firewall& firewall) {
+        for(int direction = 0; direction < 2; direction++)
+            for(uint32_t host = 0; host < 260; host++)
+                for(uint16_t port = 0; port < 53; port++)
+                {
+                    Direction d = static_cast<Direction>(direction);
+                    Ipv6Address ip6 = makeIpv6(0x20010DB800000000ull, host);
+                    assert(firewall.accept_packet(d, Protocol::Tcp, port, 0x0A000000 + host) == expected.accept_packet(d, Protocol::Tcp, port, 0x0A000000 + host));
+                    assert(firewall.accept_packet6(d, Protocol::Udp, port, ip6) == expected.accept_packet6(d, Protocol::Udp, port, ip6));
+                }
+    };
+    LoadOptions sequential;
+    sequential.bulk = false;
+    Firewall expected(filename, sequential);
+    assert(!expected.rules6().empty());
+    assert(expected.accept_packet(in, udp, 1, "2001:db8::3"));
+    assert(expected.accept_packet(in, udp, 3, "2001:DB8:0::4"));
+    assert(!expected.accept_packet(in, udp, 1, "2001:db8::1:3"));
+    assert(expected.accept_packet(out, tcp, 0, "10.0.0.0"));
+    LoadOptions parallel;
+    parallel.threads = 4;
+    LoadOptions pipelined;
+    pipelined.pipelined = true;
+    LoadOptions reloadable;
+    reloadable.reloadable = true;
+    reloadable.compact = true;
+    Firewall reloaded(filename, reloadable);
+    check(expected, Firewall(filename));
+    check(expected, Firewall(filename, parallel));
+    check(expected, Firewall(filename, pipelined));
+    check(expected, reloaded);
+
+    //only the IPv4 rules are compiled
+    reloaded.freeze();
+    check(expected, reloaded);
+    assert(reloaded.reload(filename) == 0);
+    vector<string> line = {in, udp, "9000", "::1"};
+    reloaded.insertRule(line);
+    assert(reloaded.accept_packet(in, udp, 9000, "::1") && reloaded.isFrozen());
+    reloaded.removeRule(line);
+    assert(!reloaded.accept_packet(in, udp, 9000, "::1"));
+    {
+        std::ofstream out_file(filename, std::ios::app);
+        out_file << in << ',' << udp << ",9000,::1\n";
+    }
+    assert(reloaded.reload(filename) == 401 && reloaded.accept_packet(in, udp, 9000, "::1"));
+    check(Firewall(filename), reloaded);
+
+    //neither snapshots nor ConcurrentFirewall can hold them
+    bool threw = false;
+    try { reloaded.save("/tmp/firewall_ipv6_test.snapshot"); }
+    catch(const char*) { threw = true; }
+    assert(threw);
+    threw = false;
+    try { ConcurrentFirewall concurrent(filename); }
+    catch(const char*) { threw = true; }
+    assert(threw);
+    remove(filename.c_str());
+
+    printf("passed ipv6 test\n");
+}
+
+/**
+ * The deque on its own first: LIFO for the owner, FIFO for thieves, and with an owner popping while three
+ * thieves steal every item comes out exactly once. Then the executor has to give the same verdicts as
+ * accept_packet, with batches of very different sizes so the workers steal from each other, frozen or not,
+ * and over several runs.
+ */
+void executorTest()
+{
+    WorkStealingDeque<size_t> deque(4);
+    size_t item;
+    assert(deque.capacity() == 4 && !deque.pop(item) && !deque.steal(item));
+    for(size_t i = 0; i < 4; i++)
+        assert(deque.push(i));
+    assert(!deque.push(4) && deque.size() == 4);
+    assert(deque.pop(item) && item == 3);
+    assert(deque.steal(item) && item == 0);
+    assert(deque.pop(item) && item == 2);
+    assert(deque.pop(item) && item == 1);
+    assert(!deque.pop(item) && !deque.steal(item) && deque.size() == 0);
+
+    const size_t itemCount = 200000;
+    WorkStealingDeque<size_t> shared(256);
+    std::vector<std::atomic<uint8_t>> seen(itemCount);
+    for(std::atomic<uint8_t>& count : seen)
+        count.store(0);
+    std::atomic<bool> done(false);
+    vector<std::thread> thieves;
+    for(int thief = 0; thief < 3; thief++)
+    {
+        thieves.emplace_back([&]() {
+            size_t stolen;
+            while(!done.load())
+            {
+                if(shared.steal(stolen))
+                    seen[stolen]++;
+                else
+                    std::this_thread::yield();
+            }
+            while(shared.steal(stolen))
+                seen[stolen]++;
+        });
+    }
+    for(size_t next = 0; next < itemCount;)
+    {
+        while(next < itemCount && shared.push(next))
+            next++;
+        for(int i = 0; i < 100 && shared.pop(item); i++)
+            seen[item]++;
+    }
+    while(shared.pop(item))
+        seen[item]++;
+    done = true;
+    for(std::thread& thief : thieves)
+        thief.join();
+    for(std::atomic<uint8_t>& count : seen)
+        assert(count.load() == 1);
+
+    //packets over a small space so about half are accepted
+    Firewall fw;
+    uint64_t state = 3;
+    auto next = [&state]() { state = state * 6364136223846793005ull + 1442695040888963407ull; return uint32_t(state >> 33); };
+    for(int i = 0; i < 500; i++)
+    {
+        uint32_t ip = next() % 5000;
+        uint16_t port = next() % 500;
+        fw.insertRule({static_cast<Direction>(next() & 1), static_cast<Protocol>(next() & 1), Range<uint32_t>(ip, ip + next() % 20), Range<uint16_t>(port, port + next() % 30)});
+    }
+    const size_t packetCount = 100000;
+    vector<Direction> directions(packetCount);
+    vector<Protocol> protocals(packetCount);
+    vector<uint16_t> ports(packetCount);
+    vector<uint32_t> ips(packetCount);
+    for(size_t i = 0; i < packetCount; i++)
+    {
+        directions[i] = static_cast<Direction>(next() & 1);
+        protocals[i] = static_cast<Protocol>(next() & 1);
+        ports[i] = next() % 530;
+        ips[i] = next() % 5020;
+    }
+    //a few big batches among lots of small ones, and one empty one
+    vector<ClassifyTask> tasks;
+    vector<uint8_t> verdicts(packetCount, 2);
+    for(size_t offset = 0; offset < packetCount;)
+    {
+        size_t size = std::min(packetCount - offset, size_t(tasks.size() % 17 == 0 ? 5000 : 1 + next() % 64));
+        if(tasks.size() == 5)
+            size = 0;
+        PacketBatch batch = {size, &directions[offset], &protocals[offset], &ports[offset], &ips[offset]};
+        tasks.push_back({batch, &verdicts[offset]});
+        offset += size;
+    }
+    auto check = [&]() {
+        for(size_t i = 0; i < packetCount; i++)
+            assert(verdicts[i] == fw.accept_packet(directions[i], protocals[i], ports[i], ips[i]));
+    };
+
+    ClassifyExecutor executor(fw, 4);
+    assert(executor.threads() == 4);
+    executor.run(tasks);
+    check();
+    fw.freeze();
+    for(int round = 0; round < 3; round++)
+    {
+        std::fill(verdicts.begin(), verdicts.end(), 2);
+        executor.run(tasks);
+        check();
+    }
+    executor.run(vector<ClassifyTask>());
+
+    //one worker, unpinned, has to do it all itself
+    std::fill(verdicts.begin(), verdicts.end(), 2);
+    ClassifyExecutor single(fw, 1, false);
+    single.run(tasks);
+    check();
+    assert(single.steals() == 0);
+
+    printf("passed executor test\n");
+}
+
 void runTests()
 {
     simpleRangeTest();
     restrictedRangeTest();
     overlappingRuleTest();
+    bridgingRuleTest();
+    frozenTest();
+    typedPacketTest();
+    batchTest();
+    parserTest();
+    csvReaderTest();
+    parallelLoadTest();
+    bulkLoadTest();
+    pipelinedLoadTest();
+    snapshotTest();
+    concurrentTest();
+    verdictCacheTest();
+    statsTest();
+    trieTest();
+    portSetTest();
+    nodePoolTest();
+    sharedPortSetTest();
+    removeRuleTest();
+    packetStreamTest();
+    compactTest();
+    reloadTest();
+    rangeQueryTest();
+    generatedLookupTest();
+    ipv6Test();
+    executorTest();
+}
+
+/**
+ * Loads the rules, then classifies packets from a file or stdin and writes the verdicts to stdout until
+ * the input runs out, see classifyStream. How fast that went is reported on stderr at the end.
+ * @param argc int: number of command line arguments
+ * @param argv char**: the rules file, --classify, then optionally the packets file and --binary
+ * @return int: the exit status
+ */
+int classify(int argc, char* argv[])
+{
+    string packets = "-";
+    PacketFormat format = PacketFormat::Csv;
+    for(int i = 3; i < argc; i++)
+    {
+        if(string(argv[i]) == "--binary")
+            format = PacketFormat::Binary;
+        else
+            packets = argv[i];
+    }
+
+    try
+    {
+        auto begin = std::chrono::steady_clock::now();
+        Firewall firewall(argv[1]);
+        firewall.freeze();
+        double loadSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+
+        int input = packets == "-" ? STDIN_FILENO : open(packets.c_str(), O_RDONLY);
+        if(input < 0)
+            throw "File does not exist error";
+        StreamStats stats = classifyStream(firewall, input, STDOUT_FILENO, format);
+        if(input != STDIN_FILENO)
+            close(input);
+
+        fprintf(stderr, "loaded rules in %.3fs\n", loadSeconds);
+        fprintf(stderr, "classified %llu packets in %.3fs, %.2fM packets/s, %llu accepted, %llu malformed\n",
+                (unsigned long long)stats.packets, stats.seconds, stats.packets / std::max(stats.seconds, 1e-9) / 1e6,
+                (unsigned long long)stats.accepted, (unsigned long long)stats.malformed);
+    }
+    catch(const char* error)
+    {
+        std::cerr << error << '\n';
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
+
+/**
+ * Loads the rules and writes them out as a C++ header with a lookup specialized on them, see
+ * writeLookupHeader. This is what make codegen runs.
+ * @param argc int: number of command line arguments
+ * @param argv char**: the rules file, --generate, the header to write and optionally its namespace
+ * @return int: the exit status
+ */
+int generate(int argc, char* argv[])
+{
+    if(argc < 4)
+    {
+        std::cerr << "--generate needs the header file to write" << '\n';
+        return EXIT_FAILURE;
+    }
+    string name = argc >= 5 ? argv[4] : "generated_rules";
+    try
+    {
+        Firewall firewall(argv[1]);
+        std::ofstream header(argv[3]);
+        if(!header)
+            throw "File Write Error";
+        writeLookupHeader(firewall.rules(), header, name, argv[1]);
+        header.close();
+        if(!header)
+            throw "File Write Error";
+    }
+    catch(const char* error)
+    {
+        std::cerr << error << '\n';
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
 }
 
 int main(int argc, char *argv[])
 {
+    if(argc >= 3 && string(argv[2]) == "--classify")
+        return classify(argc, argv);
+    if(argc >= 3 && string(argv[2]) == "--generate")
+        return generate(argc, argv);
     string filename = getFilename(argc, argv);
     Firewall firewall(filename);
     // runTests();